@@ -0,0 +1,105 @@
+/*
+ * relay-backend-bench - the io_uring send backend against the default one.
+ *
+ * Runs the same loopback load (see relay-bench-load.h) with destinations
+ * writing through plain non-blocking sends and through the shards'
+ * io_uring rings, alternating --runs times so drift on the host hits both
+ * alike, and reports the best run of each. "CPU us/pkt" is process CPU
+ * time per delivered packet, publishers and sink included; the load is
+ * the same for both backends, so its difference is the relay's.
+ *
+ * Linux only in practice: elsewhere the io_uring rows fall back to the
+ * default backend and match it.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "relay-bench-load.h"
+#include "relay-shard.h"
+
+#define BENCH_BACKEND_PORT_OFFSET 50 // clear of relay-shard-bench's ports
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--streams N] [--destinations N] [--seconds N] [--packet-size BYTES] [--workers N] [--runs N]\n"
+            "\n"
+            "  --streams N        concurrent publishers, one route each (default: 32)\n"
+            "  --destinations N   destinations per stream (default: 2)\n"
+            "  --seconds N        measured time per run (default: 5)\n"
+            "  --packet-size N    video payload bytes (default: 4096)\n"
+            "  --workers N        relay shards (default: usable CPUs)\n"
+            "  --runs N           runs per backend (default: 3)\n",
+            program);
+}
+
+static void printRow(const char *name, const BenchResult &result)
+{
+    double cpuPerPacket = result.packetsPerSecond > 0 ? result.cpuSeconds * 1e6 / result.packetsPerSecond : 0;
+    printf("%10s %14.0f %10.1f %12.2f %10llu\n", name, result.packetsPerSecond, result.megabytesPerSecond,
+           cpuPerPacket, (unsigned long long)result.dropped);
+}
+
+int main(int argc, char **argv)
+{
+    BenchLoad load;
+    int runs = 3;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--streams") == 0 && hasValue) {
+            load.streams = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--destinations") == 0 && hasValue) {
+            load.destinations = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            load.seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--packet-size") == 0 && hasValue) {
+            load.packetSize = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--workers") == 0 && hasValue) {
+            load.workers = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--runs") == 0 && hasValue) {
+            runs = atoi(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+    }
+    if (load.streams == 0 || load.destinations == 0 || load.seconds <= 0 || runs <= 0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    RelaySocket::initialize();
+    if (load.workers == 0) {
+        load.workers = RelayScheduler::usableCpus().size();
+    }
+    printf("%zu worker(s), %zu stream(s) x %zu destination(s), %zu-byte packets, %d x %d s per backend\n",
+           load.workers, load.streams, load.destinations, load.packetSize, runs, load.seconds);
+
+    const RelaySendBackend backends[] = {RelaySendBackend::Sockets, RelaySendBackend::IoUring};
+    BenchResult best[2];
+    uint16_t port = BENCH_BACKEND_PORT_OFFSET;
+    for (int run = 0; run < runs; run++) {
+        for (int b = 0; b < 2; b++, port++) {
+            BenchResult result;
+            load.backend = backends[b];
+            if (!runRelayLoad(load, (uint16_t)(BENCH_RELAY_PORT + port), (uint16_t)(BENCH_SINK_PORT + port),
+                              result)) {
+                return 1;
+            }
+            if (result.packetsPerSecond > best[b].packetsPerSecond) {
+                best[b] = result;
+            }
+        }
+    }
+
+    printf("\n%10s %14s %10s %12s %10s\n", "backend", "packets/s", "MB/s", "CPU us/pkt", "dropped");
+    printRow("default", best[0]);
+    printRow("io_uring", best[1]);
+    if (best[0].packetsPerSecond > 0) {
+        printf("\nio_uring delivers %.2fx the default backend's packets/s\n",
+               best[1].packetsPerSecond / best[0].packetsPerSecond);
+    }
+    return 0;
+}
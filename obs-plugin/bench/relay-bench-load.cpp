@@ -0,0 +1,452 @@
+#include "relay-bench-load.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "relay-common.h"
+#include "relay-ingest.h"
+#include "relay-publisher.h"
+#include "relay-shard.h"
+#include "relay-trace.h"
+
+#define BENCH_CONNECT_TIMEOUT_MS 10000
+#define BENCH_WARMUP_MS 1000
+#define BENCH_SETTLE_MS 2000
+#define BENCH_GOP_PACKETS 60
+#define BENCH_FPS 30
+#define BENCH_KEYFRAME_WEIGHT 4 // a keyframe is this many times a delta frame
+#define BENCH_AUDIO_KBPS 128
+#define BENCH_STAMP_OFFSET 5    // after the AVC packet header
+#define BENCH_STAMP_BYTES 8
+
+static int latencyBucket(uint64_t value)
+{
+    if (value < BENCH_LATENCY_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int exponent = 0;
+    while (value >> (exponent + 1)) {
+        exponent++;
+    }
+    int sub = (int)(value >> (exponent - 4)) & (BENCH_LATENCY_SUB_BUCKETS - 1);
+    return std::min((exponent - 3) * BENCH_LATENCY_SUB_BUCKETS + sub, BENCH_LATENCY_BUCKETS - 1);
+}
+
+static uint64_t latencyBucketLimit(int bucket)
+{
+    if (bucket < BENCH_LATENCY_SUB_BUCKETS) {
+        return (uint64_t)bucket + 1;
+    }
+    int exponent = bucket / BENCH_LATENCY_SUB_BUCKETS + 3;
+    uint64_t sub = (uint64_t)(bucket % BENCH_LATENCY_SUB_BUCKETS);
+    return (BENCH_LATENCY_SUB_BUCKETS + sub + 1) << (exponent - 4);
+}
+
+void BenchLatencyHistogram::record(uint64_t microseconds)
+{
+    buckets[latencyBucket(microseconds)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t previous = maximum.load(std::memory_order_relaxed);
+    while (microseconds > previous &&
+           !maximum.compare_exchange_weak(previous, microseconds, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t BenchLatencyHistogram::count() const
+{
+    uint64_t total = 0;
+    for (const auto &bucket : buckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+double BenchLatencyHistogram::percentileMs(double fraction) const
+{
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = std::min(total - 1, (uint64_t)(fraction * (double)total));
+    uint64_t seen = 0;
+    for (int i = 0; i < BENCH_LATENCY_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return (double)std::min(latencyBucketLimit(i), maximum.load(std::memory_order_relaxed)) / 1000;
+        }
+    }
+    return maxMs();
+}
+
+// Frames sent within it are the measured ones, wherever they are when it
+// closes, so frames in flight at either end count on both sides or on none
+struct BenchWindow {
+    std::atomic<uint64_t> startNs{UINT64_MAX};
+    std::atomic<uint64_t> endNs{UINT64_MAX};
+
+    bool contains(uint64_t sentAt) const
+    {
+        return sentAt >= startNs.load(std::memory_order_relaxed) && sentAt < endNs.load(std::memory_order_relaxed);
+    }
+};
+
+// Counts what one relayed destination delivers
+class SinkStream : public RelayIngestStream {
+public:
+    SinkStream(BenchLatencyHistogram &latency, const BenchWindow &window) : latency(latency), window(window) {}
+
+    void push(const RelayPacketPtr &packet) override
+    {
+        packets.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(packet->data.size(), std::memory_order_relaxed);
+        if (!packet->isVideo() || packet->isSequenceHeader() ||
+            packet->data.size() < BENCH_STAMP_OFFSET + BENCH_STAMP_BYTES) {
+            return;
+        }
+        uint64_t sentAt;
+        memcpy(&sentAt, packet->data.data() + BENCH_STAMP_OFFSET, sizeof(sentAt));
+        if (!window.contains(sentAt)) {
+            return;
+        }
+        frames.fetch_add(1, std::memory_order_relaxed);
+        uint64_t now = relayNowNs();
+        latency.record(now > sentAt ? (now - sentAt) / 1000 : 0);
+    }
+    bool isOpen() const override { return true; }
+
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> frames{0}; // sent within the window
+
+private:
+    BenchLatencyHistogram &latency;
+    const BenchWindow &window;
+};
+
+// Stands in for the platforms; accepts every stream key
+class BenchSink {
+public:
+    bool start(uint16_t port)
+    {
+        if (!scheduler.start()) {
+            return false;
+        }
+        RtmpIngestServer::Callbacks callbacks;
+        callbacks.onPublish = [this](const std::string &, const std::string &) -> RelayIngestStreamPtr {
+            auto stream = std::make_shared<SinkStream>(latency, window);
+            std::lock_guard<std::mutex> lock(mutex);
+            streams.push_back(stream);
+            return stream;
+        };
+        callbacks.onUnpublish = [](const RelayIngestStreamPtr &) {};
+        server = std::make_unique<RtmpIngestServer>(scheduler, callbacks);
+        return server->start(port);
+    }
+
+    void stop()
+    {
+        if (server) {
+            server->stop();
+        }
+        scheduler.stop();
+    }
+
+    void totals(uint64_t &packets, uint64_t &bytes, uint64_t &frames)
+    {
+        packets = bytes = frames = 0;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &stream : streams) {
+            packets += stream->packets.load(std::memory_order_relaxed);
+            bytes += stream->bytes.load(std::memory_order_relaxed);
+            frames += stream->frames.load(std::memory_order_relaxed);
+        }
+    }
+
+    const BenchLatencyHistogram &latencies() const { return latency; }
+
+    BenchWindow window;
+
+private:
+    BenchLatencyHistogram latency;
+    RelayScheduler scheduler;
+    std::unique_ptr<RtmpIngestServer> server;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<SinkStream>> streams;
+};
+
+static void publishLoop(RelayEngine &engine, uint16_t port, const std::string &streamKey, const BenchLoad &load,
+                        const std::atomic<bool> &running, const BenchWindow &window,
+                        std::atomic<uint64_t> &framesSent)
+{
+    RtmpPublisher publisher;
+    RelayIngestStreamPtr local;
+    if (load.local) {
+        local = engine.openLocalStream(streamKey);
+    } else if (!publisher.connect("rtmp://127.0.0.1:" + std::to_string(port) + "/live", streamKey,
+                                  BENCH_CONNECT_TIMEOUT_MS)) {
+        PLUGIN_LOG_ERROR("bench publisher %s: %s", streamKey.c_str(), publisher.lastError().c_str());
+        return;
+    }
+    if (load.local && !local) {
+        PLUGIN_LOG_ERROR("bench publisher %s: rejected by the relay", streamKey.c_str());
+        return;
+    }
+    // A local stream gets its own copy, as the ingest makes one
+    uint32_t traceTrack = RelayTracer::instance().track("local " + streamKey);
+    auto send = [&](const RelayPacket &packet) {
+        if (!local) {
+            return publisher.sendPacket(packet);
+        }
+        if (!local->isOpen()) {
+            return false;
+        }
+        auto copy = relayMakePacket();
+        *copy = packet;
+        relayTraceIngest(*copy, traceTrack);
+        local->push(copy);
+        return true;
+    };
+
+    bool paced = load.bitrateKbps > 0;
+    RelayPacket header;
+    header.data = {0x17, 0x00, 0x00, 0x00, 0x00, 0x01, 0x64, 0x00, 0x1f};
+    RelayPacket audioHeader;
+    audioHeader.type = RelayPacketType::Audio;
+    audioHeader.data = {0xaf, 0x00, 0x12, 0x10};
+    if (!send(header) || (paced && !send(audioHeader))) {
+        engine.closeLocalStream(local);
+        return;
+    }
+
+    // AVC NALU packets, a keyframe every BENCH_GOP_PACKETS at 30 fps;
+    // paced, the frames average the bitrate and an AAC frame goes with each
+    size_t minimum = BENCH_STAMP_OFFSET + BENCH_STAMP_BYTES;
+    size_t deltaBytes = std::max(load.packetSize, minimum);
+    if (paced) {
+        size_t gopBytes = (size_t)load.bitrateKbps * 125 * BENCH_GOP_PACKETS / BENCH_FPS;
+        deltaBytes = std::max(gopBytes / (BENCH_GOP_PACKETS - 1 + BENCH_KEYFRAME_WEIGHT), minimum);
+    }
+    RelayPacket frame;
+    RelayPacket keyframe;
+    frame.data.assign(deltaBytes, 0xab);
+    keyframe.data.assign(paced ? deltaBytes * BENCH_KEYFRAME_WEIGHT : deltaBytes, 0xab);
+    frame.data[0] = 0x27;
+    keyframe.data[0] = 0x17;
+    frame.data[1] = keyframe.data[1] = 0x01;
+    RelayPacket audio;
+    audio.type = RelayPacketType::Audio;
+    audio.data.assign(BENCH_AUDIO_KBPS * 125 / BENCH_FPS, 0xcd);
+    audio.data[0] = 0xaf;
+    audio.data[1] = 0x01;
+
+    auto next = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; running; i++) {
+        RelayPacket &video = i % BENCH_GOP_PACKETS == 0 ? keyframe : frame;
+        video.timestamp = audio.timestamp = i * 1000 / BENCH_FPS;
+        uint64_t sentAt = relayNowNs();
+        memcpy(video.data.data() + BENCH_STAMP_OFFSET, &sentAt, sizeof(sentAt));
+        if (!send(video) || (paced && !send(audio))) {
+            break;
+        }
+        if (window.contains(sentAt)) {
+            framesSent.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!local && (paced || i % 64 == 0) && !publisher.pollIncoming()) {
+            break;
+        }
+        if (paced) {
+            next += std::chrono::microseconds(1000000 / BENCH_FPS);
+            std::this_thread::sleep_until(next);
+        }
+    }
+    publisher.close();
+    engine.closeLocalStream(local);
+}
+
+static size_t connectedDestinations(const RelayEngine &engine)
+{
+    size_t connected = 0;
+    for (const auto &destination : engine.statsSnapshot().destinations) {
+        connected += destination.connected ? 1 : 0;
+    }
+    return connected;
+}
+
+static uint64_t droppedPackets(const RelayEngine &engine)
+{
+    uint64_t dropped = 0;
+    for (const auto &destination : engine.statsSnapshot().destinations) {
+        dropped += destination.droppedPackets;
+    }
+    return dropped;
+}
+
+// User plus system time of the whole process
+static double processCpuSeconds()
+{
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    auto seconds = [](const FILETIME &time) {
+        return (double)(((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) / 1e7;
+    };
+    return seconds(kernel) + seconds(user);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+// Resident set now and at its peak, in bytes
+static void processMemory(uint64_t &rss, uint64_t &peak)
+{
+    rss = peak = 0;
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        rss = counters.WorkingSetSize;
+        peak = counters.PeakWorkingSetSize;
+    }
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    peak = (uint64_t)usage.ru_maxrss;
+#else
+    peak = (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#ifdef __linux__
+    FILE *statm = fopen("/proc/self/statm", "r");
+    unsigned long long size = 0, pages = 0;
+    if (statm) {
+        if (fscanf(statm, "%llu %llu", &size, &pages) == 2) {
+            rss = pages * (uint64_t)sysconf(_SC_PAGESIZE);
+        }
+        fclose(statm);
+    }
+#endif
+#endif
+}
+
+bool runRelayLoad(const BenchLoad &load, uint16_t relayPort, uint16_t sinkPort, BenchResult &result)
+{
+    BenchSink sink;
+    if (!sink.start(sinkPort)) {
+        fprintf(stderr, "Cannot start the sink on port %u\n", (unsigned)sinkPort);
+        return false;
+    }
+
+    RelayConfig config;
+    config.listenPort = relayPort;
+    config.workerThreads = (int)load.workers;
+    config.sendBackend = load.backend;
+    for (size_t s = 0; s < load.streams; s++) {
+        RelayRouteConfig route;
+        route.name = "bench" + std::to_string(s);
+        route.streamKey = "in" + std::to_string(s);
+        for (size_t d = 0; d < load.destinations; d++) {
+            RelayDestinationConfig destination;
+            destination.name = "out" + std::to_string(d);
+            destination.url = "rtmp://127.0.0.1:" + std::to_string(sinkPort) + "/live";
+            destination.streamKey = route.name + "-" + destination.name;
+            // Unpaced, sizes the queue budget for the synthetic rate
+            // rather than a real encode
+            destination.bitrateKbps = load.bitrateKbps > 0 ? load.bitrateKbps + BENCH_AUDIO_KBPS : 1000000;
+            route.destinations.push_back(destination);
+        }
+        config.routes.push_back(route);
+    }
+
+    RelayEngine engine(config);
+    if (!engine.start()) {
+        fprintf(stderr, "Cannot start the relay: %s\n", engine.lastError().c_str());
+        sink.stop();
+        return false;
+    }
+
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> framesSent{0};
+    std::vector<std::thread> publishers;
+    for (size_t s = 0; s < load.streams; s++) {
+        publishers.emplace_back(publishLoop, std::ref(engine), relayPort, "in" + std::to_string(s), std::cref(load),
+                                std::cref(running), std::cref(sink.window), std::ref(framesSent));
+    }
+
+    size_t expected = load.streams * load.destinations;
+    uint64_t deadline = relayNowMs() + BENCH_CONNECT_TIMEOUT_MS;
+    while (connectedDestinations(engine) < expected && relayNowMs() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    bool ready = connectedDestinations(engine) == expected;
+    if (!ready) {
+        fprintf(stderr, "Only %zu of %zu destinations connected\n", connectedDestinations(engine), expected);
+    }
+
+    if (ready) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_WARMUP_MS));
+        uint64_t startPackets, startBytes, startFrames, endPackets, endBytes, endFrames;
+        uint64_t startDropped = droppedPackets(engine);
+        sink.totals(startPackets, startBytes, startFrames);
+        double startCpu = processCpuSeconds();
+        uint64_t startedAt = relayNowNs();
+        sink.window.startNs = startedAt;
+        std::this_thread::sleep_for(std::chrono::seconds(load.seconds));
+        sink.totals(endPackets, endBytes, endFrames);
+        uint64_t endedAt = relayNowNs();
+        sink.window.endNs = endedAt;
+        double elapsed = (double)(endedAt - startedAt) / 1e9;
+        result.cpuSeconds = processCpuSeconds() - startCpu;
+
+        // Frames of the window still on their way get a moment to arrive
+        uint64_t settled = 0;
+        for (int waited = 0; waited < BENCH_SETTLE_MS; waited += 100) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            uint64_t packets, bytes, frames;
+            sink.totals(packets, bytes, frames);
+            if (frames == settled) {
+                break;
+            }
+            settled = frames;
+        }
+
+        result.elapsedSeconds = elapsed;
+        result.packetsPerSecond = (double)(endPackets - startPackets) / elapsed;
+        result.megabytesPerSecond = (double)(endBytes - startBytes) / elapsed / 1e6;
+        result.dropped = droppedPackets(engine) - startDropped;
+        result.framesSent = framesSent.load();
+        result.framesDelivered = settled;
+        const BenchLatencyHistogram &latency = sink.latencies();
+        result.latencyP50Ms = latency.percentileMs(0.5);
+        result.latencyP99Ms = latency.percentileMs(0.99);
+        result.latencyP999Ms = latency.percentileMs(0.999);
+        result.latencyMaxMs = latency.maxMs();
+        processMemory(result.rssBytes, result.peakRssBytes);
+        result.peakRssBytes = std::max(result.peakRssBytes, result.rssBytes);
+        result.poolBytes = RelayBufferPool::instance().usedBytes() + RelayBufferPool::instance().cachedBytes();
+    }
+
+    running = false;
+    for (auto &publisher : publishers) {
+        publisher.join();
+    }
+    engine.stop();
+    sink.stop();
+    return ready;
+}
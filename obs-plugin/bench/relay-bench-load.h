@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * Shared load for the relay benchmarks: publisher threads push synthetic
+ * video into a real RelayEngine on loopback, every stream relays to its
+ * destinations, and an in-process RTMP sink standing in for the platforms
+ * counts what arrives.
+ *
+ * Publishers either push as fast as the relay takes it, or (with a
+ * bitrate) send real-time video plus AAC audio the way an encoder does.
+ * Every video frame carries its send time, so the sink also measures
+ * publisher-to-platform latency.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "relay-engine.h"
+
+#define BENCH_RELAY_PORT 19450
+#define BENCH_SINK_PORT 19550
+
+struct BenchLoad {
+    size_t streams = 32;
+    size_t destinations = 2;
+    int seconds = 5;
+    size_t packetSize = 4096;
+    size_t workers = 0;
+    RelaySendBackend backend = RelaySendBackend::Sockets;
+    int bitrateKbps = 0; // 0 pushes as fast as the relay takes it
+    bool local = false;  // publishers push into the engine instead of over RTMP
+};
+
+// Latency histogram with ~6% wide log-scale buckets, lock-free so any
+// number of sink sessions can record into it
+#define BENCH_LATENCY_SUB_BUCKETS 16
+#define BENCH_LATENCY_BUCKETS (BENCH_LATENCY_SUB_BUCKETS * 40)
+
+class BenchLatencyHistogram {
+public:
+    void record(uint64_t microseconds);
+    uint64_t count() const;
+    // Upper bound of the bucket holding the fraction-th sample, in ms
+    double percentileMs(double fraction) const;
+    double maxMs() const { return (double)maximum.load(std::memory_order_relaxed) / 1000; }
+
+private:
+    std::atomic<uint64_t> buckets[BENCH_LATENCY_BUCKETS] = {};
+    std::atomic<uint64_t> maximum{0};
+};
+
+struct BenchResult {
+    double packetsPerSecond = 0;
+    double megabytesPerSecond = 0;
+    double cpuSeconds = 0; // whole process, publishers and sink included
+    double elapsedSeconds = 0;
+    uint64_t dropped = 0;  // frames the send queues shed to stay within budget
+    uint64_t framesSent = 0;      // video frames published during the measurement
+    uint64_t framesDelivered = 0; // video frames the sink got, every destination counted
+    double latencyP50Ms = 0;
+    double latencyP99Ms = 0;
+    double latencyP999Ms = 0;
+    double latencyMaxMs = 0;
+    uint64_t rssBytes = 0;      // at the end of the measurement; 0 where unknown
+    uint64_t peakRssBytes = 0;  // of the process so far
+    uint64_t poolBytes = 0;     // packet buffers in use or cached
+};
+
+// One measured run; false (with a message on stderr) if the relay could
+// not be set up
+bool runRelayLoad(const BenchLoad &load, uint16_t relayPort, uint16_t sinkPort, BenchResult &result);
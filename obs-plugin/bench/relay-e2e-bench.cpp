@@ -0,0 +1,216 @@
+/*
+ * relay-e2e-bench - the whole relay under a realistic load, for tracking
+ * regressions.
+ *
+ * Every stream is a real-time publisher sending synthetic FLV (AVC video
+ * at --bitrate plus 128 kbps AAC, 30 fps, a keyframe every 2 s) into a
+ * RelayEngine on loopback, which relays it to --destinations local RTMP
+ * sinks standing in for the platforms (see relay-bench-load.h). One run
+ * is made per combination of the --streams and --destinations lists.
+ * With --local the publishers hand packets to the engine in-process, as
+ * the plugin's OBS output does, instead of over loopback RTMP.
+ *
+ * Each run reports delivered throughput, CPU per stream (the whole
+ * process, so the publishers and sinks are counted too), the latency
+ * from a frame leaving its publisher to arriving at a platform
+ * (p50/p99/p99.9), dropped frames and memory. With --json every run is also
+ * written to FILE as one JSON object per line, for scripts comparing
+ * against a baseline.
+ * --max-p99-ms and --min-delivery turn the bench into a pass/fail check:
+ * the exit status is 1 when any run misses them. --trace prints where the
+ * relay's share of the latency went, per stage, and writes the last run's
+ * packet trace (see relay-trace.h).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "relay-bench-load.h"
+#include "relay-shard.h"
+#include "relay-trace.h"
+
+#define BENCH_E2E_PORT_OFFSET 200 // clear of the other benches' ports
+
+struct E2eBenchOptions {
+    std::vector<size_t> streams = {1, 8, 32};
+    std::vector<size_t> destinations = {1, 3};
+    int bitrateKbps = 6000;
+    int seconds = 10;
+    size_t workers = 0;
+    bool local = false;
+    std::string jsonPath;
+    std::string tracePath;
+    double maxP99Ms = 0;     // 0 checks nothing
+    double minDelivery = 0;  // share of frames that must reach every destination
+};
+
+// Comma-separated positive counts, e.g. "1,8,32"
+static bool parseCounts(const char *text, std::vector<size_t> &counts)
+{
+    counts.clear();
+    while (*text) {
+        char *end = nullptr;
+        unsigned long value = strtoul(text, &end, 10);
+        if (end == text || value == 0 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        counts.push_back(value);
+        text = *end == ',' ? end + 1 : end;
+    }
+    return !counts.empty();
+}
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--streams LIST] [--destinations LIST] [--bitrate KBPS] [--seconds N] [--workers N]\n"
+            "          [--local] [--json FILE] [--trace FILE] [--max-p99-ms MS] [--min-delivery FRACTION]\n"
+            "\n"
+            "  --streams LIST         concurrent publishers to try, e.g. 1,8,32 (default: 1,8,32)\n"
+            "  --destinations LIST    destinations per stream to try (default: 1,3)\n"
+            "  --bitrate KBPS         video bitrate of every publisher (default: 6000)\n"
+            "  --seconds N            measured time per run (default: 10)\n"
+            "  --workers N            relay shards (default: one per usable CPU)\n"
+            "  --local                publish in-process instead of over loopback RTMP\n"
+            "  --json FILE            also write every run to FILE as a line of JSON\n"
+            "  --trace FILE           print per-stage relay latency, write the last run's Chrome trace to FILE\n"
+            "  --max-p99-ms MS        fail when a run's p99 latency exceeds this\n"
+            "  --min-delivery FRACTION  fail when a run delivers a smaller share of frames\n",
+            program);
+}
+
+static void writeJson(FILE *out, const BenchLoad &load, const BenchResult &result, double delivery,
+                      double cpuPerStream)
+{
+    fprintf(out, "{\"streams\":%zu,\"destinations\":%zu,\"local\":%s,\"bitrate_kbps\":%d,\"workers\":%zu,"
+            "\"seconds\":%.3f,"
+            "\"packets_per_second\":%.1f,\"megabytes_per_second\":%.3f,\"frames_sent\":%llu,"
+            "\"frames_delivered\":%llu,\"delivery\":%.5f,\"dropped\":%llu,\"cpu_percent_per_stream\":%.3f,"
+            "\"latency_ms\":{\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},"
+            "\"rss_bytes\":%llu,\"peak_rss_bytes\":%llu,\"pool_bytes\":%llu}\n",
+            load.streams, load.destinations, load.local ? "true" : "false", load.bitrateKbps, load.workers,
+            result.elapsedSeconds,
+            result.packetsPerSecond, result.megabytesPerSecond, (unsigned long long)result.framesSent,
+            (unsigned long long)result.framesDelivered, delivery, (unsigned long long)result.dropped,
+            cpuPerStream, result.latencyP50Ms, result.latencyP99Ms, result.latencyP999Ms, result.latencyMaxMs,
+            (unsigned long long)result.rssBytes, (unsigned long long)result.peakRssBytes,
+            (unsigned long long)result.poolBytes);
+}
+
+int main(int argc, char **argv)
+{
+    E2eBenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        bool ok = true;
+        if (strcmp(argv[i], "--streams") == 0 && hasValue) {
+            ok = parseCounts(argv[++i], options.streams);
+        } else if (strcmp(argv[i], "--destinations") == 0 && hasValue) {
+            ok = parseCounts(argv[++i], options.destinations);
+        } else if (strcmp(argv[i], "--bitrate") == 0 && hasValue) {
+            options.bitrateKbps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            options.seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && hasValue) {
+            options.workers = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--local") == 0) {
+            options.local = true;
+        } else if (strcmp(argv[i], "--json") == 0 && hasValue) {
+            options.jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+            options.tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--max-p99-ms") == 0 && hasValue) {
+            options.maxP99Ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--min-delivery") == 0 && hasValue) {
+            options.minDelivery = atof(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+        if (!ok) {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (options.bitrateKbps <= 0 || options.seconds <= 0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    RelaySocket::initialize();
+    size_t workers = options.workers ? options.workers : RelayScheduler::usableCpus().size();
+    FILE *json = nullptr;
+    if (!options.jsonPath.empty() && !(json = fopen(options.jsonPath.c_str(), "w"))) {
+        fprintf(stderr, "Cannot write %s\n", options.jsonPath.c_str());
+        return 1;
+    }
+    printf("%d kbps video + 128 kbps audio per stream, %zu worker(s), %d s per run, %s ingest\n",
+           options.bitrateKbps, workers, options.seconds, options.local ? "in-process" : "RTMP");
+    printf("\n%7s %6s %11s %8s %9s %8s %9s %9s %9s %9s %8s\n", "streams", "dests", "packets/s", "MB/s", "delivery",
+           "dropped", "cpu%/str", "p50 ms", "p99 ms", "p999 ms", "RSS MB");
+
+    bool passed = true;
+    size_t run = 0;
+    for (size_t streams : options.streams) {
+        for (size_t destinations : options.destinations) {
+            BenchLoad load;
+            load.streams = streams;
+            load.destinations = destinations;
+            load.seconds = options.seconds;
+            load.workers = workers;
+            load.bitrateKbps = options.bitrateKbps;
+            load.local = options.local;
+
+            BenchResult result;
+            uint16_t offset = (uint16_t)(BENCH_E2E_PORT_OFFSET + run++);
+            if (!runRelayLoad(load, (uint16_t)(BENCH_RELAY_PORT + offset), (uint16_t)(BENCH_SINK_PORT + offset),
+                              result)) {
+                if (json) {
+                    fclose(json);
+                }
+                return 1;
+            }
+
+            uint64_t expected = result.framesSent * destinations;
+            double delivery = expected ? (double)result.framesDelivered / (double)expected : 0;
+            double cpuPerStream = result.cpuSeconds / result.elapsedSeconds / (double)streams * 100;
+            printf("%7zu %6zu %11.0f %8.2f %8.1f%% %8llu %9.2f %9.1f %9.1f %9.1f %8.1f\n", streams, destinations,
+                   result.packetsPerSecond, result.megabytesPerSecond, delivery * 100,
+                   (unsigned long long)result.dropped, cpuPerStream, result.latencyP50Ms, result.latencyP99Ms,
+                   result.latencyP999Ms, (double)result.rssBytes / 1e6);
+            fflush(stdout);
+            if (json) {
+                writeJson(json, load, result, delivery, cpuPerStream);
+                fflush(json);
+            }
+            if (!options.tracePath.empty()) {
+                for (const auto &stage : RelayTracer::instance().summary()) {
+                    printf("%15s %-7s p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", "", stage.stage.c_str(),
+                           stage.p50Ms, stage.p99Ms, stage.maxMs);
+                }
+                std::string error;
+                if (!RelayTracer::instance().writeChromeTrace(options.tracePath, error)) {
+                    fprintf(stderr, "%s\n", error.c_str());
+                }
+            }
+
+            if (options.maxP99Ms > 0 && result.latencyP99Ms > options.maxP99Ms) {
+                fprintf(stderr, "%zu x %zu: p99 latency %.1f ms exceeds %.1f ms\n", streams, destinations,
+                        result.latencyP99Ms, options.maxP99Ms);
+                passed = false;
+            }
+            if (delivery < options.minDelivery) {
+                fprintf(stderr, "%zu x %zu: delivered %.2f%% of frames, below %.2f%%\n", streams, destinations,
+                        delivery * 100, options.minDelivery * 100);
+                passed = false;
+            }
+        }
+    }
+    if (json) {
+        fclose(json);
+    }
+    return passed ? 0 : 1;
+}
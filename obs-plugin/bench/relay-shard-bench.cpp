@@ -0,0 +1,97 @@
+/*
+ * relay-shard-bench - whole-relay throughput against the number of shards.
+ *
+ * Runs the real engine on loopback (see relay-bench-load.h). The same
+ * load is repeated with 1, 2, 4, ... worker shards up to --max-workers
+ * (default: every usable CPU), so delivered packets/s should grow roughly
+ * with the worker count for as long as the publishers and the sink have
+ * cores to spare. On a machine with few cores, start the bench under
+ * taskset and give the relay fewer workers than CPUs.
+ *
+ * Publishers outrun the relay on purpose, so the "dropped" column (frames
+ * the send queues shed to stay within budget) is expected to be non-zero:
+ * it shows the relay, not the load generator, was the bottleneck.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "relay-bench-load.h"
+#include "relay-shard.h"
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--streams N] [--destinations N] [--seconds N] [--packet-size BYTES] [--max-workers N]\n"
+            "\n"
+            "  --streams N        concurrent publishers, one route each (default: 32)\n"
+            "  --destinations N   destinations per stream (default: 2)\n"
+            "  --seconds N        measured time per worker count (default: 5)\n"
+            "  --packet-size N    video payload bytes (default: 4096)\n"
+            "  --max-workers N    largest shard count to try (default: usable CPUs)\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    BenchLoad load;
+    size_t maxWorkers = 0;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--streams") == 0 && hasValue) {
+            load.streams = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--destinations") == 0 && hasValue) {
+            load.destinations = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            load.seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--packet-size") == 0 && hasValue) {
+            load.packetSize = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--max-workers") == 0 && hasValue) {
+            maxWorkers = strtoul(argv[++i], nullptr, 10);
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+    }
+    if (load.streams == 0 || load.destinations == 0 || load.seconds <= 0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    RelaySocket::initialize();
+    size_t cpus = RelayScheduler::usableCpus().size();
+    if (maxWorkers == 0) {
+        maxWorkers = cpus;
+    }
+    printf("%zu usable CPU(s), %zu stream(s) x %zu destination(s), %zu-byte packets, %d s per run\n", cpus,
+           load.streams, load.destinations, load.packetSize, load.seconds);
+    if (cpus == 1) {
+        printf("Only one CPU is available: every row shares it, so no scaling can show here\n");
+    }
+
+    std::vector<size_t> workerCounts;
+    for (size_t workers = 1; workers < maxWorkers; workers *= 2) {
+        workerCounts.push_back(workers);
+    }
+    workerCounts.push_back(maxWorkers);
+
+    printf("\n%8s %14s %10s %9s %10s\n", "workers", "packets/s", "MB/s", "speedup", "dropped");
+    double baseline = 0;
+    for (size_t run = 0; run < workerCounts.size(); run++) {
+        BenchResult result;
+        load.workers = workerCounts[run];
+        if (!runRelayLoad(load, (uint16_t)(BENCH_RELAY_PORT + run), (uint16_t)(BENCH_SINK_PORT + run), result)) {
+            return 1;
+        }
+        if (baseline == 0) {
+            baseline = result.packetsPerSecond;
+        }
+        printf("%8zu %14.0f %10.1f %8.2fx %10llu\n", load.workers, result.packetsPerSecond,
+               result.megabytesPerSecond, baseline > 0 ? result.packetsPerSecond / baseline : 0.0,
+               (unsigned long long)result.dropped);
+        fflush(stdout);
+    }
+    return 0;
+}
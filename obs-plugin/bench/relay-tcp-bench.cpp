@@ -0,0 +1,362 @@
+/*
+ * relay-tcp-bench - frame latency through a congested link against the
+ * destinations' send-path tuning.
+ *
+ * One publisher pushes video in real time at --bitrate through the relay
+ * and a simulated link to the sink: --link kbps for the first and last
+ * third of the run and --congested kbps in between, behind a shallow
+ * buffer. Whatever the link cannot carry backs up in the relay's queue
+ * (which skips frames to stay within budget) or in the kernel's socket
+ * buffer (which cannot), so the latency of the frames that do arrive
+ * shows where the backlog was kept. Every row repeats the run with one
+ * destination option set (see RelayTcpTuning); latency is publisher send
+ * to sink receipt.
+ *
+ * Pacing and the congestion control hardly matter here, where the link
+ * is a userspace proxy on loopback rather than a router queue some round
+ * trip away; they need a real path to show.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "relay-bench-load.h"
+#include "relay-common.h"
+#include "relay-ingest.h"
+#include "relay-publisher.h"
+#include "relay-shard.h"
+
+#define BENCH_TCP_PORT_OFFSET 100 // clear of the other benches' ports
+#define BENCH_CONNECT_TIMEOUT_MS 10000
+#define BENCH_FPS 30
+#define BENCH_GOP_FRAMES 60
+#define BENCH_KEYFRAME_WEIGHT 4   // a keyframe is this many times a delta frame
+#define BENCH_STAMP_OFFSET 5      // after the AVC packet header
+#define BENCH_STAMP_BYTES 8
+#define BENCH_LINK_BUFFER_BYTES (64 * 1024) // the bottleneck's queue
+#define BENCH_LINK_SLICE_BYTES 1500         // forwarded per step, one packet's worth
+
+struct TcpBenchOptions {
+    int bitrateKbps = 8000;
+    int linkKbps = 12000;
+    int congestedKbps = 2000;
+    int seconds = 30;
+    RelayTcpTuning tuned; // what the combined row uses
+};
+
+struct TcpBenchResult {
+    size_t delivered = 0;
+    uint64_t dropped = 0;
+    std::vector<double> latenciesMs;
+};
+
+// The path to the platform: forwards the relay's bytes to the sink no
+// faster than the link rate, with a shallow buffer in front like a
+// router's. Replies travel back unthrottled.
+class ThrottledLink {
+public:
+    explicit ThrottledLink(const TcpBenchOptions &options) : options(options) {}
+    ~ThrottledLink() { stop(); }
+
+    bool start(uint16_t port, uint16_t sinkPort)
+    {
+        if (!listener.listenOn(port, true)) {
+            return false;
+        }
+        // Connections inherit it; a fixed size also stops receive
+        // autotuning from growing the buffer into a bloated one
+        int bufferBytes = BENCH_LINK_BUFFER_BYTES / 2; // the kernel doubles it
+        setsockopt(listener.fd(), SOL_SOCKET, SO_RCVBUF, (const char *)&bufferBytes, sizeof(bufferBytes));
+        acceptThread = std::thread([this, sinkPort]() {
+            RelaySocket relaySide = listener.accept();
+            RelaySocket sinkSide;
+            if (!relaySide.isValid() || !sinkSide.connectTo("127.0.0.1", sinkPort, BENCH_CONNECT_TIMEOUT_MS)) {
+                return;
+            }
+            std::thread replies([&]() { forward(sinkSide, relaySide, false); });
+            forward(relaySide, sinkSide, true);
+            sinkSide.shutdown();
+            replies.join();
+        });
+        return true;
+    }
+
+    void stop()
+    {
+        stopping = true;
+        listener.shutdown();
+        listener.close();
+        if (acceptThread.joinable()) {
+            acceptThread.join();
+        }
+    }
+
+private:
+    void forward(RelaySocket &from, RelaySocket &to, bool throttled)
+    {
+        uint8_t buffer[BENCH_LINK_SLICE_BYTES];
+        uint64_t startedAt = relayNowNs();
+        uint64_t freeAt = 0;
+        while (!stopping) {
+            if (!from.waitReadable(100)) {
+                continue;
+            }
+            long n = from.readSome(buffer, sizeof(buffer));
+            if (n <= 0) {
+                break;
+            }
+            if (throttled) {
+                // The slice takes its size over the link at the current rate
+                uint64_t now = relayNowNs();
+                double elapsed = (double)(now - startedAt) / 1e9;
+                bool congested = elapsed >= options.seconds / 3.0 && elapsed < options.seconds * 2 / 3.0;
+                uint64_t kbps = (uint64_t)(congested ? options.congestedKbps : options.linkKbps);
+                freeAt = std::max(freeAt, now) + (uint64_t)n * 8 * 1000000 / kbps;
+                std::this_thread::sleep_for(std::chrono::nanoseconds(freeAt - now));
+            }
+            if (!to.writeAll(buffer, (size_t)n)) {
+                break;
+            }
+        }
+        to.shutdown();
+    }
+
+    const TcpBenchOptions &options;
+    RelaySocket listener;
+    std::thread acceptThread;
+    std::atomic<bool> stopping{false};
+};
+
+// Records the latency of every stamped frame that arrives
+class LatencySink : public RelayIngestStream {
+public:
+    void push(const RelayPacketPtr &packet) override
+    {
+        if (!packet->isVideo() || packet->isSequenceHeader() ||
+            packet->data.size() < BENCH_STAMP_OFFSET + BENCH_STAMP_BYTES) {
+            return;
+        }
+        uint64_t sentAt;
+        memcpy(&sentAt, packet->data.data() + BENCH_STAMP_OFFSET, sizeof(sentAt));
+        std::lock_guard<std::mutex> lock(mutex);
+        latenciesMs.push_back((double)(relayNowNs() - sentAt) / 1e6);
+    }
+    bool isOpen() const override { return true; }
+
+    std::vector<double> latencies()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return latenciesMs;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<double> latenciesMs;
+};
+
+// Real-time video: BENCH_FPS frames a second averaging the bitrate, each
+// stamped with its send time
+static void publishLoop(uint16_t port, int bitrateKbps, const std::atomic<bool> &running)
+{
+    RtmpPublisher publisher;
+    if (!publisher.connect("rtmp://127.0.0.1:" + std::to_string(port) + "/live", "in", BENCH_CONNECT_TIMEOUT_MS)) {
+        PLUGIN_LOG_ERROR("bench publisher: %s", publisher.lastError().c_str());
+        return;
+    }
+
+    RelayPacket header;
+    header.data = {0x17, 0x00, 0x00, 0x00, 0x00, 0x01, 0x64, 0x00, 0x1f};
+    if (!publisher.sendPacket(header)) {
+        return;
+    }
+
+    size_t gopBytes = (size_t)bitrateKbps * 125 * BENCH_GOP_FRAMES / BENCH_FPS;
+    size_t deltaBytes = gopBytes / (BENCH_GOP_FRAMES - 1 + BENCH_KEYFRAME_WEIGHT);
+    deltaBytes = std::max(deltaBytes, (size_t)(BENCH_STAMP_OFFSET + BENCH_STAMP_BYTES));
+    RelayPacket frame;
+    auto next = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; running; i++) {
+        bool keyframe = i % BENCH_GOP_FRAMES == 0;
+        frame.data.assign(keyframe ? deltaBytes * BENCH_KEYFRAME_WEIGHT : deltaBytes, 0xab);
+        frame.data[0] = keyframe ? 0x17 : 0x27;
+        frame.data[1] = 0x01;
+        frame.timestamp = i * 1000 / BENCH_FPS;
+        uint64_t sentAt = relayNowNs();
+        memcpy(frame.data.data() + BENCH_STAMP_OFFSET, &sentAt, sizeof(sentAt));
+        if (!publisher.sendPacket(frame) || !publisher.pollIncoming()) {
+            break;
+        }
+        next += std::chrono::microseconds(1000000 / BENCH_FPS);
+        std::this_thread::sleep_until(next);
+    }
+    publisher.close();
+}
+
+static bool runScenario(const TcpBenchOptions &options, const RelayTcpTuning &tuning, uint16_t port,
+                        TcpBenchResult &result)
+{
+    uint16_t relayPort = (uint16_t)(BENCH_RELAY_PORT + port);
+    uint16_t sinkPort = (uint16_t)(BENCH_SINK_PORT + port);
+    uint16_t linkPort = (uint16_t)(BENCH_SINK_PORT + port + BENCH_TCP_PORT_OFFSET);
+
+    RelayScheduler sinkScheduler;
+    auto sink = std::make_shared<LatencySink>();
+    RtmpIngestServer::Callbacks callbacks;
+    callbacks.onPublish = [sink](const std::string &, const std::string &) -> RelayIngestStreamPtr { return sink; };
+    callbacks.onUnpublish = [](const RelayIngestStreamPtr &) {};
+    RtmpIngestServer server(sinkScheduler, callbacks);
+    if (!sinkScheduler.start() || !server.start(sinkPort)) {
+        fprintf(stderr, "Cannot start the sink on port %u\n", (unsigned)sinkPort);
+        sinkScheduler.stop();
+        return false;
+    }
+    ThrottledLink link(options);
+    if (!link.start(linkPort, sinkPort)) {
+        fprintf(stderr, "Cannot start the link on port %u\n", (unsigned)linkPort);
+        server.stop();
+        sinkScheduler.stop();
+        return false;
+    }
+
+    RelayConfig config;
+    config.listenPort = relayPort;
+    config.workerThreads = 1;
+    RelayRouteConfig route;
+    route.name = "bench";
+    route.streamKey = "in";
+    RelayDestinationConfig destination;
+    destination.name = "out";
+    destination.url = "rtmp://127.0.0.1:" + std::to_string(linkPort) + "/live";
+    destination.streamKey = "out";
+    destination.bitrateKbps = options.bitrateKbps;
+    destination.tcp = tuning;
+    route.destinations.push_back(destination);
+    config.routes.push_back(route);
+
+    RelayEngine engine(config);
+    if (!engine.start()) {
+        fprintf(stderr, "Cannot start the relay: %s\n", engine.lastError().c_str());
+        server.stop();
+        sinkScheduler.stop();
+        return false;
+    }
+
+    std::atomic<bool> running{true};
+    std::thread publisher(publishLoop, relayPort, options.bitrateKbps, std::cref(running));
+    std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+    running = false;
+    publisher.join();
+
+    for (const auto &stats : engine.statsSnapshot().destinations) {
+        result.dropped += stats.droppedPackets;
+    }
+    engine.stop();
+    link.stop();
+    server.stop();
+    sinkScheduler.stop();
+
+    result.latenciesMs = sink->latencies();
+    result.delivered = result.latenciesMs.size();
+    std::sort(result.latenciesMs.begin(), result.latenciesMs.end());
+    return true;
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, (size_t)(fraction * (double)sorted.size()))];
+}
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--bitrate KBPS] [--link KBPS] [--congested KBPS] [--seconds N]\n"
+            "          [--lowat KB] [--pacing PERCENT] [--congestion NAME]\n"
+            "\n"
+            "  --bitrate KBPS     published video bitrate (default: 8000)\n"
+            "  --link KBPS        link rate outside the congested third (default: 12000)\n"
+            "  --congested KBPS   link rate in the middle third of the run (default: 2000)\n"
+            "  --seconds N        length of each run (default: 30)\n"
+            "  --lowat KB         notsent_lowat_kb for the tuned rows (default: 64)\n"
+            "  --pacing PERCENT   pacing_percent for the tuned rows (default: 150)\n"
+            "  --congestion NAME  congestion control for the tuned rows (default: bbr)\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    TcpBenchOptions options;
+    options.tuned.notSentLowatKb = 64;
+    options.tuned.pacingPercent = 150;
+    options.tuned.congestionControl = "bbr";
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--bitrate") == 0 && hasValue) {
+            options.bitrateKbps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--link") == 0 && hasValue) {
+            options.linkKbps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--congested") == 0 && hasValue) {
+            options.congestedKbps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            options.seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lowat") == 0 && hasValue) {
+            options.tuned.notSentLowatKb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pacing") == 0 && hasValue) {
+            options.tuned.pacingPercent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--congestion") == 0 && hasValue) {
+            options.tuned.congestionControl = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+    }
+    if (options.bitrateKbps <= 0 || options.linkKbps <= 0 || options.congestedKbps <= 0 || options.seconds <= 0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    RelaySocket::initialize();
+    printf("%d kbps video over a %d kbps link, %d kbps in the middle third, %d s per run\n", options.bitrateKbps,
+           options.linkKbps, options.congestedKbps, options.seconds);
+
+    struct Scenario {
+        const char *name;
+        RelayTcpTuning tuning;
+    };
+    std::vector<Scenario> scenarios(5);
+    scenarios[0].name = "default";
+    scenarios[1].name = "lowat";
+    scenarios[1].tuning.notSentLowatKb = options.tuned.notSentLowatKb;
+    scenarios[2].name = "pacing";
+    scenarios[2].tuning.pacingPercent = options.tuned.pacingPercent;
+    scenarios[3].name = "congestion";
+    scenarios[3].tuning.congestionControl = options.tuned.congestionControl;
+    scenarios[4].name = "all";
+    scenarios[4].tuning = options.tuned;
+
+    printf("\n%12s %10s %8s %9s %9s %9s %9s\n", "tuning", "delivered", "dropped", "p50 ms", "p95 ms", "p99 ms",
+           "max ms");
+    for (size_t i = 0; i < scenarios.size(); i++) {
+        TcpBenchResult result;
+        if (!runScenario(options, scenarios[i].tuning, (uint16_t)(BENCH_TCP_PORT_OFFSET + i), result)) {
+            return 1;
+        }
+        const auto &latencies = result.latenciesMs;
+        printf("%12s %10zu %8llu %9.1f %9.1f %9.1f %9.1f\n", scenarios[i].name, result.delivered,
+               (unsigned long long)result.dropped, percentile(latencies, 0.5), percentile(latencies, 0.95),
+               percentile(latencies, 0.99), latencies.empty() ? 0.0 : latencies.back());
+        fflush(stdout);
+    }
+    return 0;
+}
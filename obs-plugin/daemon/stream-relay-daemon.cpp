@@ -0,0 +1,345 @@
+/*
+ * stream-relay-daemon - the StreamRelay engine without OBS or Qt.
+ *
+ * Reads the config.ini written by the plugin dialog and runs the same
+ * RelayEngine. The main thread only sleeps on an event queue: signals are
+ * turned into events by a dedicated thread (sigwait) or the console
+ * handler on Windows, and engine failures arrive through its callback, so
+ * nothing polls and nothing but the relay threads touches packets.
+ *
+ *   SIGINT / SIGTERM  stop
+ *   SIGHUP            reload config.ini and apply it live
+ *   SIGUSR1           write the packet latency trace to run/ and log its
+ *                     per-stage summary
+ *
+ * With --probe it tests every enabled platform instead and exits.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <csignal>
+#include <pthread.h>
+#endif
+
+#include "relay-common.h"
+#include "relay-config.h"
+#include "relay-engine.h"
+#include "relay-probe.h"
+#include "relay-reconnect.h"
+#include "relay-trace.h"
+
+enum class DaemonEvent {
+    Stop,
+    Reload,
+    Trace,
+    Failure,
+};
+
+class DaemonEvents {
+public:
+    void post(DaemonEvent event)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(event);
+        condition.notify_one();
+    }
+
+    // Returns false on timeout (timeoutMs < 0 waits forever)
+    bool wait(DaemonEvent &event, int timeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto ready = [this]() { return !events.empty(); };
+        if (timeoutMs < 0) {
+            condition.wait(lock, ready);
+        } else if (!condition.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready)) {
+            return false;
+        }
+        event = events.front();
+        events.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<DaemonEvent> events;
+};
+
+static DaemonEvents daemonEvents;
+
+#ifdef _WIN32
+
+static BOOL WINAPI onConsoleEvent(DWORD type)
+{
+    (void)type;
+    daemonEvents.post(DaemonEvent::Stop);
+    return TRUE;
+}
+
+static void installSignalHandlers()
+{
+    SetConsoleCtrlHandler(onConsoleEvent, TRUE);
+}
+
+#else
+
+// Blocked in every thread (relay threads inherit the mask) and collected
+// synchronously by one thread, so no async-signal-safety concerns
+static void installSignalHandlers()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    // A platform resetting its connection must not take every stream down
+    signal(SIGPIPE, SIG_IGN);
+
+    std::thread([signals]() {
+        while (true) {
+            int signal = 0;
+            if (sigwait(&signals, &signal) != 0) {
+                continue;
+            }
+            daemonEvents.post(signal == SIGHUP    ? DaemonEvent::Reload
+                              : signal == SIGUSR1 ? DaemonEvent::Trace
+                                                  : DaemonEvent::Stop);
+        }
+    }).detach();
+}
+
+#endif
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--config FILE] [--ffmpeg PATH] [--probe]\n"
+            "\n"
+            "  --config FILE   config.ini saved by the StreamRelay OBS dialog (default: ./config.ini)\n"
+            "  --ffmpeg PATH   ffmpeg used for the rendition ladder (default: " FFMPEG_EXECUTABLE " on PATH)\n"
+            "  --probe         test the connection to every enabled platform, then exit\n",
+            program);
+}
+
+struct DaemonOptions {
+    std::string configPath = "config.ini";
+    std::string ffmpegPath = FFMPEG_EXECUTABLE;
+    bool probe = false;
+};
+
+static bool loadConfig(const DaemonOptions &options, RelayConfig &config)
+{
+    RelayIniFile ini;
+    if (!ini.load(options.configPath)) {
+        PLUGIN_LOG_ERROR("%s", ini.lastError().c_str());
+        return false;
+    }
+
+    // logs/ and run/ live next to config.ini, as they do for the plugin
+    std::filesystem::path directory = std::filesystem::absolute(options.configPath).parent_path();
+    std::string prefix = directory.string() + "/";
+    config = relayConfigFromIni(ini, prefix);
+    config.ffmpegPath = options.ffmpegPath;
+
+    std::error_code ec;
+    if (!config.logDirectory.empty()) {
+        std::filesystem::create_directories(config.logDirectory, ec);
+    }
+    std::filesystem::create_directories(config.runDirectory, ec);
+
+    if (config.destinations.empty() && config.routes.empty()) {
+        PLUGIN_LOG_WARNING("No platform is enabled in %s; ingest will accept but relay nowhere",
+                           options.configPath.c_str());
+    }
+    return true;
+}
+
+static std::unique_ptr<RelayEngine> startEngine(const RelayConfig &config)
+{
+    auto engine = std::make_unique<RelayEngine>(config);
+    engine->setFailureCallback([](const std::string &reason) {
+        PLUGIN_LOG_ERROR("Relay failure: %s", reason.c_str());
+        daemonEvents.post(DaemonEvent::Failure);
+    });
+    engine->setBitrateAdviceCallback([](const std::string &stream, int kbps) {
+        // There is no encoder here to turn down; the publisher's operator has to
+        if (kbps > 0) {
+            PLUGIN_LOG_WARNING("Publisher of %s should send at most %d kbps", stream.c_str(), kbps);
+        }
+    });
+    if (!engine->start()) {
+        PLUGIN_LOG_ERROR("Failed to start relay: %s", engine->lastError().c_str());
+        return nullptr;
+    }
+    return engine;
+}
+
+// Same file as the dialog's Save Trace button, for ui.perfetto.dev
+static void dumpTrace(const RelayConfig &config)
+{
+    if (!config.tracing) {
+        PLUGIN_LOG_WARNING("Tracing is disabled (advanced/tracing in config.ini)");
+        return;
+    }
+    RelayTracer &tracer = RelayTracer::instance();
+    for (const auto &stage : tracer.summary()) {
+        PLUGIN_LOG_INFO("Latency %s: p50 %.2f ms, p99 %.2f ms, max %.2f ms over %zu packet(s)", stage.stage.c_str(),
+                        stage.p50Ms, stage.p99Ms, stage.maxMs, stage.count);
+    }
+    std::string path = config.runDirectory + "trace-" + std::to_string(time(nullptr)) + ".json";
+    std::string error;
+    if (tracer.writeChromeTrace(path, error)) {
+        PLUGIN_LOG_INFO("Trace written to %s", path.c_str());
+    } else {
+        PLUGIN_LOG_ERROR("%s", error.c_str());
+    }
+}
+
+// Same test as the dialog's Test Connection button
+static int probeDestinations(const RelayConfig &config)
+{
+    std::vector<const RelayDestinationConfig *> destinations;
+    for (const auto &destination : config.destinations) {
+        destinations.push_back(&destination);
+    }
+    for (const auto &route : config.routes) {
+        for (const auto &destination : route.destinations) {
+            destinations.push_back(&destination);
+        }
+    }
+
+    std::vector<RelayProbeResult> results;
+    for (const auto *destination : destinations) {
+        RelayProbeResult result = relayProbeDestination(destination->url, destination->streamKey);
+        if (result.ok) {
+            PLUGIN_LOG_INFO("%s: connect %.1f ms, handshake %.1f ms, publish %.1f ms, RTT %.1f ms, upload %s%.0f kbps",
+                            destination->name.c_str(), result.connectMs, result.handshakeMs, result.publishMs,
+                            result.rttMs, result.reachedMax ? ">= " : "", result.uploadKbps);
+        } else {
+            PLUGIN_LOG_ERROR("%s: %s", destination->name.c_str(), result.error.c_str());
+        }
+        results.push_back(result);
+    }
+
+    int suggestion = relayProbeSuggestion(results);
+    if (suggestion > 0) {
+        PLUGIN_LOG_INFO("Suggested maximum bitrate: %d kbps", suggestion);
+    }
+    bool allOk = std::all_of(results.begin(), results.end(), [](const RelayProbeResult &r) { return r.ok; });
+    return allOk ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    DaemonOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            options.configPath = argv[++i];
+        } else if (strcmp(argv[i], "--ffmpeg") == 0 && i + 1 < argc) {
+            options.ffmpegPath = argv[++i];
+        } else if (strcmp(argv[i], "--probe") == 0) {
+            options.probe = true;
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+    }
+
+    installSignalHandlers();
+    RelaySocket::initialize();
+
+    RelayConfig config;
+    if (!loadConfig(options, config)) {
+        return 1;
+    }
+    if (options.probe) {
+        return probeDestinations(config);
+    }
+
+    std::unique_ptr<RelayEngine> engine = startEngine(config);
+    if (!engine) {
+        return 1;
+    }
+    PLUGIN_LOG_INFO("stream-relay-daemon %s running, ingest on rtmp://0.0.0.0:%u/live with %zu route(s)",
+                    PLUGIN_VERSION, (unsigned)config.listenPort, config.routes.size());
+
+    // Same policy as the dialog: restart the whole engine with backoff only
+    // when it gives up by itself
+    RelayBackoff restartBackoff(config.maxReconnectAttempts, config.reconnectDelayMs);
+    uint64_t startedAt = relayNowMs();
+    bool restartPending = false;
+
+    while (true) {
+        DaemonEvent event;
+        int timeoutMs = -1;
+        if (restartPending) {
+            if (relayNowMs() - startedAt >= RELAY_RECONNECT_STABLE_MS) {
+                restartBackoff.reset();
+            }
+            timeoutMs = restartBackoff.nextDelayMs();
+            if (timeoutMs < 0 || !config.autoReconnect) {
+                PLUGIN_LOG_ERROR("Relay could not be kept running, exiting");
+                return 1;
+            }
+            PLUGIN_LOG_INFO("Restarting relay in %d ms", timeoutMs);
+        }
+
+        if (!daemonEvents.wait(event, timeoutMs)) {
+            engine.reset();
+            engine = startEngine(config);
+            restartPending = !engine;
+            startedAt = relayNowMs();
+            continue;
+        }
+
+        if (event == DaemonEvent::Stop) {
+            PLUGIN_LOG_INFO("Shutting down");
+            break;
+        }
+
+        if (event == DaemonEvent::Reload) {
+            RelayConfig next;
+            if (!loadConfig(options, next)) {
+                PLUGIN_LOG_WARNING("Keeping the current configuration");
+                continue;
+            }
+            config = next;
+            if (engine && !engine->reconfigure(config)) {
+                PLUGIN_LOG_WARNING("%s", engine->lastError().c_str());
+            }
+            PLUGIN_LOG_INFO("Reloaded %s", options.configPath.c_str());
+            continue;
+        }
+
+        if (event == DaemonEvent::Trace) {
+            dumpTrace(config);
+            continue;
+        }
+
+        // With routes a failure only disconnects the affected publisher
+        if (event == DaemonEvent::Failure && !restartPending && engine && !engine->isRunning()) {
+            engine->stop();
+            restartPending = true;
+        }
+    }
+
+    if (engine) {
+        engine->stop();
+    }
+    return 0;
+}
@@ -38,11 +38,15 @@
 
 // Default configuration
 #define DEFAULT_RTMP_PORT 1935
+#define DEFAULT_METRICS_PORT 9464
 #define DEFAULT_STREAM_KEY "live"
 #define DEFAULT_BITRATE 6000
 #define DEFAULT_PRESET "veryfast"
 #define DEFAULT_RECONNECT_ATTEMPTS 3
 #define DEFAULT_RECONNECT_DELAY 5000
+#define DEFAULT_RENDITION_LADDER "1080p60=1920x1080@60:12000, 1080p30=1920x1080@30:6000, 720p30=1280x720@30:3500"
+#define DEFAULT_AUDIO_BITRATE 160 // AAC of the plugin's own OBS output
+#define DEFAULT_KEYFRAME_SECONDS 2
 
 // Logging macros
 #if PLUGIN_DEBUG
@@ -0,0 +1,104 @@
+#include "relay-bandwidth.h"
+
+#include <algorithm>
+
+#include "plugin-macros.h"
+
+const RelayBandwidthEstimate &RelayBandwidthEstimator::update(const RelayBandwidthSample &sample)
+{
+    if (sample.intervalMs == 0) {
+        return current;
+    }
+
+    // Bytes that left for the network: what went into the socket, less
+    // what piled up behind the kernel's send window meanwhile
+    int64_t unsentGrowth = 0;
+    if (sample.unsentBytes >= 0 && lastUnsent >= 0) {
+        unsentGrowth = sample.unsentBytes - lastUnsent;
+    }
+    lastUnsent = sample.unsentBytes;
+    double drained = std::max(0.0, (double)sample.sentBytes - (double)unsentGrowth);
+    double drainedKbps = drained * 8 / (double)sample.intervalMs;
+
+    uint64_t backlog = sample.queuedBytes + (uint64_t)std::max<int64_t>(sample.unsentBytes, 0);
+    uint64_t backlogLimit = (uint64_t)std::max(sample.bitrateKbps, MIN_BITRATE) * RELAY_BANDWIDTH_BACKLOG_MS / 8;
+    current.limited = sample.droppedPackets > 0 || backlog > backlogLimit;
+
+    double sampleKbps = drainedKbps;
+    if (!current.limited && !sample.deliveryAppLimited && sample.deliveryRateBps > 0) {
+        sampleKbps = std::max(sampleKbps, (double)sample.deliveryRateBps * 8 / 1000);
+    }
+
+    if (current.kbps <= 0) {
+        current.kbps = sampleKbps;
+    } else {
+        double smoothed = current.kbps + RELAY_BANDWIDTH_SMOOTHING * (sampleKbps - current.kbps);
+        // Keeping up only shows a lower bound, which must not drag the
+        // estimate down to the rate we happened to offer
+        current.kbps = current.limited ? smoothed : std::max(smoothed, sampleKbps);
+    }
+    return current;
+}
+
+void RelayBandwidthEstimator::reset()
+{
+    current = RelayBandwidthEstimate();
+    lastUnsent = -1;
+}
+
+size_t RelayBitrateAdapter::update(const std::vector<RelayBitrateLevel> &levels, size_t current,
+                                   const RelayBandwidthEstimate &estimate, uint64_t nowMs)
+{
+    if (levels.empty()) {
+        return current;
+    }
+    current = std::min(current, levels.size() - 1);
+
+    if (estimate.limited) {
+        cleanSinceMs = 0;
+        limitedSamples++;
+    } else {
+        limitedSamples = 0;
+        if (cleanSinceMs == 0) {
+            cleanSinceMs = nowMs;
+        }
+    }
+
+    if (limitedSamples >= RELAY_ADAPT_DOWN_SAMPLES) {
+        limitedSamples = 0;
+        // A climb that did not hold up makes the next one wait longer
+        if (lastClimbMs > 0 && nowMs - lastClimbMs < holdMs) {
+            holdMs = std::min<uint64_t>(holdMs * 2, RELAY_ADAPT_UP_HOLD_MAX_MS);
+        } else {
+            holdMs = RELAY_ADAPT_UP_HOLD_MS;
+        }
+        lastClimbMs = 0;
+
+        int fits = (int)(estimate.kbps * RELAY_ADAPT_HEADROOM);
+        if (current > 0) {
+            size_t next = current - 1;
+            while (next > 0 && levels[next].kbps > fits) {
+                next--;
+            }
+            return next;
+        }
+        // Nothing lower to switch to; the encode itself has to shrink
+        int wanted = std::max(fits, MIN_BITRATE);
+        if (wanted < levels[0].kbps) {
+            advice = advice > 0 ? std::min(advice, wanted) : wanted;
+        }
+        return current;
+    }
+
+    if (cleanSinceMs > 0 && nowMs - cleanSinceMs >= holdMs) {
+        cleanSinceMs = nowMs; // every further step needs a hold of its own
+        if (advice > 0) {
+            advice = 0;
+            lastClimbMs = nowMs;
+        } else if (current + 1 < levels.size()) {
+            lastClimbMs = nowMs;
+            return current + 1;
+        }
+    }
+    return current;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+/*
+ * Per-destination bandwidth estimation and bitrate adaptation.
+ *
+ * Once a second a destination reports how much it got into the network:
+ * the bytes it handed to its socket minus whatever of them still waits
+ * unsent in the kernel. While the relay's queue or the kernel holds a
+ * backlog that is the path's capacity; while the destination keeps up,
+ * the capacity is at least that much, or what TCP's own delivery rate
+ * says when it was not limited by us.
+ *
+ * RelayBitrateAdapter turns estimates into a rendition. It steps down to
+ * the best rung that fits as soon as the path stays held back for a couple
+ * of samples, and only climbs back after the path has been clean for a
+ * hold time that doubles whenever a climb fails, so a flapping route
+ * settles instead of oscillating.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define RELAY_BANDWIDTH_SMOOTHING 0.4    // weight of a new sample
+#define RELAY_BANDWIDTH_BACKLOG_MS 500   // queued media (relay and kernel) that counts as held back
+#define RELAY_ADAPT_HEADROOM 0.8         // a rung has to fit in this share of the estimate
+#define RELAY_ADAPT_DOWN_SAMPLES 2       // held-back samples in a row before stepping down
+#define RELAY_ADAPT_UP_HOLD_MS 15000     // clean path needed before climbing a step
+#define RELAY_ADAPT_UP_HOLD_MAX_MS 240000
+
+// One interval of a destination's sending
+struct RelayBandwidthSample {
+    uint64_t intervalMs = 0;
+    uint64_t sentBytes = 0;         // handed to the socket during the interval
+    int64_t unsentBytes = -1;       // waiting in the kernel at the end; -1 if unknown
+    uint64_t queuedBytes = 0;       // waiting in the relay's send queue at the end
+    uint64_t droppedPackets = 0;    // shed by the queue budget during the interval
+    uint64_t deliveryRateBps = 0;   // TCP's delivery rate in bytes/s; 0 if unknown
+    bool deliveryAppLimited = true;
+    int bitrateKbps = 0;            // what the destination is being fed
+};
+
+struct RelayBandwidthEstimate {
+    double kbps = 0;      // smoothed achievable throughput; 0 before the first sample
+    bool limited = false; // the last interval was held back by the network
+};
+
+class RelayBandwidthEstimator {
+public:
+    const RelayBandwidthEstimate &update(const RelayBandwidthSample &sample);
+    const RelayBandwidthEstimate &estimate() const { return current; }
+    // A new connection starts without a kernel backlog to compare against
+    void reset();
+
+private:
+    RelayBandwidthEstimate current;
+    int64_t lastUnsent = -1;
+};
+
+// A rendition a destination can be fed; an empty name is OBS's own encode
+struct RelayBitrateLevel {
+    std::string rendition;
+    int kbps = 0;
+};
+
+class RelayBitrateAdapter {
+public:
+    // levels run from the lowest bitrate up to the configured one, and
+    // current is the one being sent. Returns the level to send from now on.
+    size_t update(const std::vector<RelayBitrateLevel> &levels, size_t current,
+                  const RelayBandwidthEstimate &estimate, uint64_t nowMs);
+
+    // What the lowest level would have to be encoded at to fit, or 0 while
+    // it fits as it is
+    int advisedKbps() const { return advice; }
+
+private:
+    int limitedSamples = 0;
+    uint64_t cleanSinceMs = 0;
+    uint64_t lastClimbMs = 0;
+    uint64_t holdMs = RELAY_ADAPT_UP_HOLD_MS;
+    int advice = 0;
+};
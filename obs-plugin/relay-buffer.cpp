@@ -0,0 +1,114 @@
+#include "relay-buffer.h"
+
+RelayBufferPool &RelayBufferPool::instance()
+{
+    // Intentionally leaked so packets released during static destruction
+    // never touch a destroyed pool
+    static RelayBufferPool *pool = new RelayBufferPool();
+    return *pool;
+}
+
+int RelayBufferPool::sizeClass(size_t size)
+{
+    size_t blockSize = RELAY_BUFFER_MIN_BLOCK;
+    for (int i = 0; i < RELAY_BUFFER_SIZE_CLASSES; i++) {
+        if (size <= blockSize) {
+            return i;
+        }
+        blockSize <<= 1;
+    }
+    return -1;
+}
+
+// Blocks this thread released, by size class; handed back to the shared
+// lists when the thread ends
+struct RelayBufferPool::ThreadCache {
+    std::vector<void *> blocks[RELAY_BUFFER_SIZE_CLASSES];
+
+    ~ThreadCache()
+    {
+        for (int i = 0; i < RELAY_BUFFER_SIZE_CLASSES; i++) {
+            for (void *block : blocks[i]) {
+                instance().releaseShared(block, i);
+            }
+        }
+    }
+};
+
+RelayBufferPool::ThreadCache &RelayBufferPool::threadCache()
+{
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+void *RelayBufferPool::allocate(size_t size)
+{
+    int index = sizeClass(size);
+    if (index < 0) {
+        used += size;
+        return ::operator new(size);
+    }
+
+    std::vector<void *> &local = threadCache().blocks[index];
+    if (!local.empty()) {
+        void *block = local.back();
+        local.pop_back();
+        return block;
+    }
+    return allocateShared(index);
+}
+
+void RelayBufferPool::release(void *block, size_t size)
+{
+    if (!block) {
+        return;
+    }
+
+    int index = sizeClass(size);
+    if (index < 0) {
+        used -= size;
+        ::operator delete(block);
+        return;
+    }
+
+    size_t blockSize = (size_t)RELAY_BUFFER_MIN_BLOCK << index;
+    std::vector<void *> &local = threadCache().blocks[index];
+    if ((local.size() + 1) * blockSize <= RELAY_BUFFER_THREAD_CACHE_PER_CLASS) {
+        local.push_back(block);
+        return;
+    }
+    releaseShared(block, index);
+}
+
+void *RelayBufferPool::allocateShared(int index)
+{
+    size_t blockSize = (size_t)RELAY_BUFFER_MIN_BLOCK << index;
+    used += blockSize;
+    {
+        FreeList &freeList = classes[index];
+        std::lock_guard<std::mutex> lock(freeList.mutex);
+        if (!freeList.blocks.empty()) {
+            void *block = freeList.blocks.back();
+            freeList.blocks.pop_back();
+            cached -= blockSize;
+            return block;
+        }
+    }
+    return ::operator new(blockSize);
+}
+
+void RelayBufferPool::releaseShared(void *block, int index)
+{
+    size_t blockSize = (size_t)RELAY_BUFFER_MIN_BLOCK << index;
+    used -= blockSize;
+    {
+        FreeList &freeList = classes[index];
+        std::lock_guard<std::mutex> lock(freeList.mutex);
+        if ((freeList.blocks.size() + 1) * blockSize <= RELAY_BUFFER_MAX_CACHED_PER_CLASS) {
+            freeList.blocks.push_back(block);
+            cached += blockSize;
+            return;
+        }
+    }
+    ::operator delete(block);
+}
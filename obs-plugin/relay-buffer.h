@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+ * Pooled storage for packet payloads.
+ *
+ * Every ingested frame is allocated once from a process-wide pool of
+ * power-of-two size classes, wrapped in an immutable reference-counted
+ * packet and handed to all destinations by pointer. Freed blocks go back
+ * to their class instead of the heap, so steady-state streaming does not
+ * touch malloc and memory stays flat no matter how many destinations read
+ * the same bytes.
+ *
+ * Each thread keeps a small cache per class in front of the shared lists.
+ * A packet is normally allocated and released on the same shard, so the
+ * shared lists (and their locks) are only visited to refill or spill.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#define RELAY_BUFFER_MIN_BLOCK 64
+#define RELAY_BUFFER_SIZE_CLASSES 17 // 64 B .. 4 MB
+#define RELAY_BUFFER_MAX_CACHED_PER_CLASS (16 * 1024 * 1024)
+#define RELAY_BUFFER_THREAD_CACHE_PER_CLASS (1024 * 1024)
+
+class RelayBufferPool {
+public:
+    static RelayBufferPool &instance();
+
+    void *allocate(size_t size);
+    void release(void *block, size_t size);
+
+    // Bytes currently parked in the shared free lists, ready for reuse
+    size_t cachedBytes() const { return cached; }
+    // Bytes handed out and not yet released, thread caches included
+    size_t usedBytes() const { return used; }
+
+private:
+    struct ThreadCache;
+
+    RelayBufferPool() = default;
+
+    static int sizeClass(size_t size);
+    static ThreadCache &threadCache();
+    void *allocateShared(int index);
+    void releaseShared(void *block, int index);
+
+    struct FreeList {
+        std::mutex mutex;
+        std::vector<void *> blocks;
+    };
+
+    FreeList classes[RELAY_BUFFER_SIZE_CLASSES];
+    std::atomic<size_t> cached{0};
+    std::atomic<size_t> used{0};
+};
+
+// Stateless allocator drawing from the shared pool; usable with standard
+// containers and std::allocate_shared
+template <typename T> class RelayPoolAllocator {
+public:
+    using value_type = T;
+
+    RelayPoolAllocator() = default;
+    template <typename U> RelayPoolAllocator(const RelayPoolAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(RelayBufferPool::instance().allocate(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t n) { RelayBufferPool::instance().release(p, n * sizeof(T)); }
+
+    template <typename U> bool operator==(const RelayPoolAllocator<U> &) const { return true; }
+    template <typename U> bool operator!=(const RelayPoolAllocator<U> &) const { return false; }
+};
+
+using RelayBytes = std::vector<uint8_t, RelayPoolAllocator<uint8_t>>;
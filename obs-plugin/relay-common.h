@@ -0,0 +1,42 @@
+#pragma once
+
+/*
+ * Shared helpers for the in-process relay engine.
+ *
+ * The relay engine is plain C++17 and does not depend on Qt. Logging goes
+ * through OBS's blog() when building as a plugin and falls back to stderr
+ * for standalone compilation, mirroring the mocks in stream-relay-plugin.cpp.
+ */
+
+#ifdef OBS_STUDIO_BUILD
+#include <util/base.h>
+#else
+#include <cstdio>
+#ifndef blog
+#define blog(level, format, ...) fprintf(stderr, "[" #level "] " format "\n", ##__VA_ARGS__)
+#endif
+#ifndef LOG_INFO
+#define LOG_INFO 0
+#define LOG_WARNING 1
+#define LOG_ERROR 2
+#define LOG_DEBUG 3
+#endif
+#endif
+
+#include <chrono>
+#include <cstdint>
+
+#include "plugin-macros.h"
+
+// Monotonic clock used for all relay timing (milliseconds / nanoseconds)
+inline uint64_t relayNowMs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint64_t relayNowNs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,277 @@
+#include "relay-config.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+
+#include "relay-common.h"
+
+const RelayPlatform relayPlatforms[3] = {
+    {"twitch", TWITCH_RTMP_URL},
+    {"youtube", YOUTUBE_RTMP_URL},
+    {"kick", KICK_RTMP_URL},
+};
+
+static std::string trim(const std::string &text)
+{
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+static void appendUtf8(std::string &out, uint32_t codePoint)
+{
+    if (codePoint < 0x80) {
+        out += (char)codePoint;
+    } else if (codePoint < 0x800) {
+        out += (char)(0xc0 | (codePoint >> 6));
+        out += (char)(0x80 | (codePoint & 0x3f));
+    } else {
+        out += (char)(0xe0 | (codePoint >> 12));
+        out += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+        out += (char)(0x80 | (codePoint & 0x3f));
+    }
+}
+
+// Undoes QSettings' value encoding. Unquoted commas separate list items,
+// which are joined back with ", " since every setting here is a string.
+static std::string decodeValue(const std::string &raw)
+{
+    std::string text = trim(raw);
+    if (text == "@Invalid()") {
+        return std::string();
+    }
+
+    std::string out;
+    bool quoted = false;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == ',' && !quoted) {
+            out = trim(out) + ", ";
+            while (i + 1 < text.size() && text[i + 1] == ' ') {
+                i++;
+            }
+        } else if (c == '\\' && i + 1 < text.size()) {
+            char escaped = text[++i];
+            switch (escaped) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case '0': out += '\0'; break;
+            case 'x': {
+                size_t digits = 0;
+                uint32_t codePoint = 0;
+                while (digits < 4 && i + 1 < text.size() && isxdigit((unsigned char)text[i + 1])) {
+                    char digit = (char)tolower((unsigned char)text[++i]);
+                    int nibble = isdigit((unsigned char)digit) ? digit - '0' : digit - 'a' + 10;
+                    codePoint = codePoint * 16 + (uint32_t)nibble;
+                    digits++;
+                }
+                appendUtf8(out, codePoint);
+                break;
+            }
+            default: out += escaped; break;
+            }
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+bool RelayIniFile::load(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        error = "Cannot open " + path;
+        return false;
+    }
+
+    values.clear();
+    groupNames.clear();
+    std::string group;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == ';' || line[0] == '#') {
+            continue;
+        }
+        if (line.front() == '[' && line.back() == ']') {
+            group = line.substr(1, line.size() - 2);
+            // QSettings keeps ungrouped keys under [General]
+            if (group == "General") {
+                group.clear();
+            } else {
+                groupNames.push_back(group);
+            }
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            continue;
+        }
+        // Nested keys are written as "twitch\key"
+        std::string key = trim(line.substr(0, equals));
+        for (char &c : key) {
+            if (c == '\\') {
+                c = '/';
+            }
+        }
+        values[group.empty() ? key : group + "/" + key] = decodeValue(line.substr(equals + 1));
+    }
+    return true;
+}
+
+std::string RelayIniFile::value(const std::string &key, const std::string &fallback) const
+{
+    auto it = values.find(key);
+    return it == values.end() ? fallback : it->second;
+}
+
+bool RelayIniFile::boolValue(const std::string &key, bool fallback) const
+{
+    auto it = values.find(key);
+    if (it == values.end()) {
+        return fallback;
+    }
+    return it->second == "true" || it->second == "1";
+}
+
+int RelayIniFile::intValue(const std::string &key, int fallback) const
+{
+    auto it = values.find(key);
+    if (it == values.end() || it->second.empty()) {
+        return fallback;
+    }
+    char *end = nullptr;
+    long number = strtol(it->second.c_str(), &end, 10);
+    return *end == '\0' ? (int)number : fallback;
+}
+
+std::string relayPresetName(const std::string &label)
+{
+    std::string preset;
+    for (char c : label) {
+        if (c != ' ') {
+            preset += (char)tolower((unsigned char)c);
+        }
+    }
+    return preset;
+}
+
+RelaySendBackend relayParseSendBackend(const std::string &name)
+{
+    if (name == RELAY_SEND_BACKEND_IO_URING) {
+        return RelaySendBackend::IoUring;
+    }
+    if (name != RELAY_SEND_BACKEND_DEFAULT) {
+        PLUGIN_LOG_WARNING("Unknown network backend '%s', using the default", name.c_str());
+    }
+    return RelaySendBackend::Sockets;
+}
+
+RelayDestinationConfig relayMakeDestination(const std::string &name, const std::string &url,
+                                            const std::string &streamKey, const std::string &rendition,
+                                            const std::vector<RelayEncodeParams> &ladder, int sourceBitrateKbps)
+{
+    RelayDestinationConfig destination;
+    destination.name = name;
+    destination.url = url;
+    destination.streamKey = streamKey;
+    destination.rendition = rendition;
+    destination.bitrateKbps = sourceBitrateKbps;
+    for (const auto &rung : ladder) {
+        if (rung.name == rendition) {
+            destination.bitrateKbps = rung.videoBitrateKbps;
+        }
+    }
+    return destination;
+}
+
+RelayTcpTuning relayTcpTuningFromIni(const RelayIniFile &ini, const std::string &group,
+                                     const RelayTcpTuning &fallback)
+{
+    RelayTcpTuning tuning;
+    tuning.notSentLowatKb = ini.intValue(group + "/notsent_lowat_kb", fallback.notSentLowatKb);
+    tuning.pacingPercent = ini.intValue(group + "/pacing_percent", fallback.pacingPercent);
+    tuning.congestionControl = ini.value(group + "/congestion", fallback.congestionControl);
+    if (tuning.notSentLowatKb < 0 || tuning.pacingPercent < 0) {
+        PLUGIN_LOG_WARNING("Negative send-path setting in [%s], using the defaults", group.c_str());
+        tuning = fallback;
+    }
+    return tuning;
+}
+
+// Enabled platforms with a key, read from "<scope><platform>/..."; each
+// platform may override the advanced/ send-path settings
+static std::vector<RelayDestinationConfig> platformDestinations(const RelayIniFile &ini, const std::string &scope,
+                                                                const std::vector<RelayEncodeParams> &ladder,
+                                                                int bitrateKbps, const RelayTcpTuning &tuning)
+{
+    std::vector<RelayDestinationConfig> destinations;
+    for (const auto &platform : relayPlatforms) {
+        std::string group = scope + platform.name;
+        std::string key = ini.value(group + "/key");
+        if (!ini.boolValue(group + "/enabled", false) || key.empty()) {
+            continue;
+        }
+        destinations.push_back(relayMakeDestination(platform.name, platform.url, key,
+                                                    ini.value(group + "/rendition"), ladder, bitrateKbps));
+        destinations.back().tcp = relayTcpTuningFromIni(ini, group, tuning);
+    }
+    return destinations;
+}
+
+RelayConfig relayConfigFromIni(const RelayIniFile &ini, const std::string &configDirectory)
+{
+    // Defaults match StreamRelayDialog::loadSettings()
+    RelayConfig config;
+    config.listenPort = (uint16_t)ini.intValue("general/port", DEFAULT_RTMP_PORT);
+    config.autoReconnect = ini.boolValue("advanced/auto_reconnect", true);
+    config.adaptiveBitrate = ini.boolValue("advanced/adaptive_bitrate", true);
+    config.tracing = ini.boolValue("advanced/tracing", true);
+    config.metricsPort = (uint16_t)ini.intValue("advanced/metrics_port", DEFAULT_METRICS_PORT);
+    // Not in the dialog: the plugin always runs one shard per CPU
+    config.workerThreads = ini.intValue("advanced/worker_threads", 0);
+    config.sendBackend = relayParseSendBackend(ini.value("advanced/send_backend", RELAY_SEND_BACKEND_DEFAULT));
+    if (ini.boolValue("advanced/logging", true)) {
+        config.logDirectory = configDirectory + "logs/";
+    }
+    config.runDirectory = configDirectory + "run/";
+
+    if (!parseRenditionLadder(ini.value("quality/ladder", DEFAULT_RENDITION_LADDER), config.ladder)) {
+        PLUGIN_LOG_WARNING("Invalid rendition ladder, using the default");
+        parseRenditionLadder(DEFAULT_RENDITION_LADDER, config.ladder);
+    }
+    for (auto &rung : config.ladder) {
+        rung.preset = relayPresetName(ini.value("quality/preset", "Very Fast"));
+        rung.extraArgs = ini.value("advanced/ffmpeg_args", "-tune zerolatency");
+    }
+    config.encoderGovernor.enabled = ini.boolValue("quality/auto_tune", true);
+    config.encoderGovernor.fastestPreset = relayPresetName(ini.value("quality/fastest_preset", "Ultra Fast"));
+    config.encoderGovernor.slowestPreset = relayPresetName(ini.value("quality/slowest_preset", "Medium"));
+    config.encoderGovernor.maxThreads = ini.intValue("quality/max_threads", 0);
+
+    int bitrateKbps = ini.intValue("quality/bitrate", DEFAULT_BITRATE);
+    RelayTcpTuning tuning = relayTcpTuningFromIni(ini, "advanced", RelayTcpTuning());
+    config.destinations = platformDestinations(ini, "", config.ladder, bitrateKbps, tuning);
+
+    std::string prefix = RELAY_ROUTE_GROUP_PREFIX;
+    for (const auto &group : ini.groups()) {
+        if (group.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        RelayRouteConfig route;
+        route.name = group.substr(prefix.size());
+        route.streamKey = ini.value(group + "/key");
+        route.destinations = platformDestinations(ini, group + "/", config.ladder, bitrateKbps, tuning);
+        config.routes.push_back(route);
+    }
+    return config;
+}
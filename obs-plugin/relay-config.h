@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * Relay configuration shared by the OBS dialog and the headless daemon.
+ *
+ * The dialog persists its settings through QSettings in INI format; the
+ * daemon reads that same config.ini with the small reader below, which
+ * understands the subset of QSettings' encoding the dialog produces
+ * (groups, quoted strings, backslash escapes, @Invalid()).
+ *
+ * Only the daemon knows about routes: every [stream.NAME] section is one
+ * publisher with its own ingest key and platform settings, e.g.
+ *
+ *   [stream.alice]
+ *   key=alice-ingest-key
+ *   twitch\enabled=true
+ *   twitch\key=live_123
+ *   twitch\rendition=720p
+ *   twitch\congestion=bbr
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "relay-engine.h"
+
+class RelayIniFile {
+public:
+    bool load(const std::string &path);
+    const std::string &lastError() const { return error; }
+
+    // Keys are "group/key", as passed to QSettings::value()
+    bool contains(const std::string &key) const { return values.count(key) != 0; }
+    std::string value(const std::string &key, const std::string &fallback = std::string()) const;
+    bool boolValue(const std::string &key, bool fallback) const;
+    int intValue(const std::string &key, int fallback) const;
+    // In file order, without the implicit General group
+    const std::vector<std::string> &groups() const { return groupNames; }
+
+private:
+    std::map<std::string, std::string> values;
+    std::vector<std::string> groupNames;
+    std::string error;
+};
+
+// Streaming platforms the dialog offers, in its order
+struct RelayPlatform {
+    const char *name;
+    const char *url;
+};
+extern const RelayPlatform relayPlatforms[3];
+
+// "Very Fast" (as shown in the quality combo box) -> "veryfast"
+std::string relayPresetName(const std::string &label);
+
+// advanced/send_backend: "default" or "io_uring"
+#define RELAY_SEND_BACKEND_DEFAULT "default"
+#define RELAY_SEND_BACKEND_IO_URING "io_uring"
+RelaySendBackend relayParseSendBackend(const std::string &name);
+
+// Send-path settings from "<group>/notsent_lowat_kb", "/pacing_percent"
+// and "/congestion"; what a key leaves out comes from fallback
+RelayTcpTuning relayTcpTuningFromIni(const RelayIniFile &ini, const std::string &group,
+                                     const RelayTcpTuning &fallback);
+
+// A destination fed from the given rung, or the source if the rung is
+// not in the ladder; its queue budget follows the rung's bitrate
+RelayDestinationConfig relayMakeDestination(const std::string &name, const std::string &url,
+                                            const std::string &streamKey, const std::string &rendition,
+                                            const std::vector<RelayEncodeParams> &ladder, int sourceBitrateKbps);
+
+// Section prefix of a route in config.ini
+#define RELAY_ROUTE_GROUP_PREFIX "stream."
+
+// Builds the engine configuration from a config.ini saved by the dialog,
+// plus any routes. configDirectory (with trailing separator) receives
+// logs/ and run/.
+RelayConfig relayConfigFromIni(const RelayIniFile &ini, const std::string &configDirectory);
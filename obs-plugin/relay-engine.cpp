@@ -0,0 +1,1540 @@
+#include "relay-engine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "relay-common.h"
+#include "relay-supervisor.h"
+#include "relay-trace.h"
+
+// RelayDestination ---------------------------------------------------------
+
+// A connect in flight on its helper thread. It brings its own publisher,
+// and the result only reaches a destination that still has an owner.
+struct RelayDestination::ConnectAttempt {
+    RelayDestination *owner = nullptr;
+    std::string url;
+    std::string streamKey;
+    RtmpPublisher publisher;
+    bool connected = false;
+};
+
+RelayDestination::RelayDestination(const RelayDestinationConfig &config, const RelayConfig &engineConfig,
+                                   std::shared_ptr<RelayDestinationStats> stats, RelayShard &shard)
+    : destinationConfig(config),
+      logName(stats->stream->name == RELAY_DEFAULT_ROUTE ? config.name : stats->stream->name + "/" + config.name),
+      autoReconnect(engineConfig.autoReconnect), shard(shard),
+      sendQueue(relayQueueBudget(config.bitrateKbps, engineConfig.autoReconnect)), stats(std::move(stats)),
+      backoff(engineConfig.maxReconnectAttempts, engineConfig.reconnectDelayMs), tuning(config.tcp),
+      tuningBitrateKbps(config.bitrateKbps)
+{
+    traceTrack = RelayTracer::instance().track(logName);
+    sendQueue.setNotify([this]() { this->shard.wake(this); });
+    this->stats->feedKbps = (uint32_t)config.bitrateKbps;
+}
+
+RelayDestination::~RelayDestination()
+{
+    stop();
+}
+
+void RelayDestination::start()
+{
+    if (running.exchange(true)) {
+        return;
+    }
+    shard.invoke([this]() {
+        shard.attach(this);
+        tickTimer = shard.addTimer(STATS_UPDATE_INTERVAL_MS, [this]() { tick(); });
+        connect();
+    });
+}
+
+void RelayDestination::stop()
+{
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    // A connect still in flight finishes on its own and is thrown away
+    shard.invoke([this]() {
+        if (attempt) {
+            attempt->owner = nullptr;
+            attempt.reset();
+        }
+        shard.cancelTimer(tickTimer);
+        shard.cancelTimer(retryTimer);
+        shard.unwatch(watchedFd);
+        watchedFd = RELAY_INVALID_SOCKET;
+        shard.detach(this);
+        sendInFlight = false;
+        publisher.close();
+        accepting = false;
+        connected = false;
+        publishGauges();
+    });
+}
+
+void RelayDestination::enqueue(const RelayPacketPtr &packet)
+{
+    // Nothing to buffer for while offline; the GOP cache primes reconnects
+    if (!accepting) {
+        return;
+    }
+    stats->ingress.count(*packet);
+    relayTrace(RelayTraceStage::Enqueue, traceTrack, *packet);
+    sendQueue.push(packet);
+}
+
+void RelayDestination::setBitrate(int bitrateKbps)
+{
+    destinationConfig.bitrateKbps = bitrateKbps;
+    applyBitrate();
+}
+
+// Sizes the queue budget and the pacing rate for what is being sent; the
+// stream itself is untouched
+void RelayDestination::applyBitrate()
+{
+    int bitrateKbps = feedBitrateKbps > 0 ? feedBitrateKbps.load() : destinationConfig.bitrateKbps;
+    stats->feedKbps = (uint32_t)bitrateKbps;
+    sendQueue.setBudget(relayQueueBudget(bitrateKbps, autoReconnect));
+    retune();
+}
+
+void RelayDestination::switchSource(RelayFanout *fanout, int bitrateKbps)
+{
+    feedBitrateKbps = bitrateKbps;
+    applyBitrate();
+    shard.invoke([this, fanout]() {
+        if (source) {
+            source->removeDestination(this);
+        }
+        fanout->addDestination(this);
+        // What the old stream left queued cannot continue into the new one
+        sendQueue.reset();
+        rebasePending = true;
+        if (!connected) {
+            return; // the next connect primes from the new stream
+        }
+        for (const auto &header : source->follow(this)) {
+            batch.push_back(header);
+        }
+        drain();
+    });
+}
+
+void RelayDestination::setTcpTuning(const RelayTcpTuning &next)
+{
+    destinationConfig.tcp = next;
+    retune();
+}
+
+// The shard applies the change on its next turn with this destination
+void RelayDestination::retune()
+{
+    {
+        std::lock_guard<std::mutex> lock(tuningMutex);
+        tuning = destinationConfig.tcp;
+        tuningBitrateKbps = feedBitrateKbps > 0 ? feedBitrateKbps.load() : destinationConfig.bitrateKbps;
+    }
+    retuneNeeded = true;
+    shard.wake(this);
+}
+
+// Sets whatever differs from what the socket already has. A failure only
+// costs the optimisation, so it is logged and the connection carries on.
+void RelayDestination::applyTuning()
+{
+    retuneNeeded = false;
+    RelayTcpTuning wanted;
+    int bitrateKbps;
+    {
+        std::lock_guard<std::mutex> lock(tuningMutex);
+        wanted = tuning;
+        bitrateKbps = tuningBitrateKbps;
+    }
+
+    RelaySocket &socket = publisher.socket();
+    if (wanted.notSentLowatKb != appliedTuning.notSentLowatKb &&
+        !socket.setNotSentLowat((uint32_t)wanted.notSentLowatKb * 1024)) {
+        PLUGIN_LOG_WARNING("%s: cannot limit unsent data: %s", logName.c_str(), socket.lastError().c_str());
+    }
+    if ((wanted.pacingPercent != appliedTuning.pacingPercent || bitrateKbps != appliedBitrateKbps) &&
+        (wanted.pacingPercent > 0 || appliedTuning.pacingPercent > 0)) {
+        uint64_t bytesPerSecond = (uint64_t)bitrateKbps * 1000 / 8 * (uint64_t)wanted.pacingPercent / 100;
+        if (!socket.setMaxPacingRate(bytesPerSecond)) {
+            PLUGIN_LOG_WARNING("%s: cannot pace sends: %s", logName.c_str(), socket.lastError().c_str());
+        }
+    }
+    // The system default has no name to go back to, so clearing the
+    // setting only takes effect on the next connection
+    if (!wanted.congestionControl.empty() && wanted.congestionControl != appliedTuning.congestionControl &&
+        !socket.setCongestionControl(wanted.congestionControl)) {
+        PLUGIN_LOG_WARNING("%s: cannot use %s congestion control: %s", logName.c_str(),
+                           wanted.congestionControl.c_str(), socket.lastError().c_str());
+    }
+    appliedTuning = wanted;
+    appliedBitrateKbps = bitrateKbps;
+}
+
+void RelayDestination::publishGauges()
+{
+    stats->connected.store(connected, std::memory_order_relaxed);
+    stats->droppedPackets.store(sendQueue.droppedPackets(), std::memory_order_relaxed);
+    stats->droppedBytes.store(sendQueue.droppedBytes(), std::memory_order_relaxed);
+    stats->queuedPackets.store(sendQueue.queuedPackets(), std::memory_order_relaxed);
+    stats->queuedBytes.store(sendQueue.queuedBytes(), std::memory_order_relaxed);
+}
+
+void RelayDestination::connect()
+{
+    attempt = std::make_shared<ConnectAttempt>();
+    attempt->owner = this;
+    attempt->url = destinationConfig.url;
+    attempt->streamKey = destinationConfig.streamKey;
+
+    std::shared_ptr<ConnectAttempt> pending = attempt;
+    shard.offload(
+        [pending]() {
+            pending->connected = pending->publisher.connect(pending->url, pending->streamKey,
+                                                            RELAY_CONNECT_TIMEOUT_MS);
+        },
+        [pending]() {
+            if (pending->owner) {
+                pending->owner->onConnected(*pending);
+            }
+        });
+}
+
+void RelayDestination::onConnected(ConnectAttempt &result)
+{
+    attempt.reset();
+    if (!result.connected) {
+        PLUGIN_LOG_WARNING("%s: connection failed: %s", logName.c_str(), result.publisher.lastError().c_str());
+        scheduleRetry();
+        return;
+    }
+
+    publisher = std::move(result.publisher);
+    if (!publisher.setNonBlocking(true) || !shard.watch(publisher.fd(), this, RELAY_SHARD_READABLE)) {
+        PLUGIN_LOG_WARNING("%s: cannot hand the connection to its shard", logName.c_str());
+        publisher.close();
+        scheduleRetry();
+        return;
+    }
+    watchedFd = publisher.fd();
+    useUring = shard.usesUring();
+    publisher.setDeferredWrites(useUring);
+    appliedTuning = RelayTcpTuning();
+    appliedBitrateKbps = 0;
+    applyTuning();
+
+    // Stale packets from the previous connection go; the cached GOP plus
+    // everything queued after it forms a contiguous, decodable stream.
+    // It goes out as one batched write; whatever of it the socket cannot
+    // take yet is buffered by the publisher and flushed before the queue.
+    sendQueue.reset();
+    std::vector<RelayPacketPtr> primer = source->join(this);
+    bool primedKeyframe = false;
+    for (const auto &packet : primer) {
+        primedKeyframe = primedKeyframe || packet->isKeyframe();
+        batch.push_back(packet);
+    }
+    if (!sendBatch()) {
+        accepting = false;
+        PLUGIN_LOG_WARNING("%s: failed to prime stream: %s", logName.c_str(), publisher.lastError().c_str());
+        shard.unwatch(watchedFd);
+        watchedFd = RELAY_INVALID_SOCKET;
+        publisher.close();
+        scheduleRetry();
+        return;
+    }
+    sendQueue.setNeedsKeyframe(!primedKeyframe);
+
+    bandwidth.reset();
+    sampledAt = relayNowMs();
+    sampledBytes = stats->egress.bytes.load();
+    sampledDropped = sendQueue.droppedPackets();
+
+    connected = true;
+    connectedAt = relayNowMs();
+    if (everConnected) {
+        stats->reconnects.add(1);
+    }
+    everConnected = true;
+    stats->rttUs = publisher.roundTripTimeUs();
+    publishGauges();
+    PLUGIN_LOG_INFO("%s: connected to %s, primed with %zu packet(s)", logName.c_str(),
+                    destinationConfig.url.c_str(), primer.size());
+    drain();
+}
+
+void RelayDestination::onWake()
+{
+    if (retuneNeeded && connected) {
+        applyTuning();
+    }
+    drain();
+}
+
+void RelayDestination::onSocketEvent(int events)
+{
+    if (!connected) {
+        return;
+    }
+    // Acknowledgements and pings from the server
+    if ((events & RELAY_SHARD_READABLE) && !publisher.pollIncoming()) {
+        disconnect();
+        return;
+    }
+    // With io_uring a reply to the server still needs submitting
+    if ((events & RELAY_SHARD_WRITABLE) || useUring) {
+        drain();
+    }
+}
+
+void RelayDestination::onSendComplete(int result)
+{
+    sendInFlight = false;
+    if (result == -EAGAIN) {
+        // Socket buffer full: resubmit once it is writable
+        shard.modify(watchedFd, RELAY_SHARD_READABLE | RELAY_SHARD_WRITABLE);
+        return;
+    }
+    if (result <= 0) {
+        disconnect(result < 0 ? std::string("write failed: ") + strerror(-result) : "connection closed");
+        return;
+    }
+    publisher.consumePending((size_t)result);
+    drain();
+}
+
+void RelayDestination::drain()
+{
+    if (!connected) {
+        return;
+    }
+
+    // While the socket is full the queue absorbs (and trims) the backlog;
+    // the writable event (or with io_uring the completion) brings us back
+    if (useUring) {
+        if (sendInFlight) {
+            return;
+        }
+    } else if (publisher.hasPendingOutput() && !publisher.flush()) {
+        disconnect();
+        return;
+    }
+    // Up to a batch of packets goes out in one vectored write. With a
+    // low-water mark the batch is no bigger either, so a backlog stays in
+    // the queue rather than the publisher's buffer.
+    size_t maxBytes = RELAY_DRAIN_BATCH_BYTES;
+    if (appliedTuning.notSentLowatKb > 0) {
+        maxBytes = std::min(maxBytes, (size_t)appliedTuning.notSentLowatKb * 1024);
+    }
+    size_t batchBytes = 0;
+    bool idle = false;
+    while (!publisher.hasPendingOutput() && batch.size() < RELAY_DRAIN_BATCH && batchBytes < maxBytes) {
+        RelayPacketPtr packet = sendQueue.pop();
+        if (packet) {
+            batchBytes += packet->data.size();
+            batch.push_back(std::move(packet));
+        } else if (sendQueue.armNotify()) {
+            idle = true;
+            break;
+        }
+    }
+    if (!sendBatch() || !submitOutput()) {
+        disconnect();
+        return;
+    }
+    publishGauges();
+
+    if (useUring) {
+        // Completions and buffer wakeups drive the ring from here
+        shard.modify(watchedFd, RELAY_SHARD_READABLE);
+    } else if (publisher.hasPendingOutput()) {
+        shard.modify(watchedFd, RELAY_SHARD_READABLE | RELAY_SHARD_WRITABLE);
+    } else if (idle) {
+        shard.modify(watchedFd, RELAY_SHARD_READABLE);
+    } else {
+        // More queued: let the shard's other handlers have a turn first
+        shard.wake(this);
+    }
+}
+
+bool RelayDestination::sendBatch()
+{
+    if (batch.empty()) {
+        return true;
+    }
+
+    uint64_t sendStart = relayNowNs();
+    bool ok = true;
+    for (const auto &packet : batch) {
+        if (!(ok = publisher.queuePacket(*packet, outputTimestamp(*packet)))) {
+            break;
+        }
+        relayTrace(RelayTraceStage::Mux, traceTrack, *packet);
+    }
+    ok = ok && publisher.sendQueued();
+    if (ok) {
+        stats->sendLatency.observe(relayNowNs() - sendStart);
+        for (const auto &packet : batch) {
+            relayTrace(RelayTraceStage::Write, traceTrack, *packet);
+            stats->packetSize.observe(packet->data.size());
+            stats->egress.count(*packet);
+        }
+    }
+    batch.clear();
+    return ok;
+}
+
+// After a switch the new stream's first frame follows the last one sent;
+// its headers go out with that frame's timestamp
+uint32_t RelayDestination::outputTimestamp(const RelayPacket &packet)
+{
+    if (rebasePending && !packet.isScript() && !packet.isSequenceHeader()) {
+        timestampOffset = lastTimestamp + 1 - packet.timestamp;
+        rebasePending = false;
+    }
+    if (rebasePending) {
+        return lastTimestamp;
+    }
+    uint32_t timestamp = packet.timestamp + timestampOffset;
+    if (!packet.isScript() && !packet.isSequenceHeader()) {
+        lastTimestamp = timestamp;
+    }
+    return timestamp;
+}
+
+// Sends the publisher's buffered output through the shard's ring, one
+// ring buffer at a time
+bool RelayDestination::submitOutput()
+{
+    if (!useUring || sendInFlight || !publisher.hasPendingOutput()) {
+        return true;
+    }
+    long taken = shard.sendRing(this, watchedFd, publisher.pendingData(), publisher.pendingBytes());
+    sendInFlight = taken > 0;
+    return taken >= 0;
+}
+
+void RelayDestination::disconnect(const std::string &reason)
+{
+    accepting = false;
+    connected = false;
+    publishGauges();
+    shard.unwatch(watchedFd);
+    shard.cancelSends(this);
+    sendInFlight = false;
+    watchedFd = RELAY_INVALID_SOCKET;
+    PLUGIN_LOG_WARNING("%s: connection lost: %s", logName.c_str(),
+                       reason.empty() ? publisher.lastError().c_str() : reason.c_str());
+    publisher.close();
+    scheduleRetry();
+}
+
+void RelayDestination::scheduleRetry()
+{
+    if (!autoReconnect) {
+        PLUGIN_LOG_ERROR("%s: giving up, auto-reconnect is disabled", logName.c_str());
+        return;
+    }
+
+    // Only a connection that held up for a while earns a fresh backoff
+    if (connectedAt > 0 && relayNowMs() - connectedAt >= RELAY_RECONNECT_STABLE_MS) {
+        backoff.reset();
+    }
+    connectedAt = 0;
+
+    int delayMs = backoff.nextDelayMs();
+    if (delayMs < 0) {
+        PLUGIN_LOG_ERROR("%s: giving up after %d reconnect attempts", logName.c_str(),
+                         backoff.maxAttemptCount());
+        return;
+    }
+
+    PLUGIN_LOG_INFO("%s: reconnecting in %d ms (attempt %d)", logName.c_str(), delayMs,
+                    backoff.attemptCount());
+    retryTimer = shard.addTimer(delayMs, [this]() { connect(); });
+}
+
+void RelayDestination::tick()
+{
+    if (connected) {
+        sampleBandwidth();
+    }
+    if (sendQueue.droppedPackets() != lastDropped) {
+        PLUGIN_LOG_WARNING("%s: falling behind, dropped %llu packet(s) so far", logName.c_str(),
+                           (unsigned long long)sendQueue.droppedPackets());
+        lastDropped = sendQueue.droppedPackets();
+    }
+    publishGauges();
+    tickTimer = shard.addTimer(STATS_UPDATE_INTERVAL_MS, [this]() { tick(); });
+}
+
+void RelayDestination::sampleBandwidth()
+{
+    uint64_t now = relayNowMs();
+    uint64_t sent = stats->egress.bytes.load();
+    uint64_t dropped = sendQueue.droppedPackets();
+    RelaySendPathInfo path;
+    publisher.socket().sendPathInfo(path);
+
+    // Bytes counted as sent but still buffered by the publisher have not
+    // reached the kernel either
+    RelayBandwidthSample sample;
+    sample.intervalMs = now - sampledAt;
+    sample.sentBytes = sent - sampledBytes;
+    if (path.unsentBytes >= 0) {
+        sample.unsentBytes = path.unsentBytes + (int64_t)publisher.pendingBytes();
+    }
+    sample.queuedBytes = sendQueue.queuedBytes();
+    sample.droppedPackets = dropped - sampledDropped;
+    sample.deliveryRateBps = path.deliveryRateBps;
+    sample.deliveryAppLimited = path.deliveryAppLimited;
+    sample.bitrateKbps = (int)stats->feedKbps.load();
+    sampledAt = now;
+    sampledBytes = sent;
+    sampledDropped = dropped;
+
+    const RelayBandwidthEstimate &estimate = bandwidth.update(sample);
+    stats->rttUs = path.rttUs;
+    stats->estimatedKbps = (uint64_t)estimate.kbps;
+    if (onBandwidth) {
+        onBandwidth(estimate);
+    }
+}
+
+// RelayFanout --------------------------------------------------------------
+
+void RelayFanout::addDestination(RelayDestination *destination)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    destinations.push_back(destination);
+    destination->setSource(this);
+}
+
+void RelayFanout::removeDestination(RelayDestination *destination)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = destinations.begin(); it != destinations.end(); ++it) {
+        if (*it == destination) {
+            destinations.erase(it);
+            break;
+        }
+    }
+    destination->setAccepting(false);
+}
+
+void RelayFanout::deliver(const RelayPacketPtr &packet)
+{
+    std::function<void()> keyframeReached;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (packet->isScript()) {
+            metadata = packet;
+        } else if (packet->isSequenceHeader()) {
+            // New codec configuration invalidates the cached frames
+            (packet->isVideo() ? videoHeader : audioHeader) = packet;
+            gop.clear();
+            gopBytes = 0;
+        } else {
+            cacheFrame(packet);
+            if (packet->isKeyframe()) {
+                keyframeReached.swap(keyframeCallback);
+            }
+        }
+
+        for (auto *destination : destinations) {
+            destination->enqueue(packet);
+        }
+    }
+    if (keyframeReached) {
+        keyframeReached();
+    }
+}
+
+void RelayFanout::cacheFrame(const RelayPacketPtr &packet)
+{
+    if (packet->isKeyframe()) {
+        gop.clear();
+        gopBytes = 0;
+    } else if (gop.empty()) {
+        return; // nothing is decodable before the first keyframe
+    }
+
+    if (gop.size() >= RELAY_GOP_CACHE_MAX_PACKETS || gopBytes + packet->data.size() > RELAY_GOP_CACHE_MAX_BYTES) {
+        // Too long to replay; newcomers wait for the next keyframe instead
+        gop.clear();
+        gopBytes = 0;
+        return;
+    }
+    gop.push_back(packet);
+    gopBytes += packet->data.size();
+}
+
+std::vector<RelayPacketPtr> RelayFanout::join(RelayDestination *destination)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<RelayPacketPtr> primer;
+    for (const auto &header : {metadata, videoHeader, audioHeader}) {
+        if (header) {
+            primer.push_back(header);
+        }
+    }
+    primer.insert(primer.end(), gop.begin(), gop.end());
+    destination->setAccepting(true);
+    return primer;
+}
+
+std::vector<RelayPacketPtr> RelayFanout::follow(RelayDestination *destination)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<RelayPacketPtr> primer;
+    for (const auto &header : {metadata, videoHeader, audioHeader}) {
+        if (header) {
+            primer.push_back(header);
+        }
+    }
+    destination->setAccepting(true);
+    return primer;
+}
+
+std::vector<RelayPacketPtr> RelayFanout::headers() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<RelayPacketPtr> result;
+    for (const auto &header : {metadata, videoHeader, audioHeader}) {
+        if (header) {
+            result.push_back(header);
+        }
+    }
+    return result;
+}
+
+bool RelayFanout::hasKeyframe() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !gop.empty();
+}
+
+void RelayFanout::onNextKeyframe(std::function<void()> callback)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    keyframeCallback = std::move(callback);
+}
+
+// RelayStream --------------------------------------------------------------
+
+// Ladder rung a destination subscribes to, or empty for the source
+static std::string subscribedRung(const RelayConfig &streamConfig, const RelayDestinationConfig &destinationConfig)
+{
+    for (const auto &rung : streamConfig.ladder) {
+        if (rung.name == destinationConfig.rendition) {
+            return rung.name;
+        }
+    }
+    return std::string();
+}
+
+static std::vector<std::string> subscribedRungs(const RelayConfig &streamConfig)
+{
+    std::vector<std::string> rungs;
+    for (const auto &rung : streamConfig.ladder) {
+        for (const auto &destinationConfig : streamConfig.destinations) {
+            if (destinationConfig.rendition == rung.name) {
+                rungs.push_back(rung.name);
+                break;
+            }
+        }
+    }
+    return rungs;
+}
+
+// The engine's settings narrowed to one route. The route table itself is
+// left out so a stream stays small however many routes there are.
+static RelayConfig streamConfigFor(const RelayConfig &engineConfig,
+                                   const std::vector<RelayDestinationConfig> &destinations)
+{
+    RelayConfig streamConfig = engineConfig;
+    streamConfig.routes.clear();
+    streamConfig.routes.shrink_to_fit();
+    streamConfig.destinations = destinations;
+    return streamConfig;
+}
+
+RelayStream::RelayStream(const std::string &name, const RelayConfig &engineConfig,
+                         const std::vector<RelayDestinationConfig> &destinations, RelayStats &stats,
+                         RelayShard &shard)
+    : streamName(name), config(streamConfigFor(engineConfig, destinations)), stats(stats), shard(shard)
+{
+}
+
+RelayStream::~RelayStream()
+{
+    stop();
+}
+
+void RelayStream::start()
+{
+    std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+    if (stopped) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sourceFanout = std::make_unique<RelayFanout>();
+        streamStats = stats.beginStream(streamName);
+        open = true;
+
+        for (const auto &destinationConfig : config.destinations) {
+            destinations.push_back(createDestination(destinationConfig));
+        }
+        startSubscribedLadder();
+    }
+    for (auto &destination : destinations) {
+        destination->start();
+    }
+
+    PLUGIN_LOG_INFO("%s: relaying to %zu destination(s) on shard %zu with %zu rendition(s) in %zu encoder(s)",
+                    streamName.c_str(), destinations.size(), shard.index(), renditionFanouts.size(),
+                    transcoders.size());
+}
+
+void RelayStream::stop()
+{
+    std::vector<std::unique_ptr<RelayDestination>> finishedDestinations;
+    std::vector<std::unique_ptr<RelayTranscoder>> finishedTranscoders;
+    std::map<std::string, std::unique_ptr<RelayTranscoder>> finishedAdaptive;
+    std::map<std::string, std::unique_ptr<RelayFanout>> finishedFanouts;
+    std::unique_ptr<RelayFanout> finishedSource;
+    RelayStats::StreamPtr finishedStats;
+    std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+    stopped = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        open = false;
+        finishedDestinations.swap(destinations);
+        finishedTranscoders.swap(transcoders);
+        finishedAdaptive.swap(adaptiveTranscoders);
+        finishedFanouts.swap(renditionFanouts);
+        finishedSource.swap(sourceFanout);
+        finishedStats.swap(streamStats);
+        adaptations.clear();
+        unavailableRungs.clear();
+        publishAdvice();
+    }
+
+    // Encoders feed the fanouts, and destinations prime from the fanouts,
+    // so tear down in that order
+    finishedTranscoders.clear();
+    finishedAdaptive.clear();
+    finishedDestinations.clear();
+    finishedFanouts.clear();
+    finishedSource.reset();
+    if (finishedStats) {
+        stats.endStream(finishedStats);
+    }
+}
+
+static std::string fileSafe(const std::string &name)
+{
+    std::string safe;
+    for (char c : name) {
+        safe += isalnum((unsigned char)c) || c == '-' ? c : '_';
+    }
+    return safe;
+}
+
+std::string RelayStream::fileTag() const
+{
+    // Keeps the single-publisher file names; other streams get a prefix
+    // that is safe in a file name
+    if (streamName == RELAY_DEFAULT_ROUTE) {
+        return std::string();
+    }
+    return fileSafe(streamName) + "_";
+}
+
+// Encodes the rungs in one ffmpeg into their fanouts, which must exist
+std::unique_ptr<RelayTranscoder> RelayStream::createTranscoder(const std::vector<const RelayEncodeParams *> &group,
+                                                               const std::vector<RelayFanout *> &fanouts,
+                                                               const std::string &index)
+{
+    std::vector<RelayEncodeParams> params;
+    std::vector<std::shared_ptr<RelayEncoderStats>> encoderStats;
+    for (const auto *rung : group) {
+        params.push_back(*rung);
+        encoderStats.push_back(stats.addEncoder(streamStats, rung->name));
+    }
+
+    std::string logPath;
+    if (!config.logDirectory.empty()) {
+        logPath = config.logDirectory + "encode_" + index + "_ffmpeg.log";
+    }
+    auto transcoder = std::make_unique<RelayTranscoder>(
+        params, config.ffmpegPath, logPath,
+        [fanouts](size_t rendition, const RelayPacketPtr &packet) { fanouts[rendition]->deliver(packet); });
+    transcoder->setStats(std::move(encoderStats));
+    transcoder->setGovernor(config.encoderGovernor);
+    if (!config.runDirectory.empty()) {
+        transcoder->setPidFile(config.runDirectory + "encode_" + index + ".pid");
+    }
+    transcoder->setFailureCallback([this](const std::string &reason) {
+        // The publisher is disconnected and starts afresh if it returns
+        open = false;
+        if (onFailure) {
+            onFailure(reason);
+        }
+    });
+    if (!transcoder->start(sourceFanout->headers())) {
+        PLUGIN_LOG_ERROR("Failed to start ladder encoder: %s", transcoder->lastError().c_str());
+    }
+    return transcoder;
+}
+
+void RelayStream::startLadder(const std::vector<const RelayEncodeParams *> &rungs)
+{
+    // One ffmpeg decodes the source once and serves every rung
+    std::vector<RelayFanout *> fanouts;
+    for (const auto *rung : rungs) {
+        fanouts.push_back(renditionFanouts[rung->name].get());
+    }
+    transcoders.push_back(createTranscoder(rungs, fanouts, fileTag() + std::to_string(transcoders.size())));
+}
+
+RelayFanout *RelayStream::fanoutFor(const std::string &rung)
+{
+    if (rung.empty()) {
+        return sourceFanout.get();
+    }
+    auto it = renditionFanouts.find(rung);
+    return it == renditionFanouts.end() ? nullptr : it->second.get();
+}
+
+// Where the destination's packets come from now, which adaptation may
+// have moved away from its configured rung
+std::string RelayStream::activeRung(const RelayConfig &streamConfig,
+                                    const RelayDestinationConfig &destinationConfig) const
+{
+    auto it = adaptations.find(destinationConfig.name);
+    return it == adaptations.end() ? subscribedRung(streamConfig, destinationConfig) : it->second.rung;
+}
+
+std::unique_ptr<RelayDestination> RelayStream::createDestination(const RelayDestinationConfig &destinationConfig)
+{
+    // Destinations subscribe to a ladder rung or take the source as-is
+    std::string rung = subscribedRung(config, destinationConfig);
+    if (!destinationConfig.rendition.empty() && rung.empty()) {
+        PLUGIN_LOG_WARNING("%s: unknown rendition %s for %s, sending source", streamName.c_str(),
+                           destinationConfig.rendition.c_str(), destinationConfig.name.c_str());
+    }
+
+    RelayFanout *fanout = sourceFanout.get();
+    if (!rung.empty()) {
+        auto &rungFanout = renditionFanouts[rung];
+        if (!rungFanout) {
+            rungFanout = std::make_unique<RelayFanout>();
+        }
+        fanout = rungFanout.get();
+    }
+
+    auto destination = std::make_unique<RelayDestination>(
+        destinationConfig, config,
+        stats.addDestination(streamStats, destinationConfig.name, destinationConfig.rendition), shard);
+    RelayDestination *adapted = destination.get();
+    destination->setBandwidthCallback(
+        [this, adapted](const RelayBandwidthEstimate &estimate) { adapt(adapted, estimate); });
+    fanout->addDestination(destination.get());
+    return destination;
+}
+
+void RelayStream::startSubscribedLadder()
+{
+    std::vector<const RelayEncodeParams *> rungs;
+    for (const auto &rung : config.ladder) {
+        if (renditionFanouts.count(rung.name)) {
+            rungs.push_back(&rung);
+        }
+    }
+    if (!rungs.empty()) {
+        startLadder(rungs);
+    }
+}
+
+void RelayStream::reconfigure(const RelayConfig &engineConfig, const std::vector<RelayDestinationConfig> &next)
+{
+    // Everything that has to stop is detached under the lock and torn
+    // down after it, so packets keep flowing to the untouched destinations
+    std::vector<std::unique_ptr<RelayDestination>> retiredDestinations;
+    std::vector<std::unique_ptr<RelayTranscoder>> retiredTranscoders;
+    std::map<std::string, std::unique_ptr<RelayTranscoder>> retiredAdaptive;
+    std::map<std::string, std::unique_ptr<RelayFanout>> retiredFanouts;
+    std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+    size_t firstNew = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        RelayConfig previous = config;
+        config = streamConfigFor(engineConfig, next);
+
+        if (!sourceFanout) {
+            return; // already stopped
+        }
+
+        // A different ladder, encoder or set of encoded rungs means a new
+        // encoder, and with it new streams for everyone subscribed to it
+        bool ladderChanged = previous.ladder != config.ladder || previous.ffmpegPath != config.ffmpegPath ||
+                             previous.encoderGovernor != config.encoderGovernor ||
+                             subscribedRungs(previous) != subscribedRungs(config);
+
+        for (auto it = destinations.begin(); it != destinations.end();) {
+            const RelayDestinationConfig &current = (*it)->config();
+            std::string currentRung = subscribedRung(previous, current);
+            std::string sentRung = activeRung(previous, current);
+            const RelayDestinationConfig *wanted = nullptr;
+            for (const auto &candidate : config.destinations) {
+                if (candidate.name == current.name) {
+                    wanted = &candidate;
+                }
+            }
+
+            // With adaptation turned off an adapted destination goes back
+            // to its own rendition
+            bool keep = wanted && wanted->url == current.url && wanted->streamKey == current.streamKey &&
+                        subscribedRung(config, *wanted) == currentRung && !(ladderChanged && !sentRung.empty()) &&
+                        (config.adaptiveBitrate || sentRung == currentRung);
+            if (keep) {
+                (*it)->setAutoReconnect(config.autoReconnect);
+                if (wanted->bitrateKbps != current.bitrateKbps) {
+                    (*it)->setBitrate(wanted->bitrateKbps);
+                }
+                if (wanted->tcp != current.tcp) {
+                    (*it)->setTcpTuning(wanted->tcp);
+                }
+                ++it;
+                continue;
+            }
+
+            PLUGIN_LOG_INFO("%s: %s %s", streamName.c_str(), current.name.c_str(),
+                            wanted ? "reconfigured, reconnecting" : "removed");
+            RelayFanout *fanout = fanoutFor(sentRung);
+            if (fanout) {
+                fanout->removeDestination(it->get());
+            }
+            adaptations.erase(current.name);
+            stats.removeDestination(streamStats, current.name);
+            retiredDestinations.push_back(std::move(*it));
+            it = destinations.erase(it);
+        }
+
+        if (ladderChanged) {
+            retiredTranscoders.swap(transcoders);
+            retiredAdaptive.swap(adaptiveTranscoders);
+            retiredFanouts.swap(renditionFanouts);
+            unavailableRungs.clear();
+            stats.removeEncoders(streamStats);
+        }
+        if (!config.adaptiveBitrate) {
+            adaptations.clear();
+        }
+        publishAdvice();
+
+        firstNew = destinations.size();
+        for (const auto &destinationConfig : config.destinations) {
+            bool exists = false;
+            for (const auto &destination : destinations) {
+                exists = exists || destination->config().name == destinationConfig.name;
+            }
+            if (!exists) {
+                destinations.push_back(createDestination(destinationConfig));
+            }
+        }
+        if (ladderChanged) {
+            startSubscribedLadder();
+        }
+    }
+
+    for (size_t i = firstNew; i < destinations.size(); i++) {
+        destinations[i]->start();
+    }
+    size_t added = destinations.size() - firstNew;
+
+    if (!retiredDestinations.empty() || added > 0 || !retiredTranscoders.empty()) {
+        PLUGIN_LOG_INFO("%s: %zu destination(s) restarted or removed, %zu started, %zu encoder(s) restarted",
+                        streamName.c_str(), retiredDestinations.size(), added, retiredTranscoders.size());
+    }
+
+    // Same order as stop(): encoders, destinations, then fanouts
+    retiredTranscoders.clear();
+    retiredAdaptive.clear();
+    retiredDestinations.clear();
+    retiredFanouts.clear();
+}
+
+void RelayStream::push(const RelayPacketPtr &packet)
+{
+    // Only this publisher's session and reconfigurations take the lock
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!sourceFanout) {
+        return;
+    }
+    streamStats->ingest.count(*packet);
+    sourceFanout->deliver(packet);
+    for (auto &transcoder : transcoders) {
+        transcoder->push(packet);
+    }
+    for (auto &transcoder : adaptiveTranscoders) {
+        transcoder.second->push(packet);
+    }
+}
+
+// Every rung below the configured bitrate, then the configured rendition
+std::vector<RelayBitrateLevel> RelayStream::adaptLevels(const RelayDestinationConfig &destinationConfig) const
+{
+    std::string configured = subscribedRung(config, destinationConfig);
+    std::vector<RelayBitrateLevel> levels;
+    for (const auto &rung : config.ladder) {
+        if (rung.name != configured && rung.videoBitrateKbps < destinationConfig.bitrateKbps &&
+            !unavailableRungs.count(rung.name)) {
+            levels.push_back({rung.name, rung.videoBitrateKbps});
+        }
+    }
+    std::sort(levels.begin(), levels.end(),
+              [](const RelayBitrateLevel &a, const RelayBitrateLevel &b) { return a.kbps < b.kbps; });
+    levels.push_back({configured, destinationConfig.bitrateKbps});
+    return levels;
+}
+
+void RelayStream::adapt(RelayDestination *destination, const RelayBandwidthEstimate &estimate)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string name = destination->config().name;
+    const RelayDestinationConfig *configured = nullptr;
+    for (const auto &candidate : config.destinations) {
+        if (candidate.name == name) {
+            configured = &candidate;
+        }
+    }
+    if (!config.adaptiveBitrate || !sourceFanout || !configured) {
+        return;
+    }
+
+    auto it = adaptations.find(name);
+    if (it == adaptations.end()) {
+        it = adaptations.emplace(name, Adaptation()).first;
+        it->second.rung = subscribedRung(config, *configured);
+    }
+    Adaptation &adaptation = it->second;
+    if (adaptation.switching) {
+        return;
+    }
+
+    std::vector<RelayBitrateLevel> levels = adaptLevels(*configured);
+    size_t current = levels.size() - 1;
+    for (size_t i = 0; i < levels.size(); i++) {
+        if (levels[i].rendition == adaptation.rung) {
+            current = i;
+        }
+    }
+    size_t next = adaptation.adapter.update(levels, current, estimate, relayNowMs());
+
+    // Only the publisher's own encode can be asked to shrink
+    int advice = adaptation.rung.empty() ? adaptation.adapter.advisedKbps() : 0;
+    if (advice != adaptation.advisedKbps) {
+        adaptation.advisedKbps = advice;
+        publishAdvice();
+    }
+    if (next == current) {
+        return;
+    }
+
+    const RelayBitrateLevel &level = levels[next];
+    PLUGIN_LOG_INFO("%s: %s sustains about %.0f kbps, switching to %s (%d kbps)", streamName.c_str(), name.c_str(),
+                    estimate.kbps, level.rendition.empty() ? "source" : level.rendition.c_str(), level.kbps);
+    adaptation.switching = true;
+    int bitrateKbps = next + 1 == levels.size() ? 0 : level.kbps;
+    std::weak_ptr<RelayStream> self = weak_from_this();
+    std::string rung = level.rendition;
+    shard.offload(
+        [self, name, rung, bitrateKbps]() {
+            if (auto stream = self.lock()) {
+                stream->switchRendition(name, rung, bitrateKbps);
+            }
+        },
+        nullptr);
+}
+
+void RelayStream::switchRendition(const std::string &name, const std::string &rung, int bitrateKbps)
+{
+    uint64_t id = 0;
+    {
+        std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+        RelayFanout *target = nullptr;
+        const RelayEncodeParams *params = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = adaptations.find(name);
+            if (!sourceFanout || it == adaptations.end()) {
+                return;
+            }
+            bool found = false;
+            for (const auto &candidate : destinations) {
+                found = found || candidate->config().name == name;
+            }
+            target = fanoutFor(rung);
+            for (const auto &candidate : config.ladder) {
+                if (candidate.name == rung) {
+                    params = &candidate;
+                }
+            }
+            if (!found || (!target && !params)) {
+                it->second.switching = false;
+                return;
+            }
+            id = ++nextSwitchId;
+            it->second.switchId = id;
+        }
+        if (!target) {
+            // A rung nobody subscribed to gets an encoder of its own.
+            // Spawning it happens outside mutex, so push() keeps feeding
+            // everyone else; config only changes under lifecycleMutex.
+            auto fanout = std::make_unique<RelayFanout>();
+            auto transcoder =
+                createTranscoder({params}, {fanout.get()}, fileTag() + "adaptive_" + fileSafe(rung));
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!transcoder->isRunning()) {
+                PLUGIN_LOG_WARNING("%s: cannot encode %s, leaving it out of adaptation", streamName.c_str(),
+                                   rung.c_str());
+                unavailableRungs.insert(rung);
+                stats.removeEncoder(streamStats, rung);
+                adaptations[name].switching = false;
+                return;
+            }
+            target = fanout.get();
+            renditionFanouts[rung] = std::move(fanout);
+            adaptiveTranscoders[rung] = std::move(transcoder);
+
+            // The destination keeps the old stream until the new one has
+            // something to start on, unless the encoder takes unusually long
+            std::weak_ptr<RelayStream> self = weak_from_this();
+            target->onNextKeyframe([self, name, rung, bitrateKbps, id]() {
+                if (auto stream = self.lock()) {
+                    stream->scheduleFinishSwitch(name, rung, bitrateKbps, id);
+                }
+            });
+            RelayShard *home = &shard;
+            home->post([self, name, rung, bitrateKbps, id, home]() {
+                home->addTimer(RELAY_ADAPT_WARMUP_MS, [self, name, rung, bitrateKbps, id]() {
+                    if (auto stream = self.lock()) {
+                        stream->scheduleFinishSwitch(name, rung, bitrateKbps, id);
+                    }
+                });
+            });
+            if (!target->hasKeyframe()) {
+                return;
+            }
+        }
+    }
+    finishSwitch(name, rung, bitrateKbps, id);
+}
+
+// Switching waits for the destination's shard, so it runs on a helper thread
+void RelayStream::scheduleFinishSwitch(const std::string &name, const std::string &rung, int bitrateKbps,
+                                       uint64_t id)
+{
+    std::weak_ptr<RelayStream> self = weak_from_this();
+    shard.offload(
+        [self, name, rung, bitrateKbps, id]() {
+            if (auto stream = self.lock()) {
+                stream->finishSwitch(name, rung, bitrateKbps, id);
+            }
+        },
+        nullptr);
+}
+
+// Whichever of the keyframe, the timeout and switchRendition() gets here
+// first switches; the others find the switch done
+void RelayStream::finishSwitch(const std::string &name, const std::string &rung, int bitrateKbps, uint64_t id)
+{
+    std::unique_ptr<RelayTranscoder> retiredTranscoder;
+    std::unique_ptr<RelayFanout> retiredFanout;
+    std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+    RelayDestination *destination = nullptr;
+    RelayFanout *target = nullptr;
+    std::string previous;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = adaptations.find(name);
+        if (!sourceFanout || it == adaptations.end() || !it->second.switching || it->second.switchId != id) {
+            return;
+        }
+        for (const auto &candidate : destinations) {
+            if (candidate->config().name == name) {
+                destination = candidate.get();
+            }
+        }
+        target = fanoutFor(rung);
+        if (!destination || !target) {
+            it->second.switching = false;
+            return;
+        }
+        previous = it->second.rung;
+    }
+
+    destination->switchSource(target, bitrateKbps);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = adaptations.find(name);
+        if (it != adaptations.end()) {
+            it->second.rung = rung;
+            it->second.switching = false;
+        }
+
+        // An encoder only adaptation used stops once nothing is on it
+        bool used = false;
+        for (const auto &entry : adaptations) {
+            used = used || entry.second.rung == previous;
+        }
+        auto encoder = adaptiveTranscoders.find(previous);
+        if (!used && encoder != adaptiveTranscoders.end()) {
+            retiredTranscoder = std::move(encoder->second);
+            adaptiveTranscoders.erase(encoder);
+            retiredFanout = std::move(renditionFanouts[previous]);
+            renditionFanouts.erase(previous);
+            stats.removeEncoder(streamStats, previous);
+        }
+    }
+
+    // Same order as stop(): the encoder, then the fanout it fed
+    retiredTranscoder.reset();
+    retiredFanout.reset();
+}
+
+// OBS's encode feeds every destination on the source, so it has to fit the
+// slowest of them
+void RelayStream::publishAdvice()
+{
+    int kbps = 0;
+    for (const auto &entry : adaptations) {
+        int advice = entry.second.advisedKbps;
+        if (advice > 0 && (kbps == 0 || advice < kbps)) {
+            kbps = advice;
+        }
+    }
+    if (kbps == advisedKbps) {
+        return;
+    }
+    advisedKbps = kbps;
+    if (kbps > 0) {
+        PLUGIN_LOG_WARNING("%s: a destination cannot keep up even on the lowest rung, advising %d kbps",
+                           streamName.c_str(), kbps);
+    } else {
+        PLUGIN_LOG_INFO("%s: every destination keeps up again, lifting the bitrate advice", streamName.c_str());
+    }
+    if (onAdvice) {
+        onAdvice(kbps);
+    }
+}
+
+// RelayEngine --------------------------------------------------------------
+
+RelayEngine::RelayEngine(const RelayConfig &config)
+    : config(config)
+{
+    buildRouteIndex();
+}
+
+RelayEngine::~RelayEngine()
+{
+    stop();
+}
+
+bool RelayEngine::start()
+{
+    failed = false;
+    relayTraceEnabled = config.tracing;
+    if (!config.runDirectory.empty()) {
+        RelaySupervisor::cleanupStalePidFiles(config.runDirectory);
+    }
+
+    scheduler = std::make_unique<RelayScheduler>((size_t)std::max(config.workerThreads, 0), config.sendBackend);
+    if (!scheduler->start()) {
+        error = scheduler->lastError();
+        scheduler.reset();
+        return false;
+    }
+
+    RtmpIngestServer::Callbacks callbacks;
+    callbacks.onPublish = [this](const std::string &app, const std::string &key) { return onPublish(app, key); };
+    callbacks.onUnpublish = [this](const RelayIngestStreamPtr &stream) { onUnpublish(stream); };
+
+    ingest = std::make_unique<RtmpIngestServer>(*scheduler, callbacks);
+    if (!ingest->start(config.listenPort)) {
+        error = ingest->lastError();
+        ingest.reset();
+        scheduler.reset();
+        return false;
+    }
+
+    startMetrics();
+    return true;
+}
+
+bool RelayEngine::startMetrics()
+{
+    // Monitoring is optional; the relay runs fine without it
+    if (config.metricsPort == 0) {
+        return true;
+    }
+    metrics = std::make_unique<RelayMetricsServer>([this]() { return stats.snapshot(); });
+    if (!metrics->start(config.metricsPort)) {
+        PLUGIN_LOG_WARNING("Metrics endpoint disabled: %s", metrics->lastError().c_str());
+        metrics.reset();
+        return false;
+    }
+    return true;
+}
+
+void RelayEngine::stop()
+{
+    if (metrics) {
+        metrics->stop();
+        metrics.reset();
+    }
+    if (ingest) {
+        ingest->stop();
+        ingest.reset();
+    }
+    stopStreams();
+    // Last: streams still stopping on helper threads need their shards
+    if (scheduler) {
+        scheduler->stop();
+        scheduler.reset();
+    }
+}
+
+void RelayEngine::buildRouteIndex()
+{
+    routeIndex.clear();
+    routeIndex.reserve(config.routes.size());
+    for (size_t i = 0; i < config.routes.size(); i++) {
+        const auto &route = config.routes[i];
+        if (route.name == RELAY_DEFAULT_ROUTE || route.streamKey.empty()) {
+            PLUGIN_LOG_WARNING("Ignoring route \"%s\": it needs a stream key and a name other than %s",
+                               route.name.c_str(), RELAY_DEFAULT_ROUTE);
+            continue;
+        }
+        if (!routeIndex.emplace(route.streamKey, i).second) {
+            PLUGIN_LOG_WARNING("Ignoring route %s: its stream key is already routed", route.name.c_str());
+        }
+    }
+}
+
+const std::vector<RelayDestinationConfig> *RelayEngine::routeDestinations(const std::string &route) const
+{
+    if (route == RELAY_DEFAULT_ROUTE) {
+        bool enabled = config.routes.empty() || !config.destinations.empty();
+        return enabled ? &config.destinations : nullptr;
+    }
+    for (const auto &index : routeIndex) {
+        if (config.routes[index.second].name == route) {
+            return &config.routes[index.second].destinations;
+        }
+    }
+    return nullptr;
+}
+
+RelayIngestStreamPtr RelayEngine::onPublish(const std::string &app, const std::string &streamKey)
+{
+    std::shared_ptr<RelayStream> stream;
+    {
+        std::lock_guard<std::mutex> lock(streamsMutex);
+        auto route = routeIndex.find(streamKey);
+        std::string name = route == routeIndex.end() ? RELAY_DEFAULT_ROUTE : config.routes[route->second].name;
+        const auto *destinations = route == routeIndex.end() ? routeDestinations(name)
+                                                             : &config.routes[route->second].destinations;
+        if (!destinations) {
+            // Logged like the ingest logs every publish, so the two match up
+            PLUGIN_LOG_WARNING("Rejecting publisher %s/%s: unknown stream key", app.c_str(), streamKey.c_str());
+            return nullptr;
+        }
+        if (streams.count(name)) {
+            PLUGIN_LOG_WARNING("Rejecting second publisher for %s", name.c_str());
+            return nullptr;
+        }
+
+        // The publisher's own shard, so its packets reach the destinations
+        // without crossing cores
+        RelayShard *shard = RelayShard::current();
+        if (!shard) {
+            shard = scheduler->next();
+        }
+        stream = std::make_shared<RelayStream>(name, config, *destinations, stats, *shard);
+        stream->setBitrateAdviceCallback([this, name](int kbps) {
+            if (onAdvice) {
+                onAdvice(name, kbps);
+            }
+        });
+        stream->setFailureCallback([this](const std::string &reason) {
+            // Without routes the one stream is the relay; its owner restarts it
+            if (config.routes.empty()) {
+                failed = true;
+            }
+            if (onFailure) {
+                onFailure(reason);
+            }
+        });
+        streams.emplace(name, stream);
+        publishers = streams.size();
+    }
+
+    // Starting waits for the destinations' shards, which may be in here
+    // waiting for the lock themselves. A reconfigure() that gets in first
+    // leaves its settings for start(); a stop() keeps it from starting.
+    stream->start();
+    return stream;
+}
+
+void RelayEngine::onUnpublish(const RelayIngestStreamPtr &stream)
+{
+    auto relayStream = std::static_pointer_cast<RelayStream>(stream);
+    {
+        std::lock_guard<std::mutex> lock(streamsMutex);
+        auto it = streams.find(relayStream->name());
+        if (it != streams.end() && it->second == relayStream) {
+            streams.erase(it);
+        }
+        publishers = streams.size();
+    }
+
+    // Stopping waits for the stream's encoders and for its shard, which is
+    // usually the one calling, so it happens on a helper thread
+    RelayShard *shard = RelayShard::current();
+    if (shard) {
+        shard->offload([relayStream]() { relayStream->stop(); }, nullptr);
+    } else {
+        relayStream->stop();
+    }
+}
+
+// An in-process publisher's packets cross to the stream's shard once, so
+// the fanout and the destinations' wakeups stay there as with the ingest
+class RelayLocalStream : public RelayIngestStream {
+public:
+    explicit RelayLocalStream(std::shared_ptr<RelayStream> stream) : stream(std::move(stream)) {}
+
+    void push(const RelayPacketPtr &packet) override
+    {
+        stream->homeShard().post([stream = stream, packet]() { stream->push(packet); });
+    }
+    bool isOpen() const override { return stream->isOpen(); }
+
+    const std::shared_ptr<RelayStream> stream;
+};
+
+RelayIngestStreamPtr RelayEngine::openLocalStream(const std::string &streamKey)
+{
+    if (!scheduler) {
+        return nullptr;
+    }
+    auto stream = std::static_pointer_cast<RelayStream>(onPublish("local", streamKey));
+    return stream ? std::make_shared<RelayLocalStream>(stream) : nullptr;
+}
+
+void RelayEngine::closeLocalStream(const RelayIngestStreamPtr &stream)
+{
+    if (stream) {
+        onUnpublish(std::static_pointer_cast<RelayLocalStream>(stream)->stream);
+    }
+}
+
+bool RelayEngine::reconfigure(const RelayConfig &next)
+{
+    bool applied = true;
+    if (next.listenPort != config.listenPort) {
+        error = "The ingest port change takes effect on the next start";
+        PLUGIN_LOG_WARNING("%s", error.c_str());
+        applied = false;
+    }
+    if (next.workerThreads != config.workerThreads) {
+        error = "The worker thread count takes effect on the next start";
+        PLUGIN_LOG_WARNING("%s", error.c_str());
+        applied = false;
+    }
+    if (next.sendBackend != config.sendBackend) {
+        error = "The network backend change takes effect on the next start";
+        PLUGIN_LOG_WARNING("%s", error.c_str());
+        applied = false;
+    }
+
+    if (next.metricsPort != config.metricsPort) {
+        if (metrics) {
+            metrics->stop();
+            metrics.reset();
+        }
+        config.metricsPort = next.metricsPort;
+        startMetrics();
+    }
+    relayTraceEnabled = next.tracing;
+
+    // Streams whose route is gone close, which disconnects their
+    // publishers; the others apply their part of the change. Both happen
+    // after the lock, since they wait for shards that may be in onPublish().
+    std::vector<std::shared_ptr<RelayStream>> closed;
+    std::vector<std::pair<std::shared_ptr<RelayStream>, std::vector<RelayDestinationConfig>>> changed;
+    RelayConfig nextConfig;
+    {
+        std::lock_guard<std::mutex> lock(streamsMutex);
+        uint16_t listenPort = config.listenPort;
+        int workerThreads = config.workerThreads;
+        RelaySendBackend sendBackend = config.sendBackend;
+        config = next;
+        config.listenPort = listenPort;
+        config.workerThreads = workerThreads;
+        config.sendBackend = sendBackend;
+        buildRouteIndex();
+        nextConfig = config;
+
+        for (auto it = streams.begin(); it != streams.end();) {
+            const auto *destinations = routeDestinations(it->first);
+            if (destinations) {
+                changed.emplace_back(it->second, *destinations);
+                ++it;
+                continue;
+            }
+            PLUGIN_LOG_INFO("%s: route removed, disconnecting its publisher", it->first.c_str());
+            closed.push_back(it->second);
+            it = streams.erase(it);
+        }
+        publishers = streams.size();
+    }
+
+    for (auto &stream : changed) {
+        stream.first->reconfigure(nextConfig, stream.second);
+    }
+    for (auto &stream : closed) {
+        stream->stop();
+    }
+    PLUGIN_LOG_INFO("Configuration applied to %zu live stream(s)", (size_t)publishers);
+    return applied;
+}
+
+void RelayEngine::stopStreams()
+{
+    std::unordered_map<std::string, std::shared_ptr<RelayStream>> finished;
+    {
+        std::lock_guard<std::mutex> lock(streamsMutex);
+        finished.swap(streams);
+        publishers = 0;
+    }
+    for (auto &stream : finished) {
+        stream.second->stop();
+    }
+}
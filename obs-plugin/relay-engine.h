@@ -0,0 +1,430 @@
+#pragma once
+
+/*
+ * In-process RTMP fan-out relay.
+ *
+ * OBS publishes once to the local ingest; every packet is then written
+ * straight to each configured platform without going back through a
+ * local RTMP server or per-platform ffmpeg processes.
+ *
+ * One engine can serve many publishers. The ingest stream key selects a
+ * route (a destination set) through a hash table when the publish starts;
+ * from then on the session feeds its own RelayStream and shares nothing
+ * with other publishers on the packet path.
+ *
+ * Sessions and destinations run on a RelayScheduler, one pinned event
+ * loop per CPU. A stream's destinations live on the shard its publisher
+ * was accepted on, so a packet normally goes from ingest to the platform
+ * sockets without leaving that core; different streams spread over the
+ * shards and scale with them.
+ *
+ * Each destination estimates what its path sustains. When a platform's
+ * route degrades, the stream moves that destination alone to a lower
+ * ladder rung, on the same connection, and back once the route recovers;
+ * below the lowest rung it asks for OBS's own encode to shrink.
+ */
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "relay-bandwidth.h"
+#include "relay-ingest.h"
+#include "relay-metrics.h"
+#include "relay-packet.h"
+#include "relay-publisher.h"
+#include "relay-queue.h"
+#include "relay-reconnect.h"
+#include "relay-shard.h"
+#include "relay-stats.h"
+#include "relay-transcoder.h"
+
+#include "plugin-macros.h"
+
+#define RELAY_CONNECT_TIMEOUT_MS 10000
+#define RELAY_GOP_CACHE_MAX_PACKETS 2048
+#define RELAY_GOP_CACHE_MAX_BYTES (32 * 1024 * 1024)
+#define RELAY_DRAIN_BATCH 64 // packets per turn, written together, before other handlers on the shard run
+// Bytes per turn; what the socket does not take waits in the publisher,
+// out of reach of the queue's frame skipping
+#define RELAY_DRAIN_BATCH_BYTES (256 * 1024)
+
+// How long a destination stays on its old rendition while the encoder of
+// the one it switches to starts
+#define RELAY_ADAPT_WARMUP_MS 5000
+
+// Stream name of publishers that match no route
+#define RELAY_DEFAULT_ROUTE "default"
+
+// Send-path socket options of one destination (see RelaySocket); zero or
+// empty keeps the system default. All can change on a live connection.
+struct RelayTcpTuning {
+    int notSentLowatKb = 0;        // TCP_NOTSENT_LOWAT
+    int pacingPercent = 0;         // SO_MAX_PACING_RATE, relative to the destination's bitrate
+    std::string congestionControl; // TCP_CONGESTION, e.g. "bbr"
+
+    bool operator==(const RelayTcpTuning &other) const
+    {
+        return notSentLowatKb == other.notSentLowatKb && pacingPercent == other.pacingPercent &&
+               congestionControl == other.congestionControl;
+    }
+    bool operator!=(const RelayTcpTuning &other) const { return !(*this == other); }
+};
+
+struct RelayDestinationConfig {
+    std::string name; // identifies the destination across reconfigurations
+    std::string url;
+    std::string streamKey;
+    int bitrateKbps = DEFAULT_BITRATE;
+
+    // Ladder rung this destination subscribes to; empty forwards OBS's
+    // own encode untouched
+    std::string rendition;
+    RelayTcpTuning tcp;
+};
+
+// Publishers using this ingest stream key relay to their own destinations
+struct RelayRouteConfig {
+    std::string name;      // identifies the stream in stats, logs and reconfigurations
+    std::string streamKey; // what the publisher puts after rtmp://relay/live/
+    std::vector<RelayDestinationConfig> destinations;
+};
+
+struct RelayConfig {
+    uint16_t listenPort = DEFAULT_RTMP_PORT;
+    uint16_t metricsPort = 0; // OpenMetrics endpoint; 0 disables it
+    bool autoReconnect = true;
+    bool adaptiveBitrate = true; // move destinations whose path degrades to a lower rung
+    bool tracing = true;         // per-packet latency stamps, see relay-trace.h
+    int maxReconnectAttempts = MAX_RECONNECT_ATTEMPTS; // 0 retries forever
+    int reconnectDelayMs = DEFAULT_RECONNECT_DELAY;    // backoff ceiling
+    std::string ffmpegPath = FFMPEG_EXECUTABLE;
+    std::string logDirectory; // empty disables encoder logs
+    std::string runDirectory; // encoder pid files; empty disables them
+    int workerThreads = 0;    // event loop shards; 0 runs one per CPU
+    RelaySendBackend sendBackend = RelaySendBackend::Sockets;
+    std::vector<RelayEncodeParams> ladder;
+    RelayGovernorLimits encoderGovernor; // tunes the ladder's x264 to the host
+
+    // Publishers whose key matches no route relay to destinations (the
+    // default route); with routes but no destinations they are rejected.
+    // Each route, the default one included, takes one publisher at a time.
+    std::vector<RelayDestinationConfig> destinations;
+    std::vector<RelayRouteConfig> routes;
+};
+
+class RelayFanout;
+
+// One outgoing platform connection, driven by its stream's shard. Only
+// connecting blocks, so that runs on a helper thread.
+class RelayDestination : public RelayShardHandler {
+public:
+    RelayDestination(const RelayDestinationConfig &config, const RelayConfig &engineConfig,
+                     std::shared_ptr<RelayDestinationStats> stats, RelayShard &shard);
+    ~RelayDestination() override;
+
+    // Any thread; both wait for the shard to take the change
+    void start();
+    void stop();
+
+    void setSource(RelayFanout *fanout) { source = fanout; }
+    // Moves the destination to another packet stream without reconnecting:
+    // it picks up at that stream's next keyframe, behind its headers, with
+    // timestamps carrying on from the last ones sent. bitrateKbps is what
+    // the new stream is encoded at, 0 for the configured bitrate.
+    void switchSource(RelayFanout *fanout, int bitrateKbps);
+    void enqueue(const RelayPacketPtr &packet);
+    // Set before start(); called on the shard with every new estimate
+    void setBandwidthCallback(std::function<void(const RelayBandwidthEstimate &estimate)> callback)
+    {
+        onBandwidth = std::move(callback);
+    }
+    // Called by the fanout: from now on every delivered packet is queued
+    void setAccepting(bool enabled) { accepting = enabled; }
+
+    // Live adjustments that do not need a new connection. The configured
+    // bitrate applies once the destination is back on its own rendition.
+    void setAutoReconnect(bool enabled) { autoReconnect = enabled; }
+    void setBitrate(int bitrateKbps);
+    void setTcpTuning(const RelayTcpTuning &tuning);
+
+    bool isConnected() const { return connected; }
+    const RelayDestinationConfig &config() const { return destinationConfig; }
+    const RelaySendQueue &queue() const { return sendQueue; }
+
+    // RelayShardHandler
+    void onSocketEvent(int events) override;
+    void onWake() override;
+    void onSendComplete(int result) override;
+
+private:
+    struct ConnectAttempt;
+
+    void connect();
+    void onConnected(ConnectAttempt &result);
+    void drain();
+    bool sendBatch();
+    bool submitOutput();
+    void disconnect(const std::string &reason = std::string());
+    void scheduleRetry();
+    void tick();
+    void publishGauges();
+    void retune();
+    void applyTuning();
+    void applyBitrate();
+    void sampleBandwidth();
+    uint32_t outputTimestamp(const RelayPacket &packet);
+
+    RelayDestinationConfig destinationConfig;
+    std::string logName; // "stream/name", or just the name on the default route
+    uint32_t traceTrack = 0;
+    std::atomic<bool> autoReconnect;
+    RelayShard &shard;
+    std::atomic<bool> running{false};
+    std::atomic<bool> connected{false};
+    std::atomic<bool> accepting{false};
+    RelaySendQueue sendQueue;
+    std::shared_ptr<RelayDestinationStats> stats;
+    RelayFanout *source = nullptr;
+
+    // Owned by the shard
+    RtmpPublisher publisher;
+    std::vector<RelayPacketPtr> batch; // queued in the publisher, kept alive until written
+    bool useUring = false;             // the shard's ring writes for the publisher
+    bool sendInFlight = false;
+    relay_socket_t watchedFd = RELAY_INVALID_SOCKET;
+    std::shared_ptr<ConnectAttempt> attempt;
+    RelayBackoff backoff;
+    uint64_t connectedAt = 0;
+    bool everConnected = false;
+    RelayShard::TimerId retryTimer = 0;
+    RelayShard::TimerId tickTimer = 0;
+    uint64_t lastDropped = 0;
+
+    // Bandwidth estimation, sampled every tick
+    std::function<void(const RelayBandwidthEstimate &estimate)> onBandwidth;
+    RelayBandwidthEstimator bandwidth;
+    uint64_t sampledAt = 0;
+    uint64_t sampledBytes = 0;
+    uint64_t sampledDropped = 0;
+
+    // Bitrate of a switched-to stream; 0 while on the configured one
+    std::atomic<int> feedBitrateKbps{0};
+    // Timestamps continue across switches
+    uint32_t timestampOffset = 0;
+    uint32_t lastTimestamp = 0;
+    bool rebasePending = false;
+
+    // Socket options wanted (any thread) and on the socket (the shard's)
+    std::mutex tuningMutex;
+    RelayTcpTuning tuning;
+    int tuningBitrateKbps;
+    std::atomic<bool> retuneNeeded{false};
+    RelayTcpTuning appliedTuning;
+    int appliedBitrateKbps = 0;
+};
+
+// Delivers one packet stream (source or a ladder rung) to its
+// destinations. It keeps the stream headers and the GOP in progress so a
+// destination that (re)connects starts on a keyframe straight away instead
+// of waiting up to a full GOP for the next one.
+class RelayFanout {
+public:
+    void addDestination(RelayDestination *destination);
+    // After this returns the destination receives no more packets
+    void removeDestination(RelayDestination *destination);
+    void deliver(const RelayPacketPtr &packet);
+    std::vector<RelayPacketPtr> headers() const;
+    bool empty() const { return destinations.empty(); }
+    // A keyframe went through, so newcomers start without waiting long
+    bool hasKeyframe() const;
+    // Runs once on the delivering thread, right after the next keyframe
+    // went out; replaces a callback still waiting
+    void onNextKeyframe(std::function<void()> callback);
+
+    // Returns the headers followed by the cached GOP and atomically starts
+    // queueing live packets to the destination right after them
+    std::vector<RelayPacketPtr> join(RelayDestination *destination);
+    // Like join(), but without the cached GOP: the destination waits for
+    // the next keyframe instead of replaying the past
+    std::vector<RelayPacketPtr> follow(RelayDestination *destination);
+
+private:
+    void cacheFrame(const RelayPacketPtr &packet);
+
+    mutable std::mutex mutex;
+    std::vector<RelayDestination *> destinations;
+    RelayPacketPtr metadata;
+    RelayPacketPtr videoHeader;
+    RelayPacketPtr audioHeader;
+
+    // Everything since the latest keyframe; empty while no complete
+    // keyframe-aligned GOP fits the cache limits
+    std::vector<RelayPacketPtr> gop;
+    size_t gopBytes = 0;
+    std::function<void()> keyframeCallback;
+};
+
+// One publisher's session: its source fanout, the ladder rungs its
+// destinations subscribe to and the destinations themselves
+class RelayStream : public RelayIngestStream, public std::enable_shared_from_this<RelayStream> {
+public:
+    // Relays to the given destinations with the engine's other settings;
+    // the destinations run on shard
+    RelayStream(const std::string &name, const RelayConfig &engineConfig,
+                const std::vector<RelayDestinationConfig> &destinations, RelayStats &stats, RelayShard &shard);
+    ~RelayStream() override;
+
+    void start();
+    void stop();
+    // See RelayEngine::reconfigure(); this stream's part of it
+    void reconfigure(const RelayConfig &engineConfig, const std::vector<RelayDestinationConfig> &destinations);
+
+    // Called from an encoder thread once the stream has closed itself
+    void setFailureCallback(std::function<void(const std::string &reason)> callback) { onFailure = std::move(callback); }
+    // Called from a shard when the bitrate OBS's own encode should not
+    // exceed changes (0: no limit); see RelayEngine
+    void setBitrateAdviceCallback(std::function<void(int kbps)> callback) { onAdvice = std::move(callback); }
+
+    // RelayIngestStream, from the publisher's shard
+    void push(const RelayPacketPtr &packet) override;
+    bool isOpen() const override { return open; }
+
+    const std::string &name() const { return streamName; }
+    RelayShard &homeShard() const { return shard; }
+
+private:
+    std::unique_ptr<RelayDestination> createDestination(const RelayDestinationConfig &destinationConfig);
+    RelayFanout *fanoutFor(const std::string &rung);
+    std::string activeRung(const RelayConfig &streamConfig, const RelayDestinationConfig &destinationConfig) const;
+    // Needs lifecycleMutex; mutex too unless the fanouts are not published yet
+    std::unique_ptr<RelayTranscoder> createTranscoder(const std::vector<const RelayEncodeParams *> &rungs,
+                                                      const std::vector<RelayFanout *> &fanouts,
+                                                      const std::string &index);
+    void startLadder(const std::vector<const RelayEncodeParams *> &rungs);
+    void startSubscribedLadder();
+    std::string fileTag() const;
+
+    // Bitrate adaptation: decided on the destination's shard, switched on
+    // a helper thread, since a rung may need its encoder started first. A
+    // new encoder's rung is switched to once it has a keyframe to start on.
+    void adapt(RelayDestination *destination, const RelayBandwidthEstimate &estimate);
+    void switchRendition(const std::string &destination, const std::string &rung, int bitrateKbps);
+    void finishSwitch(const std::string &destination, const std::string &rung, int bitrateKbps, uint64_t id);
+    void scheduleFinishSwitch(const std::string &destination, const std::string &rung, int bitrateKbps,
+                              uint64_t id);
+    std::vector<RelayBitrateLevel> adaptLevels(const RelayDestinationConfig &destinationConfig) const;
+    void publishAdvice();
+
+    std::string streamName;
+    RelayConfig config; // the engine's settings with this stream's destinations and no routes
+    RelayStats &stats;
+    RelayShard &shard;
+    RelayStats::StreamPtr streamStats;
+    std::atomic<bool> open{false};
+    std::function<void(const std::string &reason)> onFailure;
+    std::function<void(int kbps)> onAdvice;
+
+    // start(), stop() and reconfigure() hold lifecycleMutex throughout but
+    // mutex, which push() takes, only while they swap state: starting and
+    // stopping destinations waits for the shard, which may be in push()
+    std::mutex lifecycleMutex;
+    std::mutex mutex;
+    bool stopped = false; // under lifecycleMutex; stopped before start() means it never starts
+    std::vector<std::unique_ptr<RelayDestination>> destinations; // changed under both
+    std::unique_ptr<RelayFanout> sourceFanout;
+
+    // Only rungs with at least one subscriber are encoded, each exactly once
+    std::map<std::string, std::unique_ptr<RelayFanout>> renditionFanouts;
+    std::vector<std::unique_ptr<RelayTranscoder>> transcoders;
+
+    // Destinations that adaptation moved or is watching, by name
+    struct Adaptation {
+        RelayBitrateAdapter adapter;
+        std::string rung; // being sent; empty for the source
+        int advisedKbps = 0;
+        bool switching = false;
+        uint64_t switchId = 0; // the switch in progress
+    };
+    std::map<std::string, Adaptation> adaptations;
+    uint64_t nextSwitchId = 0;
+    // Rungs only adaptation subscribes to, each in an encoder of its own,
+    // and rungs whose encoder would not start
+    std::map<std::string, std::unique_ptr<RelayTranscoder>> adaptiveTranscoders;
+    std::set<std::string> unavailableRungs;
+    int advisedKbps = 0;
+};
+
+class RelayEngine {
+public:
+    explicit RelayEngine(const RelayConfig &config);
+    ~RelayEngine();
+
+    bool start();
+    void stop();
+
+    // Applies a new configuration while streaming. Routes and their
+    // destinations are matched by name; only added, removed or re-targeted
+    // ones (and, if the ladder changed, those fed by it) reconnect, and a
+    // publisher whose route went away is disconnected. Returns false if
+    // some change (the ingest port, the worker count) only takes effect on
+    // the next start.
+    bool reconfigure(const RelayConfig &next);
+
+    // Called from an engine thread when a stream cannot recover by itself.
+    // Without routes that stream is the whole relay and isRunning() turns
+    // false; otherwise only its publisher is disconnected.
+    void setFailureCallback(std::function<void(const std::string &reason)> callback) { onFailure = std::move(callback); }
+    // Called from an engine thread when a destination fed the publisher's
+    // own encode cannot keep up even on the lowest rung: that encode should
+    // not exceed kbps, or with 0 is free again. Set before start().
+    void setBitrateAdviceCallback(std::function<void(const std::string &stream, int kbps)> callback)
+    {
+        onAdvice = std::move(callback);
+    }
+
+    // Publishes from inside the process, e.g. OBS's own encoders, exactly
+    // as an RTMP publisher with streamKey would but without the loopback
+    // connection. Null if rejected; push() from one thread at a time, and
+    // stop once the stream is no longer open.
+    RelayIngestStreamPtr openLocalStream(const std::string &streamKey);
+    void closeLocalStream(const RelayIngestStreamPtr &stream);
+
+    bool isRunning() const { return ingest && ingest->isRunning() && !failed; }
+    bool isPublishing() const { return publishers > 0; }
+    size_t publisherCount() const { return publishers; }
+    // Lock-free for the relay threads; safe to call from any thread
+    RelayStatsSnapshot statsSnapshot() const { return stats.snapshot(); }
+    const std::string &lastError() const { return error; }
+
+private:
+    RelayIngestStreamPtr onPublish(const std::string &app, const std::string &streamKey);
+    void onUnpublish(const RelayIngestStreamPtr &stream);
+    // Destinations of the named route, or null if it does not exist
+    const std::vector<RelayDestinationConfig> *routeDestinations(const std::string &route) const;
+    void buildRouteIndex();
+    bool startMetrics();
+    void stopStreams();
+
+    RelayConfig config;
+    std::unique_ptr<RelayScheduler> scheduler;
+    std::unique_ptr<RtmpIngestServer> ingest;
+    std::unique_ptr<RelayMetricsServer> metrics;
+    std::atomic<bool> failed{false};
+    std::function<void(const std::string &reason)> onFailure;
+    std::function<void(const std::string &stream, int kbps)> onAdvice;
+    std::string error;
+    RelayStats stats;
+
+    // Consulted once per publish, never per packet
+    std::mutex streamsMutex;
+    std::unordered_map<std::string, size_t> routeIndex; // ingest stream key -> config.routes
+    std::unordered_map<std::string, std::shared_ptr<RelayStream>> streams; // live, by route name
+    std::atomic<size_t> publishers{0};
+};
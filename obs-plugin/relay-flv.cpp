@@ -0,0 +1,299 @@
+#include "relay-flv.h"
+
+#include <cstring>
+
+#include "relay-rtmp.h"
+#include "relay-trace.h"
+
+static const char setDataFrame[] = "@setDataFrame";
+
+void flvWriteHeader(std::vector<uint8_t> &out, bool hasAudio, bool hasVideo)
+{
+    const uint8_t header[FLV_HEADER_SIZE + 4] = {
+        'F', 'L', 'V', 1,
+        (uint8_t)((hasAudio ? 0x04 : 0) | (hasVideo ? 0x01 : 0)),
+        0, 0, 0, FLV_HEADER_SIZE,
+        0, 0, 0, 0, // PreviousTagSize0
+    };
+    out.insert(out.end(), header, header + sizeof(header));
+}
+
+void flvWriteTag(std::vector<uint8_t> &out, const RelayPacket &packet)
+{
+    uint32_t size = (uint32_t)packet.data.size();
+    uint32_t ts = packet.timestamp;
+    const uint8_t header[FLV_TAG_HEADER_SIZE] = {
+        (uint8_t)packet.type,
+        (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size,
+        (uint8_t)(ts >> 16), (uint8_t)(ts >> 8), (uint8_t)ts, (uint8_t)(ts >> 24),
+        0, 0, 0,
+    };
+    out.insert(out.end(), header, header + sizeof(header));
+    out.insert(out.end(), packet.data.begin(), packet.data.end());
+
+    uint32_t tagSize = size + FLV_TAG_HEADER_SIZE;
+    out.push_back((uint8_t)(tagSize >> 24));
+    out.push_back((uint8_t)(tagSize >> 16));
+    out.push_back((uint8_t)(tagSize >> 8));
+    out.push_back((uint8_t)tagSize);
+}
+
+// AMF0 string marker + 16-bit length + "@setDataFrame"
+static const size_t setDataFrameSize = 3 + sizeof(setDataFrame) - 1;
+
+static bool hasSetDataFrame(const RelayPacket &packet)
+{
+    const auto &data = packet.data;
+    return data.size() > setDataFrameSize && data[0] == 0x02 && data[1] == 0 &&
+           data[2] == sizeof(setDataFrame) - 1 &&
+           memcmp(data.data() + 3, setDataFrame, sizeof(setDataFrame) - 1) == 0;
+}
+
+RelayPacketPtr flvStripSetDataFrame(const RelayPacketPtr &packet)
+{
+    if (!packet->isScript() || !hasSetDataFrame(*packet)) {
+        return packet;
+    }
+
+    auto stripped = relayMakePacket();
+    stripped->type = packet->type;
+    stripped->timestamp = packet->timestamp;
+    stripped->data.assign(packet->data.begin() + setDataFrameSize, packet->data.end());
+    return stripped;
+}
+
+RelayPacketPtr flvAddSetDataFrame(const RelayPacketPtr &packet)
+{
+    if (!packet->isScript() || hasSetDataFrame(*packet)) {
+        return packet;
+    }
+
+    auto wrapped = relayMakePacket();
+    wrapped->type = packet->type;
+    wrapped->timestamp = packet->timestamp;
+    wrapped->data.reserve(setDataFrameSize + packet->data.size());
+    wrapped->data.push_back(0x02);
+    wrapped->data.push_back(0);
+    wrapped->data.push_back(sizeof(setDataFrame) - 1);
+    wrapped->data.insert(wrapped->data.end(), setDataFrame, setDataFrame + sizeof(setDataFrame) - 1);
+    wrapped->data.insert(wrapped->data.end(), packet->data.begin(), packet->data.end());
+    return wrapped;
+}
+
+std::shared_ptr<RelayPacket> flvMetadataPacket(const FlvStreamInfo &info)
+{
+    AmfWriter amf;
+    amf.writeString(setDataFrame);
+    amf.writeString("onMetaData");
+    amf.beginObject();
+    amf.writeProperty("width", info.width);
+    amf.writeProperty("height", info.height);
+    amf.writeProperty("framerate", info.fps);
+    amf.writeProperty("videocodecid", FLV_VIDEO_CODEC_AVC);
+    amf.writeProperty("videodatarate", info.videoKbps);
+    amf.writeProperty("audiocodecid", FLV_AUDIO_CODEC_AAC);
+    amf.writeProperty("audiodatarate", info.audioKbps);
+    amf.writeProperty("audiosamplerate", info.sampleRate);
+    amf.writeProperty("audiochannels", info.channels);
+    amf.writeKey("stereo");
+    amf.writeBool(info.channels == 2);
+    amf.endObject();
+
+    auto packet = relayMakePacket();
+    packet->type = RelayPacketType::Script;
+    packet->data.assign(amf.data().begin(), amf.data().end());
+    return packet;
+}
+
+// Calls visit(nal, size) for every NAL unit between start codes
+template <typename Visit> static void forEachNal(const uint8_t *data, size_t size, Visit visit)
+{
+    auto startCode = [&](size_t pos) {
+        for (; pos + 3 <= size; pos++) {
+            if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1) {
+                return pos;
+            }
+        }
+        return size;
+    };
+
+    size_t start = startCode(0);
+    while (start < size) {
+        size_t nal = start + 3;
+        size_t next = startCode(nal);
+        size_t end = next;
+        // A 4-byte start code's leading zero belongs to it, not to this NAL
+        while (end > nal && data[end - 1] == 0 && next < size) {
+            end--;
+        }
+        if (end > nal) {
+            visit(data + nal, end - nal);
+        }
+        start = next;
+    }
+}
+
+static void putLength(RelayBytes &out, size_t length)
+{
+    out.push_back((uint8_t)(length >> 24));
+    out.push_back((uint8_t)(length >> 16));
+    out.push_back((uint8_t)(length >> 8));
+    out.push_back((uint8_t)length);
+}
+
+#define AVC_NAL_SPS 7
+#define AVC_NAL_PPS 8
+#define AVC_NAL_AUD 9
+
+std::shared_ptr<RelayPacket> flvAvcSequenceHeader(const uint8_t *annexB, size_t size)
+{
+    const uint8_t *sps = nullptr, *pps = nullptr;
+    size_t spsSize = 0, ppsSize = 0;
+    forEachNal(annexB, size, [&](const uint8_t *nal, size_t nalSize) {
+        uint8_t type = nal[0] & 0x1f;
+        if (type == AVC_NAL_SPS && !sps && nalSize >= 4) {
+            sps = nal;
+            spsSize = nalSize;
+        } else if (type == AVC_NAL_PPS && !pps) {
+            pps = nal;
+            ppsSize = nalSize;
+        }
+    });
+    if (!sps || !pps) {
+        return nullptr;
+    }
+
+    // AVCDecoderConfigurationRecord with 4-byte NAL lengths
+    auto packet = relayMakePacket();
+    packet->type = RelayPacketType::Video;
+    auto &data = packet->data;
+    data = {FLV_VIDEO_FRAME_KEY << 4 | FLV_VIDEO_CODEC_AVC, 0, 0, 0, 0};
+    data.insert(data.end(), {1, sps[1], sps[2], sps[3], 0xff, 0xe1});
+    data.push_back((uint8_t)(spsSize >> 8));
+    data.push_back((uint8_t)spsSize);
+    data.insert(data.end(), sps, sps + spsSize);
+    data.push_back(1);
+    data.push_back((uint8_t)(ppsSize >> 8));
+    data.push_back((uint8_t)ppsSize);
+    data.insert(data.end(), pps, pps + ppsSize);
+    return packet;
+}
+
+std::shared_ptr<RelayPacket> flvAvcFrame(const uint8_t *annexB, size_t size, uint32_t timestamp,
+                                         int32_t compositionMs, bool keyframe)
+{
+    auto packet = relayMakePacket();
+    packet->type = RelayPacketType::Video;
+    packet->timestamp = timestamp;
+    auto &data = packet->data;
+    data.reserve(size + 16);
+    data = {(uint8_t)((keyframe ? FLV_VIDEO_FRAME_KEY : 2) << 4 | FLV_VIDEO_CODEC_AVC), 1,
+            (uint8_t)(compositionMs >> 16), (uint8_t)(compositionMs >> 8), (uint8_t)compositionMs};
+    // Access unit delimiters mean nothing in FLV
+    forEachNal(annexB, size, [&](const uint8_t *nal, size_t nalSize) {
+        if ((nal[0] & 0x1f) != AVC_NAL_AUD) {
+            putLength(data, nalSize);
+            data.insert(data.end(), nal, nal + nalSize);
+        }
+    });
+    return packet;
+}
+
+// AAC, 44 kHz, 16-bit, stereo: FLV requires these flags for AAC whatever
+// the stream actually is; the AudioSpecificConfig has the real values
+#define FLV_AAC_FLAGS (FLV_AUDIO_CODEC_AAC << 4 | 3 << 2 | 1 << 1 | 1)
+
+std::shared_ptr<RelayPacket> flvAacSequenceHeader(const uint8_t *config, size_t size)
+{
+    auto packet = relayMakePacket();
+    packet->type = RelayPacketType::Audio;
+    packet->data = {FLV_AAC_FLAGS, 0};
+    packet->data.insert(packet->data.end(), config, config + size);
+    return packet;
+}
+
+std::shared_ptr<RelayPacket> flvAacFrame(const uint8_t *data, size_t size, uint32_t timestamp)
+{
+    auto packet = relayMakePacket();
+    packet->type = RelayPacketType::Audio;
+    packet->timestamp = timestamp;
+    packet->data.reserve(size + 2);
+    packet->data = {FLV_AAC_FLAGS, 1};
+    packet->data.insert(packet->data.end(), data, data + size);
+    return packet;
+}
+
+bool flvParseAacConfig(const RelayPacket &sequenceHeader, FlvAacConfig &config)
+{
+    static const int sampleRates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                      22050, 16000, 12000, 11025, 8000,  7350};
+    if (!sequenceHeader.isAudio() || !sequenceHeader.isSequenceHeader() || sequenceHeader.data.size() < 4) {
+        return false;
+    }
+
+    // 5 bits object type, 4 bits sampling frequency index, 4 bits channels
+    const uint8_t *asc = &sequenceHeader.data[2];
+    int rateIndex = ((asc[0] & 0x07) << 1) | (asc[1] >> 7);
+    if (rateIndex >= (int)(sizeof(sampleRates) / sizeof(sampleRates[0]))) {
+        return false; // an explicit rate, which no encoder we feed from uses
+    }
+    config.objectType = asc[0] >> 3;
+    config.sampleRate = sampleRates[rateIndex];
+    config.channels = (asc[1] >> 3) & 0x0f;
+    return true;
+}
+
+bool FlvDemuxer::feed(const uint8_t *data, size_t size, std::vector<RelayPacketPtr> &packets)
+{
+    pending.insert(pending.end(), data, data + size);
+    size_t pos = 0;
+
+    if (!headerParsed) {
+        if (pending.size() < FLV_HEADER_SIZE + 4) {
+            return true;
+        }
+        if (memcmp(pending.data(), "FLV", 3) != 0) {
+            return false;
+        }
+        uint32_t headerSize = ((uint32_t)pending[5] << 24) | ((uint32_t)pending[6] << 16) |
+                              ((uint32_t)pending[7] << 8) | pending[8];
+        if (pending.size() < headerSize + 4) {
+            return true;
+        }
+        pos = headerSize + 4;
+        headerParsed = true;
+    }
+
+    while (pending.size() - pos >= FLV_TAG_HEADER_SIZE) {
+        const uint8_t *tag = pending.data() + pos;
+        uint32_t dataSize = ((uint32_t)tag[1] << 16) | ((uint32_t)tag[2] << 8) | tag[3];
+        if (pending.size() - pos < FLV_TAG_HEADER_SIZE + dataSize + 4) {
+            break;
+        }
+
+        uint8_t type = tag[0] & 0x1f;
+        if (type == (uint8_t)RelayPacketType::Audio || type == (uint8_t)RelayPacketType::Video ||
+            type == (uint8_t)RelayPacketType::Script) {
+            auto packet = relayMakePacket();
+            packet->type = (RelayPacketType)type;
+            packet->timestamp = ((uint32_t)tag[7] << 24) | ((uint32_t)tag[4] << 16) |
+                                ((uint32_t)tag[5] << 8) | tag[6];
+            packet->timestamp += timestampOffset;
+            packet->data.assign(tag + FLV_TAG_HEADER_SIZE, tag + FLV_TAG_HEADER_SIZE + dataSize);
+            if (traceTrack) {
+                relayTraceIngest(*packet, traceTrack);
+            }
+            packets.push_back(packet);
+        }
+        pos += FLV_TAG_HEADER_SIZE + dataSize + 4;
+    }
+
+    pending.erase(pending.begin(), pending.begin() + (long)pos);
+    return true;
+}
+
+void FlvDemuxer::reset()
+{
+    pending.clear();
+    headerParsed = false;
+}
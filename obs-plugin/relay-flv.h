@@ -0,0 +1,75 @@
+#pragma once
+
+/*
+ * FLV muxing/demuxing used to exchange packets with ffmpeg over pipes,
+ * and FLV tag bodies for encoder output handed over in-process.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include "relay-packet.h"
+
+#define FLV_HEADER_SIZE 9
+#define FLV_TAG_HEADER_SIZE 11
+
+void flvWriteHeader(std::vector<uint8_t> &out, bool hasAudio, bool hasVideo);
+void flvWriteTag(std::vector<uint8_t> &out, const RelayPacket &packet);
+
+// RTMP carries metadata as "@setDataFrame" + "onMetaData" + object while
+// FLV files store "onMetaData" + object. These convert between the two.
+RelayPacketPtr flvStripSetDataFrame(const RelayPacketPtr &packet);
+RelayPacketPtr flvAddSetDataFrame(const RelayPacketPtr &packet);
+
+// Elementary streams as an encoder produces them (H.264 in Annex B, raw
+// AAC frames) to the tag bodies the relay carries. H.264 NAL units get
+// 4-byte lengths instead of start codes. The packets are still mutable,
+// for the caller to stamp (relay-trace.h) before handing them on.
+struct FlvStreamInfo {
+    int width = 0;
+    int height = 0;
+    double fps = 0;
+    int videoKbps = 0;
+    int audioKbps = 0;
+    int sampleRate = 0;
+    int channels = 0;
+};
+
+// onMetaData in its RTMP form, "@setDataFrame" first
+std::shared_ptr<RelayPacket> flvMetadataPacket(const FlvStreamInfo &info);
+// From the encoder's SPS and PPS; null when either is missing
+std::shared_ptr<RelayPacket> flvAvcSequenceHeader(const uint8_t *annexB, size_t size);
+std::shared_ptr<RelayPacket> flvAvcFrame(const uint8_t *annexB, size_t size, uint32_t timestamp,
+                                         int32_t compositionMs, bool keyframe);
+// From the AudioSpecificConfig
+std::shared_ptr<RelayPacket> flvAacSequenceHeader(const uint8_t *config, size_t size);
+std::shared_ptr<RelayPacket> flvAacFrame(const uint8_t *data, size_t size, uint32_t timestamp);
+
+#define FLV_AAC_OBJECT_LC 2
+
+// What an AAC sequence header's AudioSpecificConfig says about the audio
+struct FlvAacConfig {
+    int objectType = 0;
+    int sampleRate = 0;
+    int channels = 0;
+};
+
+bool flvParseAacConfig(const RelayPacket &sequenceHeader, FlvAacConfig &config);
+
+// Incremental FLV stream parser
+class FlvDemuxer {
+public:
+    // Returns false when the input is not a valid FLV stream
+    bool feed(const uint8_t *data, size_t size, std::vector<RelayPacketPtr> &packets);
+    void reset();
+    // Added to every timestamp, to continue a stream across encoder restarts
+    void setTimestampOffset(uint32_t offset) { timestampOffset = offset; }
+    // Packets demuxed here enter the relay on this trace track (relay-trace.h)
+    void setTraceTrack(uint32_t track) { traceTrack = track; }
+
+private:
+    std::vector<uint8_t> pending;
+    uint32_t timestampOffset = 0;
+    uint32_t traceTrack = 0;
+    bool headerParsed = false;
+};
@@ -0,0 +1,162 @@
+#include "relay-governor.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+const char *const relayX264Presets[9] = {
+    "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow",
+};
+
+int relayX264PresetIndex(const std::string &preset)
+{
+    for (int i = 0; i < (int)(sizeof(relayX264Presets) / sizeof(relayX264Presets[0])); i++) {
+        if (preset == relayX264Presets[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+RelayEncoderGovernor::RelayEncoderGovernor(const RelayGovernorLimits &limits, const std::string &start,
+                                           unsigned cpus)
+{
+    int last = (int)(sizeof(relayX264Presets) / sizeof(relayX264Presets[0])) - 1;
+    fastest = relayX264PresetIndex(limits.fastestPreset);
+    slowest = relayX264PresetIndex(limits.slowestPreset);
+    fastest = fastest < 0 ? 0 : fastest;
+    slowest = slowest < 0 ? last : slowest;
+    if (fastest > slowest) {
+        std::swap(fastest, slowest);
+    }
+
+    int configured = relayX264PresetIndex(start);
+    preset = std::min(std::max(configured < 0 ? fastest : configured, fastest), slowest);
+    maxThreads = limits.maxThreads > 0 ? limits.maxThreads : std::max((int)cpus, 1);
+    // Room to add threads before giving up quality
+    threads = std::max(maxThreads / 2, 1);
+}
+
+void RelayEncoderGovernor::launched(uint64_t nowMs)
+{
+    warmUntilMs = nowMs + RELAY_GOVERNOR_WARMUP_MS;
+    strainedSamples = 0;
+    idleSinceMs = 0;
+}
+
+bool RelayEncoderGovernor::update(const RelayGovernorSample &sample, uint64_t nowMs)
+{
+    if (nowMs < warmUntilMs) {
+        return false;
+    }
+
+    bool behind = sample.speed < RELAY_GOVERNOR_BEHIND_SPEED;
+    bool busy = sample.cpuBusy >= RELAY_GOVERNOR_CPU_BUSY;
+    bool idle = !behind && sample.cpuBusy >= 0 && sample.cpuBusy < RELAY_GOVERNOR_CPU_IDLE;
+    strainedSamples = behind || busy ? strainedSamples + 1 : 0;
+    if (!idle) {
+        idleSinceMs = 0;
+    } else if (idleSinceMs == 0) {
+        idleSinceMs = nowMs;
+    }
+
+    if (strainedSamples >= RELAY_GOVERNOR_DOWN_SAMPLES) {
+        strainedSamples = 0;
+        // A step up that did not hold up makes the next one wait longer
+        if (lastClimbMs > 0 && nowMs - lastClimbMs < holdMs) {
+            holdMs = std::min<uint64_t>(holdMs * 2, RELAY_GOVERNOR_UP_HOLD_MAX_MS);
+        } else {
+            holdMs = RELAY_GOVERNOR_UP_HOLD_MS;
+        }
+        lastClimbMs = 0;
+
+        // Behind with cores to spare: the encoder is short of parallelism
+        if (behind && !busy && threads < maxThreads) {
+            threads = std::min(threads * 2, maxThreads);
+            return true;
+        }
+        if (preset > fastest) {
+            preset--;
+            return true;
+        }
+        return false;
+    }
+
+    if (idleSinceMs > 0 && nowMs - idleSinceMs >= holdMs) {
+        idleSinceMs = nowMs;
+        lastClimbMs = nowMs;
+        if (preset < slowest) {
+            preset++;
+            return true;
+        }
+        // Every frame thread adds a frame of latency and blurs rate control
+        if (threads > 1) {
+            threads = std::max(threads / 2, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+RelayEncoderTuning RelayEncoderGovernor::tuning() const
+{
+    RelayEncoderTuning tuning;
+    tuning.preset = relayX264Presets[preset];
+    tuning.threads = threads;
+    return tuning;
+}
+
+double RelayCpuSampler::sample()
+{
+    uint64_t busy = 0;
+    uint64_t total = 0;
+#ifdef _WIN32
+    FILETIME idleTime, kernelTime, userTime;
+    if (!GetSystemTimes(&idleTime, &kernelTime, &userTime)) {
+        return -1;
+    }
+    auto ticks = [](const FILETIME &time) { return ((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime; };
+    // Kernel time includes the idle time
+    total = ticks(kernelTime) + ticks(userTime);
+    busy = total - ticks(idleTime);
+#elif defined(__APPLE__)
+    host_cpu_load_info_data_t load;
+    mach_msg_type_number_t count = HOST_CPU_LOAD_INFO_COUNT;
+    if (host_statistics(mach_host_self(), HOST_CPU_LOAD_INFO, (host_info_t)&load, &count) != KERN_SUCCESS) {
+        return -1;
+    }
+    for (int state = 0; state < CPU_STATE_MAX; state++) {
+        total += load.cpu_ticks[state];
+    }
+    busy = total - load.cpu_ticks[CPU_STATE_IDLE];
+#else
+    FILE *file = fopen("/proc/stat", "r");
+    if (!file) {
+        return -1;
+    }
+    unsigned long long user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+    int fields = fscanf(file, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &user, &nice, &system, &idle, &iowait,
+                        &irq, &softirq, &steal);
+    fclose(file);
+    if (fields < 4) {
+        return -1;
+    }
+    busy = user + nice + system + irq + softirq + steal;
+    total = busy + idle + iowait;
+#endif
+
+    bool first = lastTotal == 0;
+    uint64_t busyDelta = busy - lastBusy;
+    uint64_t totalDelta = total - lastTotal;
+    lastBusy = busy;
+    lastTotal = total;
+    if (first || totalDelta == 0 || busyDelta > totalDelta) {
+        return -1;
+    }
+    return (double)busyDelta / (double)totalDelta;
+}
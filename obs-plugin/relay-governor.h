@@ -0,0 +1,93 @@
+#pragma once
+
+/*
+ * Encoder auto-tuning for the rendition ladder.
+ *
+ * About once a second the ladder encoder reports how much media it
+ * encoded against how much it was fed, and how busy the host's CPUs were.
+ * RelayEncoderGovernor turns that into an x264 preset and thread count
+ * within the limits the user set. Falling behind or saturating the host
+ * for a few samples in a row steps to a faster preset, or to more threads
+ * while cores sit idle. Stepping back towards quality needs headroom for a
+ * hold time that doubles whenever such a step does not hold up, the same
+ * hysteresis bitrate adaptation uses, so a marginal host settles instead
+ * of flapping. Every step relaunches the encoder, resuming at a keyframe.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define RELAY_GOVERNOR_BEHIND_SPEED 0.97  // encoded per fed media time below which the encoder falls behind
+#define RELAY_GOVERNOR_CPU_BUSY 0.90      // host CPU share that counts as saturated
+#define RELAY_GOVERNOR_CPU_IDLE 0.60      // ... and below which a slower preset is tried
+#define RELAY_GOVERNOR_DOWN_SAMPLES 3     // strained samples in a row before stepping down
+#define RELAY_GOVERNOR_UP_HOLD_MS 60000   // headroom needed before stepping up
+#define RELAY_GOVERNOR_UP_HOLD_MAX_MS 960000
+#define RELAY_GOVERNOR_WARMUP_MS 10000    // samples ignored after every launch
+
+// x264's presets, fastest first
+extern const char *const relayX264Presets[9];
+// Index into relayX264Presets, or -1
+int relayX264PresetIndex(const std::string &preset);
+
+// What the user lets the governor choose from
+struct RelayGovernorLimits {
+    bool enabled = true;
+    std::string fastestPreset = "ultrafast";
+    std::string slowestPreset = "medium";
+    int maxThreads = 0; // per encoder; 0 allows one per CPU
+
+    bool operator==(const RelayGovernorLimits &other) const
+    {
+        return enabled == other.enabled && fastestPreset == other.fastestPreset &&
+               slowestPreset == other.slowestPreset && maxThreads == other.maxThreads;
+    }
+    bool operator!=(const RelayGovernorLimits &other) const { return !(*this == other); }
+};
+
+struct RelayGovernorSample {
+    double speed = 1;    // media time encoded per media time fed
+    double cpuBusy = -1; // share of all CPUs busy; -1 if unknown
+};
+
+struct RelayEncoderTuning {
+    std::string preset;
+    int threads = 0;
+};
+
+class RelayEncoderGovernor {
+public:
+    // Starts from the configured preset, clamped to the limits
+    RelayEncoderGovernor(const RelayGovernorLimits &limits, const std::string &preset, unsigned cpus);
+
+    // Returns true when the tuning changed
+    bool update(const RelayGovernorSample &sample, uint64_t nowMs);
+    RelayEncoderTuning tuning() const;
+    // A freshly launched encoder fills its lookahead before its speed means anything
+    void launched(uint64_t nowMs);
+
+private:
+    int fastest = 0;
+    int slowest = 0;
+    int maxThreads = 1;
+    int preset = 0;
+    int threads = 1;
+
+    int strainedSamples = 0;
+    uint64_t idleSinceMs = 0;
+    uint64_t lastClimbMs = 0;
+    uint64_t holdMs = RELAY_GOVERNOR_UP_HOLD_MS;
+    uint64_t warmUntilMs = 0;
+};
+
+// Share of all CPUs busy since the previous call
+class RelayCpuSampler {
+public:
+    // -1 on the first call, or where the platform does not tell
+    double sample();
+
+private:
+    uint64_t lastBusy = 0;
+    uint64_t lastTotal = 0;
+};
@@ -0,0 +1,394 @@
+#include "relay-ingest.h"
+
+#include <algorithm>
+
+#include "relay-common.h"
+#include "relay-trace.h"
+
+#define INGEST_HANDSHAKE_TIMEOUT_MS 10000
+#define INGEST_POLL_INTERVAL_MS 200
+#define INGEST_READ_BUFFER_SIZE (64 * 1024)
+#define INGEST_READS_PER_EVENT 16 // then other sessions on the shard get a turn
+
+// One publisher connection, driven by its shard: the handshake is read
+// incrementally, then every readable event feeds the chunk parser
+class RtmpIngestServer::Session : public RelayShardHandler {
+public:
+    Session(RtmpIngestServer &server, RelayShard &shard, RelaySocket socket)
+        : server(server), shard(shard), connection(std::move(socket)), fd(connection.socket().fd())
+    {
+    }
+
+    bool open();
+    // Unpublishes and lets go of the socket; the server drops the session
+    // later, since this may run inside its own callback
+    void finish();
+    bool isFinished() const { return finished; }
+
+    void onSocketEvent(int events) override;
+
+private:
+    enum class Phase {
+        C0C1,
+        C2,
+        Streaming,
+    };
+
+    bool readAvailable();
+    bool consume(const uint8_t *data, size_t size);
+    bool handleMessage(RtmpMessage &message);
+    void tick();
+
+    RtmpIngestServer &server;
+    RelayShard &shard;
+    RtmpConnection connection;
+    relay_socket_t fd;
+    Phase phase = Phase::C0C1;
+    std::vector<uint8_t> handshake;
+    uint64_t acceptedAt = relayNowMs();
+    RelayShard::TimerId timer = 0;
+    bool finished = false;
+
+    std::string app;
+    std::string streamKey;
+    RelayIngestStreamPtr stream;
+    uint32_t traceTrack = 0;
+};
+
+static void sendResult(RtmpConnection &connection, double transactionId)
+{
+    AmfWriter result;
+    result.writeString("_result");
+    result.writeNumber(transactionId);
+    result.writeNull();
+    result.writeNull();
+    connection.sendCommand(0, result);
+}
+
+static void sendStatus(RtmpConnection &connection, uint32_t streamId, const char *level,
+                       const char *code, const std::string &description)
+{
+    AmfWriter status;
+    status.writeString("onStatus");
+    status.writeNumber(0);
+    status.writeNull();
+    status.beginObject();
+    status.writeProperty("level", std::string(level));
+    status.writeProperty("code", std::string(code));
+    status.writeProperty("description", description);
+    status.endObject();
+    connection.sendCommand(streamId, status);
+}
+
+bool RtmpIngestServer::Session::open()
+{
+    if (!connection.setNonBlocking(true)) {
+        return false;
+    }
+    shard.attach(this);
+    if (!shard.watch(fd, this, RELAY_SHARD_READABLE)) {
+        shard.detach(this);
+        return false;
+    }
+    timer = shard.addTimer(INGEST_POLL_INTERVAL_MS, [this]() { tick(); });
+    return true;
+}
+
+void RtmpIngestServer::Session::finish()
+{
+    if (finished) {
+        return;
+    }
+    finished = true;
+    shard.cancelTimer(timer);
+    shard.unwatch(fd);
+    shard.detach(this);
+
+    if (stream) {
+        server.callbacks.onUnpublish(stream);
+        stream.reset();
+        PLUGIN_LOG_INFO("Ingest connection closed: %s", streamKey.c_str());
+    }
+    connection.close();
+}
+
+void RtmpIngestServer::Session::tick()
+{
+    if (phase != Phase::Streaming && relayNowMs() - acceptedAt >= INGEST_HANDSHAKE_TIMEOUT_MS) {
+        PLUGIN_LOG_WARNING("Ingest handshake failed");
+        finish();
+        return;
+    }
+    // A stream closed by the relay has no other way to reach an idle publisher
+    if (stream && !stream->isOpen()) {
+        PLUGIN_LOG_INFO("Ingest stream closed by the relay: %s", streamKey.c_str());
+        finish();
+        return;
+    }
+    timer = shard.addTimer(INGEST_POLL_INTERVAL_MS, [this]() { tick(); });
+}
+
+void RtmpIngestServer::Session::onSocketEvent(int events)
+{
+    bool ok = true;
+    if (events & RELAY_SHARD_WRITABLE) {
+        ok = connection.flush();
+    }
+    if (ok && (events & RELAY_SHARD_READABLE)) {
+        ok = readAvailable();
+    }
+    if (ok && stream && !stream->isOpen()) {
+        PLUGIN_LOG_INFO("Ingest stream closed by the relay: %s", streamKey.c_str());
+        ok = false;
+    }
+    if (!ok) {
+        finish();
+        return;
+    }
+    int interest = RELAY_SHARD_READABLE | (connection.hasPendingOutput() ? RELAY_SHARD_WRITABLE : 0);
+    shard.modify(fd, interest);
+}
+
+bool RtmpIngestServer::Session::readAvailable()
+{
+    uint8_t buffer[INGEST_READ_BUFFER_SIZE];
+    for (int i = 0; i < INGEST_READS_PER_EVENT && !finished; i++) {
+        long n = connection.socket().readSome(buffer, sizeof(buffer));
+        if (n < 0 && connection.socket().wouldBlock()) {
+            return true;
+        }
+        if (n <= 0 || !consume(buffer, (size_t)n)) {
+            if (phase != Phase::Streaming) {
+                PLUGIN_LOG_WARNING("Ingest handshake failed");
+            }
+            return false;
+        }
+        if ((size_t)n < sizeof(buffer)) {
+            return true;
+        }
+    }
+    // Anything left is reported again by the next poll
+    return !finished;
+}
+
+bool RtmpIngestServer::Session::consume(const uint8_t *data, size_t size)
+{
+    if (phase != Phase::Streaming) {
+        size_t expected = phase == Phase::C0C1 ? 1 + RTMP_HANDSHAKE_SIZE : RTMP_HANDSHAKE_SIZE;
+        size_t take = std::min(expected - handshake.size(), size);
+        handshake.insert(handshake.end(), data, data + take);
+        data += take;
+        size -= take;
+        if (handshake.size() < expected) {
+            return true;
+        }
+
+        if (phase == Phase::C0C1) {
+            if (handshake[0] != 3) {
+                return false;
+            }
+            std::vector<uint8_t> s0s1s2 = rtmpServerHandshakeReply(handshake.data());
+            if (!connection.sendRaw(s0s1s2.data(), s0s1s2.size())) {
+                return false;
+            }
+            handshake.clear();
+            phase = Phase::C2;
+            return consume(data, size);
+        }
+
+        // C2 only echoes S1; chunks may follow in the same read
+        handshake.clear();
+        handshake.shrink_to_fit();
+        phase = Phase::Streaming;
+        if (size == 0) {
+            return true;
+        }
+    }
+
+    std::vector<RtmpMessage> messages;
+    if (!connection.receive(data, size, messages)) {
+        return false;
+    }
+    for (auto &message : messages) {
+        if (!handleMessage(message)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RtmpIngestServer::Session::handleMessage(RtmpMessage &message)
+{
+    if (message.type == RTMP_MSG_AUDIO || message.type == RTMP_MSG_VIDEO || message.type == RTMP_MSG_DATA_AMF0) {
+        if (stream && !message.payload.empty()) {
+            auto packet = relayMakePacket();
+            packet->type = (RelayPacketType)message.type;
+            packet->timestamp = message.timestamp;
+            packet->data = std::move(message.payload);
+            relayTraceIngest(*packet, traceTrack);
+            stream->push(packet);
+        }
+        return true;
+    }
+
+    if (message.type != RTMP_MSG_COMMAND_AMF0) {
+        return true;
+    }
+
+    std::vector<AmfValue> values;
+    if (!amfDecode(message.payload.data(), message.payload.size(), values) || values.empty()) {
+        return true;
+    }
+
+    const std::string &name = values[0].string;
+    double transactionId = values.size() > 1 ? values[1].number : 0;
+
+    if (name == "connect") {
+        app = values.size() > 2 ? values[2].getString("app") : std::string();
+        connection.sendWindowAckSize(RTMP_DEFAULT_WINDOW_ACK_SIZE);
+        connection.sendPeerBandwidth(RTMP_DEFAULT_WINDOW_ACK_SIZE);
+        // Announced large so relays publishing here may use large chunks too
+        connection.setOutgoingChunkSize(RTMP_RELAY_MAX_CHUNK_SIZE);
+
+        AmfWriter result;
+        result.writeString("_result");
+        result.writeNumber(transactionId);
+        result.beginObject();
+        result.writeProperty("fmsVer", std::string("FMS/3,0,1,123"));
+        result.writeProperty("capabilities", 31.0);
+        result.endObject();
+        result.beginObject();
+        result.writeProperty("level", std::string("status"));
+        result.writeProperty("code", std::string("NetConnection.Connect.Success"));
+        result.writeProperty("description", std::string("Connection succeeded."));
+        result.writeProperty("objectEncoding", 0.0);
+        result.endObject();
+        connection.sendCommand(0, result);
+    } else if (name == "createStream") {
+        AmfWriter result;
+        result.writeString("_result");
+        result.writeNumber(transactionId);
+        result.writeNull();
+        result.writeNumber(1);
+        connection.sendCommand(0, result);
+    } else if (name == "publish") {
+        streamKey = values.size() > 3 ? values[3].string : std::string();
+        size_t query = streamKey.find('?');
+        if (query != std::string::npos) {
+            streamKey.resize(query);
+        }
+
+        // One publish per connection
+        if (stream || !(stream = server.callbacks.onPublish(app, streamKey))) {
+            sendStatus(connection, message.streamId, "error", "NetStream.Publish.BadName", "Stream key rejected");
+            return false;
+        }
+
+        traceTrack = RelayTracer::instance().track("ingest " + streamKey);
+        connection.sendUserControl(RTMP_EVENT_STREAM_BEGIN, message.streamId);
+        sendStatus(connection, message.streamId, "status", "NetStream.Publish.Start",
+                   streamKey + " is now published");
+        PLUGIN_LOG_INFO("Ingest publish started: %s/%s", app.c_str(), streamKey.c_str());
+    } else if (name == "FCUnpublish" || name == "deleteStream" || name == "closeStream") {
+        if (stream) {
+            server.callbacks.onUnpublish(stream);
+            stream.reset();
+            PLUGIN_LOG_INFO("Ingest publish stopped: %s", streamKey.c_str());
+        }
+    } else if (transactionId > 0) {
+        // releaseStream, FCPublish and friends only need an acknowledgement
+        sendResult(connection, transactionId);
+    }
+    return true;
+}
+
+// RtmpIngestServer ---------------------------------------------------------
+
+RtmpIngestServer::RtmpIngestServer(RelayScheduler &scheduler, Callbacks callbacks)
+    : scheduler(scheduler), callbacks(std::move(callbacks)), sessions(scheduler.size())
+{
+}
+
+RtmpIngestServer::~RtmpIngestServer()
+{
+    stop();
+}
+
+bool RtmpIngestServer::start(uint16_t port)
+{
+    if (running) {
+        return true;
+    }
+
+    RelaySocket::initialize();
+    if (!listener.listenOn(port, false)) {
+        error = "Cannot listen on port " + std::to_string(port) + ": " + listener.lastError();
+        return false;
+    }
+
+    running = true;
+    acceptThread = std::thread(&RtmpIngestServer::acceptLoop, this);
+    PLUGIN_LOG_INFO("RTMP ingest listening on port %u", (unsigned)port);
+    return true;
+}
+
+void RtmpIngestServer::stop()
+{
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    listener.shutdown();
+    if (acceptThread.joinable()) {
+        acceptThread.join();
+    }
+    listener.close();
+
+    // Sessions handed over before the accept loop ended are already in
+    // each shard's queue ahead of this
+    for (size_t i = 0; i < scheduler.size(); i++) {
+        scheduler.shard(i).invoke([this, i]() {
+            for (auto &session : sessions[i]) {
+                session->finish();
+            }
+            sessions[i].clear();
+        });
+    }
+}
+
+void RtmpIngestServer::acceptLoop()
+{
+    while (running) {
+        if (!listener.waitReadable(INGEST_POLL_INTERVAL_MS)) {
+            continue;
+        }
+
+        RelaySocket client = listener.accept();
+        if (!client.isValid()) {
+            continue;
+        }
+
+        RelayShard *shard = scheduler.next();
+        auto socket = std::make_shared<RelaySocket>(std::move(client));
+        shard->post([this, shard, socket]() { addSession(*shard, std::move(*socket)); });
+    }
+}
+
+void RtmpIngestServer::addSession(RelayShard &shard, RelaySocket socket)
+{
+    if (!running) {
+        return;
+    }
+
+    // Finished sessions are dropped here rather than from their own
+    // callbacks, which is where they finish
+    auto &list = sessions[shard.index()];
+    list.remove_if([](const std::unique_ptr<Session> &session) { return session->isFinished(); });
+
+    auto session = std::make_unique<Session>(*this, shard, std::move(socket));
+    if (!session->open()) {
+        PLUGIN_LOG_WARNING("Cannot add ingest connection to shard %zu", shard.index());
+        return;
+    }
+    list.push_back(std::move(session));
+}
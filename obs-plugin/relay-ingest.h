@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+ * Local RTMP ingest server. OBS (or any RTMP encoder) publishes here and
+ * every audio/video/data message is handed to the relay as a packet.
+ *
+ * Many publishers can be connected at once. Each publish is resolved to a
+ * RelayIngestStream once, when it starts, and the session then pushes
+ * packets straight into that stream, so nothing on the packet path looks
+ * up the stream key or touches state shared with other publishers.
+ *
+ * Sessions are spread over the scheduler's shards as they are accepted
+ * and run entirely on their shard's event loop; only the accept loop has
+ * a thread of its own.
+ */
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "relay-packet.h"
+#include "relay-rtmp.h"
+#include "relay-shard.h"
+
+// Receives one publisher's packets, always on that publisher's shard
+class RelayIngestStream {
+public:
+    virtual ~RelayIngestStream() = default;
+    virtual void push(const RelayPacketPtr &packet) = 0;
+    // A closed stream disconnects its publisher
+    virtual bool isOpen() const = 0;
+};
+
+using RelayIngestStreamPtr = std::shared_ptr<RelayIngestStream>;
+
+class RtmpIngestServer {
+public:
+    struct Callbacks {
+        // Return null to reject the publisher
+        std::function<RelayIngestStreamPtr(const std::string &app, const std::string &streamKey)> onPublish;
+        std::function<void(const RelayIngestStreamPtr &stream)> onUnpublish;
+    };
+
+    RtmpIngestServer(RelayScheduler &scheduler, Callbacks callbacks);
+    ~RtmpIngestServer();
+
+    bool start(uint16_t port);
+    void stop();
+    bool isRunning() const { return running; }
+    const std::string &lastError() const { return error; }
+
+private:
+    class Session;
+
+    void acceptLoop();
+    // Runs on the shard the session is given to
+    void addSession(RelayShard &shard, RelaySocket socket);
+
+    RelayScheduler &scheduler;
+    Callbacks callbacks;
+    RelaySocket listener;
+    std::thread acceptThread;
+    std::atomic<bool> running{false};
+    // One list per shard, each only touched by its shard
+    std::vector<std::list<std::unique_ptr<Session>>> sessions;
+    std::string error;
+};
@@ -0,0 +1,292 @@
+#include "relay-metrics.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+#include "relay-common.h"
+
+#define METRICS_POLL_INTERVAL_MS 250
+#define METRICS_REQUEST_TIMEOUT_MS 2000
+#define METRICS_MAX_REQUEST 8192
+
+// Text rendering -----------------------------------------------------------
+
+static void appendFormat(std::string &out, const char *format, ...)
+{
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (n > 0) {
+        out.append(buffer, (size_t)n < sizeof(buffer) ? (size_t)n : sizeof(buffer) - 1);
+    }
+}
+
+static std::string escapeLabel(const std::string &value)
+{
+    std::string result;
+    result.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            result += '\\';
+            result += c;
+        } else if (c == '\n') {
+            result += "\\n";
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+static std::string streamLabel(const std::string &stream)
+{
+    return "stream=\"" + escapeLabel(stream) + "\"";
+}
+
+static std::string destinationLabels(const RelayDestinationSnapshot &destination)
+{
+    return streamLabel(destination.stream) + ",destination=\"" + escapeLabel(destination.name) +
+           "\",rendition=\"" + escapeLabel(destination.rendition.empty() ? "source" : destination.rendition) + "\"";
+}
+
+static std::string encoderLabels(const RelayEncoderSnapshot &encoder)
+{
+    return streamLabel(encoder.stream) + ",rendition=\"" + escapeLabel(encoder.rendition) + "\"";
+}
+
+static void appendFamily(std::string &out, const char *name, const char *type, const char *help)
+{
+    appendFormat(out, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void appendSample(std::string &out, const char *name, const std::string &labels, double value)
+{
+    if (labels.empty()) {
+        appendFormat(out, "%s %.17g\n", name, value);
+    } else {
+        out += name;
+        out += '{';
+        out += labels;
+        appendFormat(out, "} %.17g\n", value);
+    }
+}
+
+static void appendHistogram(std::string &out, const char *name, const std::string &labels,
+                            const RelayHistogramTotals &histogram)
+{
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    for (size_t i = 0; i < histogram.cumulative.size(); i++) {
+        char bound[32];
+        if (i < histogram.bounds.size()) {
+            snprintf(bound, sizeof(bound), "%.9g", histogram.bounds[i]);
+        } else {
+            snprintf(bound, sizeof(bound), "+Inf");
+        }
+        appendFormat(out, "%s_bucket{%sle=\"%s\"} %llu\n", name, prefix.c_str(), bound,
+                     (unsigned long long)histogram.cumulative[i]);
+    }
+    appendFormat(out, "%s_count{%s} %llu\n", name, labels.c_str(), (unsigned long long)histogram.count);
+    appendFormat(out, "%s_sum{%s} %.17g\n", name, labels.c_str(), histogram.sum);
+}
+
+std::string relayRenderMetrics(const RelayStatsSnapshot &snapshot)
+{
+    std::string out;
+    out.reserve(4096 + snapshot.destinations.size() * 4096);
+
+    appendFamily(out, "relay_publishing", "gauge", "Whether a source is publishing to the relay ingest.");
+    appendSample(out, "relay_publishing", "", snapshot.publishingSinceMs ? 1 : 0);
+
+    appendFamily(out, "relay_publishers", "gauge", "Publishers currently streaming to the relay ingest.");
+    appendSample(out, "relay_publishers", "", (double)snapshot.streams.size());
+
+    appendFamily(out, "relay_ingest_bytes", "counter", "Payload bytes received from all publishers.");
+    appendSample(out, "relay_ingest_bytes_total", "", (double)snapshot.ingest.bytes);
+    appendFamily(out, "relay_ingest_video_frames", "counter", "Video frames received from all publishers.");
+    appendSample(out, "relay_ingest_video_frames_total", "", (double)snapshot.ingest.videoFrames);
+
+    // Per publish session; restarts from zero when the publisher reconnects
+    appendFamily(out, "relay_stream_ingest_bytes", "counter", "Payload bytes received from the stream's publisher.");
+    for (const auto &stream : snapshot.streams) {
+        appendSample(out, "relay_stream_ingest_bytes_total", streamLabel(stream.name), (double)stream.ingest.bytes);
+    }
+
+    // Families must stay contiguous, so each one loops over destinations
+    const auto &destinations = snapshot.destinations;
+    appendFamily(out, "relay_destination_connected", "gauge", "Whether the destination is connected.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_connected", destinationLabels(destination), destination.connected);
+    }
+    appendFamily(out, "relay_destination_ingress_bytes", "counter", "Payload bytes queued for the destination.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_ingress_bytes_total", destinationLabels(destination),
+                     (double)destination.ingress.bytes);
+    }
+    appendFamily(out, "relay_destination_sent_bytes", "counter", "Payload bytes sent to the destination.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_sent_bytes_total", destinationLabels(destination),
+                     (double)destination.egress.bytes);
+    }
+    appendFamily(out, "relay_destination_sent_video_frames", "counter", "Video frames sent to the destination.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_sent_video_frames_total", destinationLabels(destination),
+                     (double)destination.egress.videoFrames);
+    }
+    appendFamily(out, "relay_destination_reconnects", "counter", "Successful reconnects after a lost connection.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_reconnects_total", destinationLabels(destination),
+                     (double)destination.reconnects);
+    }
+    appendFamily(out, "relay_destination_dropped_packets", "counter", "Packets dropped by the send queue budget.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_dropped_packets_total", destinationLabels(destination),
+                     (double)destination.droppedPackets);
+    }
+    appendFamily(out, "relay_destination_dropped_bytes", "counter", "Payload bytes dropped by the send queue budget.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_dropped_bytes_total", destinationLabels(destination),
+                     (double)destination.droppedBytes);
+    }
+    appendFamily(out, "relay_destination_queued_bytes", "gauge", "Payload bytes waiting in the send queue.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_queued_bytes", destinationLabels(destination),
+                     (double)destination.queuedBytes);
+    }
+    appendFamily(out, "relay_destination_rtt_seconds", "gauge", "Smoothed TCP round-trip time.");
+    for (const auto &destination : destinations) {
+        if (destination.rttUs >= 0) {
+            appendSample(out, "relay_destination_rtt_seconds", destinationLabels(destination),
+                         destination.rttUs / 1e6);
+        }
+    }
+    appendFamily(out, "relay_destination_estimated_bandwidth_bits_per_second", "gauge",
+                 "Throughput the destination's path is estimated to sustain.");
+    for (const auto &destination : destinations) {
+        if (destination.estimatedKbps > 0) {
+            appendSample(out, "relay_destination_estimated_bandwidth_bits_per_second", destinationLabels(destination),
+                         destination.estimatedKbps * 1000.0);
+        }
+    }
+    appendFamily(out, "relay_destination_target_bitrate_bits_per_second", "gauge",
+                 "Bitrate of the rendition currently sent, lower than configured while adapted.");
+    for (const auto &destination : destinations) {
+        appendSample(out, "relay_destination_target_bitrate_bits_per_second", destinationLabels(destination),
+                     destination.feedKbps * 1000.0);
+    }
+    appendFamily(out, "relay_destination_send_latency_seconds", "histogram",
+                 "Time to hand one batch of packets to the destination socket.");
+    for (const auto &destination : destinations) {
+        appendHistogram(out, "relay_destination_send_latency_seconds", destinationLabels(destination),
+                        destination.sendLatency);
+    }
+    appendFamily(out, "relay_destination_packet_size_bytes", "histogram", "Size of packets sent.");
+    for (const auto &destination : destinations) {
+        appendHistogram(out, "relay_destination_packet_size_bytes", destinationLabels(destination),
+                        destination.packetSize);
+    }
+
+    const auto &encoders = snapshot.encoders;
+    appendFamily(out, "relay_encoder_speed_ratio", "histogram", "Encoded media time per wall-clock time.");
+    for (const auto &encoder : encoders) {
+        appendHistogram(out, "relay_encoder_speed_ratio", encoderLabels(encoder), encoder.speed);
+    }
+    appendFamily(out, "relay_encoder_restarts", "counter", "Encoder restarts after a crash.");
+    for (const auto &encoder : encoders) {
+        appendSample(out, "relay_encoder_restarts_total", encoderLabels(encoder), (double)encoder.restarts);
+    }
+
+    out += "# EOF\n";
+    return out;
+}
+
+// RelayMetricsServer -------------------------------------------------------
+
+RelayMetricsServer::RelayMetricsServer(SnapshotSource source)
+    : source(std::move(source))
+{
+}
+
+RelayMetricsServer::~RelayMetricsServer()
+{
+    stop();
+}
+
+bool RelayMetricsServer::start(uint16_t port)
+{
+    if (running) {
+        return true;
+    }
+
+    RelaySocket::initialize();
+    if (!listener.listenOn(port, false)) {
+        error = "Cannot listen on port " + std::to_string(port) + ": " + listener.lastError();
+        return false;
+    }
+
+    running = true;
+    acceptThread = std::thread(&RelayMetricsServer::acceptLoop, this);
+    PLUGIN_LOG_INFO("Metrics endpoint listening on port %u", (unsigned)port);
+    return true;
+}
+
+void RelayMetricsServer::stop()
+{
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    listener.shutdown();
+    if (acceptThread.joinable()) {
+        acceptThread.join();
+    }
+    listener.close();
+}
+
+void RelayMetricsServer::acceptLoop()
+{
+    while (running) {
+        if (!listener.waitReadable(METRICS_POLL_INTERVAL_MS)) {
+            continue;
+        }
+
+        RelaySocket client = listener.accept();
+        if (client.isValid()) {
+            serve(client);
+        }
+    }
+}
+
+void RelayMetricsServer::serve(RelaySocket &client)
+{
+    // Only the request line matters; read until the end of the headers
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < METRICS_MAX_REQUEST) {
+        if (!client.waitReadable(METRICS_REQUEST_TIMEOUT_MS)) {
+            return;
+        }
+        long n = client.readSome(buffer, sizeof(buffer));
+        if (n <= 0) {
+            return;
+        }
+        request.append(buffer, (size_t)n);
+    }
+
+    std::string status = "200 OK";
+    std::string body;
+    const char *contentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        body = relayRenderMetrics(source());
+    } else {
+        status = "404 Not Found";
+        body = "Try /metrics\n";
+        contentType = "text/plain; charset=utf-8";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: " + contentType +
+                           "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    RelayIoSlice slices[2] = {{response.data(), response.size()}, {body.data(), body.size()}};
+    client.writeVectored(slices, 2);
+}
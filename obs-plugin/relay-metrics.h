@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * OpenMetrics (Prometheus) endpoint for the relay.
+ *
+ * A single thread answers GET /metrics with the text exposition of one
+ * stats snapshot. Scrapes are rare and the body is small, so requests are
+ * served inline on the accept thread; rendering reads the same lock-free
+ * counters as the Monitor tab and never touches the packet path.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "relay-socket.h"
+#include "relay-stats.h"
+
+// Renders a snapshot in the OpenMetrics text format, ending with "# EOF"
+std::string relayRenderMetrics(const RelayStatsSnapshot &snapshot);
+
+class RelayMetricsServer {
+public:
+    using SnapshotSource = std::function<RelayStatsSnapshot()>;
+
+    explicit RelayMetricsServer(SnapshotSource source);
+    ~RelayMetricsServer();
+
+    bool start(uint16_t port);
+    void stop();
+    const std::string &lastError() const { return error; }
+
+private:
+    void acceptLoop();
+    void serve(RelaySocket &client);
+
+    SnapshotSource source;
+    RelaySocket listener;
+    std::thread acceptThread;
+    std::atomic<bool> running{false};
+    std::string error;
+};
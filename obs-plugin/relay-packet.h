@@ -0,0 +1,108 @@
+#pragma once
+
+/*
+ * Encoded media packet as it travels through the relay engine.
+ *
+ * The payload is an FLV tag body (the same bytes carried by an RTMP audio,
+ * video or data message), so packets can be forwarded to any RTMP
+ * destination without remuxing. Payloads live in the shared buffer pool
+ * and are never copied on the way out: every destination references the
+ * same bytes.
+ */
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "relay-buffer.h"
+
+enum class RelayPacketType : uint8_t {
+    Audio = 8,
+    Video = 9,
+    Script = 18,
+};
+
+// FLV codec identifiers we care about when inspecting payloads
+#define FLV_VIDEO_CODEC_AVC 7
+#define FLV_AUDIO_CODEC_AAC 10
+#define FLV_VIDEO_FRAME_KEY 1
+#define FLV_VIDEO_FRAME_DISPOSABLE 3
+
+struct RelayPacket {
+    RelayPacketType type = RelayPacketType::Video;
+    uint32_t timestamp = 0;
+    RelayBytes data;
+    // Set where tracing picked the packet up (see relay-trace.h); 0 if not
+    uint64_t traceId = 0;
+    uint64_t ingestNs = 0;
+
+    bool isVideo() const { return type == RelayPacketType::Video; }
+    bool isAudio() const { return type == RelayPacketType::Audio; }
+    bool isScript() const { return type == RelayPacketType::Script; }
+
+    bool isKeyframe() const
+    {
+        return isVideo() && !data.empty() && (data[0] >> 4) == FLV_VIDEO_FRAME_KEY;
+    }
+
+    // AVC decoder configuration record or AAC AudioSpecificConfig
+    bool isSequenceHeader() const
+    {
+        if (data.size() < 2) {
+            return false;
+        }
+        if (isVideo()) {
+            return (data[0] & 0x0f) == FLV_VIDEO_CODEC_AVC && data[1] == 0;
+        }
+        if (isAudio()) {
+            return (data[0] >> 4) == FLV_AUDIO_CODEC_AAC && data[1] == 0;
+        }
+        return false;
+    }
+
+    // A frame no other frame references (non-reference B frame), which can
+    // be dropped without corrupting the rest of the GOP. AVC payloads are
+    // checked NAL by NAL; 4-byte NAL lengths are assumed, as every common
+    // encoder emits them.
+    bool isDisposable() const
+    {
+        if (!isVideo() || data.size() < 5 || isKeyframe() || isSequenceHeader()) {
+            return false;
+        }
+        if ((data[0] >> 4) == FLV_VIDEO_FRAME_DISPOSABLE) {
+            return true;
+        }
+        if ((data[0] & 0x0f) != FLV_VIDEO_CODEC_AVC || data[1] != 1) {
+            return false;
+        }
+
+        bool sawSlice = false;
+        size_t pos = 5;
+        while (pos + 4 < data.size()) {
+            size_t length = ((size_t)data[pos] << 24) | ((size_t)data[pos + 1] << 16) |
+                            ((size_t)data[pos + 2] << 8) | data[pos + 3];
+            pos += 4;
+            if (length == 0 || length > data.size() - pos) {
+                return false;
+            }
+            uint8_t nalType = data[pos] & 0x1f;
+            if (nalType >= 1 && nalType <= 5) {
+                if ((data[pos] & 0x60) != 0) {
+                    return false;
+                }
+                sawSlice = true;
+            }
+            pos += length;
+        }
+        return sawSlice;
+    }
+};
+
+// Packets are immutable once ingested and shared between destinations
+using RelayPacketPtr = std::shared_ptr<const RelayPacket>;
+
+// Allocates the packet and its reference count from the buffer pool
+inline std::shared_ptr<RelayPacket> relayMakePacket()
+{
+    return std::allocate_shared<RelayPacket>(RelayPoolAllocator<RelayPacket>());
+}
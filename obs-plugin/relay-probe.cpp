@@ -0,0 +1,111 @@
+#include "relay-probe.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "relay-common.h"
+#include "relay-packet.h"
+#include "relay-publisher.h"
+
+// Twitch ingests accept the key with this suffix and discard the stream
+static std::string probeStreamKey(const std::string &url, const std::string &streamKey)
+{
+    bool twitch = url.find("twitch.tv") != std::string::npos || url.find("live-video.net") != std::string::npos;
+    return twitch ? streamKey + "?bandwidthtest=true" : streamKey;
+}
+
+// An AVC frame of incompressible filler, a keyframe first so the ingest
+// has something to start on
+static RelayPacket probeFrame(bool keyframe, uint32_t &seed)
+{
+    RelayPacket packet;
+    packet.type = RelayPacketType::Video;
+    packet.data.resize(RELAY_PROBE_FRAME_BYTES);
+    packet.data[0] = (uint8_t)((keyframe ? FLV_VIDEO_FRAME_KEY : 2) << 4 | FLV_VIDEO_CODEC_AVC);
+    packet.data[1] = 1; // NALU, composition time 0
+    packet.data[2] = packet.data[3] = packet.data[4] = 0;
+    uint32_t length = RELAY_PROBE_FRAME_BYTES - 9;
+    packet.data[5] = (uint8_t)(length >> 24);
+    packet.data[6] = (uint8_t)(length >> 16);
+    packet.data[7] = (uint8_t)(length >> 8);
+    packet.data[8] = (uint8_t)length;
+    for (size_t i = 9; i < packet.data.size(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        packet.data[i] = (uint8_t)(seed >> 24);
+    }
+    return packet;
+}
+
+RelayProbeResult relayProbeDestination(const std::string &url, const std::string &streamKey,
+                                       const RelayProbeOptions &options)
+{
+    RelayProbeResult result;
+    RtmpPublisher publisher;
+    bool connected = publisher.connect(url, probeStreamKey(url, streamKey), options.timeoutMs);
+    const RtmpConnectTimings &timings = publisher.connectTimings();
+    result.connectMs = timings.tcpConnectUs >= 0 ? timings.tcpConnectUs / 1000.0 : -1;
+    result.handshakeMs = timings.handshakeUs >= 0 ? timings.handshakeUs / 1000.0 : -1;
+    result.publishMs = timings.publishUs >= 0 ? timings.publishUs / 1000.0 : -1;
+    if (!connected) {
+        result.error = publisher.lastError();
+        return result;
+    }
+    int64_t rttUs = publisher.roundTripTimeUs();
+    result.rttMs = rttUs >= 0 ? rttUs / 1000.0 : -1;
+
+    // Non-blocking, so a path that stops taking data cannot hold the probe
+    // past its burst
+    if (!publisher.setNonBlocking(true)) {
+        result.error = publisher.lastError();
+        return result;
+    }
+    uint32_t seed = 0x9e3779b9;
+    RelayPacket keyframe = probeFrame(true, seed);
+    RelayPacket frame = probeFrame(false, seed);
+    uint64_t sent = 0;
+    uint64_t start = relayNowMs();
+    uint64_t elapsed = 0;
+    bool ok = true;
+    while (ok && (elapsed = relayNowMs() - start) < (uint64_t)options.burstMs) {
+        ok = publisher.pollIncoming();
+        if (ok && publisher.hasPendingOutput()) {
+            ok = publisher.flush();
+        }
+        bool overMax = sent * 8 > (uint64_t)options.maxKbps * std::max<uint64_t>(elapsed, 1);
+        if (!ok || publisher.hasPendingOutput() || overMax) {
+            result.reachedMax = result.reachedMax || overMax;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+        const RelayPacket &next = sent == 0 ? keyframe : frame;
+        ok = publisher.queuePacket(next, (uint32_t)elapsed) && publisher.sendQueued();
+        sent += next.data.size();
+    }
+    if (!ok) {
+        result.error = publisher.lastError();
+        return result;
+    }
+
+    // Bytes still in the publisher or the kernel never reached the network
+    RelaySendPathInfo path;
+    publisher.socket().sendPathInfo(path);
+    uint64_t waiting = publisher.pendingBytes() + (uint64_t)std::max<int64_t>(path.unsentBytes, 0);
+    uint64_t drained = sent > waiting ? sent - waiting : 0;
+    result.uploadKbps = (double)drained * 8 / (double)std::max<uint64_t>(elapsed, 1);
+    result.suggestedKbps = (int)(result.uploadKbps * RELAY_PROBE_SAFE_SHARE) / 100 * 100;
+    result.ok = true;
+    publisher.close();
+    return result;
+}
+
+int relayProbeSuggestion(const std::vector<RelayProbeResult> &results)
+{
+    int suggestion = 0;
+    for (const auto &result : results) {
+        if (result.ok && (suggestion == 0 || result.suggestedKbps < suggestion)) {
+            suggestion = result.suggestedKbps;
+        }
+    }
+    return suggestion;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+ * Connection test for a destination before going live.
+ *
+ * The probe connects and publishes exactly as a destination would, timing
+ * the TCP connect, the RTMP handshake and the publish commands, then
+ * pushes synthetic video for a few seconds as fast as the path takes it.
+ * What drained into the network during that burst (sent minus what still
+ * waits in the kernel) is the sustainable upload; a share of it is a safe
+ * bitrate to stream at.
+ *
+ * Twitch ingests get the stream key's bandwidthtest flag so the burst
+ * never shows up as a broadcast. Other platforms see a short publish.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define RELAY_PROBE_BURST_MS 3000
+#define RELAY_PROBE_MAX_KBPS 100000   // the burst stops short of this rate
+#define RELAY_PROBE_FRAME_BYTES 32768
+#define RELAY_PROBE_SAFE_SHARE 0.7    // of the measured upload, for the suggestion
+
+struct RelayProbeOptions {
+    int timeoutMs = 5000;
+    int burstMs = RELAY_PROBE_BURST_MS;
+    int maxKbps = RELAY_PROBE_MAX_KBPS;
+};
+
+struct RelayProbeResult {
+    bool ok = false;
+    std::string error;
+    double connectMs = -1;
+    double handshakeMs = -1;
+    double publishMs = -1;
+    double rttMs = -1;     // kernel's estimate before the burst
+    double uploadKbps = 0; // drained during the burst
+    bool reachedMax = false; // the path took the whole burst; uploadKbps is a lower bound
+    int suggestedKbps = 0;
+};
+
+RelayProbeResult relayProbeDestination(const std::string &url, const std::string &streamKey,
+                                       const RelayProbeOptions &options = RelayProbeOptions());
+
+// Highest bitrate every probed path sustains, or 0 if none succeeded
+int relayProbeSuggestion(const std::vector<RelayProbeResult> &results);
@@ -0,0 +1,436 @@
+#include "relay-process.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "relay-supervisor.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+RelayProcess::~RelayProcess()
+{
+    terminate(2000);
+    closePipes();
+}
+
+void RelayProcess::watchChild(const std::string &program)
+{
+    exited = false;
+#ifdef _WIN32
+    relay_process_t handle = processInfo.hProcess;
+    int64_t id = (int64_t)processInfo.dwProcessId;
+#else
+    relay_process_t handle = childPid;
+    int64_t id = (int64_t)childPid;
+#endif
+    if (!pidFile.empty()) {
+        RelaySupervisor::writePidFile(pidFile, id, program);
+    }
+    watchId = RelaySupervisor::instance().watch(handle, [this](int status) {
+        exited = true;
+        if (onExit) {
+            onExit(status);
+        }
+    });
+}
+
+std::string RelayProcess::outputUrl(int output) const
+{
+    if (output == 0) {
+        return "pipe:1";
+    }
+#ifdef _WIN32
+    char name[96];
+    snprintf(name, sizeof(name), "\\\\.\\pipe\\stream-relay-%lu-%p-%d", GetCurrentProcessId(), (const void *)this,
+             output);
+    return name;
+#else
+    return "pipe:" + std::to_string(2 + output);
+#endif
+}
+
+void RelayProcess::unwatchChild()
+{
+    // Once unwatched the supervisor leaves the child to us
+    if (watchId) {
+        RelaySupervisor::instance().unwatch(watchId);
+        watchId = 0;
+    }
+}
+
+#ifdef _WIN32
+
+static std::string quoteArgument(const std::string &argument)
+{
+    if (!argument.empty() && argument.find_first_of(" \t\"") == std::string::npos) {
+        return argument;
+    }
+
+    std::string quoted = "\"";
+    for (char c : argument) {
+        if (c == '"') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+bool RelayProcess::start(const std::string &program, const std::vector<std::string> &arguments,
+                         const std::string &stderrPath, int extraOutputs)
+{
+    closePipes();
+
+    // Only the standard handles are inherited, so extra outputs are pipes
+    // the child opens by name; each takes a single client
+    for (int i = 1; i <= extraOutputs; i++) {
+        HANDLE pipe = CreateNamedPipeA(outputUrl(i).c_str(), PIPE_ACCESS_INBOUND | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                       PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0, 1 << 20, 0,
+                                       nullptr);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            error = "CreateNamedPipe failed";
+            closePipes();
+            return false;
+        }
+        outputPipes.push_back(pipe);
+    }
+    outputConnected.assign(outputPipes.size(), 0);
+
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    HANDLE stdinRead = nullptr;
+    HANDLE stdoutWrite = nullptr;
+    if (!CreatePipe(&stdinRead, &stdinWrite, &sa, 1 << 20) ||
+        !CreatePipe(&stdoutRead, &stdoutWrite, &sa, 1 << 20)) {
+        error = "CreatePipe failed";
+        return false;
+    }
+    SetHandleInformation(stdinWrite, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(stdoutRead, HANDLE_FLAG_INHERIT, 0);
+
+    HANDLE stderrHandle = CreateFileA(stderrPath.empty() ? "NUL" : stderrPath.c_str(), GENERIC_WRITE,
+                                      FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, CREATE_ALWAYS,
+                                      FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    STARTUPINFOA startup = {};
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = stdinRead;
+    startup.hStdOutput = stdoutWrite;
+    startup.hStdError = stderrHandle;
+
+    std::string commandLine = quoteArgument(program);
+    for (const auto &argument : arguments) {
+        commandLine += " " + quoteArgument(argument);
+    }
+
+    BOOL ok = CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, TRUE, CREATE_NO_WINDOW,
+                             nullptr, nullptr, &startup, &processInfo);
+    CloseHandle(stdinRead);
+    CloseHandle(stdoutWrite);
+    if (stderrHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(stderrHandle);
+    }
+
+    if (!ok) {
+        error = "Failed to start " + program;
+        closePipes();
+        return false;
+    }
+    watchChild(program);
+    return true;
+}
+
+bool RelayProcess::writeAll(const void *data, size_t size)
+{
+    auto *in = (const char *)data;
+    while (size > 0) {
+        DWORD written = 0;
+        if (!WriteFile(stdinWrite, in, (DWORD)size, &written, nullptr)) {
+            error = "Write to child failed";
+            return false;
+        }
+        in += written;
+        size -= written;
+    }
+    return true;
+}
+
+long RelayProcess::readSome(void *buffer, size_t size, int output)
+{
+    if (output < 0 || (size_t)output > outputPipes.size()) {
+        return -1;
+    }
+    HANDLE pipe = output == 0 ? stdoutRead : outputPipes[output - 1];
+
+    // The child connects once ffmpeg opens the output; if it never does,
+    // terminate() connects in its place so this returns
+    if (output > 0 && !outputConnected[output - 1]) {
+        if (!ConnectNamedPipe(pipe, nullptr)) {
+            DWORD status = GetLastError();
+            if (status == ERROR_NO_DATA) {
+                return 0;
+            }
+            if (status != ERROR_PIPE_CONNECTED) {
+                return -1;
+            }
+        }
+        outputConnected[output - 1] = 1;
+    }
+
+    DWORD n = 0;
+    if (!ReadFile(pipe, buffer, (DWORD)size, &n, nullptr)) {
+        return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+    }
+    return (long)n;
+}
+
+void RelayProcess::closeStdin()
+{
+    if (stdinWrite) {
+        CloseHandle(stdinWrite);
+        stdinWrite = nullptr;
+    }
+}
+
+bool RelayProcess::isRunning()
+{
+    return processInfo.hProcess && WaitForSingleObject(processInfo.hProcess, 0) == WAIT_TIMEOUT;
+}
+
+void RelayProcess::requestExit()
+{
+    if (processInfo.hProcess && !exited) {
+        TerminateProcess(processInfo.hProcess, 1);
+    }
+}
+
+void RelayProcess::terminate(int timeoutMs)
+{
+    closeStdin();
+    unwatchChild();
+    if (processInfo.hProcess) {
+        if (WaitForSingleObject(processInfo.hProcess, (DWORD)timeoutMs) == WAIT_TIMEOUT) {
+            TerminateProcess(processInfo.hProcess, 1);
+            WaitForSingleObject(processInfo.hProcess, INFINITE);
+        }
+        CloseHandle(processInfo.hProcess);
+        CloseHandle(processInfo.hThread);
+        processInfo = {};
+        if (!pidFile.empty()) {
+            std::remove(pidFile.c_str());
+        }
+
+        // Outputs the child never opened: a client that closes at once
+        // leaves their readers at EOF. Connected pipes refuse it.
+        for (size_t i = 0; i < outputPipes.size(); i++) {
+            HANDLE client = CreateFileA(outputUrl((int)i + 1).c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0,
+                                        nullptr);
+            if (client != INVALID_HANDLE_VALUE) {
+                CloseHandle(client);
+            }
+        }
+    }
+}
+
+void RelayProcess::closePipes()
+{
+    closeStdin();
+    if (stdoutRead) {
+        CloseHandle(stdoutRead);
+        stdoutRead = nullptr;
+    }
+    for (HANDLE pipe : outputPipes) {
+        CloseHandle(pipe);
+    }
+    outputPipes.clear();
+    outputConnected.clear();
+}
+
+#else
+
+bool RelayProcess::start(const std::string &program, const std::vector<std::string> &arguments,
+                         const std::string &stderrPath, int extraOutputs)
+{
+    closePipes();
+
+    // outputs[0] is stdout, outputs[i] becomes fd 2 + i in the child
+    int stdinPipe[2] = {-1, -1};
+    std::vector<int> childEnds;
+    bool ok = pipe2(stdinPipe, O_CLOEXEC) == 0;
+    for (int i = 0; ok && i <= extraOutputs; i++) {
+        int outputPipe[2];
+        ok = pipe2(outputPipe, O_CLOEXEC) == 0;
+        if (ok) {
+            // Keep write ends clear of the fd numbers they are dup'ed onto
+            int high = fcntl(outputPipe[1], F_DUPFD_CLOEXEC, 3 + extraOutputs);
+            ::close(outputPipe[1]);
+            outputFds.push_back(outputPipe[0]);
+            childEnds.push_back(high);
+            ok = high >= 0;
+        }
+    }
+    if (!ok) {
+        if (stdinPipe[0] >= 0) {
+            ::close(stdinPipe[0]);
+            ::close(stdinPipe[1]);
+        }
+        for (int fd : childEnds) {
+            ::close(fd);
+        }
+        closePipes();
+        error = "pipe failed";
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, stdinPipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, childEnds[0], STDOUT_FILENO);
+    for (size_t i = 1; i < childEnds.size(); i++) {
+        posix_spawn_file_actions_adddup2(&actions, childEnds[i], (int)(2 + i));
+    }
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO,
+                                     stderrPath.empty() ? "/dev/null" : stderrPath.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(program.c_str()));
+    for (const auto &argument : arguments) {
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    int rc = posix_spawnp(&childPid, program.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(stdinPipe[0]);
+    for (int fd : childEnds) {
+        ::close(fd);
+    }
+
+    if (rc != 0) {
+        ::close(stdinPipe[1]);
+        closePipes();
+        childPid = -1;
+        error = "Failed to start " + program + ": " + strerror(rc);
+        return false;
+    }
+
+    stdinFd = stdinPipe[1];
+    reaped = false;
+    watchChild(program);
+
+    // A dying encoder must not take the host down with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+}
+
+bool RelayProcess::writeAll(const void *data, size_t size)
+{
+    auto *in = (const uint8_t *)data;
+    while (size > 0) {
+        ssize_t n = ::write(stdinFd, in, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            error = "Write to child failed";
+            return false;
+        }
+        in += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+long RelayProcess::readSome(void *buffer, size_t size, int output)
+{
+    if (output < 0 || output >= (int)outputFds.size()) {
+        return -1;
+    }
+
+    while (true) {
+        ssize_t n = ::read(outputFds[output], buffer, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return (long)n;
+    }
+}
+
+void RelayProcess::closeStdin()
+{
+    if (stdinFd >= 0) {
+        ::close(stdinFd);
+        stdinFd = -1;
+    }
+}
+
+bool RelayProcess::isRunning()
+{
+    if (childPid <= 0 || reaped || exited) {
+        return false;
+    }
+    if (watchId) {
+        return true; // the supervisor reaps and reports the exit
+    }
+    int status = 0;
+    if (waitpid(childPid, &status, WNOHANG) == childPid) {
+        reaped = true;
+        return false;
+    }
+    return true;
+}
+
+void RelayProcess::requestExit()
+{
+    // Never signal a pid the supervisor already reaped; it may be reused
+    if (childPid > 0 && !reaped && !exited) {
+        kill(childPid, SIGTERM);
+    }
+}
+
+void RelayProcess::terminate(int timeoutMs)
+{
+    closeStdin();
+    unwatchChild();
+    if (childPid > 0 && !reaped && !exited) {
+        int status = 0;
+        kill(childPid, SIGTERM);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (waitpid(childPid, &status, WNOHANG) == 0) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                kill(childPid, SIGKILL);
+                waitpid(childPid, &status, 0);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        reaped = true;
+    }
+    if (childPid > 0 && !pidFile.empty()) {
+        std::remove(pidFile.c_str());
+    }
+    childPid = -1;
+}
+
+void RelayProcess::closePipes()
+{
+    closeStdin();
+    for (int fd : outputFds) {
+        ::close(fd);
+    }
+    outputFds.clear();
+}
+
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+/*
+ * Child process with piped stdin/stdout, used to run the shared ffmpeg
+ * encoders. stderr can be redirected to a log file, and additional output
+ * pipes are handed to the child: as fd 3, 4, ... on POSIX systems and as
+ * named pipes it opens by name on Windows, where only the standard handles
+ * are inherited. Running
+ * children are registered with the RelaySupervisor, which reports an
+ * unexpected exit the moment it happens.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#endif
+
+class RelayProcess {
+public:
+    RelayProcess() = default;
+    ~RelayProcess();
+
+    RelayProcess(const RelayProcess &) = delete;
+    RelayProcess &operator=(const RelayProcess &) = delete;
+
+    // Both apply to the next start(). The exit callback fires only when the
+    // child dies on its own, never for terminate(), and runs on the
+    // supervisor thread.
+    void setExitCallback(std::function<void(int status)> callback) { onExit = std::move(callback); }
+    void setPidFile(const std::string &path) { pidFile = path; }
+
+    bool start(const std::string &program, const std::vector<std::string> &arguments,
+               const std::string &stderrPath = std::string(), int extraOutputs = 0);
+
+    bool writeAll(const void *data, size_t size);
+    // Reads from stdout (output 0) or an extra output pipe.
+    // Returns bytes read, 0 on EOF, -1 on error
+    long readSome(void *buffer, size_t size, int output = 0);
+    // What the child writes an output to, as an ffmpeg output URL
+    std::string outputUrl(int output) const;
+    void closeStdin();
+
+    bool isRunning();
+    // Signals the child to exit without touching the pipes
+    void requestExit();
+    // Asks the child to exit, escalating to a hard kill after timeoutMs.
+    // stdout stays open so a reader thread can drain it to EOF.
+    void terminate(int timeoutMs);
+
+    const std::string &lastError() const { return error; }
+#ifdef _WIN32
+    DWORD pid() const { return processInfo.dwProcessId; }
+#else
+    pid_t pid() const { return childPid; }
+#endif
+
+private:
+    void closePipes();
+    void watchChild(const std::string &program);
+    void unwatchChild();
+
+#ifdef _WIN32
+    PROCESS_INFORMATION processInfo = {};
+    HANDLE stdinWrite = nullptr;
+    HANDLE stdoutRead = nullptr;
+    std::vector<HANDLE> outputPipes;
+    // One flag per output, each only touched by that output's reader
+    std::vector<char> outputConnected;
+#else
+    pid_t childPid = -1;
+    int stdinFd = -1;
+    std::vector<int> outputFds;
+    bool reaped = false;
+#endif
+    std::function<void(int status)> onExit;
+    std::string pidFile;
+    uint64_t watchId = 0;
+    std::atomic<bool> exited{false};
+    std::string error;
+};
@@ -0,0 +1,254 @@
+#include "relay-publisher.h"
+
+#include "relay-common.h"
+
+bool RtmpPublisher::connect(const std::string &url, const std::string &streamKey, int timeoutMs)
+{
+    close();
+    error.clear();
+    timings = RtmpConnectTimings();
+
+    RtmpUrl parsed;
+    if (!parseRtmpUrl(url, parsed)) {
+        return fail("Unsupported RTMP URL: " + url);
+    }
+
+    uint64_t stepStart = relayNowNs();
+    RelaySocket socket;
+    if (!socket.connectTo(parsed.host, parsed.port, timeoutMs)) {
+        return fail(socket.lastError());
+    }
+    timings.tcpConnectUs = (int64_t)(relayNowNs() - stepStart) / 1000;
+    stepStart = relayNowNs();
+    if (!rtmpClientHandshake(socket, timeoutMs)) {
+        return fail("RTMP handshake failed with " + parsed.host);
+    }
+    timings.handshakeUs = (int64_t)(relayNowNs() - stepStart) / 1000;
+    stepStart = relayNowNs();
+
+    connection = RtmpConnection(std::move(socket));
+    nextTransactionId = 1;
+
+    if (!connection.setOutgoingChunkSize(RTMP_RELAY_CHUNK_SIZE) || !sendConnect(parsed)) {
+        return fail(connection.lastError());
+    }
+    if (!waitForResult(1, timeoutMs, nullptr)) {
+        return false;
+    }
+
+    AmfWriter releaseStream;
+    releaseStream.writeString("releaseStream");
+    releaseStream.writeNumber(++nextTransactionId);
+    releaseStream.writeNull();
+    releaseStream.writeString(streamKey);
+
+    AmfWriter fcPublish;
+    fcPublish.writeString("FCPublish");
+    fcPublish.writeNumber(++nextTransactionId);
+    fcPublish.writeNull();
+    fcPublish.writeString(streamKey);
+
+    AmfWriter createStream;
+    double createId = ++nextTransactionId;
+    createStream.writeString("createStream");
+    createStream.writeNumber(createId);
+    createStream.writeNull();
+
+    if (!connection.sendCommand(0, releaseStream) || !connection.sendCommand(0, fcPublish) ||
+        !connection.sendCommand(0, createStream)) {
+        return fail(connection.lastError());
+    }
+
+    AmfValue result;
+    if (!waitForResult(createId, timeoutMs, &result)) {
+        return false;
+    }
+    streamId = result.type == AmfType::Number ? (uint32_t)result.number : 1;
+
+    AmfWriter publish;
+    publish.writeString("publish");
+    publish.writeNumber(0);
+    publish.writeNull();
+    publish.writeString(streamKey);
+    publish.writeString("live");
+    if (!connection.sendCommand(streamId, publish)) {
+        return fail(connection.lastError());
+    }
+    if (!waitForPublishStart(timeoutMs)) {
+        return false;
+    }
+    timings.publishUs = (int64_t)(relayNowNs() - stepStart) / 1000;
+    raiseChunkSize();
+
+    connected = true;
+    return true;
+}
+
+bool RtmpPublisher::sendConnect(const RtmpUrl &url)
+{
+    AmfWriter command;
+    command.writeString("connect");
+    command.writeNumber(1);
+    command.beginObject();
+    command.writeProperty("app", url.app);
+    command.writeProperty("type", std::string("nonprivate"));
+    command.writeProperty("flashVer", std::string("FMLE/3.0 (compatible; " PLUGIN_NAME ")"));
+    command.writeProperty("tcUrl", url.tcUrl);
+    command.endObject();
+    return connection.sendCommand(0, command);
+}
+
+// RTMP has no chunk size negotiation, and some ingests mishandle chunks
+// larger than they use themselves. A server that sends large chunks
+// certainly reads them, so media goes out in chunks as large as the
+// server's own, up to RTMP_RELAY_MAX_CHUNK_SIZE: fewer chunk headers and
+// fewer slices per vectored write.
+void RtmpPublisher::raiseChunkSize()
+{
+    uint32_t serverChunkSize = connection.incomingChunkSize();
+    uint32_t size = serverChunkSize < RTMP_RELAY_MAX_CHUNK_SIZE ? serverChunkSize : RTMP_RELAY_MAX_CHUNK_SIZE;
+    if (size > connection.outgoingChunkSize()) {
+        connection.setOutgoingChunkSize(size);
+    }
+}
+
+bool RtmpPublisher::waitForResult(double transactionId, int timeoutMs, AmfValue *result)
+{
+    uint64_t deadline = relayNowMs() + (uint64_t)timeoutMs;
+    while (relayNowMs() < deadline) {
+        std::vector<RtmpMessage> messages;
+        if (!connection.readMessages(messages, (int)(deadline - relayNowMs()))) {
+            return fail(connection.lastError());
+        }
+
+        for (const auto &message : messages) {
+            if (message.type != RTMP_MSG_COMMAND_AMF0) {
+                continue;
+            }
+            std::vector<AmfValue> values;
+            if (!amfDecode(message.payload.data(), message.payload.size(), values) || values.size() < 2) {
+                continue;
+            }
+            if (values[1].type != AmfType::Number || values[1].number != transactionId) {
+                continue;
+            }
+            if (values[0].string == "_result") {
+                if (result && values.size() > 3) {
+                    *result = values[3];
+                }
+                return true;
+            }
+            if (values[0].string == "_error") {
+                std::string description = values.size() > 3 ? values[3].getString("description") : std::string();
+                return fail("Server rejected request: " + description);
+            }
+        }
+    }
+    return fail("Timed out waiting for server response");
+}
+
+bool RtmpPublisher::waitForPublishStart(int timeoutMs)
+{
+    uint64_t deadline = relayNowMs() + (uint64_t)timeoutMs;
+    while (relayNowMs() < deadline) {
+        std::vector<RtmpMessage> messages;
+        if (!connection.readMessages(messages, (int)(deadline - relayNowMs()))) {
+            return fail(connection.lastError());
+        }
+
+        for (const auto &message : messages) {
+            if (message.type != RTMP_MSG_COMMAND_AMF0) {
+                continue;
+            }
+            std::vector<AmfValue> values;
+            if (!amfDecode(message.payload.data(), message.payload.size(), values) || values.size() < 4 ||
+                values[0].string != "onStatus") {
+                continue;
+            }
+            std::string code = values[3].getString("code");
+            if (code == "NetStream.Publish.Start") {
+                return true;
+            }
+            if (values[3].getString("level") == "error") {
+                return fail("Publish rejected: " + code);
+            }
+        }
+    }
+    return fail("Timed out waiting for NetStream.Publish.Start");
+}
+
+bool RtmpPublisher::sendPacket(const RelayPacket &packet)
+{
+    return queuePacket(packet) && sendQueued();
+}
+
+bool RtmpPublisher::queuePacket(const RelayPacket &packet)
+{
+    return queuePacket(packet, packet.timestamp);
+}
+
+bool RtmpPublisher::queuePacket(const RelayPacket &packet, uint32_t timestamp)
+{
+    uint32_t csid = RTMP_CSID_DATA;
+    if (packet.isVideo()) {
+        csid = RTMP_CSID_VIDEO;
+    } else if (packet.isAudio()) {
+        csid = RTMP_CSID_AUDIO;
+    }
+
+    if (!connection.queueMessage(csid, (uint8_t)packet.type, streamId, timestamp,
+                                 packet.data.data(), packet.data.size())) {
+        connected = false;
+        return fail(connection.lastError());
+    }
+    return true;
+}
+
+bool RtmpPublisher::sendQueued()
+{
+    if (!connection.flushBatch()) {
+        connected = false;
+        return fail(connection.lastError());
+    }
+    return true;
+}
+
+bool RtmpPublisher::pollIncoming()
+{
+    std::vector<RtmpMessage> messages;
+    if (!connection.readMessages(messages, 0)) {
+        connected = false;
+        return fail(connection.lastError());
+    }
+    return true;
+}
+
+bool RtmpPublisher::setNonBlocking(bool enabled)
+{
+    if (!connection.setNonBlocking(enabled)) {
+        return fail(connection.lastError());
+    }
+    return true;
+}
+
+bool RtmpPublisher::flush()
+{
+    if (!connection.flush()) {
+        connected = false;
+        return fail(connection.lastError());
+    }
+    return true;
+}
+
+void RtmpPublisher::close()
+{
+    connection.close();
+    connected = false;
+}
+
+bool RtmpPublisher::fail(const std::string &message)
+{
+    error = message;
+    connection.close();
+    return false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * Outgoing RTMP publish session to a platform ingest (Twitch, YouTube, ...).
+ */
+
+#include <string>
+
+#include "relay-packet.h"
+#include "relay-rtmp.h"
+
+// How long each step of the last connect() took, in microseconds; -1 for
+// steps it did not get to
+struct RtmpConnectTimings {
+    int64_t tcpConnectUs = -1;
+    int64_t handshakeUs = -1;
+    int64_t publishUs = -1; // connect, createStream and publish commands
+};
+
+class RtmpPublisher {
+public:
+    // Connects, handshakes and issues connect/createStream/publish
+    bool connect(const std::string &url, const std::string &streamKey, int timeoutMs);
+    bool sendPacket(const RelayPacket &packet);
+    // Batched sending: queued packets go out together with sendQueued(),
+    // and must stay alive until it returns
+    bool queuePacket(const RelayPacket &packet);
+    // Sends the packet with another timestamp, e.g. to splice two streams
+    bool queuePacket(const RelayPacket &packet, uint32_t timestamp);
+    bool sendQueued();
+
+    // Handles pings/acks from the server without blocking
+    bool pollIncoming();
+
+    // Once connected a shard drives the session without blocking: a send
+    // buffers what the socket cannot take and flush() continues it later
+    bool setNonBlocking(bool enabled);
+    bool flush();
+    bool hasPendingOutput() const { return connection.hasPendingOutput(); }
+    // For owners that send through io_uring: see RtmpConnection
+    void setDeferredWrites(bool enabled) { connection.setDeferredWrites(enabled); }
+    const uint8_t *pendingData() const { return connection.pendingData(); }
+    size_t pendingBytes() const { return connection.pendingBytes(); }
+    void consumePending(size_t bytes) { connection.consumePending(bytes); }
+    relay_socket_t fd() { return connection.socket().fd(); }
+    RelaySocket &socket() { return connection.socket(); }
+
+    void close();
+    bool isConnected() const { return connected; }
+    int64_t roundTripTimeUs() { return connection.socket().roundTripTimeUs(); }
+    const std::string &lastError() const { return error; }
+    const RtmpConnectTimings &connectTimings() const { return timings; }
+
+private:
+    bool sendConnect(const RtmpUrl &url);
+    void raiseChunkSize();
+    bool waitForResult(double transactionId, int timeoutMs, AmfValue *result);
+    bool waitForPublishStart(int timeoutMs);
+    bool fail(const std::string &message);
+
+    RtmpConnection connection;
+    uint32_t streamId = 0;
+    double nextTransactionId = 1;
+    bool connected = false;
+    RtmpConnectTimings timings;
+    std::string error;
+};
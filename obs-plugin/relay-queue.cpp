@@ -0,0 +1,248 @@
+#include "relay-queue.h"
+
+#include "plugin-macros.h"
+
+RelayQueueBudget relayQueueBudget(int bitrateKbps, bool autoReconnect)
+{
+    if (bitrateKbps <= 0) {
+        bitrateKbps = DEFAULT_BITRATE;
+    }
+
+    RelayQueueBudget budget;
+    budget.maxDurationMs = autoReconnect ? RELAY_QUEUE_RECONNECT_BUDGET_MS : RELAY_QUEUE_BUDGET_MS;
+    // Half again on top of the nominal rate leaves room for keyframe bursts
+    budget.maxBytes = (size_t)bitrateKbps * 125 * budget.maxDurationMs / 1000 * 3 / 2;
+    return budget;
+}
+
+// RelayPacketRing ----------------------------------------------------------
+
+RelayPacketRing::RelayPacketRing(size_t capacity)
+    : ringSlots(capacity), mask(capacity - 1)
+{
+}
+
+bool RelayPacketRing::push(const RelayPacketPtr &packet)
+{
+    size_t write = tail.load(std::memory_order_relaxed);
+    if (write - head.load(std::memory_order_acquire) >= ringSlots.size()) {
+        return false;
+    }
+    ringSlots[write & mask] = packet;
+    tail.store(write + 1, std::memory_order_release);
+    return true;
+}
+
+bool RelayPacketRing::pop(RelayPacketPtr &packet)
+{
+    size_t read = head.load(std::memory_order_relaxed);
+    if (read == tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    packet = std::move(ringSlots[read & mask]);
+    head.store(read + 1, std::memory_order_release);
+    return true;
+}
+
+// RelaySendQueue -----------------------------------------------------------
+
+RelaySendQueue::RelaySendQueue(const RelayQueueBudget &budget)
+    : maxBytes(budget.maxBytes), maxDurationMs(budget.maxDurationMs), ring(RELAY_QUEUE_RING_CAPACITY)
+{
+}
+
+void RelaySendQueue::push(const RelayPacketPtr &packet)
+{
+    // After an overflow the ring only resumes at a keyframe so the
+    // consumer never sees a broken reference chain
+    bool isFrame = packet->isVideo() && !packet->isSequenceHeader();
+    if (ringOverflow.load(std::memory_order_relaxed) && isFrame && !packet->isKeyframe()) {
+        dropped++;
+        droppedSize += packet->data.size();
+        return;
+    }
+
+    if (!ring.push(packet)) {
+        ringOverflow.store(true, std::memory_order_relaxed);
+        dropped++;
+        droppedSize += packet->data.size();
+        return;
+    }
+    if (isFrame) {
+        ringOverflow.store(false, std::memory_order_relaxed);
+    }
+
+    // Pairs with the fence in armNotify(): either the consumer sees this
+    // packet or this sees the consumer asleep, and only one push wakes it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false) && notify) {
+        notify();
+    }
+}
+
+bool RelaySendQueue::armNotify()
+{
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring.empty()) {
+        return true;
+    }
+    sleeping.store(false, std::memory_order_relaxed);
+    return false;
+}
+
+void RelaySendQueue::reset()
+{
+    drainRing();
+    backlog.clear();
+    bytes = 0;
+    waitingForKeyframe = true;
+    backlogBytes = 0;
+    backlogPackets = 0;
+}
+
+RelayPacketPtr RelaySendQueue::pop()
+{
+    drainRing();
+    enforceBudget();
+
+    RelayPacketPtr packet;
+    while (!backlog.empty() && !packet) {
+        packet = std::move(backlog.front());
+        backlog.pop_front();
+        bytes -= packet->data.size();
+
+        // A freshly (re)started stream must begin on a keyframe
+        if (packet->isVideo() && !packet->isSequenceHeader()) {
+            if (waitingForKeyframe && !packet->isKeyframe()) {
+                packet.reset();
+            } else {
+                waitingForKeyframe = false;
+            }
+        }
+    }
+
+    backlogBytes = bytes;
+    backlogPackets = backlog.size();
+    return packet;
+}
+
+void RelaySendQueue::drainRing()
+{
+    RelayPacketPtr packet;
+    while (ring.pop(packet)) {
+        bytes += packet->data.size();
+        backlog.push_back(std::move(packet));
+    }
+}
+
+void RelaySendQueue::setBudget(const RelayQueueBudget &budget)
+{
+    maxBytes.store(budget.maxBytes, std::memory_order_relaxed);
+    maxDurationMs.store(budget.maxDurationMs, std::memory_order_relaxed);
+}
+
+static bool isFrame(const RelayPacket &packet)
+{
+    return packet.isVideo() && !packet.isSequenceHeader();
+}
+
+bool RelaySendQueue::overBudget() const
+{
+    // Audio is never dropped, so only queued video counts towards latency
+    for (const auto &packet : backlog) {
+        if (isFrame(*packet)) {
+            return overBudget(bytes, packet.get());
+        }
+    }
+    return overBudget(bytes, nullptr);
+}
+
+bool RelaySendQueue::overBudget(size_t queuedBytes, const RelayPacket *oldestVideo) const
+{
+    size_t byteLimit = maxBytes.load(std::memory_order_relaxed);
+    if (byteLimit > 0 && queuedBytes > byteLimit) {
+        return true;
+    }
+    if (!oldestVideo) {
+        return false;
+    }
+    uint32_t last = backlog.back()->timestamp;
+    return last > oldestVideo->timestamp &&
+           last - oldestVideo->timestamp > maxDurationMs.load(std::memory_order_relaxed);
+}
+
+void RelaySendQueue::removeIf(const std::function<bool(const RelayPacket &packet)> &drop)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < backlog.size(); i++) {
+        if (drop(*backlog[i])) {
+            size_t size = backlog[i]->data.size();
+            bytes -= size;
+            dropped++;
+            droppedSize += size;
+            continue;
+        }
+        if (kept != i) {
+            backlog[kept] = std::move(backlog[i]);
+        }
+        kept++;
+    }
+    backlog.erase(backlog.begin() + (long)kept, backlog.end());
+}
+
+// Each step is a single pass over the backlog, however long a stall let
+// it grow
+void RelaySendQueue::enforceBudget()
+{
+    if (!overBudget()) {
+        return;
+    }
+
+    // Non-reference frames can go without hurting anything else. Until a
+    // frame is kept, the one being looked at is the oldest left.
+    const RelayPacket *oldestKept = nullptr;
+    removeIf([&](const RelayPacket &packet) {
+        if (packet.isDisposable() && overBudget(bytes, oldestKept ? oldestKept : &packet)) {
+            return true;
+        }
+        if (!oldestKept && isFrame(packet)) {
+            oldestKept = &packet;
+        }
+        return false;
+    });
+
+    // Then the oldest GOPs' frames, each up to the next keyframe: find
+    // where that ends first, then drop the video before it
+    size_t remaining = bytes;
+    size_t cut = 0;
+    size_t first = 0;
+    while (true) {
+        while (first < backlog.size() && !isFrame(*backlog[first])) {
+            first++;
+        }
+        if (first == backlog.size() || !overBudget(remaining, backlog[first].get())) {
+            break; // within budget, or only audio and headers left, which are never dropped
+        }
+
+        size_t nextKey = first + 1;
+        while (nextKey < backlog.size() && !backlog[nextKey]->isKeyframe()) {
+            nextKey++;
+        }
+        if (nextKey == backlog.size()) {
+            // No later keyframe queued yet; resume from the next one
+            waitingForKeyframe = true;
+        }
+        for (size_t i = first; i < nextKey; i++) {
+            if (isFrame(*backlog[i])) {
+                remaining -= backlog[i]->data.size();
+            }
+        }
+        cut = nextKey;
+        first = nextKey;
+    }
+    if (cut > 0) {
+        size_t index = 0;
+        removeIf([&](const RelayPacket &packet) { return index++ < cut && isFrame(packet); });
+    }
+}
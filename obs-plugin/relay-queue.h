@@ -0,0 +1,109 @@
+#pragma once
+
+/*
+ * Per-destination send queue.
+ *
+ * The fan-out side pushes into a lock-free single-producer ring and never
+ * waits, so a congested destination cannot stall the stream or any other
+ * destination. The sender's shard drains the ring into its own backlog and
+ * keeps that backlog within a byte and time budget: non-reference frames
+ * go first, then whole GOPs up to the next keyframe. Audio, metadata and
+ * sequence headers are never dropped by the budget.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "relay-packet.h"
+
+#define RELAY_QUEUE_RING_CAPACITY 4096 // packets, power of two
+#define RELAY_QUEUE_BUDGET_MS 1500
+#define RELAY_QUEUE_RECONNECT_BUDGET_MS 4000
+
+struct RelayQueueBudget {
+    size_t maxBytes = 0;
+    uint32_t maxDurationMs = RELAY_QUEUE_BUDGET_MS;
+};
+
+// Budget for a destination streaming at bitrateKbps. Destinations that
+// auto-reconnect ride out longer stalls before shedding frames.
+RelayQueueBudget relayQueueBudget(int bitrateKbps, bool autoReconnect);
+
+// Lock-free ring for exactly one producer and one consumer thread
+class RelayPacketRing {
+public:
+    explicit RelayPacketRing(size_t capacity);
+
+    bool push(const RelayPacketPtr &packet);
+    bool pop(RelayPacketPtr &packet);
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+private:
+    std::vector<RelayPacketPtr> ringSlots; // not "slots", which Qt defines as a macro
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0}; // next slot to read
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to write
+};
+
+class RelaySendQueue {
+public:
+    explicit RelaySendQueue(const RelayQueueBudget &budget);
+
+    // Producer side: never blocks. If the ring itself is full the packet is
+    // dropped and the consumer resynchronises on the next keyframe.
+    void push(const RelayPacketPtr &packet);
+
+    // Consumer side
+    RelayPacketPtr pop();
+    // Set before the producer starts; called from the producer's thread
+    // when data arrives for a consumer that went idle
+    void setNotify(std::function<void()> callback) { notify = std::move(callback); }
+    // The consumer is about to go idle: returns true once the next push()
+    // is certain to notify, false if data slipped in and pop() has more
+    bool armNotify();
+    // Forget everything queued and restart on the next keyframe
+    void reset();
+    // After priming from a cached GOP the queue continues mid-GOP
+    void setNeedsKeyframe(bool needed) { waitingForKeyframe = needed; }
+
+    // Safe from any thread; applies from the consumer's next pop()
+    void setBudget(const RelayQueueBudget &budget);
+
+    size_t queuedBytes() const { return backlogBytes; }
+    size_t queuedPackets() const { return backlogPackets; }
+    uint64_t droppedPackets() const { return dropped; }
+    uint64_t droppedBytes() const { return droppedSize; }
+
+private:
+    void drainRing();
+    void enforceBudget();
+    bool overBudget() const;
+    // With queuedBytes queued and oldestVideo the oldest frame left (or none)
+    bool overBudget(size_t queuedBytes, const RelayPacket *oldestVideo) const;
+    // One stable pass; drop() sees the backlog oldest first, with bytes
+    // already lowered by what it dropped so far
+    void removeIf(const std::function<bool(const RelayPacket &packet)> &drop);
+
+    std::atomic<size_t> maxBytes;
+    std::atomic<uint32_t> maxDurationMs;
+    RelayPacketRing ring;
+    std::atomic<bool> ringOverflow{false};
+
+    // Only an idle consumer costs the producer a notification; a busy one
+    // never makes it leave the ring
+    std::function<void()> notify;
+    std::atomic<bool> sleeping{false};
+
+    // Owned by the consumer thread
+    std::deque<RelayPacketPtr> backlog;
+    size_t bytes = 0;
+    bool waitingForKeyframe = true;
+
+    std::atomic<size_t> backlogBytes{0};
+    std::atomic<size_t> backlogPackets{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> droppedSize{0};
+};
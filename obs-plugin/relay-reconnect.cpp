@@ -0,0 +1,26 @@
+#include "relay-reconnect.h"
+
+RelayBackoff::RelayBackoff(int maxAttempts, int maxDelayMs, int baseDelayMs)
+    : maxAttempts(maxAttempts), maxDelayMs(maxDelayMs), baseDelayMs(baseDelayMs), rng(std::random_device{}())
+{
+}
+
+int RelayBackoff::nextDelayMs()
+{
+    if (maxAttempts > 0 && attempts >= maxAttempts) {
+        return -1;
+    }
+
+    int attempt = attempts++;
+    if (attempt == 0) {
+        // Retry right away, spread over one base interval
+        return std::uniform_int_distribution<int>(0, baseDelayMs)(rng);
+    }
+
+    int64_t delay = (int64_t)baseDelayMs << (attempt < 16 ? attempt : 16);
+    if (delay > maxDelayMs) {
+        delay = maxDelayMs;
+    }
+    // Equal jitter: at least half the delay, at most all of it
+    return (int)(delay / 2) + std::uniform_int_distribution<int>(0, (int)(delay / 2))(rng);
+}
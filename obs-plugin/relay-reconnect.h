@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Reconnect scheduling shared by destinations and the relay supervisor.
+ *
+ * The first retry after a healthy connection drops goes out almost
+ * immediately; later ones back off exponentially up to the configured
+ * delay, with jitter so destinations that failed together (e.g. a local
+ * network blip) do not hammer their ingests in lockstep.
+ */
+
+#include <cstdint>
+#include <random>
+
+#include "plugin-macros.h"
+
+#define RELAY_RECONNECT_BASE_DELAY_MS 250
+// A connection that stayed up this long resets the backoff
+#define RELAY_RECONNECT_STABLE_MS 30000
+
+class RelayBackoff {
+public:
+    RelayBackoff(int maxAttempts = MAX_RECONNECT_ATTEMPTS, int maxDelayMs = DEFAULT_RECONNECT_DELAY,
+                 int baseDelayMs = RELAY_RECONNECT_BASE_DELAY_MS);
+
+    // Delay before the next attempt, or -1 once the attempt cap is reached
+    int nextDelayMs();
+    void reset() { attempts = 0; }
+    int attemptCount() const { return attempts; }
+    int maxAttemptCount() const { return maxAttempts; }
+
+private:
+    int maxAttempts;
+    int maxDelayMs;
+    int baseDelayMs;
+    int attempts = 0;
+    std::mt19937 rng;
+};
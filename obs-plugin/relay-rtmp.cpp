@@ -0,0 +1,753 @@
+#include "relay-rtmp.h"
+
+#include <cstring>
+#include <random>
+
+#include "relay-common.h"
+
+// Big-endian helpers
+static void putBE16(std::vector<uint8_t> &out, uint32_t v)
+{
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+
+static void putBE32(std::vector<uint8_t> &out, uint32_t v)
+{
+    out.push_back((uint8_t)(v >> 24));
+    out.push_back((uint8_t)(v >> 16));
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+
+static uint32_t getBE16(const uint8_t *p) { return ((uint32_t)p[0] << 8) | p[1]; }
+static uint32_t getBE24(const uint8_t *p) { return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2]; }
+static uint32_t getBE32(const uint8_t *p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]; }
+
+// AMF0 ---------------------------------------------------------------------
+
+const AmfValue *AmfValue::get(const std::string &key) const
+{
+    for (const auto &property : properties) {
+        if (property.first == key) {
+            return &property.second;
+        }
+    }
+    return nullptr;
+}
+
+std::string AmfValue::getString(const std::string &key) const
+{
+    const AmfValue *value = get(key);
+    return value && value->type == AmfType::String ? value->string : std::string();
+}
+
+void AmfWriter::writeNumber(double value)
+{
+    buffer.push_back((uint8_t)AmfType::Number);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        buffer.push_back((uint8_t)(bits >> shift));
+    }
+}
+
+void AmfWriter::writeBool(bool value)
+{
+    buffer.push_back((uint8_t)AmfType::Boolean);
+    buffer.push_back(value ? 1 : 0);
+}
+
+void AmfWriter::writeString(const std::string &value)
+{
+    buffer.push_back((uint8_t)AmfType::String);
+    writeRawString(value);
+}
+
+void AmfWriter::writeNull()
+{
+    buffer.push_back((uint8_t)AmfType::Null);
+}
+
+void AmfWriter::beginObject()
+{
+    buffer.push_back((uint8_t)AmfType::Object);
+}
+
+void AmfWriter::writeKey(const std::string &key)
+{
+    writeRawString(key);
+}
+
+void AmfWriter::endObject()
+{
+    putBE16(buffer, 0);
+    buffer.push_back((uint8_t)AmfType::ObjectEnd);
+}
+
+void AmfWriter::writeProperty(const std::string &key, const std::string &value)
+{
+    writeKey(key);
+    writeString(value);
+}
+
+void AmfWriter::writeProperty(const std::string &key, double value)
+{
+    writeKey(key);
+    writeNumber(value);
+}
+
+void AmfWriter::writeRawString(const std::string &value)
+{
+    size_t length = value.size() > 0xffff ? 0xffff : value.size();
+    putBE16(buffer, (uint32_t)length);
+    buffer.insert(buffer.end(), value.begin(), value.begin() + length);
+}
+
+static bool amfDecodeValue(const uint8_t *data, size_t size, size_t &pos, AmfValue &value, int depth);
+
+static bool amfDecodeProperties(const uint8_t *data, size_t size, size_t &pos, AmfValue &value, int depth)
+{
+    while (true) {
+        if (pos + 2 > size) {
+            return false;
+        }
+        uint32_t keyLength = getBE16(data + pos);
+        pos += 2;
+        if (keyLength == 0) {
+            if (pos < size && data[pos] == (uint8_t)AmfType::ObjectEnd) {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+        if (pos + keyLength > size) {
+            return false;
+        }
+        std::string key((const char *)data + pos, keyLength);
+        pos += keyLength;
+
+        AmfValue property;
+        if (!amfDecodeValue(data, size, pos, property, depth + 1)) {
+            return false;
+        }
+        value.properties.emplace_back(std::move(key), std::move(property));
+    }
+}
+
+static bool amfDecodeValue(const uint8_t *data, size_t size, size_t &pos, AmfValue &value, int depth)
+{
+    if (pos >= size || depth > 16) {
+        return false;
+    }
+
+    value.type = (AmfType)data[pos++];
+    switch (value.type) {
+    case AmfType::Number: {
+        if (pos + 8 > size) {
+            return false;
+        }
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++) {
+            bits = (bits << 8) | data[pos + i];
+        }
+        memcpy(&value.number, &bits, sizeof(bits));
+        pos += 8;
+        return true;
+    }
+    case AmfType::Boolean:
+        if (pos + 1 > size) {
+            return false;
+        }
+        value.boolean = data[pos++] != 0;
+        return true;
+    case AmfType::String: {
+        if (pos + 2 > size) {
+            return false;
+        }
+        uint32_t length = getBE16(data + pos);
+        pos += 2;
+        if (pos + length > size) {
+            return false;
+        }
+        value.string.assign((const char *)data + pos, length);
+        pos += length;
+        return true;
+    }
+    case AmfType::Object:
+        return amfDecodeProperties(data, size, pos, value, depth);
+    case AmfType::EcmaArray:
+        if (pos + 4 > size) {
+            return false;
+        }
+        pos += 4; // advisory element count
+        return amfDecodeProperties(data, size, pos, value, depth);
+    case AmfType::StrictArray: {
+        if (pos + 4 > size) {
+            return false;
+        }
+        uint32_t count = getBE32(data + pos);
+        pos += 4;
+        for (uint32_t i = 0; i < count; i++) {
+            AmfValue element;
+            if (!amfDecodeValue(data, size, pos, element, depth + 1)) {
+                return false;
+            }
+            value.elements.push_back(std::move(element));
+        }
+        return true;
+    }
+    case AmfType::Null:
+    case AmfType::Undefined:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool amfDecode(const uint8_t *data, size_t size, std::vector<AmfValue> &values)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        AmfValue value;
+        if (!amfDecodeValue(data, size, pos, value, 0)) {
+            return false;
+        }
+        values.push_back(std::move(value));
+    }
+    return true;
+}
+
+// Chunk stream -------------------------------------------------------------
+
+bool RtmpChunkReader::feed(const uint8_t *data, size_t size, std::vector<RtmpMessage> &messages)
+{
+    pending.insert(pending.end(), data, data + size);
+
+    size_t offset = 0;
+    while (offset < pending.size()) {
+        long consumed = parseChunk(pending.data() + offset, pending.size() - offset, messages);
+        if (consumed < 0) {
+            return false;
+        }
+        if (consumed == 0) {
+            break;
+        }
+        offset += (size_t)consumed;
+    }
+
+    pending.erase(pending.begin(), pending.begin() + (long)offset);
+    return true;
+}
+
+long RtmpChunkReader::parseChunk(const uint8_t *data, size_t size, std::vector<RtmpMessage> &messages)
+{
+    size_t pos = 0;
+    if (size < 1) {
+        return 0;
+    }
+
+    uint8_t fmt = data[0] >> 6;
+    uint32_t csid = data[0] & 0x3f;
+    pos = 1;
+    if (csid == 0) {
+        if (size < 2) {
+            return 0;
+        }
+        csid = 64 + data[1];
+        pos = 2;
+    } else if (csid == 1) {
+        if (size < 3) {
+            return 0;
+        }
+        csid = 64 + data[1] + ((uint32_t)data[2] << 8);
+        pos = 3;
+    }
+
+    static const size_t headerSizes[4] = {11, 7, 3, 0};
+    if (size < pos + headerSizes[fmt]) {
+        return 0;
+    }
+
+    ChunkStream &stream = streams[csid];
+    if (fmt != 0 && !stream.hasHeader) {
+        return -1;
+    }
+
+    const uint8_t *header = data + pos;
+    pos += headerSizes[fmt];
+
+    uint32_t timestampField = 0;
+    bool extended = stream.extendedTimestamp;
+    if (fmt <= 2) {
+        timestampField = getBE24(header);
+        extended = timestampField == 0xffffff;
+    }
+
+    uint32_t extendedValue = 0;
+    if (extended) {
+        if (size < pos + 4) {
+            return 0;
+        }
+        extendedValue = getBE32(data + pos);
+        pos += 4;
+    }
+
+    bool newMessage = stream.payload.empty() || fmt <= 1;
+    uint32_t length = stream.length;
+    if (fmt <= 1) {
+        length = getBE24(header + 3);
+        if (length > RTMP_MAX_MESSAGE_SIZE) {
+            return -1;
+        }
+    }
+
+    size_t remaining = length - (newMessage ? 0 : stream.payload.size());
+    size_t chunkBytes = remaining < chunkSize ? remaining : chunkSize;
+    if (size < pos + chunkBytes) {
+        return 0;
+    }
+
+    // Commit the header now that the whole chunk is available
+    uint32_t timestampValue = extended ? extendedValue : timestampField;
+    if (fmt == 0) {
+        stream.timestamp = timestampValue;
+        stream.timestampDelta = 0;
+        stream.length = length;
+        stream.type = header[6];
+        stream.streamId = (uint32_t)header[7] | ((uint32_t)header[8] << 8) |
+                          ((uint32_t)header[9] << 16) | ((uint32_t)header[10] << 24);
+    } else if (fmt == 1 || fmt == 2) {
+        stream.timestampDelta = timestampValue;
+        stream.timestamp += timestampValue;
+        if (fmt == 1) {
+            stream.length = length;
+            stream.type = header[6];
+        }
+    } else if (newMessage) {
+        stream.timestamp += stream.timestampDelta;
+    }
+    if (fmt <= 2) {
+        stream.extendedTimestamp = extended;
+    }
+    stream.hasHeader = true;
+    if (fmt <= 1 || newMessage) {
+        stream.payload.clear();
+        stream.payload.reserve(stream.length);
+    }
+
+    stream.payload.insert(stream.payload.end(), data + pos, data + pos + chunkBytes);
+    pos += chunkBytes;
+
+    if (stream.payload.size() >= stream.length) {
+        // Chunk size changes apply to the very next chunk, which may
+        // already be sitting in the pending buffer
+        if (stream.type == RTMP_MSG_SET_CHUNK_SIZE && stream.payload.size() >= 4) {
+            uint32_t size = getBE32(stream.payload.data()) & 0x7fffffff;
+            if (size > 0) {
+                chunkSize = size;
+            }
+        }
+
+        RtmpMessage message;
+        message.type = stream.type;
+        message.streamId = stream.streamId;
+        message.timestamp = stream.timestamp;
+        message.payload.swap(stream.payload);
+        messages.push_back(std::move(message));
+    }
+
+    return (long)pos;
+}
+
+void rtmpBuildChunkHeaders(RtmpChunkHeaders &headers, uint32_t csid, uint8_t type, uint32_t streamId,
+                           uint32_t timestamp, size_t length)
+{
+    bool extended = timestamp >= 0xffffff;
+    uint32_t timestampField = extended ? 0xffffff : timestamp;
+    uint8_t *out = headers.first;
+
+    *out++ = (uint8_t)(csid & 0x3f);
+    *out++ = (uint8_t)(timestampField >> 16);
+    *out++ = (uint8_t)(timestampField >> 8);
+    *out++ = (uint8_t)timestampField;
+    *out++ = (uint8_t)(length >> 16);
+    *out++ = (uint8_t)(length >> 8);
+    *out++ = (uint8_t)length;
+    *out++ = type;
+    *out++ = (uint8_t)streamId;
+    *out++ = (uint8_t)(streamId >> 8);
+    *out++ = (uint8_t)(streamId >> 16);
+    *out++ = (uint8_t)(streamId >> 24);
+
+    uint8_t *continuation = headers.continuation;
+    *continuation++ = (uint8_t)(0xc0 | (csid & 0x3f));
+
+    if (extended) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            *out++ = (uint8_t)(timestamp >> shift);
+            *continuation++ = (uint8_t)(timestamp >> shift);
+        }
+    }
+    headers.firstSize = (size_t)(out - headers.first);
+    headers.continuationSize = (size_t)(continuation - headers.continuation);
+}
+
+void rtmpAppendMessageSlices(std::vector<RelayIoSlice> &slices, const RtmpChunkHeaders &headers,
+                             uint32_t chunkSize, const uint8_t *payload, size_t length)
+{
+    slices.push_back({headers.first, headers.firstSize});
+
+    size_t offset = 0;
+    while (true) {
+        size_t bytes = length - offset < chunkSize ? length - offset : chunkSize;
+        if (bytes > 0) {
+            slices.push_back({payload + offset, bytes});
+        }
+        offset += bytes;
+        if (offset >= length) {
+            break;
+        }
+        slices.push_back({headers.continuation, headers.continuationSize});
+    }
+}
+
+// Handshake ----------------------------------------------------------------
+
+static void fillRandom(uint8_t *data, size_t size)
+{
+    static thread_local std::mt19937 rng(std::random_device{}());
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)rng();
+    }
+}
+
+bool rtmpClientHandshake(RelaySocket &socket, int timeoutMs)
+{
+    std::vector<uint8_t> c0c1(1 + RTMP_HANDSHAKE_SIZE, 0);
+    c0c1[0] = 3;
+    fillRandom(c0c1.data() + 9, RTMP_HANDSHAKE_SIZE - 8);
+    if (!socket.writeAll(c0c1.data(), c0c1.size())) {
+        return false;
+    }
+
+    std::vector<uint8_t> s0s1s2(1 + 2 * RTMP_HANDSHAKE_SIZE);
+    if (!socket.readExact(s0s1s2.data(), s0s1s2.size(), timeoutMs) || s0s1s2[0] != 3) {
+        return false;
+    }
+
+    // C2 echoes S1
+    return socket.writeAll(s0s1s2.data() + 1, RTMP_HANDSHAKE_SIZE);
+}
+
+std::vector<uint8_t> rtmpServerHandshakeReply(const uint8_t *c0c1)
+{
+    std::vector<uint8_t> s0s1s2(1 + 2 * RTMP_HANDSHAKE_SIZE, 0);
+    s0s1s2[0] = 3;
+    fillRandom(s0s1s2.data() + 9, RTMP_HANDSHAKE_SIZE - 8);
+    // S2 echoes C1
+    memcpy(s0s1s2.data() + 1 + RTMP_HANDSHAKE_SIZE, c0c1 + 1, RTMP_HANDSHAKE_SIZE);
+    return s0s1s2;
+}
+
+bool rtmpServerHandshake(RelaySocket &socket, int timeoutMs)
+{
+    std::vector<uint8_t> c0c1(1 + RTMP_HANDSHAKE_SIZE);
+    if (!socket.readExact(c0c1.data(), c0c1.size(), timeoutMs) || c0c1[0] != 3) {
+        return false;
+    }
+
+    std::vector<uint8_t> s0s1s2 = rtmpServerHandshakeReply(c0c1.data());
+    if (!socket.writeAll(s0s1s2.data(), s0s1s2.size())) {
+        return false;
+    }
+
+    std::vector<uint8_t> c2(RTMP_HANDSHAKE_SIZE);
+    return socket.readExact(c2.data(), c2.size(), timeoutMs);
+}
+
+// URLs ---------------------------------------------------------------------
+
+bool parseRtmpUrl(const std::string &url, RtmpUrl &out)
+{
+    static const std::string scheme = "rtmp://";
+    if (url.compare(0, scheme.size(), scheme) != 0) {
+        return false;
+    }
+
+    std::string rest = url.substr(scheme.size());
+    size_t slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    std::string path = slash == std::string::npos ? std::string() : rest.substr(slash + 1);
+    while (!path.empty() && path.back() == '/') {
+        path.pop_back();
+    }
+
+    size_t colon = authority.rfind(':');
+    out.port = 1935;
+    if (colon != std::string::npos) {
+        int port = atoi(authority.c_str() + colon + 1);
+        if (port <= 0 || port > 65535) {
+            return false;
+        }
+        out.port = (uint16_t)port;
+        authority.resize(colon);
+    }
+
+    if (authority.empty() || path.empty()) {
+        return false;
+    }
+
+    out.host = authority;
+    out.app = path;
+    out.tcUrl = scheme + out.host + ":" + std::to_string(out.port) + "/" + out.app;
+    return true;
+}
+
+// Connection ---------------------------------------------------------------
+
+bool RtmpConnection::sendMessage(uint32_t csid, uint8_t type, uint32_t streamId, uint32_t timestamp,
+                                 const uint8_t *payload, size_t length)
+{
+    // Through the batch, so control messages never overtake queued media
+    return queueMessage(csid, type, streamId, timestamp, payload, length) && flushBatch();
+}
+
+bool RtmpConnection::queueMessage(uint32_t csid, uint8_t type, uint32_t streamId, uint32_t timestamp,
+                                  const uint8_t *payload, size_t length)
+{
+    if (batchMessages == RTMP_BATCH_MAX_MESSAGES && !flushBatch()) {
+        return false;
+    }
+    if (headerArena.empty()) {
+        headerArena.resize(RTMP_BATCH_MAX_MESSAGES);
+    }
+    RtmpChunkHeaders &headers = headerArena[batchMessages++];
+    rtmpBuildChunkHeaders(headers, csid, type, streamId, timestamp, length);
+    rtmpAppendMessageSlices(writeSlices, headers, outChunkSize, payload, length);
+    return true;
+}
+
+bool RtmpConnection::flushBatch()
+{
+    if (writeSlices.empty()) {
+        return true;
+    }
+    bool ok = writeBatch();
+    writeSlices.clear();
+    batchMessages = 0;
+    return ok;
+}
+
+bool RtmpConnection::sendRaw(const uint8_t *data, size_t size)
+{
+    if (!flushBatch()) {
+        return false;
+    }
+    writeSlices.push_back({data, size});
+    return flushBatch();
+}
+
+bool RtmpConnection::writeBatch()
+{
+    if (deferredWrites) {
+        for (const auto &slice : writeSlices) {
+            const auto *data = (const uint8_t *)slice.data;
+            pendingOutput.insert(pendingOutput.end(), data, data + slice.size);
+        }
+        return true;
+    }
+    if (!nonBlocking) {
+        if (!sock.writeVectored(writeSlices.data(), writeSlices.size())) {
+            error = sock.lastError();
+            return false;
+        }
+        return true;
+    }
+
+    // Straight to the socket unless an earlier message is still queued
+    size_t index = 0;
+    while (!hasPendingOutput() && index < writeSlices.size()) {
+        long n = sock.writeSome(&writeSlices[index], writeSlices.size() - index);
+        if (n < 0) {
+            error = sock.lastError();
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        size_t written = (size_t)n;
+        while (index < writeSlices.size() && written >= writeSlices[index].size) {
+            written -= writeSlices[index].size;
+            index++;
+        }
+        if (written > 0) {
+            writeSlices[index].data = (const uint8_t *)writeSlices[index].data + written;
+            writeSlices[index].size -= written;
+        }
+    }
+
+    // Whatever the kernel did not take is copied, since the slices point
+    // into the caller's payload
+    for (; index < writeSlices.size(); index++) {
+        const auto *data = (const uint8_t *)writeSlices[index].data;
+        pendingOutput.insert(pendingOutput.end(), data, data + writeSlices[index].size);
+    }
+    return true;
+}
+
+bool RtmpConnection::flush()
+{
+    if (deferredWrites) {
+        return true;
+    }
+    while (hasPendingOutput()) {
+        RelayIoSlice slice = {pendingOutput.data() + pendingOffset, pendingOutput.size() - pendingOffset};
+        long n = sock.writeSome(&slice, 1);
+        if (n < 0) {
+            error = sock.lastError();
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        pendingOffset += (size_t)n;
+    }
+    pendingOutput.clear();
+    pendingOffset = 0;
+    return true;
+}
+
+void RtmpConnection::consumePending(size_t bytes)
+{
+    pendingOffset += bytes;
+    if (pendingOffset >= pendingOutput.size()) {
+        pendingOutput.clear();
+        pendingOffset = 0;
+    }
+}
+
+bool RtmpConnection::setNonBlocking(bool enabled)
+{
+    if (!sock.setNonBlocking(enabled)) {
+        error = "Cannot change the socket mode";
+        return false;
+    }
+    nonBlocking = enabled;
+    return true;
+}
+
+bool RtmpConnection::sendCommand(uint32_t streamId, const AmfWriter &command)
+{
+    const auto &data = command.data();
+    return sendMessage(RTMP_CSID_COMMAND, RTMP_MSG_COMMAND_AMF0, streamId, 0, data.data(), data.size());
+}
+
+bool RtmpConnection::setOutgoingChunkSize(uint32_t size)
+{
+    // sendMessage() flushes everything framed with the old size first
+    std::vector<uint8_t> payload;
+    putBE32(payload, size & 0x7fffffff);
+    if (!sendMessage(RTMP_CSID_CONTROL, RTMP_MSG_SET_CHUNK_SIZE, 0, 0, payload.data(), payload.size())) {
+        return false;
+    }
+    outChunkSize = size;
+    return true;
+}
+
+bool RtmpConnection::sendWindowAckSize(uint32_t size)
+{
+    std::vector<uint8_t> payload;
+    putBE32(payload, size);
+    return sendMessage(RTMP_CSID_CONTROL, RTMP_MSG_WINDOW_ACK_SIZE, 0, 0, payload.data(), payload.size());
+}
+
+bool RtmpConnection::sendPeerBandwidth(uint32_t size)
+{
+    std::vector<uint8_t> payload;
+    putBE32(payload, size);
+    payload.push_back(2); // dynamic limit
+    return sendMessage(RTMP_CSID_CONTROL, RTMP_MSG_SET_PEER_BANDWIDTH, 0, 0, payload.data(), payload.size());
+}
+
+bool RtmpConnection::sendUserControl(uint16_t event, uint32_t value)
+{
+    std::vector<uint8_t> payload;
+    putBE16(payload, event);
+    putBE32(payload, value);
+    return sendMessage(RTMP_CSID_CONTROL, RTMP_MSG_USER_CONTROL, 0, 0, payload.data(), payload.size());
+}
+
+bool RtmpConnection::readMessages(std::vector<RtmpMessage> &messages, int timeoutMs)
+{
+    if (!sock.waitReadable(timeoutMs)) {
+        if (!sock.isValid()) {
+            error = "Socket closed";
+            return false;
+        }
+        return true;
+    }
+
+    uint8_t buffer[64 * 1024];
+    long n = sock.readSome(buffer, sizeof(buffer));
+    if (n < 0 && sock.wouldBlock()) {
+        return true;
+    }
+    if (n <= 0) {
+        error = n == 0 ? "Connection closed by peer" : sock.lastError();
+        return false;
+    }
+    return receive(buffer, (size_t)n, messages);
+}
+
+bool RtmpConnection::receive(const uint8_t *data, size_t size, std::vector<RtmpMessage> &messages)
+{
+    std::vector<RtmpMessage> received;
+    if (!reader.feed(data, size, received)) {
+        error = "Malformed RTMP chunk stream";
+        return false;
+    }
+
+    bytesReceived += size;
+    if (ackWindow > 0 && bytesReceived - lastAckSent >= ackWindow) {
+        std::vector<uint8_t> payload;
+        putBE32(payload, (uint32_t)bytesReceived);
+        if (!sendMessage(RTMP_CSID_CONTROL, RTMP_MSG_ACK, 0, 0, payload.data(), payload.size())) {
+            return false;
+        }
+        lastAckSent = bytesReceived;
+    }
+
+    for (auto &message : received) {
+        if (!handleControl(message)) {
+            messages.push_back(std::move(message));
+        }
+    }
+    return true;
+}
+
+bool RtmpConnection::handleControl(const RtmpMessage &message)
+{
+    const auto &payload = message.payload;
+    switch (message.type) {
+    case RTMP_MSG_SET_CHUNK_SIZE:
+        // Applied by the chunk reader itself
+        return true;
+    case RTMP_MSG_WINDOW_ACK_SIZE:
+        if (payload.size() >= 4) {
+            ackWindow = getBE32(payload.data());
+        }
+        return true;
+    case RTMP_MSG_USER_CONTROL:
+        if (payload.size() >= 6 && getBE16(payload.data()) == RTMP_EVENT_PING_REQUEST) {
+            sendUserControl(RTMP_EVENT_PING_RESPONSE, getBE32(payload.data() + 2));
+        }
+        return true;
+    case RTMP_MSG_ABORT:
+    case RTMP_MSG_ACK:
+    case RTMP_MSG_SET_PEER_BANDWIDTH:
+        return true;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+/*
+ * Minimal RTMP protocol support for the relay engine: AMF0 encoding,
+ * chunk stream parsing/serialisation, the simple (non-digest) handshake
+ * and a connection helper that takes care of protocol control messages.
+ */
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "relay-buffer.h"
+#include "relay-socket.h"
+
+// RTMP message types
+#define RTMP_MSG_SET_CHUNK_SIZE 1
+#define RTMP_MSG_ABORT 2
+#define RTMP_MSG_ACK 3
+#define RTMP_MSG_USER_CONTROL 4
+#define RTMP_MSG_WINDOW_ACK_SIZE 5
+#define RTMP_MSG_SET_PEER_BANDWIDTH 6
+#define RTMP_MSG_AUDIO 8
+#define RTMP_MSG_VIDEO 9
+#define RTMP_MSG_DATA_AMF0 18
+#define RTMP_MSG_COMMAND_AMF0 20
+
+// User control events
+#define RTMP_EVENT_STREAM_BEGIN 0
+#define RTMP_EVENT_PING_REQUEST 6
+#define RTMP_EVENT_PING_RESPONSE 7
+
+// Chunk stream ids used for outgoing messages
+#define RTMP_CSID_CONTROL 2
+#define RTMP_CSID_COMMAND 3
+#define RTMP_CSID_AUDIO 4
+#define RTMP_CSID_DATA 5
+#define RTMP_CSID_VIDEO 6
+
+#define RTMP_DEFAULT_CHUNK_SIZE 128
+#define RTMP_RELAY_CHUNK_SIZE 4096
+#define RTMP_RELAY_MAX_CHUNK_SIZE 65536 // used when the peer shows it handles large chunks
+#define RTMP_DEFAULT_WINDOW_ACK_SIZE 2500000
+#define RTMP_HANDSHAKE_SIZE 1536
+#define RTMP_MAX_MESSAGE_SIZE (16 * 1024 * 1024)
+#define RTMP_MAX_CHUNK_HEADER_SIZE 16 // basic + type 0 header + extended timestamp
+#define RTMP_BATCH_MAX_MESSAGES 256    // messages framed before a batch is written out
+
+// AMF0 values
+enum class AmfType : uint8_t {
+    Number = 0x00,
+    Boolean = 0x01,
+    String = 0x02,
+    Object = 0x03,
+    Null = 0x05,
+    Undefined = 0x06,
+    EcmaArray = 0x08,
+    ObjectEnd = 0x09,
+    StrictArray = 0x0a,
+};
+
+struct AmfValue {
+    AmfType type = AmfType::Null;
+    double number = 0.0;
+    bool boolean = false;
+    std::string string;
+    std::vector<std::pair<std::string, AmfValue>> properties;
+    std::vector<AmfValue> elements;
+
+    const AmfValue *get(const std::string &key) const;
+    std::string getString(const std::string &key) const;
+};
+
+class AmfWriter {
+public:
+    void writeNumber(double value);
+    void writeBool(bool value);
+    void writeString(const std::string &value);
+    void writeNull();
+    void beginObject();
+    void writeKey(const std::string &key);
+    void endObject();
+
+    void writeProperty(const std::string &key, const std::string &value);
+    void writeProperty(const std::string &key, double value);
+
+    const std::vector<uint8_t> &data() const { return buffer; }
+
+private:
+    void writeRawString(const std::string &value);
+
+    std::vector<uint8_t> buffer;
+};
+
+// Decodes a sequence of AMF0 values; returns false on malformed input
+bool amfDecode(const uint8_t *data, size_t size, std::vector<AmfValue> &values);
+
+struct RtmpMessage {
+    uint8_t type = 0;
+    uint32_t streamId = 0;
+    uint32_t timestamp = 0;
+    RelayBytes payload;
+};
+
+// Incremental chunk stream parser
+class RtmpChunkReader {
+public:
+    // Consumes bytes and appends every completed message to messages.
+    // Returns false on a protocol violation.
+    bool feed(const uint8_t *data, size_t size, std::vector<RtmpMessage> &messages);
+    void setChunkSize(uint32_t size) { chunkSize = size; }
+    uint32_t currentChunkSize() const { return chunkSize; }
+
+private:
+    struct ChunkStream {
+        uint32_t timestamp = 0;
+        uint32_t timestampDelta = 0;
+        uint32_t length = 0;
+        uint32_t streamId = 0;
+        uint8_t type = 0;
+        bool extendedTimestamp = false;
+        bool hasHeader = false;
+        RelayBytes payload;
+    };
+
+    // Returns bytes consumed, 0 when more data is needed, -1 on error
+    long parseChunk(const uint8_t *data, size_t size, std::vector<RtmpMessage> &messages);
+
+    std::unordered_map<uint32_t, ChunkStream> streams;
+    std::vector<uint8_t> pending;
+    uint32_t chunkSize = RTMP_DEFAULT_CHUNK_SIZE;
+};
+
+// Chunk headers for one message: a type 0 header in front of the first
+// chunk and the same type 3 header in front of every following one
+struct RtmpChunkHeaders {
+    uint8_t first[RTMP_MAX_CHUNK_HEADER_SIZE];
+    size_t firstSize = 0;
+    uint8_t continuation[5];
+    size_t continuationSize = 0;
+};
+
+void rtmpBuildChunkHeaders(RtmpChunkHeaders &headers, uint32_t csid, uint8_t type, uint32_t streamId,
+                           uint32_t timestamp, size_t length);
+
+// Frames the payload as chunks by interleaving the headers with slices of
+// the caller's bytes; nothing is copied, so headers and payload must
+// outlive the write
+void rtmpAppendMessageSlices(std::vector<RelayIoSlice> &slices, const RtmpChunkHeaders &headers,
+                             uint32_t chunkSize, const uint8_t *payload, size_t length);
+
+bool rtmpClientHandshake(RelaySocket &socket, int timeoutMs);
+bool rtmpServerHandshake(RelaySocket &socket, int timeoutMs);
+// S0S1S2 answering a complete C0C1, for servers that read it themselves
+std::vector<uint8_t> rtmpServerHandshakeReply(const uint8_t *c0c1);
+
+struct RtmpUrl {
+    std::string host;
+    uint16_t port = 1935;
+    std::string app;
+    std::string tcUrl;
+};
+
+// Parses rtmp://host[:port]/app[/...]; the stream key is kept separately
+bool parseRtmpUrl(const std::string &url, RtmpUrl &out);
+
+// A handshaken RTMP session that transparently handles protocol control
+// messages (chunk size, acknowledgements, pings) in both directions.
+class RtmpConnection {
+public:
+    RtmpConnection() = default;
+    explicit RtmpConnection(RelaySocket socket) : sock(std::move(socket)) {}
+
+    RelaySocket &socket() { return sock; }
+
+    bool sendMessage(uint32_t csid, uint8_t type, uint32_t streamId, uint32_t timestamp,
+                     const uint8_t *payload, size_t length);
+    // Frames a message into the current batch: its chunk headers go to a
+    // small arena, the payload is referenced, not copied, so it has to
+    // stay alive until flushBatch(). A full batch is written out first.
+    bool queueMessage(uint32_t csid, uint8_t type, uint32_t streamId, uint32_t timestamp,
+                      const uint8_t *payload, size_t length);
+    // Writes every queued message with as few vectored writes as the
+    // iovec limit allows; sendMessage() is queueMessage() plus this
+    bool flushBatch();
+    bool sendCommand(uint32_t streamId, const AmfWriter &command);
+    bool setOutgoingChunkSize(uint32_t size);
+    bool sendWindowAckSize(uint32_t size);
+    bool sendPeerBandwidth(uint32_t size);
+    bool sendUserControl(uint16_t event, uint32_t value);
+    // Bytes outside the chunk stream, such as the server handshake
+    bool sendRaw(const uint8_t *data, size_t size);
+
+    // Waits up to timeoutMs for data and appends non-control messages.
+    // Returns false when the connection failed or was closed.
+    bool readMessages(std::vector<RtmpMessage> &messages, int timeoutMs);
+    // Same for bytes the caller read from the socket itself
+    bool receive(const uint8_t *data, size_t size, std::vector<RtmpMessage> &messages);
+
+    // In non-blocking mode whatever part of a message the socket cannot
+    // take is buffered, later messages queue up behind it so chunks never
+    // interleave, and flush() continues once the socket is writable
+    bool setNonBlocking(bool enabled);
+    bool flush();
+    bool hasPendingOutput() const { return pendingOffset < pendingOutput.size(); }
+    size_t pendingBytes() const { return pendingOutput.size() - pendingOffset; }
+    // Deferred writes never touch the socket: everything is buffered and
+    // the owner sends pendingData() itself (e.g. through io_uring), then
+    // reports what went out with consumePending()
+    void setDeferredWrites(bool enabled) { deferredWrites = enabled; }
+    const uint8_t *pendingData() const { return pendingOutput.data() + pendingOffset; }
+    void consumePending(size_t bytes);
+
+    uint32_t outgoingChunkSize() const { return outChunkSize; }
+    // What the peer announced with Set Chunk Size for its own messages
+    uint32_t incomingChunkSize() const { return reader.currentChunkSize(); }
+    const std::string &lastError() const { return error; }
+    void close() { sock.close(); }
+
+private:
+    bool handleControl(const RtmpMessage &message);
+    bool writeBatch();
+
+    RelaySocket sock;
+    RtmpChunkReader reader;
+    uint32_t outChunkSize = RTMP_DEFAULT_CHUNK_SIZE;
+    uint32_t ackWindow = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t lastAckSent = 0;
+    std::vector<RtmpChunkHeaders> headerArena; // RTMP_BATCH_MAX_MESSAGES, never reallocated
+    size_t batchMessages = 0;
+    std::vector<RelayIoSlice> writeSlices;
+    bool nonBlocking = false;
+    bool deferredWrites = false;
+    std::vector<uint8_t> pendingOutput;
+    size_t pendingOffset = 0;
+    std::string error;
+};
@@ -0,0 +1,736 @@
+#include "relay-shard.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "relay-common.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define relay_poll WSAPoll
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#define relay_poll poll
+#endif
+
+#define SHARD_MAX_EVENTS 256
+#define SHARD_IDLE_TIMEOUT_MS 1000
+
+static thread_local RelayShard *currentShard = nullptr;
+
+static void pinToCpu(int cpu)
+{
+    if (cpu < 0) {
+        return;
+    }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        PLUGIN_LOG_WARNING("Cannot pin relay shard to CPU %d", cpu);
+    }
+#elif defined(_WIN32)
+    if (cpu < (int)(sizeof(DWORD_PTR) * 8)) {
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+    }
+#else
+    // macOS only takes affinity hints; leave placement to the kernel
+    (void)cpu;
+#endif
+}
+
+// RelayShard ---------------------------------------------------------------
+
+RelayShard::RelayShard(size_t index, int cpu, RelaySendBackend backend)
+    : shardIndex(index), cpu(cpu), sendBackend(backend)
+{
+}
+
+RelayShard::~RelayShard()
+{
+    stop();
+}
+
+RelayShard *RelayShard::current()
+{
+    return currentShard;
+}
+
+bool RelayShard::start()
+{
+    if (running) {
+        return true;
+    }
+    if (!openWakeup()) {
+        return false;
+    }
+    if (sendBackend == RelaySendBackend::IoUring && !openUring()) {
+        PLUGIN_LOG_WARNING("Shard %zu: %s, using plain sends", shardIndex, uring.lastError().c_str());
+    }
+    stopping = false;
+    running = true;
+    thread = std::thread(&RelayShard::run, this);
+    return true;
+}
+
+void RelayShard::stop()
+{
+    if (!running) {
+        return;
+    }
+    stopping = true;
+    signalWakeup();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    running = false;
+    uring.close();
+    uringChains.clear();
+    bufferWaiters.clear();
+    closeWakeup();
+}
+
+void RelayShard::run()
+{
+    currentShard = this;
+    pinToCpu(cpu);
+
+    while (true) {
+        runInbox();
+        runReady();
+        int timeoutMs = runTimers();
+        if (stopping && offloaded == 0) {
+            break;
+        }
+        // Everything handlers queued on the ring this iteration goes out
+        // together
+        // Writes to sockets with room complete during the submit itself
+        submitUring();
+        reapUring();
+        if (!ready.empty() || uring.hasUnsubmitted()) {
+            timeoutMs = 0;
+        }
+        pollOnce(timeoutMs);
+    }
+
+    // Whatever is still attached belongs to owners that stop it inline now
+    runInbox();
+    currentShard = nullptr;
+}
+
+void RelayShard::runInbox()
+{
+    std::vector<std::function<void()>> tasks;
+    std::vector<RelayShardHandler *> wakes;
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+        tasks.swap(inboxTasks);
+        wakes.swap(inboxWakes);
+        wakeupSignalled = false;
+    }
+
+    ready.insert(ready.end(), wakes.begin(), wakes.end());
+    for (auto &task : tasks) {
+        task();
+    }
+}
+
+void RelayShard::runReady()
+{
+    // Handlers woken while this runs wait for the next iteration
+    std::vector<RelayShardHandler *> batch;
+    batch.swap(ready);
+    for (auto *handler : batch) {
+        if (handlers.count(handler)) {
+            handler->onWake();
+        }
+    }
+}
+
+int RelayShard::runTimers()
+{
+    while (!timers.empty()) {
+        auto first = timers.begin();
+        uint64_t now = relayNowMs();
+        if (first->first.first > now) {
+            uint64_t wait = first->first.first - now;
+            return wait < SHARD_IDLE_TIMEOUT_MS ? (int)wait : SHARD_IDLE_TIMEOUT_MS;
+        }
+        std::function<void()> callback = std::move(first->second);
+        timerDeadlines.erase(first->first.second);
+        timers.erase(first);
+        callback();
+    }
+    return SHARD_IDLE_TIMEOUT_MS;
+}
+
+void RelayShard::attach(RelayShardHandler *handler)
+{
+    handlers.insert(handler);
+}
+
+void RelayShard::detach(RelayShardHandler *handler)
+{
+    handlers.erase(handler);
+    cancelSends(handler);
+    for (auto it = watches.begin(); it != watches.end();) {
+        if (it->second.handler == handler) {
+            pollerRemove(it->first);
+            it = watches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Stale entries in ready are skipped by runReady()
+}
+
+bool RelayShard::watch(relay_socket_t fd, RelayShardHandler *handler, int events)
+{
+    if (!pollerAdd(fd, events)) {
+        return false;
+    }
+    watches[fd] = {handler, events};
+    return true;
+}
+
+bool RelayShard::modify(relay_socket_t fd, int events)
+{
+    auto it = watches.find(fd);
+    if (it == watches.end() || it->second.events == events) {
+        return it != watches.end();
+    }
+    it->second.events = events;
+    return pollerModify(fd, events);
+}
+
+void RelayShard::unwatch(relay_socket_t fd)
+{
+    if (watches.erase(fd)) {
+        pollerRemove(fd);
+    }
+}
+
+RelayShard::TimerId RelayShard::addTimer(int delayMs, std::function<void()> callback)
+{
+    TimerId id = nextTimerId++;
+    uint64_t deadline = relayNowMs() + (uint64_t)(delayMs > 0 ? delayMs : 0);
+    timers.emplace(std::make_pair(deadline, id), std::move(callback));
+    timerDeadlines[id] = deadline;
+    return id;
+}
+
+void RelayShard::cancelTimer(TimerId id)
+{
+    auto it = timerDeadlines.find(id);
+    if (it != timerDeadlines.end()) {
+        timers.erase(std::make_pair(it->second, id));
+        timerDeadlines.erase(it);
+    }
+}
+
+void RelayShard::post(std::function<void()> task)
+{
+    bool signal = false;
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+        inboxTasks.push_back(std::move(task));
+        signal = !wakeupSignalled;
+        wakeupSignalled = true;
+    }
+    if (signal) {
+        signalWakeup();
+    }
+}
+
+void RelayShard::invoke(const std::function<void()> &task)
+{
+    if (currentShard == this || !running || thread.get_id() == std::thread::id()) {
+        task();
+        return;
+    }
+
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    bool done = false;
+    post([&]() {
+        task();
+        std::lock_guard<std::mutex> lock(doneMutex);
+        done = true;
+        doneCondition.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&]() { return done; });
+}
+
+void RelayShard::wake(RelayShardHandler *handler)
+{
+    if (currentShard == this) {
+        ready.push_back(handler);
+        return;
+    }
+
+    bool signal = false;
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+        inboxWakes.push_back(handler);
+        signal = !wakeupSignalled;
+        wakeupSignalled = true;
+    }
+    if (signal) {
+        signalWakeup();
+    }
+}
+
+void RelayShard::offload(std::function<void()> work, std::function<void()> completion)
+{
+    offloaded++;
+    std::thread([this, work = std::move(work), completion = std::move(completion)]() mutable {
+        work();
+        post([this, completion = std::move(completion)]() {
+            if (completion) {
+                completion();
+            }
+            offloaded--;
+        });
+    }).detach();
+}
+
+long RelayShard::sendRing(RelayShardHandler *handler, relay_socket_t fd, const uint8_t *data, size_t size)
+{
+    size_t bufferSize = uring.bufferSize();
+    size_t count = (size + bufferSize - 1) / bufferSize;
+    count = std::min({count, (size_t)RELAY_URING_MAX_CHAIN, uring.freeBufferCount()});
+    // The chain has to sit in the queue in one piece, or its link would
+    // reach into whatever is queued next
+    if (count > uring.freeSubmissions() && !uring.submit()) {
+        PLUGIN_LOG_WARNING("Shard %zu: %s", shardIndex, uring.lastError().c_str());
+        return -1;
+    }
+    if (count == 0 || count > uring.freeSubmissions()) {
+        bufferWaiters.push_back(handler);
+        return 0;
+    }
+
+    uint64_t id = nextSendId++;
+    UringChain &chain = uringChains[id];
+    chain.handler = handler;
+    chain.count = (unsigned)count;
+    size_t taken = 0;
+    for (unsigned i = 0; i < chain.count; i++) {
+        chain.buffers[i] = uring.acquireBuffer();
+        chain.lengths[i] = std::min(bufferSize, size - taken);
+        memcpy(uring.buffer(chain.buffers[i]), data + taken, chain.lengths[i]);
+        uring.prepareSend((int)fd, chain.buffers[i], chain.lengths[i], id << RELAY_URING_CHAIN_SHIFT | i,
+                          i + 1 < chain.count);
+        taken += chain.lengths[i];
+    }
+    return (long)taken;
+}
+
+void RelayShard::cancelSends(RelayShardHandler *handler)
+{
+    // The writes themselves complete; only their buffers come back
+    for (auto &chain : uringChains) {
+        if (chain.second.handler == handler) {
+            chain.second.handler = nullptr;
+        }
+    }
+    for (auto &waiter : bufferWaiters) {
+        if (waiter == handler) {
+            waiter = nullptr;
+        }
+    }
+}
+
+bool RelayShard::openUring()
+{
+    if (!uring.open(RELAY_URING_ENTRIES, RELAY_URING_BUFFERS, RELAY_URING_BUFFER_SIZE)) {
+        return false;
+    }
+    if (!pollerAdd(uring.fd(), RELAY_SHARD_READABLE)) {
+        uring.close();
+        return false;
+    }
+    return true;
+}
+
+void RelayShard::submitUring()
+{
+    if (uring.hasUnsubmitted() && !uring.submit()) {
+        PLUGIN_LOG_WARNING("Shard %zu: %s", shardIndex, uring.lastError().c_str());
+    }
+}
+
+void RelayShard::reapUring()
+{
+    uring.reap([this](uint64_t userData, int result) {
+        auto it = uringChains.find(userData >> RELAY_URING_CHAIN_SHIFT);
+        if (it == uringChains.end()) {
+            return;
+        }
+        UringChain &chain = it->second;
+        unsigned index = (unsigned)(userData & ((1u << RELAY_URING_CHAIN_SHIFT) - 1));
+        uring.releaseBuffer(chain.buffers[index]);
+
+        // Links end at the first short or failed write; anything written
+        // after one would leave a hole in the stream
+        if (result < 0) {
+            if (!chain.broken) {
+                chain.error = result;
+            }
+            chain.broken = true;
+        } else if (chain.broken) {
+            if (result > 0) {
+                chain.error = -EIO;
+                chain.written = 0;
+            }
+        } else {
+            chain.written += result;
+            chain.broken = (size_t)result < chain.lengths[index];
+        }
+        if (++chain.completed < chain.count) {
+            return;
+        }
+
+        RelayShardHandler *handler = chain.handler;
+        int outcome = chain.written > 0 ? (int)chain.written : chain.error;
+        uringChains.erase(it);
+        if (handler && handlers.count(handler)) {
+            handler->onSendComplete(outcome);
+        }
+    });
+
+    // Handlers that found no free buffer retry on their next wakeup
+    for (auto *waiter : bufferWaiters) {
+        if (waiter) {
+            ready.push_back(waiter);
+        }
+    }
+    bufferWaiters.clear();
+}
+
+void RelayShard::dispatch(relay_socket_t fd, int events)
+{
+    // Looked up per event: an earlier handler in the batch may have
+    // dropped this socket
+    auto it = watches.find(fd);
+    if (it != watches.end() && handlers.count(it->second.handler)) {
+        it->second.handler->onSocketEvent(events);
+    }
+}
+
+#ifdef __linux__
+
+// epoll + eventfd ----------------------------------------------------------
+
+static uint32_t epollEvents(int events)
+{
+    uint32_t flags = 0;
+    if (events & RELAY_SHARD_READABLE) {
+        flags |= EPOLLIN;
+    }
+    if (events & RELAY_SHARD_WRITABLE) {
+        flags |= EPOLLOUT;
+    }
+    return flags;
+}
+
+bool RelayShard::openWakeup()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0) {
+        error = "Cannot create the shard event loop (" + std::to_string(errno) + ")";
+        closeWakeup();
+        return false;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    return true;
+}
+
+void RelayShard::closeWakeup()
+{
+    if (wakeFd >= 0) {
+        ::close(wakeFd);
+        wakeFd = -1;
+    }
+    if (epollFd >= 0) {
+        ::close(epollFd);
+        epollFd = -1;
+    }
+}
+
+void RelayShard::signalWakeup()
+{
+    uint64_t one = 1;
+    ssize_t rc = ::write(wakeFd, &one, sizeof(one));
+    (void)rc;
+}
+
+void RelayShard::drainWakeup()
+{
+    uint64_t count;
+    ssize_t rc = ::read(wakeFd, &count, sizeof(count));
+    (void)rc;
+}
+
+bool RelayShard::pollerAdd(relay_socket_t fd, int events)
+{
+    epoll_event event = {};
+    event.events = epollEvents(events);
+    event.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool RelayShard::pollerModify(relay_socket_t fd, int events)
+{
+    epoll_event event = {};
+    event.events = epollEvents(events);
+    event.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void RelayShard::pollerRemove(relay_socket_t fd)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void RelayShard::pollOnce(int timeoutMs)
+{
+    epoll_event events[SHARD_MAX_EVENTS];
+    int count = epoll_wait(epollFd, events, SHARD_MAX_EVENTS, timeoutMs);
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wakeFd) {
+            drainWakeup();
+            continue;
+        }
+        if (fd == uring.fd()) {
+            reapUring();
+            continue;
+        }
+        // Errors and hangups surface through the handler's next read
+        uint32_t flags = events[i].events;
+        int mask = (flags & (EPOLLIN | EPOLLERR | EPOLLHUP) ? RELAY_SHARD_READABLE : 0) |
+                    (flags & EPOLLOUT ? RELAY_SHARD_WRITABLE : 0);
+        dispatch(fd, mask);
+    }
+}
+
+#else
+
+// poll() + self-pipe (a loopback datagram socket on Windows) ---------------
+
+static short pollEvents(int events)
+{
+    return (short)((events & RELAY_SHARD_READABLE ? POLLIN : 0) | (events & RELAY_SHARD_WRITABLE ? POLLOUT : 0));
+}
+
+bool RelayShard::openWakeup()
+{
+#ifdef _WIN32
+    RelaySocket::initialize();
+    relay_socket_t fd = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int length = sizeof(addr);
+    if (fd == INVALID_SOCKET || ::bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(fd, (sockaddr *)&addr, &length) != 0 || ::connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (fd != INVALID_SOCKET) {
+            closesocket(fd);
+        }
+        error = "Cannot create the shard wakeup socket";
+        return false;
+    }
+    u_long nonBlocking = 1;
+    ioctlsocket(fd, FIONBIO, &nonBlocking);
+    wakeRead = wakeWrite = fd;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        error = "Cannot create the shard wakeup pipe";
+        return false;
+    }
+    for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    wakeRead = fds[0];
+    wakeWrite = fds[1];
+#endif
+    pollSetDirty = true;
+    return true;
+}
+
+void RelayShard::closeWakeup()
+{
+#ifdef _WIN32
+    if (wakeRead != RELAY_INVALID_SOCKET) {
+        closesocket(wakeRead);
+    }
+#else
+    if (wakeRead != RELAY_INVALID_SOCKET) {
+        ::close(wakeRead);
+        ::close(wakeWrite);
+    }
+#endif
+    wakeRead = wakeWrite = RELAY_INVALID_SOCKET;
+}
+
+void RelayShard::signalWakeup()
+{
+    char byte = 1;
+#ifdef _WIN32
+    ::send(wakeWrite, &byte, 1, 0);
+#else
+    ssize_t rc = ::write(wakeWrite, &byte, 1);
+    (void)rc;
+#endif
+}
+
+void RelayShard::drainWakeup()
+{
+    char buffer[256];
+#ifdef _WIN32
+    while (::recv(wakeRead, buffer, sizeof(buffer), 0) > 0) {
+    }
+#else
+    while (::read(wakeRead, buffer, sizeof(buffer)) > 0) {
+    }
+#endif
+}
+
+bool RelayShard::pollerAdd(relay_socket_t fd, int events)
+{
+    (void)fd;
+    (void)events;
+    pollSetDirty = true;
+    return true;
+}
+
+bool RelayShard::pollerModify(relay_socket_t fd, int events)
+{
+    return pollerAdd(fd, events);
+}
+
+void RelayShard::pollerRemove(relay_socket_t fd)
+{
+    (void)fd;
+    pollSetDirty = true;
+}
+
+void RelayShard::pollOnce(int timeoutMs)
+{
+    if (pollSetDirty) {
+        pollSet.clear();
+        pollSet.push_back({wakeRead, POLLIN, 0});
+        for (const auto &watch : watches) {
+            pollSet.push_back({watch.first, pollEvents(watch.second.events), 0});
+        }
+        pollSetDirty = false;
+    }
+
+    // Dispatch may change the watch set, so work on a copy of the results
+    std::vector<struct pollfd> results = pollSet;
+    int count = relay_poll(results.data(), (unsigned long)results.size(), timeoutMs);
+    for (size_t i = 0; count > 0 && i < results.size(); i++) {
+        short flags = results[i].revents;
+        if (flags == 0) {
+            continue;
+        }
+        count--;
+        if (results[i].fd == wakeRead) {
+            drainWakeup();
+            continue;
+        }
+        int mask = (flags & (POLLIN | POLLERR | POLLHUP) ? RELAY_SHARD_READABLE : 0) |
+                    (flags & POLLOUT ? RELAY_SHARD_WRITABLE : 0);
+        dispatch(results[i].fd, mask);
+    }
+}
+
+#endif
+
+// RelayScheduler -----------------------------------------------------------
+
+RelayScheduler::RelayScheduler(size_t workers, RelaySendBackend backend)
+{
+    std::vector<int> cpus = usableCpus();
+    if (workers == 0) {
+        workers = cpus.size();
+    }
+    for (size_t i = 0; i < workers; i++) {
+        // More shards than CPUs share cores and stay unpinned
+        int cpu = workers <= cpus.size() ? cpus[i] : -1;
+        shards.push_back(std::make_unique<RelayShard>(i, cpu, backend));
+    }
+}
+
+RelayScheduler::~RelayScheduler()
+{
+    stop();
+}
+
+bool RelayScheduler::start()
+{
+    for (auto &shard : shards) {
+        if (!shard->start()) {
+            error = shard->lastError();
+            stop();
+            return false;
+        }
+    }
+    PLUGIN_LOG_INFO("Relay scheduler running %zu shard(s)%s", shards.size(),
+                    shards[0]->usesUring() ? " with io_uring sends" : "");
+    return true;
+}
+
+void RelayScheduler::stop()
+{
+    for (auto &shard : shards) {
+        shard->stop();
+    }
+}
+
+RelayShard *RelayScheduler::next()
+{
+    return shards[nextShard.fetch_add(1, std::memory_order_relaxed) % shards.size()].get();
+}
+
+std::vector<int> RelayScheduler::usableCpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    // Honours cgroup/taskset limits, unlike hardware_concurrency()
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        unsigned count = std::thread::hardware_concurrency();
+        for (unsigned cpu = 0; cpu < (count ? count : 1); cpu++) {
+            cpus.push_back((int)cpu);
+        }
+    }
+    return cpus;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+/*
+ * Per-core event loops.
+ *
+ * A RelayScheduler runs one RelayShard per CPU: a thread pinned to its
+ * core with its own poller (epoll on Linux, poll() elsewhere), timers and
+ * handlers. Ingest sessions and destination senders each belong to exactly
+ * one shard and are only ever touched by its thread, so shards share no
+ * locks on the packet path. Other threads reach a shard through its inbox
+ * (posted tasks and wakeups), whose lock is taken when work is handed
+ * over, not per packet. Work that has to block, like connecting to a
+ * platform, is offloaded to a helper thread and its result comes back to
+ * the shard as a task.
+ *
+ * With the io_uring send backend (Linux) destinations do not write to
+ * their sockets themselves: they hand bytes to their shard's ring, which
+ * submits all of an iteration's writes with one system call.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(__linux__)
+#include <poll.h>
+#endif
+
+#include "relay-socket.h"
+#include "relay-uring.h"
+
+#define RELAY_SHARD_READABLE 1
+#define RELAY_SHARD_WRITABLE 2
+
+// io_uring ring per shard: 64 x 128 KB send buffers, and up
+// to 8 of them (1 MB) per send
+#define RELAY_URING_ENTRIES 256
+#define RELAY_URING_BUFFERS 64
+#define RELAY_URING_BUFFER_SIZE (128 * 1024)
+#define RELAY_URING_MAX_CHAIN 8
+#define RELAY_URING_CHAIN_SHIFT 4 // user data: send id, then the write's place in it
+
+// How destinations write to their sockets
+enum class RelaySendBackend {
+    Sockets, // non-blocking sends driven by the poller
+    IoUring, // sends batched per loop iteration; Sockets where unavailable
+};
+
+// Something a shard drives; every callback runs on the shard's thread
+class RelayShardHandler {
+public:
+    virtual ~RelayShardHandler() = default;
+    // Readiness of the socket registered with RelayShard::watch()
+    virtual void onSocketEvent(int events) { (void)events; }
+    // Requested through RelayShard::wake(), possibly from another thread
+    virtual void onWake() {}
+    // Result of a RelayShard::sendRing(): bytes written or -errno
+    virtual void onSendComplete(int result) { (void)result; }
+};
+
+class RelayShard {
+public:
+    using TimerId = uint64_t;
+
+    // cpu < 0 leaves the thread unpinned
+    RelayShard(size_t index, int cpu, RelaySendBackend backend = RelaySendBackend::Sockets);
+    ~RelayShard();
+
+    bool start();
+    // Waits for offloaded work to come back, then ends the loop
+    void stop();
+
+    // Shard thread only. A handler must be attached before it is woken or
+    // watches a socket; detaching drops its socket and pending wakeups.
+    void attach(RelayShardHandler *handler);
+    void detach(RelayShardHandler *handler);
+    bool watch(relay_socket_t fd, RelayShardHandler *handler, int events);
+    bool modify(relay_socket_t fd, int events);
+    void unwatch(relay_socket_t fd);
+    TimerId addTimer(int delayMs, std::function<void()> callback);
+    void cancelTimer(TimerId id);
+
+    // Shard thread only, with the io_uring backend running. Copies up to
+    // RELAY_URING_MAX_CHAIN ring buffers of data and queues their
+    // sends, linked so they run in order; returns the bytes taken, 0 when
+    // every buffer is in flight (the handler is woken once one comes back)
+    // or -1 if the ring failed. onSendComplete() then reports the bytes
+    // that went out in one piece. Keep one send per socket in flight,
+    // since it may complete short.
+    bool usesUring() const { return uring.isOpen(); }
+    long sendRing(RelayShardHandler *handler, relay_socket_t fd, const uint8_t *data, size_t size);
+    // Completions of the handler's sends still in flight are dropped
+    void cancelSends(RelayShardHandler *handler);
+
+    // Any thread
+    void post(std::function<void()> task);
+    // Runs the task on the shard and waits for it; runs it right away when
+    // called on the shard or while the loop is not running
+    void invoke(const std::function<void()> &task);
+    void wake(RelayShardHandler *handler);
+    // Runs work on a helper thread, then completion on this shard
+    void offload(std::function<void()> work, std::function<void()> completion);
+
+    // The shard whose thread is calling, if any
+    static RelayShard *current();
+    size_t index() const { return shardIndex; }
+    const std::string &lastError() const { return error; }
+
+private:
+    struct Watch {
+        RelayShardHandler *handler = nullptr;
+        int events = 0;
+    };
+
+    void run();
+    void runInbox();
+    void runReady();
+    int runTimers();
+    void pollOnce(int timeoutMs);
+    void dispatch(relay_socket_t fd, int events);
+    bool openUring();
+    void submitUring();
+    void reapUring();
+    bool openWakeup();
+    void closeWakeup();
+    void signalWakeup();
+    void drainWakeup();
+    bool pollerAdd(relay_socket_t fd, int events);
+    bool pollerModify(relay_socket_t fd, int events);
+    void pollerRemove(relay_socket_t fd);
+
+    size_t shardIndex;
+    int cpu;
+    RelaySendBackend sendBackend;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> offloaded{0};
+    std::string error;
+
+    // Inbox: the only state other threads touch
+    std::mutex inboxMutex;
+    std::vector<std::function<void()>> inboxTasks;
+    std::vector<RelayShardHandler *> inboxWakes;
+    bool wakeupSignalled = false;
+
+    // Owned by the shard thread
+    std::unordered_set<RelayShardHandler *> handlers;
+    std::vector<RelayShardHandler *> ready;
+    std::unordered_map<relay_socket_t, Watch> watches;
+    std::map<std::pair<uint64_t, TimerId>, std::function<void()>> timers;
+    std::unordered_map<TimerId, uint64_t> timerDeadlines;
+    TimerId nextTimerId = 1;
+
+    // io_uring sends in flight, by id
+    struct UringChain {
+        RelayShardHandler *handler = nullptr;
+        int buffers[RELAY_URING_MAX_CHAIN] = {};
+        size_t lengths[RELAY_URING_MAX_CHAIN] = {};
+        unsigned count = 0;
+        unsigned completed = 0;
+        long written = 0;
+        int error = 0;
+        bool broken = false;
+    };
+    RelayUring uring;
+    std::unordered_map<uint64_t, UringChain> uringChains;
+    std::vector<RelayShardHandler *> bufferWaiters;
+    uint64_t nextSendId = 1;
+
+    // Poller and its wakeup channel
+#ifdef __linux__
+    int epollFd = -1;
+    int wakeFd = -1;
+#else
+    bool pollSetDirty = true;
+    std::vector<struct pollfd> pollSet;
+    relay_socket_t wakeRead = RELAY_INVALID_SOCKET;
+    relay_socket_t wakeWrite = RELAY_INVALID_SOCKET;
+#endif
+};
+
+class RelayScheduler {
+public:
+    // workers == 0 runs one shard per CPU the process may use
+    explicit RelayScheduler(size_t workers = 0, RelaySendBackend backend = RelaySendBackend::Sockets);
+    ~RelayScheduler();
+
+    bool start();
+    void stop();
+
+    size_t size() const { return shards.size(); }
+    RelayShard &shard(size_t index) { return *shards[index]; }
+    // Shards in turn, for new sessions
+    RelayShard *next();
+    const std::string &lastError() const { return error; }
+
+    // CPUs this process may run on
+    static std::vector<int> usableCpus();
+
+private:
+    std::vector<std::unique_ptr<RelayShard>> shards;
+    std::atomic<size_t> nextShard{0};
+    std::string error;
+};
@@ -0,0 +1,514 @@
+#include "relay-socket.h"
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+#include <mstcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#define relay_poll WSAPoll
+#define RELAY_WOULD_BLOCK(err) ((err) == WSAEWOULDBLOCK || (err) == WSAEINPROGRESS)
+static int relayLastError() { return WSAGetLastError(); }
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define relay_poll poll
+#define closesocket ::close
+#define RELAY_WOULD_BLOCK(err) ((err) == EWOULDBLOCK || (err) == EAGAIN || (err) == EINPROGRESS)
+static int relayLastError() { return errno; }
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifdef __linux__
+#include <cstddef>
+
+// struct tcp_info as the kernel fills it. glibc's copy ends before the
+// unsent bytes and delivery rate; older kernels fill less of it, which the
+// returned size tells.
+struct RelayKernelTcpInfo {
+    uint8_t state, caState, retransmits, probes, backoff, options, windowScales;
+    uint8_t flags; // delivery_rate_app_limited:1, fastopen_client_fail:2
+    uint32_t rto, ato, sndMss, rcvMss;
+    uint32_t unacked, sacked, lost, retrans, fackets;
+    uint32_t lastDataSent, lastAckSent, lastDataRecv, lastAckRecv;
+    uint32_t pmtu, rcvSsthresh, rtt, rttvar, sndSsthresh, sndCwnd, advmss, reordering;
+    uint32_t rcvRtt, rcvSpace;
+    uint32_t totalRetrans;
+    uint64_t pacingRate, maxPacingRate, bytesAcked, bytesReceived;
+    uint32_t segsOut, segsIn;
+    uint32_t notsentBytes, minRtt, dataSegsIn, dataSegsOut;
+    uint64_t deliveryRate;
+};
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define RELAY_TCPI_APP_LIMITED 0x80
+#else
+#define RELAY_TCPI_APP_LIMITED 0x01
+#endif
+#endif
+
+RelaySocket::~RelaySocket()
+{
+    close();
+}
+
+RelaySocket::RelaySocket(RelaySocket &&other) noexcept
+    : handle(other.handle), error(std::move(other.error))
+{
+    other.handle = RELAY_INVALID_SOCKET;
+}
+
+RelaySocket &RelaySocket::operator=(RelaySocket &&other) noexcept
+{
+    if (this != &other) {
+        close();
+        handle = other.handle;
+        error = std::move(other.error);
+        other.handle = RELAY_INVALID_SOCKET;
+    }
+    return *this;
+}
+
+bool RelaySocket::initialize()
+{
+#ifdef _WIN32
+    static bool initialized = false;
+    if (!initialized) {
+        WSADATA data;
+        initialized = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+    return initialized;
+#else
+    return true;
+#endif
+}
+
+static bool setBlocking(relay_socket_t fd, bool blocking)
+{
+#ifdef _WIN32
+    u_long mode = blocking ? 0 : 1;
+    return ioctlsocket(fd, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return false;
+    }
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags) == 0;
+#endif
+}
+
+// macOS has no MSG_NOSIGNAL; a send to a reset peer would raise SIGPIPE
+// and take the daemon, or OBS, down with it
+static void suppressSigpipe(relay_socket_t fd)
+{
+#ifdef SO_NOSIGPIPE
+    int value = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (const char *)&value, sizeof(value));
+#else
+    (void)fd;
+#endif
+}
+
+bool RelaySocket::connectTo(const std::string &host, uint16_t port, int timeoutMs)
+{
+    close();
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *results = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &results) != 0 || !results) {
+        error = "Failed to resolve " + host;
+        return false;
+    }
+
+    for (addrinfo *ai = results; ai; ai = ai->ai_next) {
+        relay_socket_t fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd == RELAY_INVALID_SOCKET) {
+            continue;
+        }
+
+        suppressSigpipe(fd);
+        setBlocking(fd, false);
+        int rc = ::connect(fd, ai->ai_addr, (int)ai->ai_addrlen);
+        if (rc != 0 && RELAY_WOULD_BLOCK(relayLastError())) {
+            pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            rc = relay_poll(&pfd, 1, timeoutMs) == 1 ? 0 : -1;
+            if (rc == 0) {
+                int soError = 0;
+                socklen_t len = sizeof(soError);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *)&soError, &len);
+                rc = soError == 0 ? 0 : -1;
+            }
+        }
+
+        if (rc == 0) {
+            setBlocking(fd, true);
+            handle = fd;
+            freeaddrinfo(results);
+            setNoDelay(true);
+            return true;
+        }
+        closesocket(fd);
+    }
+
+    freeaddrinfo(results);
+    error = "Failed to connect to " + host + ":" + service;
+    return false;
+}
+
+bool RelaySocket::listenOn(uint16_t port, bool loopbackOnly)
+{
+    close();
+
+    relay_socket_t fd = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd == RELAY_INVALID_SOCKET) {
+        setError("socket");
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+    suppressSigpipe(fd);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+
+    if (::bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        handle = fd;
+        setError("bind/listen");
+        close();
+        return false;
+    }
+
+    handle = fd;
+    return true;
+}
+
+RelaySocket RelaySocket::accept()
+{
+    relay_socket_t fd = ::accept(handle, nullptr, nullptr);
+    if (fd == RELAY_INVALID_SOCKET) {
+        setError("accept");
+        return RelaySocket();
+    }
+
+    suppressSigpipe(fd);
+    RelaySocket client(fd);
+    client.setNoDelay(true);
+    return client;
+}
+
+long RelaySocket::readSome(void *buffer, size_t size)
+{
+    long n = (long)::recv(handle, (char *)buffer, (int)size, 0);
+    blocked = n < 0 && RELAY_WOULD_BLOCK(relayLastError());
+    if (n < 0) {
+        setError("recv");
+    }
+    return n;
+}
+
+bool RelaySocket::readExact(void *buffer, size_t size, int timeoutMs)
+{
+    auto *out = (uint8_t *)buffer;
+    while (size > 0) {
+        if (!waitReadable(timeoutMs)) {
+            if (error.empty()) {
+                error = "Timed out waiting for data";
+            }
+            return false;
+        }
+        long n = readSome(out, size);
+        if (n <= 0) {
+            if (n == 0) {
+                error = "Connection closed by peer";
+            }
+            return false;
+        }
+        out += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool RelaySocket::writeAll(const void *data, size_t size)
+{
+    auto *in = (const uint8_t *)data;
+    while (size > 0) {
+        long n = (long)::send(handle, (const char *)in, (int)size, MSG_NOSIGNAL);
+        if (n <= 0) {
+            setError("send");
+            return false;
+        }
+        in += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+long RelaySocket::sendSlices(const RelayIoSlice *slices, size_t count, size_t skip)
+{
+#ifdef _WIN32
+    WSABUF buffers[RELAY_SOCKET_MAX_IOV];
+#else
+    iovec buffers[RELAY_SOCKET_MAX_IOV];
+#endif
+    size_t used = 0;
+    for (size_t i = 0; i < count && used < RELAY_SOCKET_MAX_IOV; i++) {
+        size_t offset = i == 0 ? skip : 0;
+#ifdef _WIN32
+        buffers[used].buf = (char *)slices[i].data + offset;
+        buffers[used].len = (ULONG)(slices[i].size - offset);
+#else
+        buffers[used].iov_base = (uint8_t *)slices[i].data + offset;
+        buffers[used].iov_len = slices[i].size - offset;
+#endif
+        used++;
+    }
+
+    blocked = false;
+#ifdef _WIN32
+    DWORD sent = 0;
+    if (WSASend(handle, buffers, (DWORD)used, &sent, 0, nullptr, nullptr) != 0) {
+        blocked = RELAY_WOULD_BLOCK(relayLastError());
+        setError("WSASend");
+        return -1;
+    }
+    return (long)sent;
+#else
+    msghdr message = {};
+    message.msg_iov = buffers;
+    message.msg_iovlen = used;
+    ssize_t rc;
+    do {
+        rc = ::sendmsg(handle, &message, MSG_NOSIGNAL);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+        blocked = RELAY_WOULD_BLOCK(errno);
+        setError("sendmsg");
+        return -1;
+    }
+    return (long)rc;
+#endif
+}
+
+bool RelaySocket::writeVectored(const RelayIoSlice *slices, size_t count)
+{
+    size_t index = 0;
+    size_t offset = 0; // bytes of slices[index] already written
+
+    while (index < count) {
+        long rc = sendSlices(slices + index, count - index, offset);
+        if (rc <= 0) {
+            if (rc == 0) {
+                setError("sendmsg");
+            }
+            return false;
+        }
+
+        // Advance past everything the kernel accepted
+        size_t n = (size_t)rc;
+        while (index < count && n >= slices[index].size - offset) {
+            n -= slices[index].size - offset;
+            offset = 0;
+            index++;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+long RelaySocket::writeSome(const RelayIoSlice *slices, size_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+    long rc = sendSlices(slices, count, 0);
+    return rc < 0 && blocked ? 0 : rc;
+}
+
+bool RelaySocket::setNonBlocking(bool enabled)
+{
+    return setBlocking(handle, !enabled);
+}
+
+bool RelaySocket::waitReadable(int timeoutMs)
+{
+    if (!isValid()) {
+        return false;
+    }
+
+    pollfd pfd;
+    pfd.fd = handle;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int rc = relay_poll(&pfd, 1, timeoutMs);
+    if (rc < 0) {
+        setError("poll");
+        return false;
+    }
+    return rc > 0;
+}
+
+bool RelaySocket::setNoDelay(bool enabled)
+{
+    int value = enabled ? 1 : 0;
+    return setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char *)&value, sizeof(value)) == 0;
+}
+
+int64_t RelaySocket::roundTripTimeUs() const
+{
+#if defined(__linux__)
+    tcp_info info = {};
+    socklen_t size = sizeof(info);
+    if (getsockopt(handle, IPPROTO_TCP, TCP_INFO, &info, &size) == 0) {
+        return (int64_t)info.tcpi_rtt;
+    }
+#elif defined(__APPLE__)
+    tcp_connection_info info = {};
+    socklen_t size = sizeof(info);
+    if (getsockopt(handle, IPPROTO_TCP, TCP_CONNECTION_INFO, &info, &size) == 0) {
+        return (int64_t)info.tcpi_srtt * 1000;
+    }
+#elif defined(_WIN32) && defined(SIO_TCP_INFO)
+    // Windows 10 1703 and later
+    DWORD version = 0;
+    TCP_INFO_v0 info = {};
+    DWORD size = 0;
+    if (WSAIoctl(handle, SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &size, nullptr,
+                 nullptr) == 0) {
+        return (int64_t)info.RttUs;
+    }
+#endif
+    return -1;
+}
+
+bool RelaySocket::sendPathInfo(RelaySendPathInfo &info) const
+{
+    info = RelaySendPathInfo();
+#ifdef __linux__
+    RelayKernelTcpInfo kernel = {};
+    socklen_t size = sizeof(kernel);
+    if (getsockopt(handle, IPPROTO_TCP, TCP_INFO, &kernel, &size) != 0) {
+        return false;
+    }
+    info.rttUs = (int64_t)kernel.rtt;
+    if (size >= offsetof(RelayKernelTcpInfo, minRtt)) {
+        info.unsentBytes = (int64_t)kernel.notsentBytes;
+    }
+    if (size >= offsetof(RelayKernelTcpInfo, deliveryRate) + sizeof(kernel.deliveryRate)) {
+        info.deliveryRateBps = kernel.deliveryRate;
+        info.deliveryAppLimited = (kernel.flags & RELAY_TCPI_APP_LIMITED) != 0;
+    }
+    return true;
+#else
+    info.rttUs = roundTripTimeUs();
+    return info.rttUs >= 0;
+#endif
+}
+
+bool RelaySocket::setNotSentLowat(uint32_t bytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    unsigned int value = bytes;
+    if (setsockopt(handle, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char *)&value, sizeof(value)) == 0) {
+        return true;
+    }
+    setError("TCP_NOTSENT_LOWAT");
+#else
+    (void)bytes;
+    error = "TCP_NOTSENT_LOWAT is not supported on this platform";
+#endif
+    return false;
+}
+
+bool RelaySocket::setMaxPacingRate(uint64_t bytesPerSecond)
+{
+#ifdef SO_MAX_PACING_RATE
+    // 32 bits is what every kernel accepts, and ~4 GB/s is no limit here
+    unsigned int value = UINT32_MAX;
+    if (bytesPerSecond > 0 && bytesPerSecond < UINT32_MAX) {
+        value = (unsigned int)bytesPerSecond;
+    }
+    if (setsockopt(handle, SOL_SOCKET, SO_MAX_PACING_RATE, (const char *)&value, sizeof(value)) == 0) {
+        return true;
+    }
+    setError("SO_MAX_PACING_RATE");
+#else
+    (void)bytesPerSecond;
+    error = "SO_MAX_PACING_RATE is not supported on this platform";
+#endif
+    return false;
+}
+
+bool RelaySocket::setCongestionControl(const std::string &name)
+{
+#ifdef TCP_CONGESTION
+    if (setsockopt(handle, IPPROTO_TCP, TCP_CONGESTION, name.c_str(), (socklen_t)name.size()) == 0) {
+        return true;
+    }
+    setError("TCP_CONGESTION");
+#else
+    (void)name;
+    error = "Choosing the congestion control is not supported on this platform";
+#endif
+    return false;
+}
+
+bool RelaySocket::setRecvTimeout(int timeoutMs)
+{
+#ifdef _WIN32
+    DWORD value = (DWORD)timeoutMs;
+    return setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (const char *)&value, sizeof(value)) == 0;
+#else
+    timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    return setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0;
+#endif
+}
+
+void RelaySocket::shutdown()
+{
+    if (handle != RELAY_INVALID_SOCKET) {
+#ifdef _WIN32
+        ::shutdown(handle, SD_BOTH);
+#else
+        ::shutdown(handle, SHUT_RDWR);
+#endif
+    }
+}
+
+void RelaySocket::close()
+{
+    if (handle != RELAY_INVALID_SOCKET) {
+        closesocket(handle);
+        handle = RELAY_INVALID_SOCKET;
+    }
+}
+
+void RelaySocket::setError(const char *what)
+{
+    error = std::string(what) + " failed (" + std::to_string(relayLastError()) + ")";
+}
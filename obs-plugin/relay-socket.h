@@ -0,0 +1,112 @@
+#pragma once
+
+/*
+ * Thin portable TCP socket wrapper used by the relay engine.
+ * Winsock on Windows, BSD sockets everywhere else.
+ */
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET relay_socket_t;
+#define RELAY_INVALID_SOCKET INVALID_SOCKET
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+typedef int relay_socket_t;
+#define RELAY_INVALID_SOCKET (-1)
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Maximum slices handed to the kernel per vectored send (IOV_MAX on Linux
+// and macOS), enough for a whole batch of chunked messages
+#define RELAY_SOCKET_MAX_IOV 1024
+
+// One contiguous piece of a scatter-gather write
+struct RelayIoSlice {
+    const void *data;
+    size_t size;
+};
+
+// The kernel's view of a connection's send path; what a platform does not
+// report keeps its "unknown" value
+struct RelaySendPathInfo {
+    int64_t rttUs = -1;
+    int64_t unsentBytes = -1;     // written but not yet sent
+    uint64_t deliveryRateBps = 0; // TCP's recent delivery rate in bytes/s; 0 if unknown
+    bool deliveryAppLimited = true; // the rate only shows what we offered, not the path
+};
+
+class RelaySocket {
+public:
+    RelaySocket() = default;
+    explicit RelaySocket(relay_socket_t fd) : handle(fd) {}
+    ~RelaySocket();
+
+    RelaySocket(const RelaySocket &) = delete;
+    RelaySocket &operator=(const RelaySocket &) = delete;
+    RelaySocket(RelaySocket &&other) noexcept;
+    RelaySocket &operator=(RelaySocket &&other) noexcept;
+
+    // Blocking connect with a timeout; resolves host names
+    bool connectTo(const std::string &host, uint16_t port, int timeoutMs);
+    bool listenOn(uint16_t port, bool loopbackOnly);
+    RelaySocket accept();
+
+    // Returns bytes read, 0 on orderly shutdown, -1 on error (or, on a
+    // non-blocking socket, with wouldBlock() set when nothing is there)
+    long readSome(void *buffer, size_t size);
+    bool readExact(void *buffer, size_t size, int timeoutMs);
+    bool writeAll(const void *data, size_t size);
+    // Writes every slice in order with as few syscalls as possible
+    bool writeVectored(const RelayIoSlice *slices, size_t count);
+    // One scatter-gather send for non-blocking sockets: returns the bytes
+    // the kernel took (0 if its buffer is full) or -1 on error
+    long writeSome(const RelayIoSlice *slices, size_t count);
+    bool setNonBlocking(bool enabled);
+    bool wouldBlock() const { return blocked; }
+
+    // Wait until the socket is readable; returns false on timeout or error
+    bool waitReadable(int timeoutMs);
+    bool setNoDelay(bool enabled);
+    bool setRecvTimeout(int timeoutMs);
+    // Kernel's smoothed round-trip estimate, or -1 where unavailable
+    int64_t roundTripTimeUs() const;
+    // Round trip, unsent backlog and delivery rate (all of them on Linux
+    // 4.18+, the round trip elsewhere); false if the socket reports nothing
+    bool sendPathInfo(RelaySendPathInfo &info) const;
+
+    // Send-path tuning; each returns false where the platform lacks the
+    // option (only Linux has all three).
+    // Stops the socket taking more once this many bytes wait unsent in
+    // the kernel, so a backlog stays in the application's queue; 0
+    // restores the system default
+    bool setNotSentLowat(uint32_t bytes);
+    // Upper bound for the kernel's pacing; 0 removes it
+    bool setMaxPacingRate(uint64_t bytesPerSecond);
+    // e.g. "bbr" or "cubic"; needs the module loaded and, without
+    // CAP_NET_ADMIN, listed in net.ipv4.tcp_allowed_congestion_control
+    bool setCongestionControl(const std::string &name);
+
+    // Wakes up any thread blocked on this socket
+    void shutdown();
+    void close();
+    bool isValid() const { return handle != RELAY_INVALID_SOCKET; }
+    relay_socket_t fd() const { return handle; }
+    const std::string &lastError() const { return error; }
+
+    // Winsock needs process-wide initialisation; no-op elsewhere
+    static bool initialize();
+
+private:
+    void setError(const char *what);
+    // One send of up to RELAY_SOCKET_MAX_IOV slices, the first skip bytes in
+    long sendSlices(const RelayIoSlice *slices, size_t count, size_t skip);
+
+    relay_socket_t handle = RELAY_INVALID_SOCKET;
+    bool blocked = false;
+    std::string error;
+};
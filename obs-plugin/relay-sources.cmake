@@ -0,0 +1,25 @@
+# Relay engine sources, shared by the OBS plugin and stream-relay-daemon.
+# Everything listed here is free of OBS and Qt.
+set(RELAY_ENGINE_SOURCES
+    ${CMAKE_CURRENT_LIST_DIR}/relay-bandwidth.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-buffer.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-config.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-engine.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-flv.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-governor.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-ingest.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-metrics.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-probe.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-process.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-publisher.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-queue.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-reconnect.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-rtmp.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-shard.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-socket.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-stats.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-supervisor.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-trace.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-transcoder.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/relay-uring.cpp
+)
@@ -0,0 +1,239 @@
+#include "relay-stats.h"
+
+#include "relay-common.h"
+
+static const uint64_t sendLatencyBoundsNs[] = {
+    50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+    25000000, 50000000, 100000000, 250000000, 500000000, 1000000000,
+};
+static const uint64_t packetSizeBounds[] = {
+    256, 1024, 4096, 16384, 65536, 262144, 1048576,
+};
+static const uint64_t encoderSpeedBoundsPerMille[] = {
+    250, 500, 750, 900, 950, 990, 1010, 1050, 1100, 1250, 1500, 2000,
+};
+
+#define RELAY_ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+RelayHistogram::RelayHistogram(const uint64_t *bounds, size_t boundCount, double scale)
+    : bounds(bounds), boundCount(boundCount < RELAY_HISTOGRAM_MAX_BUCKETS ? boundCount : RELAY_HISTOGRAM_MAX_BUCKETS),
+      scale(scale)
+{
+}
+
+void RelayHistogram::observe(uint64_t value)
+{
+    // Bucket lists are short; a linear scan beats a binary search here
+    size_t index = 0;
+    while (index < boundCount && value > bounds[index]) {
+        index++;
+    }
+    buckets[index].add(1);
+    sum.add(value);
+}
+
+RelayHistogramTotals RelayHistogram::load() const
+{
+    RelayHistogramTotals totals;
+    uint64_t running = 0;
+    for (size_t i = 0; i <= boundCount; i++) {
+        running += buckets[i].load();
+        totals.cumulative.push_back(running);
+        if (i < boundCount) {
+            totals.bounds.push_back((double)bounds[i] * scale);
+        }
+    }
+    totals.count = running;
+    totals.sum = (double)sum.load() * scale;
+    return totals;
+}
+
+RelayHistogram relaySendLatencyHistogram()
+{
+    return RelayHistogram(sendLatencyBoundsNs, RELAY_ARRAY_SIZE(sendLatencyBoundsNs), 1e-9);
+}
+
+RelayHistogram relayPacketSizeHistogram()
+{
+    return RelayHistogram(packetSizeBounds, RELAY_ARRAY_SIZE(packetSizeBounds), 1.0);
+}
+
+RelayHistogram relayEncoderSpeedHistogram()
+{
+    return RelayHistogram(encoderSpeedBoundsPerMille, RELAY_ARRAY_SIZE(encoderSpeedBoundsPerMille), 1e-3);
+}
+
+void RelayTrafficCounters::count(const RelayPacket &packet)
+{
+    packets.add(1);
+    bytes.add(packet.data.size());
+    if (packet.isVideo() && !packet.isSequenceHeader()) {
+        videoFrames.add(1);
+    }
+}
+
+RelayTrafficTotals RelayTrafficCounters::load() const
+{
+    RelayTrafficTotals totals;
+    totals.packets = packets.load();
+    totals.bytes = bytes.load();
+    totals.videoFrames = videoFrames.load();
+    return totals;
+}
+
+RelayTrafficRate relayTrafficRate(const RelayTrafficTotals &previous, const RelayTrafficTotals &current,
+                                  uint64_t intervalMs)
+{
+    RelayTrafficRate rate;
+    // Counters restart with each publish session; treat that as no data
+    if (intervalMs == 0 || current.bytes < previous.bytes || current.videoFrames < previous.videoFrames) {
+        return rate;
+    }
+    rate.kbps = (double)(current.bytes - previous.bytes) * 8.0 / (double)intervalMs;
+    rate.fps = (double)(current.videoFrames - previous.videoFrames) * 1000.0 / (double)intervalMs;
+    return rate;
+}
+
+RelayStats::StreamPtr RelayStats::beginStream(const std::string &name)
+{
+    auto entry = std::make_shared<RelayStreamStats>();
+    entry->name = name;
+    entry->publishingSinceMs = relayNowMs();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    streams.push_back(entry);
+    return entry;
+}
+
+template<typename T>
+static void eraseStream(std::vector<std::shared_ptr<T>> &entries, const RelayStats::StreamPtr &stream)
+{
+    for (auto it = entries.begin(); it != entries.end();) {
+        it = (*it)->stream == stream ? entries.erase(it) : it + 1;
+    }
+}
+
+void RelayStats::endStream(const StreamPtr &stream)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = streams.begin(); it != streams.end(); ++it) {
+        if (*it == stream) {
+            RelayTrafficTotals ingest = stream->ingest.load();
+            endedIngest.packets += ingest.packets;
+            endedIngest.bytes += ingest.bytes;
+            endedIngest.videoFrames += ingest.videoFrames;
+            streams.erase(it);
+            break;
+        }
+    }
+    eraseStream(destinations, stream);
+    eraseStream(encoders, stream);
+}
+
+std::shared_ptr<RelayDestinationStats> RelayStats::addDestination(const StreamPtr &stream, const std::string &name,
+                                                                  const std::string &rendition)
+{
+    auto entry = std::make_shared<RelayDestinationStats>();
+    entry->stream = stream;
+    entry->name = name;
+    entry->rendition = rendition;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    destinations.push_back(entry);
+    return entry;
+}
+
+void RelayStats::removeDestination(const StreamPtr &stream, const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = destinations.begin(); it != destinations.end(); ++it) {
+        if ((*it)->stream == stream && (*it)->name == name) {
+            destinations.erase(it);
+            return;
+        }
+    }
+}
+
+std::shared_ptr<RelayEncoderStats> RelayStats::addEncoder(const StreamPtr &stream, const std::string &rendition)
+{
+    auto entry = std::make_shared<RelayEncoderStats>();
+    entry->stream = stream;
+    entry->rendition = rendition;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    encoders.push_back(entry);
+    return entry;
+}
+
+void RelayStats::removeEncoder(const StreamPtr &stream, const std::string &rendition)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = encoders.begin(); it != encoders.end(); ++it) {
+        if ((*it)->stream == stream && (*it)->rendition == rendition) {
+            encoders.erase(it);
+            return;
+        }
+    }
+}
+
+void RelayStats::removeEncoders(const StreamPtr &stream)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    eraseStream(encoders, stream);
+}
+
+RelayStatsSnapshot RelayStats::snapshot() const
+{
+    RelayStatsSnapshot result;
+    result.timestampMs = relayNowMs();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    result.ingest = endedIngest;
+    result.streams.reserve(streams.size());
+    for (const auto &entry : streams) {
+        RelayStreamSnapshot stream;
+        stream.name = entry->name;
+        stream.publishingSinceMs = entry->publishingSinceMs;
+        stream.ingest = entry->ingest.load();
+        result.ingest.packets += stream.ingest.packets;
+        result.ingest.bytes += stream.ingest.bytes;
+        result.ingest.videoFrames += stream.ingest.videoFrames;
+        if (result.publishingSinceMs == 0 || stream.publishingSinceMs < result.publishingSinceMs) {
+            result.publishingSinceMs = stream.publishingSinceMs;
+        }
+        result.streams.push_back(stream);
+    }
+
+    result.destinations.reserve(destinations.size());
+    for (const auto &entry : destinations) {
+        RelayDestinationSnapshot destination;
+        destination.stream = entry->stream->name;
+        destination.name = entry->name;        destination.rendition = entry->rendition;
+        destination.connected = entry->connected;
+        destination.ingress = entry->ingress.load();
+        destination.egress = entry->egress.load();
+        destination.reconnects = entry->reconnects.load();
+        destination.sendLatency = entry->sendLatency.load();
+        destination.packetSize = entry->packetSize.load();
+        destination.droppedPackets = entry->droppedPackets;
+        destination.droppedBytes = entry->droppedBytes;
+        destination.queuedPackets = entry->queuedPackets;
+        destination.queuedBytes = entry->queuedBytes;
+        destination.rttUs = entry->rttUs;
+        destination.estimatedKbps = entry->estimatedKbps;
+        destination.feedKbps = entry->feedKbps;
+        result.destinations.push_back(destination);
+    }
+
+    result.encoders.reserve(encoders.size());
+    for (const auto &entry : encoders) {
+        RelayEncoderSnapshot encoder;
+        encoder.stream = entry->stream->name;
+        encoder.rendition = entry->rendition;
+        encoder.speed = entry->speed.load();
+        encoder.lastSpeed = entry->lastSpeedPerMille / 1000.0;
+        encoder.restarts = entry->restarts.load();
+        result.encoders.push_back(encoder);
+    }
+    return result;
+}
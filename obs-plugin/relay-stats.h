@@ -0,0 +1,197 @@
+#pragma once
+
+/*
+ * Live relay statistics.
+ *
+ * Every counter has exactly one writer thread (the ingest session, a
+ * fanout's producer or a destination's sender), so it is bumped with a
+ * relaxed load and store instead of a locked read-modify-write and the
+ * packet path never contends with anything. Readers take cumulative
+ * snapshots whenever they like; rates come from the difference between two
+ * snapshots, so the reader decides the averaging interval. Histograms use
+ * fixed bucket bounds and the same single-writer counters.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "relay-packet.h"
+
+#define RELAY_HISTOGRAM_MAX_BUCKETS 16
+
+// Monotonic counter that only one thread at a time may add to
+class RelayCounter {
+public:
+    void add(uint64_t amount) { value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed); }
+    uint64_t load() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+struct RelayHistogramTotals {
+    std::vector<double> bounds;        // upper bounds, excluding +Inf
+    std::vector<uint64_t> cumulative;  // one per bound plus +Inf
+    uint64_t count = 0;
+    double sum = 0;
+};
+
+// Fixed-bucket histogram with a single writer thread. Values are recorded
+// as integers in some unit and scaled on output (e.g. ns -> seconds).
+class RelayHistogram {
+public:
+    RelayHistogram(const uint64_t *bounds, size_t boundCount, double scale);
+
+    void observe(uint64_t value);
+    RelayHistogramTotals load() const;
+
+private:
+    const uint64_t *bounds;
+    size_t boundCount;
+    double scale;
+    RelayCounter buckets[RELAY_HISTOGRAM_MAX_BUCKETS + 1];
+    RelayCounter sum;
+};
+
+// Shared bucket layouts
+RelayHistogram relaySendLatencyHistogram();  // nanoseconds, output in seconds
+RelayHistogram relayPacketSizeHistogram();   // bytes
+RelayHistogram relayEncoderSpeedHistogram(); // per mille of realtime, output as a ratio
+
+struct RelayTrafficTotals {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t videoFrames = 0;
+};
+
+// Traffic through one point of the pipeline
+struct RelayTrafficCounters {
+    RelayCounter packets;
+    RelayCounter bytes;
+    RelayCounter videoFrames;
+
+    void count(const RelayPacket &packet);
+    RelayTrafficTotals load() const;
+};
+
+// One publish session on the ingest
+struct RelayStreamStats {
+    std::string name; // the route the publisher was matched to
+    uint64_t publishingSinceMs = 0;
+    RelayTrafficCounters ingest; // written by the ingest session thread
+};
+
+// Shared by a destination and the stats registry, so a snapshot never has
+// to reach into (or keep alive) the destination itself
+struct RelayDestinationStats {
+    std::shared_ptr<RelayStreamStats> stream;
+    std::string name;
+    std::string rendition;
+
+    RelayTrafficCounters ingress; // written by the fanout's producer thread
+    RelayTrafficCounters egress;  // written by the sender thread
+    RelayCounter reconnects;      // written by the sender thread
+    RelayHistogram sendLatency = relaySendLatencyHistogram();
+    RelayHistogram packetSize = relayPacketSizeHistogram();
+
+    // Gauges published by the sender thread
+    std::atomic<bool> connected{false};
+    std::atomic<uint64_t> droppedPackets{0};
+    std::atomic<uint64_t> droppedBytes{0};
+    std::atomic<uint64_t> queuedPackets{0};
+    std::atomic<uint64_t> queuedBytes{0};
+    std::atomic<int64_t> rttUs{-1};
+    std::atomic<uint64_t> estimatedKbps{0}; // achievable throughput; 0 before the first estimate
+    std::atomic<uint32_t> feedKbps{0};      // bitrate of the rendition being sent
+};
+
+// Written by the reader thread of one ladder rendition
+struct RelayEncoderStats {
+    std::shared_ptr<RelayStreamStats> stream;
+    std::string rendition;
+    // Media time produced per wall-clock second; below 1.0 the encoder
+    // cannot keep up
+    RelayHistogram speed = relayEncoderSpeedHistogram();
+    std::atomic<uint32_t> lastSpeedPerMille{0};
+    RelayCounter restarts;
+};
+
+struct RelayStreamSnapshot {
+    std::string name;
+    uint64_t publishingSinceMs = 0;
+    RelayTrafficTotals ingest;
+};
+
+struct RelayEncoderSnapshot {
+    std::string stream;
+    std::string rendition;
+    RelayHistogramTotals speed;
+    double lastSpeed = 0;
+    uint64_t restarts = 0;
+};
+
+struct RelayDestinationSnapshot {
+    std::string stream;
+    std::string name;
+    std::string rendition;
+    bool connected = false;
+    RelayTrafficTotals ingress;
+    RelayTrafficTotals egress;
+    uint64_t reconnects = 0;
+    RelayHistogramTotals sendLatency;
+    RelayHistogramTotals packetSize;
+    uint64_t droppedPackets = 0;
+    uint64_t droppedBytes = 0;
+    uint64_t queuedPackets = 0;
+    uint64_t queuedBytes = 0;
+    int64_t rttUs = -1;
+    uint64_t estimatedKbps = 0;
+    uint32_t feedKbps = 0;
+};
+
+struct RelayStatsSnapshot {
+    uint64_t timestampMs = 0;
+    uint64_t publishingSinceMs = 0; // oldest live stream; 0 while nothing publishes
+    RelayTrafficTotals ingest;      // every stream since the relay started
+    std::vector<RelayStreamSnapshot> streams;
+    std::vector<RelayDestinationSnapshot> destinations;
+    std::vector<RelayEncoderSnapshot> encoders;
+};
+
+struct RelayTrafficRate {
+    double kbps = 0;
+    double fps = 0;
+};
+
+// Average rate between two snapshots of the same counters
+RelayTrafficRate relayTrafficRate(const RelayTrafficTotals &previous, const RelayTrafficTotals &current,
+                                  uint64_t intervalMs);
+
+class RelayStats {
+public:
+    // A publish session owns its stream, destination and encoder entries
+    // until it ends
+    using StreamPtr = std::shared_ptr<RelayStreamStats>;
+    StreamPtr beginStream(const std::string &name);
+    void endStream(const StreamPtr &stream);
+    std::shared_ptr<RelayDestinationStats> addDestination(const StreamPtr &stream, const std::string &name,
+                                                          const std::string &rendition);
+    void removeDestination(const StreamPtr &stream, const std::string &name);
+    std::shared_ptr<RelayEncoderStats> addEncoder(const StreamPtr &stream, const std::string &rendition);
+    void removeEncoder(const StreamPtr &stream, const std::string &rendition);
+    void removeEncoders(const StreamPtr &stream);
+
+    RelayStatsSnapshot snapshot() const;
+
+private:
+    // Guards the registry only; nothing on the packet path takes it
+    mutable std::mutex mutex;
+    std::vector<StreamPtr> streams;
+    std::vector<std::shared_ptr<RelayDestinationStats>> destinations;
+    std::vector<std::shared_ptr<RelayEncoderStats>> encoders;
+    RelayTrafficTotals endedIngest; // keeps the ingest totals monotonic
+};
@@ -0,0 +1,284 @@
+#include "relay-supervisor.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "relay-common.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <csignal>
+#endif
+
+RelaySupervisor &RelaySupervisor::instance()
+{
+    // Leaked on purpose: children may still be watched during static teardown
+    static RelaySupervisor *supervisor = new RelaySupervisor();
+    return *supervisor;
+}
+
+static std::string baseName(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+#ifdef __linux__
+
+RelaySupervisor::RelaySupervisor()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        PLUGIN_LOG_WARNING("Process supervisor unavailable: epoll_create1 failed");
+        return;
+    }
+    thread = std::thread(&RelaySupervisor::run, this);
+    thread.detach();
+}
+
+uint64_t RelaySupervisor::watch(relay_process_t process, ExitCallback onExit)
+{
+#ifdef SYS_pidfd_open
+    if (epollFd < 0) {
+        return 0;
+    }
+
+    // pidfd_open needs Linux 5.3; older kernels fall back to the caller
+    int pidfd = (int)syscall(SYS_pidfd_open, process, 0);
+    if (pidfd < 0) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(dispatchMutex);
+    uint64_t id = nextId++;
+    auto entry = std::make_unique<Watch>();
+    entry->process = process;
+    entry->onExit = std::move(onExit);
+    entry->pidfd = pidfd;
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = id;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, pidfd, &event) != 0) {
+        ::close(pidfd);
+        return 0;
+    }
+    watches[id] = std::move(entry);
+    return id;
+#else
+    (void)process;
+    (void)onExit;
+    return 0;
+#endif
+}
+
+void RelaySupervisor::unwatch(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(dispatchMutex);
+    auto it = watches.find(id);
+    if (it == watches.end()) {
+        return;
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second->pidfd, nullptr);
+    ::close(it->second->pidfd);
+    watches.erase(it);
+}
+
+void RelaySupervisor::run()
+{
+    epoll_event events[16];
+    while (true) {
+        int count = epoll_wait(epollFd, events, 16, -1);
+        if (count < 0 && errno != EINTR) {
+            PLUGIN_LOG_ERROR("Process supervisor stopped: epoll_wait failed");
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            dispatch(events[i].data.u64);
+        }
+    }
+}
+
+void RelaySupervisor::dispatch(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(dispatchMutex);
+    auto it = watches.find(id);
+    if (it == watches.end()) {
+        return; // unwatched while the event was in flight
+    }
+
+    int status = 0;
+    pid_t reaped;
+    do {
+        reaped = waitpid(it->second->process, &status, WNOHANG);
+    } while (reaped < 0 && errno == EINTR);
+    if (reaped == 0) {
+        return;
+    }
+
+    std::unique_ptr<Watch> entry = std::move(it->second);
+    watches.erase(it);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, entry->pidfd, nullptr);
+    ::close(entry->pidfd);
+    if (entry->onExit) {
+        entry->onExit(status);
+    }
+}
+
+#elif defined(_WIN32)
+
+RelaySupervisor::RelaySupervisor() = default;
+
+void CALLBACK RelaySupervisor::onProcessSignaled(PVOID context, BOOLEAN timedOut)
+{
+    (void)timedOut;
+    instance().dispatch((uint64_t)(uintptr_t)context);
+}
+
+uint64_t RelaySupervisor::watch(relay_process_t process, ExitCallback onExit)
+{
+    std::lock_guard<std::mutex> lock(dispatchMutex);
+    uint64_t id = nextId++;
+    auto entry = std::make_unique<Watch>();
+    entry->process = process;
+    entry->onExit = std::move(onExit);
+    if (!RegisterWaitForSingleObject(&entry->waitHandle, process, onProcessSignaled, (PVOID)(uintptr_t)id,
+                                     INFINITE, WT_EXECUTEONLYONCE)) {
+        return 0;
+    }
+    watches[id] = std::move(entry);
+    return id;
+}
+
+void RelaySupervisor::unwatch(uint64_t id)
+{
+    HANDLE waitHandle = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(dispatchMutex);
+        auto it = watches.find(id);
+        if (it == watches.end()) {
+            return;
+        }
+        waitHandle = it->second->waitHandle;
+        watches.erase(it);
+    }
+    // Blocks until a callback that already started has returned
+    UnregisterWaitEx(waitHandle, INVALID_HANDLE_VALUE);
+}
+
+void RelaySupervisor::dispatch(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(dispatchMutex);
+    auto it = watches.find(id);
+    if (it == watches.end()) {
+        return;
+    }
+
+    std::unique_ptr<Watch> entry = std::move(it->second);
+    watches.erase(it);
+    UnregisterWait(entry->waitHandle);
+
+    DWORD code = 0;
+    GetExitCodeProcess(entry->process, &code);
+    if (entry->onExit) {
+        entry->onExit((int)code);
+    }
+}
+
+#else
+
+RelaySupervisor::RelaySupervisor() = default;
+
+uint64_t RelaySupervisor::watch(relay_process_t process, ExitCallback onExit)
+{
+    (void)process;
+    (void)onExit;
+    return 0;
+}
+
+void RelaySupervisor::unwatch(uint64_t id)
+{
+    (void)id;
+}
+
+void RelaySupervisor::dispatch(uint64_t id)
+{
+    (void)id;
+}
+
+#endif
+
+bool RelaySupervisor::writePidFile(const std::string &path, int64_t pid, const std::string &program)
+{
+    std::ofstream out(path, std::ios::trunc);
+    out << pid << "\n" << baseName(program) << "\n";
+    return (bool)out;
+}
+
+// True when pid is still alive and running the given program, so a reused
+// pid never gets an unrelated process killed
+static bool isStaleChild(int64_t pid, const std::string &program)
+{
+#ifdef __linux__
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/%lld/exe", (long long)pid);
+    std::error_code ec;
+    std::filesystem::path exe = std::filesystem::read_symlink(link, ec);
+    return !ec && exe.filename().string() == program;
+#elif defined(_WIN32)
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+    if (!process) {
+        return false;
+    }
+    char image[MAX_PATH];
+    DWORD size = MAX_PATH;
+    bool match = QueryFullProcessImageNameA(process, 0, image, &size) &&
+                 _stricmp(baseName(image).c_str(), program.c_str()) == 0;
+    CloseHandle(process);
+    return match;
+#else
+    // No reliable identity check here; leave the process alone
+    (void)pid;
+    (void)program;
+    return false;
+#endif
+}
+
+void RelaySupervisor::cleanupStalePidFiles(const std::string &directory)
+{
+    std::error_code ec;
+    for (const auto &file : std::filesystem::directory_iterator(directory, ec)) {
+        if (file.path().extension() != ".pid") {
+            continue;
+        }
+
+        int64_t pid = 0;
+        std::string program;
+        {
+            std::ifstream in(file.path());
+            in >> pid >> program;
+        }
+
+        if (pid > 0 && isStaleChild(pid, program)) {
+            PLUGIN_LOG_WARNING("Stopping orphaned %s (pid %lld) from a previous session", program.c_str(),
+                               (long long)pid);
+#ifdef _WIN32
+            HANDLE process = OpenProcess(PROCESS_TERMINATE, FALSE, (DWORD)pid);
+            if (process) {
+                TerminateProcess(process, 1);
+                CloseHandle(process);
+            }
+#else
+            kill((pid_t)pid, SIGKILL);
+#endif
+        }
+        std::filesystem::remove(file.path(), ec);
+    }
+}
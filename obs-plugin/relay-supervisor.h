@@ -0,0 +1,76 @@
+#pragma once
+
+/*
+ * Event-driven child process supervision.
+ *
+ * One background thread sleeps until a watched child exits: pidfd + epoll
+ * on Linux, a thread-pool wait on the process handle on Windows. The exit
+ * is reaped on the spot, so no zombies linger and nothing polls. Platforms
+ * without either mechanism get watch() == 0 and fall back to reaping in
+ * RelayProcess itself.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE relay_process_t;
+#else
+#include <sys/types.h>
+typedef pid_t relay_process_t;
+#endif
+
+class RelaySupervisor {
+public:
+    // Receives the raw exit status (waitpid status / Windows exit code)
+    using ExitCallback = std::function<void(int status)>;
+
+    static RelaySupervisor &instance();
+
+    // Starts watching a child; returns 0 if it cannot be watched here.
+    // The callback runs on the supervisor thread and must not call watch()
+    // or unwatch().
+    uint64_t watch(relay_process_t process, ExitCallback onExit);
+    // After this returns the callback is guaranteed not to run (again) and
+    // the supervisor will not reap the child
+    void unwatch(uint64_t id);
+
+    // Pid files let a crashed OBS session's orphaned encoders be found and
+    // stopped on the next start
+    static bool writePidFile(const std::string &path, int64_t pid, const std::string &program);
+    static void cleanupStalePidFiles(const std::string &directory);
+
+private:
+    RelaySupervisor();
+    void dispatch(uint64_t id);
+
+    struct Watch {
+        relay_process_t process;
+        ExitCallback onExit;
+#ifdef _WIN32
+        HANDLE waitHandle = nullptr;
+#else
+        int pidfd = -1;
+#endif
+    };
+
+    // Held while a callback runs so unwatch() can wait for it
+    std::mutex dispatchMutex;
+    std::map<uint64_t, std::unique_ptr<Watch>> watches;
+    uint64_t nextId = 1;
+
+#ifdef _WIN32
+    static void CALLBACK onProcessSignaled(PVOID context, BOOLEAN timedOut);
+#endif
+#ifdef __linux__
+    void run();
+    int epollFd = -1;
+    std::thread thread;
+#endif
+};
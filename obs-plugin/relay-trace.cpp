@@ -0,0 +1,312 @@
+#include "relay-trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+std::atomic<bool> relayTraceEnabled{false};
+
+// One thread's events. Only the owning thread writes; a slot's fields are
+// relaxed atomics so a reader racing the writer gets a torn event, never
+// undefined behaviour, and the head tells it which ones to discard.
+struct RelayTracer::Ring {
+    struct Slot {
+        std::atomic<uint64_t> ns{0};
+        std::atomic<uint64_t> packetId{0};
+        std::atomic<uint64_t> ingestNs{0};
+        std::atomic<uint64_t> meta{0}; // track << 32 | stage << 28 | bytes
+    };
+
+    std::atomic<uint64_t> head{0};
+    std::atomic<bool> owned{true};
+    Slot slots[RELAY_TRACE_RING_EVENTS];
+};
+
+#define RELAY_TRACE_MAX_BYTES ((1u << 28) - 1)
+
+RelayTracer::RelayTracer() : tracks{"unknown"}
+{
+}
+
+// Never destroyed: threads still running at exit may record
+RelayTracer &RelayTracer::instance()
+{
+    static RelayTracer *tracer = new RelayTracer();
+    return *tracer;
+}
+
+uint32_t RelayTracer::track(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = trackIds.find(name);
+    if (it != trackIds.end()) {
+        return it->second;
+    }
+    uint32_t id = (uint32_t)tracks.size();
+    tracks.push_back(name);
+    trackIds[name] = id;
+    return id;
+}
+
+std::vector<std::string> RelayTracer::trackNames() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return tracks;
+}
+
+// A thread takes a ring on its first event and hands it back when it
+// exits, so restarting the engine reuses rings instead of adding more
+RelayTracer::Ring &RelayTracer::threadRing()
+{
+    struct Owner {
+        Ring *ring = nullptr;
+        ~Owner()
+        {
+            if (ring) {
+                ring->owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+    thread_local Owner owner;
+    if (owner.ring) {
+        return *owner.ring;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &ring : rings) {
+        bool expected = false;
+        if (ring->owned.compare_exchange_strong(expected, true)) {
+            owner.ring = ring.get();
+            return *owner.ring;
+        }
+    }
+    rings.push_back(std::make_unique<Ring>());
+    owner.ring = rings.back().get();
+    return *owner.ring;
+}
+
+void RelayTracer::record(RelayTraceStage stage, uint32_t track, const RelayPacket &packet)
+{
+    Ring &ring = threadRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    Ring::Slot &slot = ring.slots[head & (RELAY_TRACE_RING_EVENTS - 1)];
+    uint64_t bytes = std::min<uint64_t>(packet.data.size(), RELAY_TRACE_MAX_BYTES);
+    slot.ns.store(relayNowNs(), std::memory_order_relaxed);
+    slot.packetId.store(packet.traceId, std::memory_order_relaxed);
+    slot.ingestNs.store(packet.ingestNs, std::memory_order_relaxed);
+    slot.meta.store((uint64_t)track << 32 | (uint64_t)stage << 28 | bytes, std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+std::vector<RelayTraceEvent> RelayTracer::events() const
+{
+    std::vector<Ring *> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &ring : rings) {
+            snapshot.push_back(ring.get());
+        }
+    }
+
+    std::vector<RelayTraceEvent> result;
+    for (Ring *ring : snapshot) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > RELAY_TRACE_RING_EVENTS ? head - RELAY_TRACE_RING_EVENTS : 0;
+        std::vector<RelayTraceEvent> copied;
+        copied.reserve((size_t)(head - first));
+        for (uint64_t i = first; i < head; i++) {
+            const Ring::Slot &slot = ring->slots[i & (RELAY_TRACE_RING_EVENTS - 1)];
+            RelayTraceEvent event;
+            event.ns = slot.ns.load(std::memory_order_relaxed);
+            event.packetId = slot.packetId.load(std::memory_order_relaxed);
+            event.ingestNs = slot.ingestNs.load(std::memory_order_relaxed);
+            uint64_t meta = slot.meta.load(std::memory_order_relaxed);
+            event.track = (uint32_t)(meta >> 32);
+            event.stage = (RelayTraceStage)((meta >> 28) & 0xf);
+            event.bytes = (uint32_t)(meta & RELAY_TRACE_MAX_BYTES);
+            copied.push_back(event);
+        }
+
+        // Slots the writer reached while we copied hold newer events now;
+        // the one it may be writing is the oldest we still keep otherwise
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t now = ring->head.load(std::memory_order_relaxed);
+        uint64_t valid = now >= RELAY_TRACE_RING_EVENTS ? now - RELAY_TRACE_RING_EVENTS + 1 : 0;
+        for (uint64_t i = std::max(first, valid); i < head; i++) {
+            result.push_back(copied[(size_t)(i - first)]);
+        }
+    }
+    return result;
+}
+
+static uint64_t stageKey(uint64_t packetId, uint32_t track)
+{
+    return packetId * 0x9e3779b97f4a7c15ull ^ track;
+}
+
+// Where one packet was on one destination
+struct PacketPath {
+    uint64_t packetId = 0;
+    uint32_t track = 0;
+    uint64_t ingestNs = 0;
+    uint64_t enqueueNs = 0;
+    uint64_t muxNs = 0;
+    uint64_t writeNs = 0;
+};
+
+static std::unordered_map<uint64_t, PacketPath> packetPaths(const std::vector<RelayTraceEvent> &events)
+{
+    std::unordered_map<uint64_t, PacketPath> paths;
+    for (const auto &event : events) {
+        if (event.stage == RelayTraceStage::Ingest) {
+            continue;
+        }
+        PacketPath &path = paths[stageKey(event.packetId, event.track)];
+        path.packetId = event.packetId;
+        path.track = event.track;
+        path.ingestNs = event.ingestNs;
+        if (event.stage == RelayTraceStage::Enqueue) {
+            path.enqueueNs = event.ns;
+        } else if (event.stage == RelayTraceStage::Mux) {
+            path.muxNs = event.ns;
+        } else {
+            path.writeNs = event.ns;
+        }
+    }
+    return paths;
+}
+
+static RelayTraceStageSummary summarize(const char *stage, std::vector<uint64_t> &durations)
+{
+    RelayTraceStageSummary summary;
+    summary.stage = stage;
+    summary.count = durations.size();
+    if (durations.empty()) {
+        return summary;
+    }
+    std::sort(durations.begin(), durations.end());
+    auto at = [&](double fraction) {
+        return (double)durations[std::min(durations.size() - 1, (size_t)(fraction * (double)durations.size()))] / 1e6;
+    };
+    summary.p50Ms = at(0.5);
+    summary.p99Ms = at(0.99);
+    summary.maxMs = (double)durations.back() / 1e6;
+    return summary;
+}
+
+std::vector<RelayTraceStageSummary> RelayTracer::summary() const
+{
+    std::vector<uint64_t> enqueue, mux, write, total;
+    for (const auto &entry : packetPaths(events())) {
+        const PacketPath &path = entry.second;
+        if (path.enqueueNs && path.ingestNs && path.enqueueNs >= path.ingestNs) {
+            enqueue.push_back(path.enqueueNs - path.ingestNs);
+        }
+        if (path.muxNs && path.enqueueNs && path.muxNs >= path.enqueueNs) {
+            mux.push_back(path.muxNs - path.enqueueNs);
+        }
+        if (path.writeNs && path.muxNs && path.writeNs >= path.muxNs) {
+            write.push_back(path.writeNs - path.muxNs);
+        }
+        if (path.writeNs && path.ingestNs && path.writeNs >= path.ingestNs) {
+            total.push_back(path.writeNs - path.ingestNs);
+        }
+    }
+    return {summarize("enqueue", enqueue), summarize("mux", mux), summarize("write", write),
+            summarize("total", total)};
+}
+
+static void appendJsonString(std::string &out, const std::string &text)
+{
+    out += '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// A process per track (ingest, encoder or destination), ingests as
+// instants and every packet's stages on a destination as async slices,
+// since packets queued behind each other overlap; timestamps in microseconds
+std::string RelayTracer::chromeTrace() const
+{
+    std::vector<RelayTraceEvent> all = events();
+    std::vector<std::string> names = trackNames();
+    uint64_t origin = UINT64_MAX;
+    for (const auto &event : all) {
+        origin = std::min(origin, event.ingestNs && event.ingestNs < event.ns ? event.ingestNs : event.ns);
+    }
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char line[256];
+    auto append = [&](const char *text) {
+        out += first ? "\n" : ",\n";
+        out += text;
+        first = false;
+    };
+    auto span = [&](const char *name, uint32_t track, uint64_t from, uint64_t to, uint64_t packetId) {
+        if (!from || !to || to < from) {
+            return;
+        }
+        for (int end = 0; end < 2; end++) {
+            snprintf(line, sizeof(line),
+                     "{\"name\":\"%s\",\"cat\":\"packet\",\"ph\":\"%c\",\"id\":%llu,\"pid\":%u,\"tid\":%u,"
+                     "\"ts\":%.3f}",
+                     name, end ? 'e' : 'b', (unsigned long long)packetId, track, track,
+                     (double)((end ? to : from) - origin) / 1000);
+            append(line);
+        }
+    };
+
+    for (uint32_t track = 1; track < names.size(); track++) {
+        std::string meta = "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + std::to_string(track) +
+                           ",\"args\":{\"name\":";
+        appendJsonString(meta, names[track]);
+        meta += "}}";
+        append(meta.c_str());
+    }
+    for (const auto &event : all) {
+        if (event.stage == RelayTraceStage::Ingest) {
+            snprintf(line, sizeof(line),
+                     "{\"name\":\"ingest\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,"
+                     "\"args\":{\"packet\":%llu,\"bytes\":%u}}",
+                     event.track, event.track, (double)(event.ns - origin) / 1000, (unsigned long long)event.packetId,
+                     event.bytes);
+            append(line);
+        }
+    }
+    for (const auto &entry : packetPaths(all)) {
+        const PacketPath &path = entry.second;
+        span("enqueue", path.track, path.ingestNs, path.enqueueNs, path.packetId);
+        span("mux", path.track, path.enqueueNs, path.muxNs, path.packetId);
+        span("write", path.track, path.muxNs, path.writeNs, path.packetId);
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+bool RelayTracer::writeChromeTrace(const std::string &path, std::string &error) const
+{
+    std::string trace = chromeTrace();
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        error = "Cannot write " + path;
+        return false;
+    }
+    bool ok = fwrite(trace.data(), 1, trace.size(), file) == trace.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        error = "Failed writing " + path;
+    }
+    return ok;
+}
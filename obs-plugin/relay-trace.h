@@ -0,0 +1,101 @@
+#pragma once
+
+/*
+ * Per-packet latency tracing.
+ *
+ * A packet is stamped with the monotonic clock where it enters the relay
+ * (the ingest, or an encoder's output for renditions), when a destination
+ * queues it, when it is framed into RTMP chunks (mux) and when the socket
+ * took it (write). Every thread records into a ring of its own, so a
+ * stamp is a handful of relaxed stores that never contend, and the oldest
+ * events are overwritten. Readers copy the rings whenever they like,
+ * dropping whatever a writer overtook meanwhile: for per-stage
+ * percentiles, or as a Chrome trace to open in ui.perfetto.dev or
+ * chrome://tracing.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "relay-common.h"
+#include "relay-packet.h"
+
+#define RELAY_TRACE_RING_EVENTS 16384 // per recording thread, a power of two
+
+enum class RelayTraceStage : uint8_t {
+    Ingest,
+    Enqueue,
+    Mux,
+    Write,
+};
+
+struct RelayTraceEvent {
+    uint64_t ns = 0;
+    uint64_t packetId = 0;
+    uint64_t ingestNs = 0;
+    uint32_t track = 0; // an ingest, encoder or destination; see RelayTracer::track()
+    uint32_t bytes = 0;
+    RelayTraceStage stage = RelayTraceStage::Ingest;
+};
+
+// Time spent reaching a stage from the one before it, over the events
+// still in the rings; "total" runs from ingest to write
+struct RelayTraceStageSummary {
+    std::string stage;
+    size_t count = 0;
+    double p50Ms = 0;
+    double p99Ms = 0;
+    double maxMs = 0;
+};
+
+extern std::atomic<bool> relayTraceEnabled;
+
+class RelayTracer {
+public:
+    static RelayTracer &instance();
+
+    // Tracks name the rows of a trace; the same name gets the same id
+    uint32_t track(const std::string &name);
+    void record(RelayTraceStage stage, uint32_t track, const RelayPacket &packet);
+
+    std::vector<RelayTraceEvent> events() const;
+    std::vector<RelayTraceStageSummary> summary() const;
+    // Chrome's JSON trace format, which Perfetto reads too
+    std::string chromeTrace() const;
+    bool writeChromeTrace(const std::string &path, std::string &error) const;
+
+private:
+    struct Ring;
+
+    RelayTracer();
+    Ring &threadRing();
+    std::vector<std::string> trackNames() const;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings; // never shrinks; readers walk them unlocked
+    std::vector<std::string> tracks;
+    std::map<std::string, uint32_t> trackIds;
+};
+
+// Gives a packet entering the relay its id and ingest time
+inline void relayTraceIngest(RelayPacket &packet, uint32_t track)
+{
+    if (relayTraceEnabled.load(std::memory_order_relaxed)) {
+        static std::atomic<uint64_t> nextId{1};
+        packet.traceId = nextId.fetch_add(1, std::memory_order_relaxed);
+        packet.ingestNs = relayNowNs();
+        RelayTracer::instance().record(RelayTraceStage::Ingest, track, packet);
+    }
+}
+
+inline void relayTrace(RelayTraceStage stage, uint32_t track, const RelayPacket &packet)
+{
+    if (packet.traceId && relayTraceEnabled.load(std::memory_order_relaxed)) {
+        RelayTracer::instance().record(stage, track, packet);
+    }
+}
@@ -0,0 +1,590 @@
+#include "relay-transcoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <thread>
+
+#include "relay-common.h"
+#include "relay-flv.h"
+#include "relay-trace.h"
+
+std::string RelayEncodeParams::describe() const
+{
+    std::ostringstream out;
+    out << name << " " << videoBitrateKbps << "k " << preset;
+    if (width > 0 && height > 0) {
+        out << " " << width << "x" << height;
+    }
+    out << "@" << fps;
+    return out.str();
+}
+
+static std::string trimmed(const std::string &text)
+{
+    size_t begin = text.find_first_not_of(" \t");
+    size_t end = text.find_last_not_of(" \t");
+    return begin == std::string::npos ? std::string() : text.substr(begin, end - begin + 1);
+}
+
+bool parseRenditionLadder(const std::string &text, std::vector<RelayEncodeParams> &ladder)
+{
+    std::vector<RelayEncodeParams> parsed;
+    std::istringstream entries(text);
+    std::string entry;
+
+    while (std::getline(entries, entry, ',')) {
+        entry = trimmed(entry);
+        if (entry.empty()) {
+            continue;
+        }
+
+        size_t equals = entry.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+
+        RelayEncodeParams rung;
+        rung.name = trimmed(entry.substr(0, equals));
+        std::string spec = trimmed(entry.substr(equals + 1));
+        if (rung.name.empty() || rung.name == "source" ||
+            sscanf(spec.c_str(), "%dx%d@%d:%d", &rung.width, &rung.height, &rung.fps,
+                   &rung.videoBitrateKbps) != 4) {
+            return false;
+        }
+        if (rung.width <= 0 || rung.height <= 0 || rung.fps <= 0 ||
+            rung.videoBitrateKbps < MIN_BITRATE || rung.videoBitrateKbps > MAX_BITRATE) {
+            return false;
+        }
+        for (const auto &existing : parsed) {
+            if (existing.name == rung.name) {
+                return false;
+            }
+        }
+        parsed.push_back(rung);
+    }
+
+    ladder.swap(parsed);
+    return true;
+}
+
+RelayTranscoder::RelayTranscoder(const std::vector<RelayEncodeParams> &renditions, const std::string &ffmpegPath,
+                                 const std::string &logPath, PacketCallback onOutput)
+    : outputs(renditions), ffmpegPath(ffmpegPath), logPath(logPath), onOutput(std::move(onOutput))
+{
+    for (const auto &rung : outputs) {
+        size_t track = 0;
+        while (track < audioTracks.size() && (audioTracks[track].bitrateKbps != rung.audioBitrateKbps ||
+                                              audioTracks[track].sampleRate != rung.audioSampleRate)) {
+            track++;
+        }
+        if (track == audioTracks.size()) {
+            audioTracks.push_back({rung.audioBitrateKbps, rung.audioSampleRate});
+        }
+        rungAudio.push_back(track);
+    }
+}
+
+RelayTranscoder::~RelayTranscoder()
+{
+    stop();
+}
+
+std::string RelayTranscoder::describe() const
+{
+    std::string text;
+    for (const auto &rung : outputs) {
+        text += (text.empty() ? "" : ", ") + rung.describe();
+    }
+    return text;
+}
+
+// The source's AAC as it is, if it already has the rate asked for; the
+// rung's audio bitrate only applies to audio we encode
+bool RelayTranscoder::copiesAudio(const AudioTrack &track) const
+{
+    FlvAacConfig source;
+    return audioHeader && flvParseAacConfig(*audioHeader, source) && source.objectType == FLV_AAC_OBJECT_LC &&
+           source.sampleRate == track.sampleRate && source.channels >= 1 && source.channels <= 2;
+}
+
+// The tee muxer parses its slave list, unescaping once
+static std::string teeEscaped(const std::string &url)
+{
+    std::string escaped;
+    for (char c : url) {
+        if (c == '\\' || c == '\'' || c == '|') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+std::vector<std::string> RelayTranscoder::buildArguments() const
+{
+    std::vector<std::string> args = {
+        "-hide_banner", "-loglevel", "warning", "-y",
+        "-fflags", "nobuffer", "-f", "flv", "-i", "pipe:0",
+    };
+
+    // Decode once, scale once per distinct resolution, then split by frame rate:
+    // [0:v]split=G[g0]..; [g0]scale=W:H,split=K[r0]..; [r0]fps=F[v0]; ...
+    std::vector<std::pair<std::pair<int, int>, std::vector<size_t>>> groups;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        std::pair<int, int> size(outputs[i].width, outputs[i].height);
+        auto group = groups.begin();
+        while (group != groups.end() && group->first != size) {
+            ++group;
+        }
+        if (group == groups.end()) {
+            groups.push_back({size, {}});
+            group = groups.end() - 1;
+        }
+        group->second.push_back(i);
+    }
+
+    std::string graph = "[0:v]split=" + std::to_string(groups.size());
+    for (size_t g = 0; g < groups.size(); g++) {
+        graph += "[g" + std::to_string(g) + "]";
+    }
+    for (size_t g = 0; g < groups.size(); g++) {
+        const auto &size = groups[g].first;
+        graph += ";[g" + std::to_string(g) + "]";
+        if (size.first > 0 && size.second > 0) {
+            graph += "scale=" + std::to_string(size.first) + ":" + std::to_string(size.second) + ",";
+        }
+        graph += "split=" + std::to_string(groups[g].second.size());
+        for (size_t rung : groups[g].second) {
+            graph += "[r" + std::to_string(rung) + "]";
+        }
+    }
+    for (size_t i = 0; i < outputs.size(); i++) {
+        graph += ";[r" + std::to_string(i) + "]fps=" + std::to_string(outputs[i].fps) +
+                 "[v" + std::to_string(i) + "]";
+    }
+    args.push_back("-filter_complex");
+    args.push_back(graph);
+
+    // One output holding every rung's video (streams 0..N-1) and then the
+    // audio streams, so no audio is encoded twice
+    for (size_t i = 0; i < outputs.size(); i++) {
+        args.push_back("-map");
+        args.push_back("[v" + std::to_string(i) + "]");
+    }
+
+    std::vector<std::string> extraArgs;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        const auto &p = outputs[i];
+        std::string v = ":v:" + std::to_string(i);
+        std::string bitrate = std::to_string(p.videoBitrateKbps) + "k";
+        RelayEncoderTuning tuning = governor ? governor->tuning() : RelayEncoderTuning{p.preset, 0};
+
+        const std::vector<std::string> rung = {
+            "-c" + v, "libx264", "-preset" + v, tuning.preset,
+            "-b" + v, bitrate, "-maxrate" + v, bitrate, "-bufsize" + v, bitrate,
+            "-pix_fmt" + v, "yuv420p", "-g" + v, std::to_string(p.gopSize()),
+        };
+        args.insert(args.end(), rung.begin(), rung.end());
+        if (tuning.threads > 0) {
+            args.insert(args.end(), {"-threads" + v, std::to_string(tuning.threads)});
+        }
+        if (std::find(extraArgs.begin(), extraArgs.end(), p.extraArgs) == extraArgs.end()) {
+            extraArgs.push_back(p.extraArgs);
+        }
+    }
+
+    // A stream per audio track, except that the tracks copying the source
+    // are all the same stream
+    FlvAacConfig source;
+    bool sourceKnown = audioHeader && flvParseAacConfig(*audioHeader, source);
+    std::vector<size_t> trackStreams;
+    size_t audioStreams = 0;
+    size_t copyStream = SIZE_MAX;
+    for (const auto &track : audioTracks) {
+        bool copy = copiesAudio(track);
+        if (copy && copyStream != SIZE_MAX) {
+            trackStreams.push_back(copyStream);
+            continue;
+        }
+        std::string a = ":a:" + std::to_string(audioStreams);
+        trackStreams.push_back(audioStreams++);
+        args.insert(args.end(), {"-map", "0:a?"});
+        if (copy) {
+            copyStream = trackStreams.back();
+            args.insert(args.end(), {"-c" + a, "copy"});
+            continue;
+        }
+        args.insert(args.end(), {"-c" + a, "aac", "-b" + a, std::to_string(track.bitrateKbps) + "k", "-ac" + a, "2"});
+        if (!sourceKnown || source.sampleRate != track.sampleRate) {
+            args.insert(args.end(), {"-ar" + a, std::to_string(track.sampleRate)});
+        }
+    }
+
+    // Extra arguments apply to the whole output, once for every distinct set
+    for (const auto &extra : extraArgs) {
+        std::istringstream tokens(extra);
+        std::string token;
+        while (tokens >> token) {
+            args.push_back(token);
+        }
+    }
+
+    // Rung i gets its video and its audio track, on stdout for rung 0 and
+    // on the process's extra outputs for the rest. FLV wants the codec
+    // configuration up front, which the tee muxer does not ask for.
+    std::string slaves;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        slaves += (i == 0 ? "" : "|") + std::string("[f=flv:select=") + std::to_string(i) + "," +
+                  std::to_string(outputs.size() + trackStreams[rungAudio[i]]) + "]" + teeEscaped(process.outputUrl((int)i));
+    }
+    args.insert(args.end(), {"-flags", "+global_header", "-f", "tee", slaves});
+    return args;
+}
+
+bool RelayTranscoder::start(const std::vector<RelayPacketPtr> &headers)
+{
+    if (running) {
+        return true;
+    }
+
+    if (outputs.empty()) {
+        error = "No renditions requested";
+        return false;
+    }
+
+    // Reported the instant ffmpeg exits; the writer thread restarts it
+    process.setExitCallback([this](int status) {
+        exitStatus = status;
+        std::lock_guard<std::mutex> lock(queueMutex);
+        crashed = true;
+        queueCondition.notify_all();
+    });
+
+    lastTimestamps.assign(outputs.size(), 0);
+    governor.reset();
+    if (governorLimits.enabled) {
+        governor = std::make_unique<RelayEncoderGovernor>(governorLimits, outputs[0].preset,
+                                                          std::thread::hardware_concurrency());
+    }
+    for (const auto &header : headers) {
+        if (header->isScript()) {
+            metadata = header;
+        } else if (header->isSequenceHeader()) {
+            (header->isVideo() ? videoHeader : audioHeader) = header;
+        }
+    }
+
+    // Whether the audio can be copied depends on the source's headers. A
+    // source that has not sent them yet sends them ahead of its first
+    // keyframe, so the writer launches ffmpeg there instead.
+    launched = false;
+    if (videoHeader && !launch()) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.clear();
+        waitingForKeyframe = true;
+    }
+
+    running = true;
+    writer = std::thread(&RelayTranscoder::writeLoop, this);
+    PLUGIN_LOG_INFO("Ladder encoder started (%s)", describe().c_str());
+    return true;
+}
+
+bool RelayTranscoder::launch()
+{
+    crashed = false;
+    exitStatus = -1;
+    if (!process.start(ffmpegPath, buildArguments(), logPath, (int)outputs.size() - 1)) {
+        error = process.lastError();
+        return false;
+    }
+    launchedAt = relayNowMs();
+    launched = true;
+    if (governor) {
+        governor->launched(launchedAt);
+    }
+    for (const auto &track : audioTracks) {
+        if (copiesAudio(track)) {
+            PLUGIN_LOG_INFO("Ladder encoder passes the source audio through at %d Hz", track.sampleRate);
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < outputs.size(); i++) {
+        // Continue each rung's timeline instead of jumping back to zero
+        uint32_t offset = lastTimestamps[i] > 0 ? lastTimestamps[i] + 1 : 0;
+        readers.emplace_back(&RelayTranscoder::readLoop, this, i, offset);
+    }
+    return true;
+}
+
+bool RelayTranscoder::restart()
+{
+    // A new tuning relaunches at once; only failures back off
+    bool retuning = retune.exchange(false) && !crashed;
+    if (!retuning && exitStatus >= 0) {
+        // A broken pipe can be noticed before the exit itself is reported
+        PLUGIN_LOG_WARNING("Ladder encoder exited unexpectedly (status %d)", exitStatus.load());
+    } else if (!retuning) {
+        PLUGIN_LOG_WARNING("Ladder encoder stopped accepting input");
+    }
+
+    std::lock_guard<std::mutex> lock(processMutex);
+
+    // Reap the old process; its readers end at EOF
+    process.terminate(0);
+    for (auto &reader : readers) {
+        if (reader.joinable()) {
+            reader.join();
+        }
+    }
+    readers.clear();
+
+    int delayMs = 0;
+    if (retuning) {
+        // Read only now: rendition 0's reader updates the governor
+        RelayEncoderTuning tuning = governor->tuning();
+        PLUGIN_LOG_INFO("Ladder encoder retuned to preset %s with %d thread(s) per rung", tuning.preset.c_str(),
+                        tuning.threads);
+    } else {
+        if (relayNowMs() - launchedAt >= RELAY_RECONNECT_STABLE_MS) {
+            restartBackoff.reset();
+        }
+        delayMs = restartBackoff.nextDelayMs();
+        if (delayMs < 0) {
+            error = "Ladder encoder keeps failing, giving up";
+            PLUGIN_LOG_ERROR("%s", error.c_str());
+            if (onFailure) {
+                onFailure(error);
+            }
+            return false;
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> queueLock(queueMutex);
+        queueCondition.wait_for(queueLock, std::chrono::milliseconds(delayMs), [this]() { return !running.load(); });
+        if (!running) {
+            return false;
+        }
+        // Resume from the next keyframe after the cached headers
+        queue.clear();
+        waitingForKeyframe = true;
+    }
+
+    if (!launch()) {
+        PLUGIN_LOG_ERROR("Failed to restart ladder encoder: %s", error.c_str());
+        crashed = true;
+        return running;
+    }
+    if (!retuning) {
+        for (const auto &entry : stats) {
+            entry->restarts.add(1);
+        }
+        PLUGIN_LOG_INFO("Ladder encoder restarted (attempt %d)", restartBackoff.attemptCount());
+    }
+    return true;
+}
+
+void RelayTranscoder::stop()
+{
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    // SIGTERM lets ffmpeg finish cleanly and unblocks a writer stuck on a
+    // full pipe; the readers then drain their pipes to EOF
+    queueCondition.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(processMutex);
+        process.requestExit();
+    }
+    if (writer.joinable()) {
+        writer.join();
+    }
+    process.terminate(2000);
+    for (auto &reader : readers) {
+        if (reader.joinable()) {
+            reader.join();
+        }
+    }
+    readers.clear();
+}
+
+void RelayTranscoder::push(const RelayPacketPtr &packet)
+{
+    if (!running) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (queue.size() >= RELAY_TRANSCODER_MAX_QUEUED) {
+            // The encoder fell behind; restart from the next keyframe
+            PLUGIN_LOG_WARNING("Ladder encoder is falling behind, dropping queued frames");
+            queue.clear();
+            waitingForKeyframe = true;
+        }
+        queue.push_back(packet);
+    }
+    queueCondition.notify_one();
+}
+
+void RelayTranscoder::writeLoop()
+{
+    std::vector<uint8_t> buffer;
+    bool headerWritten = false;
+
+    while (running) {
+        if (crashed || retune) {
+            if (!restart()) {
+                break;
+            }
+            headerWritten = false;
+            continue;
+        }
+
+        RelayPacketPtr packet;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this]() { return !queue.empty() || !running || crashed || retune; });
+            if (!running || crashed || retune) {
+                continue;
+            }
+            packet = queue.front();
+            queue.pop_front();
+
+            if (packet->isVideo() && !packet->isSequenceHeader()) {
+                if (waitingForKeyframe && !packet->isKeyframe()) {
+                    continue;
+                }
+                waitingForKeyframe = false;
+            }
+        }
+
+        bool header = packet->isScript() || packet->isSequenceHeader();
+        if (packet->isScript()) {
+            metadata = packet;
+        } else if (packet->isSequenceHeader()) {
+            (packet->isVideo() ? videoHeader : audioHeader) = packet;
+        }
+
+        if (!launched) {
+            if (header || !packet->isKeyframe()) {
+                continue;
+            }
+            if (!launch()) {
+                PLUGIN_LOG_ERROR("Failed to start ladder encoder: %s", error.c_str());
+                crashed = true;
+                continue;
+            }
+        }
+        if (!headerWritten) {
+            buffer.clear();
+            flvWriteHeader(buffer, true, true);
+            for (const auto &cached : {metadata, videoHeader, audioHeader}) {
+                if (cached) {
+                    flvWriteTag(buffer, *flvStripSetDataFrame(cached));
+                }
+            }
+            if (!process.writeAll(buffer.data(), buffer.size())) {
+                crashed = true;
+                continue;
+            }
+            headerWritten = true;
+            if (header) {
+                continue; // went out with the cached ones
+            }
+        }
+
+        buffer.clear();
+        flvWriteTag(buffer, *flvStripSetDataFrame(packet));
+        if (!process.writeAll(buffer.data(), buffer.size()) && running) {
+            // The exit notification follows; restart either way
+            crashed = true;
+        }
+        fedTimestamp.store(packet->timestamp, std::memory_order_relaxed);
+    }
+}
+
+void RelayTranscoder::readLoop(size_t rendition, uint32_t timestampOffset)
+{
+    FlvDemuxer demuxer;
+    demuxer.setTimestampOffset(timestampOffset);
+    demuxer.setTraceTrack(RelayTracer::instance().track("encode " + outputs[rendition].name));
+    std::vector<uint8_t> buffer(64 * 1024);
+    RelayEncoderStats *speedStats = rendition < stats.size() ? stats[rendition].get() : nullptr;
+    bool tunes = rendition == 0 && governor;
+    uint64_t windowStartMs = 0;
+    uint32_t windowStartTimestamp = 0;
+    uint32_t windowStartFed = 0;
+
+    while (true) {
+        long n = process.readSome(buffer.data(), buffer.size(), (int)rendition);
+        if (n <= 0) {
+            break;
+        }
+
+        std::vector<RelayPacketPtr> packets;
+        if (!demuxer.feed(buffer.data(), (size_t)n, packets)) {
+            PLUGIN_LOG_ERROR("Rendition %s produced invalid FLV", outputs[rendition].name.c_str());
+            break;
+        }
+        for (const auto &packet : packets) {
+            lastTimestamps[rendition] = packet->timestamp;
+            onOutput(rendition, flvAddSetDataFrame(packet));
+        }
+
+        // Speed = media time produced per wall-clock time
+        if ((speedStats || tunes) && !packets.empty()) {
+            uint64_t now = relayNowMs();
+            uint32_t timestamp = packets.back()->timestamp;
+            uint32_t fed = fedTimestamp.load(std::memory_order_relaxed);
+            if (windowStartMs == 0 || timestamp < windowStartTimestamp || fed < windowStartFed) {
+                windowStartMs = now;
+                windowStartTimestamp = timestamp;
+                windowStartFed = fed;
+            } else if (now - windowStartMs >= RELAY_TRANSCODER_SPEED_WINDOW_MS) {
+                uint64_t perMille = (uint64_t)(timestamp - windowStartTimestamp) * 1000 / (now - windowStartMs);
+                if (speedStats) {
+                    speedStats->speed.observe(perMille);
+                    speedStats->lastSpeedPerMille.store((uint32_t)perMille, std::memory_order_relaxed);
+                }
+                if (tunes) {
+                    tune(timestamp - windowStartTimestamp, fed - windowStartFed);
+                }
+                windowStartMs = now;
+                windowStartTimestamp = timestamp;
+                windowStartFed = fed;
+            }
+        }
+    }
+}
+
+// Encoded against fed media time, so a source that stalls does not look
+// like an encoder falling behind
+void RelayTranscoder::tune(uint32_t encodedMs, uint32_t fedMs)
+{
+    double cpuBusy = cpuSampler.sample();
+    if (fedMs < RELAY_TRANSCODER_SPEED_WINDOW_MS / 2) {
+        return;
+    }
+
+    RelayGovernorSample sample;
+    sample.speed = (double)encodedMs / fedMs;
+    sample.cpuBusy = cpuBusy;
+    if (governor->update(sample, relayNowMs())) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            retune = true;
+        }
+        queueCondition.notify_all();
+    }
+}
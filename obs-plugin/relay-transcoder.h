@@ -0,0 +1,153 @@
+#pragma once
+
+/*
+ * Shared ffmpeg encode stage for the rendition ladder. The source stream is
+ * fed to ffmpeg as FLV over stdin; ffmpeg decodes it once, scales once per
+ * distinct resolution and encodes each requested rung exactly once. The
+ * split filters hand every encoder references to the same decoded frames,
+ * so no frame is copied between them. Audio is one stream per distinct
+ * bitrate and rate, copied when the source already is AAC at that rate and
+ * resampled only when it is not, and the tee muxer gives every rung its
+ * video and its audio as FLV on a pipe of its own. Each is demuxed into
+ * packets, so any number of destinations can subscribe to a rung for free.
+ * With auto-tuning on, a RelayEncoderGovernor picks the x264 preset and
+ * threads, and ffmpeg is relaunched whenever it changes them. If ffmpeg
+ * dies it is restarted with backoff, and output timestamps carry on from
+ * where the previous process left off.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "relay-governor.h"
+#include "relay-packet.h"
+#include "relay-process.h"
+#include "relay-reconnect.h"
+#include "relay-stats.h"
+
+#include "plugin-macros.h"
+
+// Encoder speed is sampled over windows of at least this long
+#define RELAY_TRANSCODER_SPEED_WINDOW_MS 1000
+#define RELAY_TRANSCODER_MAX_QUEUED 1024
+
+// One rung of the rendition ladder
+struct RelayEncodeParams {
+    std::string name;
+    int videoBitrateKbps = DEFAULT_BITRATE;
+    std::string preset = DEFAULT_PRESET;
+    int width = 0; // 0 keeps the source resolution
+    int height = 0;
+    int fps = 30;
+    int audioBitrateKbps = 160;
+    int audioSampleRate = 44100;
+    std::string extraArgs;
+
+    bool operator==(const RelayEncodeParams &other) const
+    {
+        return name == other.name && videoBitrateKbps == other.videoBitrateKbps &&
+               preset == other.preset && width == other.width && height == other.height &&
+               fps == other.fps && audioBitrateKbps == other.audioBitrateKbps &&
+               audioSampleRate == other.audioSampleRate && extraArgs == other.extraArgs;
+    }
+    bool operator!=(const RelayEncodeParams &other) const { return !(*this == other); }
+
+    // Keyframe every two seconds, as the platforms recommend
+    int gopSize() const { return fps * 2; }
+    std::string describe() const;
+};
+
+// Parses "name=WxH@fps:kbps, ..." (e.g. "720p30=1280x720@30:3500")
+bool parseRenditionLadder(const std::string &text, std::vector<RelayEncodeParams> &ladder);
+
+class RelayTranscoder {
+public:
+    using PacketCallback = std::function<void(size_t rendition, const RelayPacketPtr &packet)>;
+
+    RelayTranscoder(const std::vector<RelayEncodeParams> &renditions, const std::string &ffmpegPath,
+                    const std::string &logPath, PacketCallback onOutput);
+    ~RelayTranscoder();
+
+    // Called once restarting has been given up on
+    void setFailureCallback(std::function<void(const std::string &reason)> callback) { onFailure = std::move(callback); }
+    void setPidFile(const std::string &path) { process.setPidFile(path); }
+    // One entry per rendition, in the order given to the constructor
+    void setStats(std::vector<std::shared_ptr<RelayEncoderStats>> renditionStats) { stats = std::move(renditionStats); }
+    // Applies to the next start()
+    void setGovernor(const RelayGovernorLimits &limits) { governorLimits = limits; }
+
+    // headers are the source's current metadata/sequence headers, if any
+    bool start(const std::vector<RelayPacketPtr> &headers);
+    void stop();
+    void push(const RelayPacketPtr &packet);
+
+    bool isRunning() const { return running; }
+    const std::vector<RelayEncodeParams> &renditions() const { return outputs; }
+    const std::string &lastError() const { return error; }
+
+private:
+    // An audio stream the rungs asking for the same audio share
+    struct AudioTrack {
+        int bitrateKbps = 0;
+        int sampleRate = 0;
+    };
+
+    std::vector<std::string> buildArguments() const;
+    bool copiesAudio(const AudioTrack &track) const;
+    std::string describe() const;
+    bool launch();
+    bool restart();
+    void writeLoop();
+    void readLoop(size_t rendition, uint32_t timestampOffset);
+    void tune(uint32_t encodedMs, uint32_t fedMs);
+
+    std::vector<RelayEncodeParams> outputs;
+    std::vector<AudioTrack> audioTracks;
+    std::vector<size_t> rungAudio; // index into audioTracks, per rung
+    std::string ffmpegPath;
+    std::string logPath;
+    PacketCallback onOutput;
+    std::function<void(const std::string &reason)> onFailure;
+    std::vector<std::shared_ptr<RelayEncoderStats>> stats;
+
+    RelayProcess process;
+    // Serialises stop() against the writer replacing a crashed process.
+    // Never held together with queueMutex: the exit callback takes that one.
+    std::mutex processMutex;
+    std::thread writer;
+    std::vector<std::thread> readers;
+    std::atomic<bool> running{false};
+    std::atomic<bool> crashed{false};
+    std::atomic<bool> retune{false}; // the governor changed the tuning
+    std::atomic<int> exitStatus{-1};
+    RelayBackoff restartBackoff;
+    uint64_t launchedAt = 0;
+    // Writer thread only once started; see start()
+    bool launched = false;
+
+    // Rung 0's reader samples and updates the governor; the writer reads
+    // its tuning only while no reader runs
+    RelayGovernorLimits governorLimits;
+    std::unique_ptr<RelayEncoderGovernor> governor;
+    RelayCpuSampler cpuSampler;
+    std::atomic<uint32_t> fedTimestamp{0}; // source timestamp last written to ffmpeg
+    std::string error;
+
+    // Written by the reader of each rendition; read once readers are joined
+    std::vector<uint32_t> lastTimestamps;
+    // Latest source headers, written first into every encoder launched
+    RelayPacketPtr metadata;
+    RelayPacketPtr videoHeader;
+    RelayPacketPtr audioHeader;
+
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<RelayPacketPtr> queue;
+    bool waitingForKeyframe = true;
+};
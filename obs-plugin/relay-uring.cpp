@@ -0,0 +1,277 @@
+#include "relay-uring.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+RelayUring::~RelayUring()
+{
+    close();
+}
+
+bool RelayUring::fail(const std::string &what, int code)
+{
+    error = what + " (" + std::strerror(code) + ")";
+    close();
+    return false;
+}
+
+#ifdef __linux__
+
+// The kernel and this thread share the ring indexes
+static unsigned loadAcquire(const unsigned *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned *p, unsigned value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+bool RelayUring::open(unsigned entries, size_t bufferCount, size_t bufferSize)
+{
+    close();
+
+    // Completions are only ever reaped by the owning thread between
+    // iterations, so the kernel need not interrupt it to post them (5.19+)
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (ringFd < 0) {
+        ringFd = -1;
+        return fail("io_uring_setup failed", errno);
+    }
+    sqEntries = params.sq_entries;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                  IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        return fail("Cannot map the submission ring", errno);
+    }
+    if (singleMap) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            return fail("Cannot map the completion ring", errno);
+        }
+    }
+    sqeMemorySize = params.sq_entries * sizeof(io_uring_sqe);
+    sqeMemory = mmap(nullptr, sqeMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                     IORING_OFF_SQES);
+    if (sqeMemory == MAP_FAILED) {
+        sqeMemory = nullptr;
+        return fail("Cannot map the submission entries", errno);
+    }
+
+    auto *sq = (uint8_t *)sqRing;
+    sqHead = (unsigned *)(sq + params.sq_off.head);
+    sqTail = (unsigned *)(sq + params.sq_off.tail);
+    sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + params.sq_off.array);
+    auto *cq = (uint8_t *)cqRing;
+    cqHead = (unsigned *)(cq + params.cq_off.head);
+    cqTail = (unsigned *)(cq + params.cq_off.tail);
+    cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+    sqTailLocal = *sqTail;
+
+    // Sends need 5.6; the probe itself arrived with them
+    std::vector<uint8_t> probeMemory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto *probe = (io_uring_probe *)probeMemory.data();
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, 256) != 0) {
+        return fail("Cannot probe the ring", errno);
+    }
+    if (probe->last_op < IORING_OP_SEND || !(probe->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED)) {
+        return fail("The ring cannot send", EOPNOTSUPP);
+    }
+
+    memorySize = bufferCount * bufferSize;
+    void *mapping = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return fail("Cannot allocate the send buffers", errno);
+    }
+    memory = (uint8_t *)mapping;
+    bufferBytes = bufferSize;
+
+    freeBuffers.clear();
+    for (size_t i = bufferCount; i > 0; i--) {
+        freeBuffers.push_back((int)(i - 1));
+    }
+    return true;
+}
+
+void RelayUring::close()
+{
+    // Closing the ring cancels what is in flight
+    if (ringFd >= 0) {
+        ::close(ringFd);
+        ringFd = -1;
+    }
+    if (sqeMemory) {
+        munmap(sqeMemory, sqeMemorySize);
+        sqeMemory = nullptr;
+    }
+    if (cqRing && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    cqRing = nullptr;
+    if (sqRing) {
+        munmap(sqRing, sqRingSize);
+        sqRing = nullptr;
+    }
+    if (memory) {
+        munmap(memory, memorySize);
+        memory = nullptr;
+    }
+    freeBuffers.clear();
+    unsubmitted = 0;
+}
+
+unsigned RelayUring::freeSubmissions() const
+{
+    return isOpen() ? sqEntries - (sqTailLocal - loadAcquire(sqHead)) : 0;
+}
+
+bool RelayUring::prepareSend(int fd, int bufferIndex, size_t length, uint64_t userData, bool linkNext)
+{
+    if (freeSubmissions() == 0) {
+        return false;
+    }
+
+    unsigned index = sqTailLocal & *sqMask;
+    auto *sqe = (io_uring_sqe *)sqeMemory + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_SEND;
+    sqe->flags = linkNext ? IOSQE_IO_LINK : 0;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer(bufferIndex);
+    sqe->len = (uint32_t)length;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData;
+    sqArray[index] = index;
+
+    storeRelease(sqTail, ++sqTailLocal);
+    unsubmitted++;
+    return true;
+}
+
+bool RelayUring::submit()
+{
+    while (unsubmitted > 0) {
+        long rc = syscall(__NR_io_uring_enter, ringFd, unsubmitted, 0, 0, nullptr, 0);
+        enterCalls++;
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                // Completions are backing up; the next loop iteration reaps
+                // them and submits the rest
+                return true;
+            }
+            error = std::string("io_uring_enter failed (") + std::strerror(errno) + ")";
+            return false;
+        }
+        unsubmitted -= (unsigned)rc;
+    }
+    return true;
+}
+
+size_t RelayUring::reap(const std::function<void(uint64_t userData, int result)> &callback)
+{
+    size_t count = 0;
+    if (!isOpen()) {
+        return count;
+    }
+    unsigned head = *cqHead;
+    while (head != loadAcquire(cqTail)) {
+        const auto *cqe = (const io_uring_cqe *)cqes + (head & *cqMask);
+        uint64_t userData = cqe->user_data;
+        int result = cqe->res;
+        // Released before the callback, which may queue more writes
+        storeRelease(cqHead, ++head);
+        callback(userData, result);
+        count++;
+        head = *cqHead;
+    }
+    return count;
+}
+
+#else
+
+bool RelayUring::open(unsigned entries, size_t bufferCount, size_t bufferSize)
+{
+    (void)entries;
+    (void)bufferCount;
+    (void)bufferSize;
+    error = "io_uring is only available on Linux";
+    return false;
+}
+
+void RelayUring::close() {}
+
+unsigned RelayUring::freeSubmissions() const
+{
+    return 0;
+}
+
+bool RelayUring::prepareSend(int fd, int bufferIndex, size_t length, uint64_t userData, bool linkNext)
+{
+    (void)fd;
+    (void)bufferIndex;
+    (void)length;
+    (void)userData;
+    (void)linkNext;
+    return false;
+}
+
+bool RelayUring::submit()
+{
+    return false;
+}
+
+size_t RelayUring::reap(const std::function<void(uint64_t userData, int result)> &callback)
+{
+    (void)callback;
+    return 0;
+}
+
+#endif
+
+int RelayUring::acquireBuffer()
+{
+    if (freeBuffers.empty()) {
+        return -1;
+    }
+    int index = freeBuffers.back();
+    freeBuffers.pop_back();
+    return index;
+}
+
+void RelayUring::releaseBuffer(int index)
+{
+    freeBuffers.push_back(index);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+/*
+ * io_uring send ring for one shard (Linux 5.6+).
+ *
+ * Talks to the kernel through the raw system calls, so there is no
+ * liburing dependency. Destinations copy outgoing bytes into the ring's
+ * buffer pool and queue sends with MSG_NOSIGNAL (a write to a reset peer
+ * would raise SIGPIPE, and fixed-buffer writes cannot suppress it); the
+ * shard submits everything its
+ * handlers queued during one loop iteration with a single io_uring_enter
+ * and learns about completions through the ring fd in its poller. With N
+ * destinations that is a few system calls per iteration instead of one
+ * per write.
+ *
+ * Elsewhere, or on kernels without IORING_OP_SEND, open() fails and the
+ * shard keeps plain non-blocking sends.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class RelayUring {
+public:
+    RelayUring() = default;
+    ~RelayUring();
+    RelayUring(const RelayUring &) = delete;
+    RelayUring &operator=(const RelayUring &) = delete;
+
+    // Sets up a ring of the given depth and a pool of bufferCount buffers
+    // of bufferSize bytes each
+    bool open(unsigned entries, size_t bufferCount, size_t bufferSize);
+    void close();
+    bool isOpen() const { return ringFd >= 0; }
+    // Readable while completions are waiting
+    int fd() const { return ringFd; }
+
+    // Send buffers; acquire returns -1 while all are in flight
+    int acquireBuffer();
+    void releaseBuffer(int index);
+    uint8_t *buffer(int index) { return memory + (size_t)index * bufferBytes; }
+    size_t bufferSize() const { return bufferBytes; }
+
+    // Queues a send of the first length bytes of a pool buffer; false when
+    // the submission queue is full. A linked send only starts once the one
+    // before it completed in full, and is cancelled (-ECANCELED) otherwise.
+    bool prepareSend(int fd, int bufferIndex, size_t length, uint64_t userData, bool linkNext);
+    unsigned freeSubmissions() const;
+    size_t freeBufferCount() const { return freeBuffers.size(); }
+    // Hands everything prepared to the kernel with one system call
+    bool submit();
+    bool hasUnsubmitted() const { return unsubmitted > 0; }
+    // result is what send() would return, or -errno
+    size_t reap(const std::function<void(uint64_t userData, int result)> &callback);
+
+    uint64_t submitCalls() const { return enterCalls; }
+    const std::string &lastError() const { return error; }
+
+private:
+    bool fail(const std::string &what, int code);
+
+    int ringFd = -1;
+    unsigned sqEntries = 0;
+    unsigned unsubmitted = 0;
+    unsigned sqTailLocal = 0;
+
+    // Ring mappings
+    void *sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void *cqRing = nullptr;
+    size_t cqRingSize = 0;
+    void *sqeMemory = nullptr;
+    size_t sqeMemorySize = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    void *cqes = nullptr;
+
+    // Send buffers, one anonymous mapping
+    uint8_t *memory = nullptr;
+    size_t memorySize = 0;
+    size_t bufferBytes = 0;
+    std::vector<int> freeBuffers;
+
+    uint64_t enterCalls = 0;
+    std::string error;
+};
@@ -66,6 +66,8 @@ typedef void* obs_frontend_cb_data;
 #include <QtWidgets/QSpinBox>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QFileDialog>
+#include <QtWidgets/QTableWidget>
+#include <QtWidgets/QHeaderView>
 #include <QtCore/QJsonDocument>
 #include <QtCore/QJsonObject>
 #include <QtCore/QProcess>
@@ -75,6 +77,7 @@ typedef void* obs_frontend_cb_data;
 #include <QtCore/QStandardPaths>
 #include <QtCore/QDir>
 #include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
 #else
 // Mock Qt classes for standalone compilation
 #define Q_OBJECT
@@ -90,17 +93,299 @@ class QProcess {};
 // Add other mock classes as needed
 #endif
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 // Plugin configuration
 #include "plugin-macros.h"
 
+// In-process relay engine
+#include "relay-config.h"
+#include "relay-engine.h"
+#include "relay-flv.h"
+#include "relay-probe.h"
+#include "relay-trace.h"
+
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("stream-relay-plugin", "en-US")
 
 class StreamRelayPlugin;
 static StreamRelayPlugin *plugin_instance = nullptr;
 
+// Native output ------------------------------------------------------------
+//
+// An OBS output the relay's own encoders feed: their packets become relay
+// packets right here, where OBS would otherwise mux FLV, publish it over
+// a loopback RTMP connection and have the ingest take it apart again.
+
+#define RELAY_OUTPUT_ID "stream_relay_output"
+
+struct RelayObsOutput {
+    obs_output_t *output = nullptr;
+    RelayEngine *engine = nullptr; // set by the dialog before every start
+    uint32_t traceTrack = 0;
+
+    // Encoder threads take turns delivering packets; stop() races them
+    std::mutex mutex;
+    RelayIngestStreamPtr stream;
+    bool headersSent = false;
+    int64_t firstDtsUsec = -1;
+};
+
+static void relay_output_push(RelayObsOutput *relayOutput, const std::shared_ptr<RelayPacket> &packet)
+{
+    if (packet) {
+        relayTraceIngest(*packet, relayOutput->traceTrack);
+        relayOutput->stream->push(packet);
+    }
+}
+
+// Metadata and both codec configurations, from the initialized encoders
+static void relay_output_send_headers(RelayObsOutput *relayOutput)
+{
+    obs_output_t *output = relayOutput->output;
+    obs_encoder_t *videoEncoder = obs_output_get_video_encoder(output);
+    obs_encoder_t *audioEncoder = obs_output_get_audio_encoder(output, 0);
+
+    FlvStreamInfo info;
+    info.width = (int)obs_output_get_width(output);
+    info.height = (int)obs_output_get_height(output);
+    info.fps = video_output_get_frame_rate(obs_output_video(output));
+    info.sampleRate = (int)obs_encoder_get_sample_rate(audioEncoder);
+    info.channels = (int)audio_output_get_channels(obs_output_audio(output));
+    obs_data_t *videoSettings = obs_encoder_get_settings(videoEncoder);
+    info.videoKbps = (int)obs_data_get_int(videoSettings, "bitrate");
+    obs_data_release(videoSettings);
+    obs_data_t *audioSettings = obs_encoder_get_settings(audioEncoder);
+    info.audioKbps = (int)obs_data_get_int(audioSettings, "bitrate");
+    obs_data_release(audioSettings);
+    relay_output_push(relayOutput, flvMetadataPacket(info));
+
+    uint8_t *extra = nullptr;
+    size_t size = 0;
+    if (obs_encoder_get_extra_data(videoEncoder, &extra, &size)) {
+        relay_output_push(relayOutput, flvAvcSequenceHeader(extra, size));
+    }
+    if (obs_encoder_get_extra_data(audioEncoder, &extra, &size)) {
+        relay_output_push(relayOutput, flvAacSequenceHeader(extra, size));
+    }
+}
+
+static const char *relay_output_get_name(void *type_data)
+{
+    UNUSED_PARAMETER(type_data);
+    return "StreamRelay";
+}
+
+static void *relay_output_create(obs_data_t *settings, obs_output_t *output)
+{
+    UNUSED_PARAMETER(settings);
+    auto *relayOutput = new RelayObsOutput();
+    relayOutput->output = output;
+    relayOutput->traceTrack = RelayTracer::instance().track("obs output");
+    return relayOutput;
+}
+
+static void relay_output_destroy(void *data)
+{
+    delete static_cast<RelayObsOutput *>(data);
+}
+
+static bool relay_output_start(void *data)
+{
+    auto *relayOutput = static_cast<RelayObsOutput *>(data);
+    if (!relayOutput->engine || !obs_output_can_begin_data_capture(relayOutput->output, 0) ||
+        !obs_output_initialize_encoders(relayOutput->output, 0)) {
+        return false;
+    }
+
+    RelayIngestStreamPtr stream = relayOutput->engine->openLocalStream(DEFAULT_STREAM_KEY);
+    if (!stream) {
+        obs_output_set_last_error(relayOutput->output, "The relay did not accept OBS's stream");
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(relayOutput->mutex);
+        relayOutput->stream = stream;
+        relayOutput->headersSent = false;
+        relayOutput->firstDtsUsec = -1;
+    }
+    return obs_output_begin_data_capture(relayOutput->output, 0);
+}
+
+static void relay_output_stop(void *data, uint64_t ts)
+{
+    UNUSED_PARAMETER(ts);
+    auto *relayOutput = static_cast<RelayObsOutput *>(data);
+    obs_output_end_data_capture(relayOutput->output);
+
+    RelayIngestStreamPtr stream;
+    {
+        std::lock_guard<std::mutex> lock(relayOutput->mutex);
+        stream = std::move(relayOutput->stream);
+    }
+    if (stream && relayOutput->engine) {
+        relayOutput->engine->closeLocalStream(stream);
+    }
+}
+
+static void relay_output_encoded_packet(void *data, struct encoder_packet *packet)
+{
+    auto *relayOutput = static_cast<RelayObsOutput *>(data);
+    if (!packet) {
+        obs_output_signal_stop(relayOutput->output, OBS_OUTPUT_ENCODE_ERROR);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(relayOutput->mutex);
+    if (!relayOutput->stream) {
+        return;
+    }
+    // The relay let go of the stream, e.g. it failed and is restarting.
+    // Signalled without the lock, since stopping the output takes it.
+    if (!relayOutput->stream->isOpen()) {
+        RelayIngestStreamPtr stream = std::move(relayOutput->stream);
+        lock.unlock();
+        if (relayOutput->engine) {
+            relayOutput->engine->closeLocalStream(stream);
+        }
+        obs_output_signal_stop(relayOutput->output, OBS_OUTPUT_DISCONNECTED);
+        return;
+    }
+    if (!relayOutput->headersSent) {
+        relay_output_send_headers(relayOutput);
+        relayOutput->headersSent = true;
+    }
+
+    // OBS interleaves from a video keyframe, so that packet starts the clock
+    if (relayOutput->firstDtsUsec < 0) {
+        relayOutput->firstDtsUsec = packet->dts_usec;
+    }
+    uint32_t timestamp = (uint32_t)std::max<int64_t>((packet->dts_usec - relayOutput->firstDtsUsec) / 1000, 0);
+    if (packet->type == OBS_ENCODER_VIDEO) {
+        int32_t compositionMs =
+            (int32_t)((packet->pts - packet->dts) * 1000 * packet->timebase_num / packet->timebase_den);
+        relay_output_push(relayOutput,
+                          flvAvcFrame(packet->data, packet->size, timestamp, compositionMs, packet->keyframe));
+    } else {
+        relay_output_push(relayOutput, flvAacFrame(packet->data, packet->size, timestamp));
+    }
+}
+
+// What OBS itself streams with, copied for the native output so the relay
+// honours the user's encoder (hardware or x264, rate control, keyframes)
+struct RelayEncoderChoice {
+    std::string id;
+    obs_data_t *settings = nullptr; // owned
+};
+
+// Simple output mode stores a short name; the encoder ids behind it moved
+// between OBS versions, so the first one this OBS knows wins
+static std::string simpleModeEncoderId(const char *name)
+{
+    static const std::vector<std::pair<std::string, std::vector<const char *>>> ids = {
+        {"x264", {"obs_x264"}},
+        {"x264_lowcpu", {"obs_x264"}},
+        {"qsv", {"obs_qsv11_v2", "obs_qsv11"}},
+        {"nvenc", {"obs_nvenc_h264_tex", "jim_nvenc", "ffmpeg_nvenc"}},
+        {"amd", {"h264_texture_amf", "amd_amf_h264"}},
+        {"apple_h264", {"com.apple.videotoolbox.videoencoder.ave.avc"}},
+    };
+    for (const auto &entry : ids) {
+        if (name && entry.first == name) {
+            for (const char *id : entry.second) {
+                if (obs_get_encoder_codec(id)) {
+                    return id;
+                }
+            }
+        }
+    }
+    return std::string();
+}
+
+// The streaming output's own encoder once OBS has set it up, else what the
+// profile configures. Empty unless it makes what the relay carries.
+static RelayEncoderChoice streamingEncoder(bool video)
+{
+    RelayEncoderChoice choice;
+    obs_output_t *output = obs_frontend_get_streaming_output();
+    obs_encoder_t *encoder =
+        !output ? nullptr : video ? obs_output_get_video_encoder(output) : obs_output_get_audio_encoder(output, 0);
+    if (encoder) {
+        // A copy: OBS hands the encoder's own settings out by reference
+        choice.id = obs_encoder_get_id(encoder);
+        obs_data_t *current = obs_encoder_get_settings(encoder);
+        choice.settings = obs_data_create();
+        obs_data_apply(choice.settings, current);
+        obs_data_release(current);
+    }
+    if (output) {
+        obs_output_release(output);
+    }
+
+    config_t *profile = encoder ? nullptr : obs_frontend_get_profile_config();
+    const char *mode = profile ? config_get_string(profile, "Output", "Mode") : nullptr;
+    if (mode && strcmp(mode, "Advanced") == 0) {
+        const char *id = config_get_string(profile, "AdvOut", video ? "Encoder" : "AudioEncoder");
+        choice.id = id ? id : "";
+        if (video) {
+            char *profilePath = obs_frontend_get_current_profile_path();
+            std::string path = std::string(profilePath ? profilePath : "") + "/streamEncoder.json";
+            bfree(profilePath);
+            choice.settings = obs_data_create_from_json_file_safe(path.c_str(), "bak");
+        } else {
+            choice.settings = obs_data_create();
+            obs_data_set_int(choice.settings, "bitrate", config_get_int(profile, "AdvOut", "Track1Bitrate"));
+        }
+    } else if (profile) {
+        choice.settings = obs_data_create();
+        if (video) {
+            const char *name = config_get_string(profile, "SimpleOutput", "StreamEncoder");
+            choice.id = simpleModeEncoderId(name);
+            obs_data_set_string(choice.settings, "rate_control", "CBR");
+            obs_data_set_int(choice.settings, "keyint_sec", DEFAULT_KEYFRAME_SECONDS);
+            if (choice.id == "obs_x264") {
+                const char *preset = config_get_string(profile, "SimpleOutput", "Preset");
+                obs_data_set_string(choice.settings, "preset", preset ? preset : "veryfast");
+            }
+        } else {
+            choice.id = "ffmpeg_aac";
+            obs_data_set_int(choice.settings, "bitrate", config_get_int(profile, "SimpleOutput", "ABitrate"));
+        }
+    }
+
+    const char *codec = choice.id.empty() ? nullptr : obs_get_encoder_codec(choice.id.c_str());
+    if (!codec || strcmp(codec, video ? "h264" : "aac") != 0) {
+        obs_data_release(choice.settings);
+        return RelayEncoderChoice();
+    }
+    if (!choice.settings) {
+        choice.settings = obs_data_create();
+    }
+    return choice;
+}
+
+static void register_relay_output()
+{
+    struct obs_output_info info = {};
+    info.id = RELAY_OUTPUT_ID;
+    info.flags = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED;
+    info.encoded_video_codecs = "h264";
+    info.encoded_audio_codecs = "aac";
+    info.get_name = relay_output_get_name;
+    info.create = relay_output_create;
+    info.destroy = relay_output_destroy;
+    info.start = relay_output_start;
+    info.stop = relay_output_stop;
+    info.encoded_packet = relay_output_encoded_packet;
+    obs_register_output(&info);
+}
+
 class StreamRelayDialog : public QDialog {
     Q_OBJECT
 
@@ -115,17 +400,37 @@ private slots:
     void onLoadConfig();
     void onTestConnection();
     void onCopyRTMPUrl();
+    void onSaveTrace();
     void updateStatus();
     void onPlatformToggled();
+    void applyLiveConfig();
 
 private:
+    // A platform's own send-path settings; the lowest value of each
+    // control (or its first item) leaves the global Advanced one in charge
+    struct PlatformTuning {
+        QSpinBox *sendLowat;
+        QSpinBox *sendPacing;
+        QComboBox *congestionControl;
+    };
+    
     void setupUI();
     void loadSettings();
+    void updateRenditionChoices();
     void saveSettings();
     void updateRelayStatus();
+    void scheduleLiveConfig();
+    void applyBitrateAdvice(int kbps);
+    void showProbeResults(const std::vector<std::string> &names, const std::vector<RelayProbeResult> &results);
     void startRTMPServer();
     void stopRTMPServer();
-    void createNginxConfig();
+    void startNativeOutput();
+    void stopNativeOutput();
+    void updateIngestHints();
+    RelayTcpTuning platformTuning(const PlatformTuning &platform, const RelayTcpTuning &fallback) const;
+    void loadPlatformTuning(const QString &group, const PlatformTuning &platform);
+    void savePlatformTuning(const QString &group, const PlatformTuning &platform);
+    RelayConfig buildRelayConfig() const;
     
     // UI Elements
     QTabWidget *tabWidget;
@@ -135,12 +440,15 @@ private:
     QCheckBox *twitchEnabled;
     QLineEdit *twitchKey;
     QPushButton *twitchShow;
+    QComboBox *twitchRendition;
     QCheckBox *youtubeEnabled;
     QLineEdit *youtubeKey;
     QPushButton *youtubeShow;
+    QComboBox *youtubeRendition;
     QCheckBox *kickEnabled;
     QLineEdit *kickKey;
     QPushButton *kickShow;
+    QComboBox *kickRendition;
     QSpinBox *localPort;
     QPushButton *saveConfigBtn;
     QPushButton *loadConfigBtn;
@@ -150,32 +458,63 @@ private:
     QLabel *rtmpUrlLabel;
     QLineEdit *rtmpUrlEdit;
     QPushButton *copyUrlBtn;
+    QLabel *streamKeyLabel;
+    QCheckBox *nativeOutput;
     QPushButton *startBtn;
     QPushButton *stopBtn;
     QLabel *statusLabel;
     QProgressBar *statusProgress;
     QPushButton *testBtn;
+    QLabel *instructionsLabel;
     
     // Monitor Tab
     QWidget *monitorTab;
     QTextEdit *logOutput;
-    QLabel *viewersLabel;
+    QLabel *latencyLabel;
     QLabel *bitrateLabel;
     QLabel *uptimeLabel;
+    QTableWidget *destinationsTable;
+    QPushButton *saveTraceBtn;
     QTimer *updateTimer;
+    QTimer *reconfigureTimer;
+    QElapsedTimer uptimeClock;
+    RelayStatsSnapshot lastStats;
     
     // Settings Tab
     QWidget *settingsTab;
     QComboBox *qualityPreset;
     QSpinBox *maxBitrate;
+    QLineEdit *renditionLadder;
+    QCheckBox *autoTune;
+    QComboBox *fastestPreset;
+    QComboBox *slowestPreset;
+    QSpinBox *maxThreads;
     QCheckBox *autoReconnect;
+    QCheckBox *adaptiveBitrate;
+    QCheckBox *tracing;
     QCheckBox *enableLogging;
     QLineEdit *customFFmpegArgs;
+    QComboBox *networkBackend;
+    QSpinBox *sendLowat;
+    QSpinBox *sendPacing;
+    QComboBox *congestionControl;
+    QSpinBox *metricsPort;
+    
+    // Per-platform send-path controls, see PlatformTuning
+    PlatformTuning twitchTuning;
+    PlatformTuning youtubeTuning;
+    PlatformTuning kickTuning;
     
     // Internal state
     bool isRelaying;
-    QProcess *nginxProcess;
-    QTimer *statusTimer;
+    std::unique_ptr<RelayEngine> relayEngine;
+    RelayBackoff restartBackoff;
+    bool restartPending;
+    int originalEncoderKbps;
+    obs_output_t *relayOutput;
+    obs_encoder_t *relayVideoEncoder;
+    obs_encoder_t *relayAudioEncoder;
+    QThread *probeThread;
     QMutex configMutex;
     QString configPath;
     QSettings *settings;
@@ -195,7 +534,8 @@ private:
 };
 
 StreamRelayDialog::StreamRelayDialog(QWidget *parent)
-    : QDialog(parent), isRelaying(false), nginxProcess(nullptr)
+    : QDialog(parent), isRelaying(false), restartPending(false), originalEncoderKbps(0),
+      relayOutput(nullptr), relayVideoEncoder(nullptr), relayAudioEncoder(nullptr), probeThread(nullptr)
 {
     setWindowTitle("StreamRelay - Multi-Platform Streaming");
     setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
@@ -213,15 +553,21 @@ StreamRelayDialog::StreamRelayDialog(QWidget *parent)
     updateTimer = new QTimer(this);
     connect(updateTimer, &QTimer::timeout, this, &StreamRelayDialog::updateStatus);
     
-    statusTimer = new QTimer(this);
-    connect(statusTimer, &QTimer::timeout, this, &StreamRelayDialog::updateRelayStatus);
+    // Edits made while relaying are batched and applied live
+    reconfigureTimer = new QTimer(this);
+    reconfigureTimer->setSingleShot(true);
+    reconfigureTimer->setInterval(500);
+    connect(reconfigureTimer, &QTimer::timeout, this, &StreamRelayDialog::applyLiveConfig);
 }
 
 StreamRelayDialog::~StreamRelayDialog()
 {
-    if (isRelaying) {
-        stopRTMPServer();
+    if (probeThread) {
+        probeThread->wait();
+        delete probeThread;
     }
+    // Also restores OBS's encoder if the relay had lowered it
+    stopRTMPServer();
     delete settings;
 }
 
@@ -263,6 +609,9 @@ void StreamRelayDialog::setupUI()
     });
     platformLayout->addWidget(twitchShow, 0, 2);
     
+    twitchRendition = new QComboBox();
+    platformLayout->addWidget(twitchRendition, 0, 3);
+    
     // YouTube
     youtubeEnabled = new QCheckBox("Enable YouTube");
     youtubeEnabled->setStyleSheet("color: #ff0000; font-weight: bold;");
@@ -280,6 +629,9 @@ void StreamRelayDialog::setupUI()
     });
     platformLayout->addWidget(youtubeShow, 1, 2);
     
+    youtubeRendition = new QComboBox();
+    platformLayout->addWidget(youtubeRendition, 1, 3);
+    
     // Kick
     kickEnabled = new QCheckBox("Enable Kick");
     kickEnabled->setStyleSheet("color: #53ff1a; font-weight: bold;");
@@ -297,6 +649,9 @@ void StreamRelayDialog::setupUI()
     });
     platformLayout->addWidget(kickShow, 2, 2);
     
+    kickRendition = new QComboBox();
+    platformLayout->addWidget(kickRendition, 2, 3);
+    
     // Local port
     auto *portLabel = new QLabel("Local RTMP Port:");
     platformLayout->addWidget(portLabel, 3, 0);
@@ -345,10 +700,16 @@ void StreamRelayDialog::setupUI()
     connect(copyUrlBtn, &QPushButton::clicked, this, &StreamRelayDialog::onCopyRTMPUrl);
     rtmpLayout->addWidget(copyUrlBtn, 0, 2);
     
-    auto *streamKeyLabel = new QLabel("Stream Key: live");
+    streamKeyLabel = new QLabel();
     streamKeyLabel->setStyleSheet("color: #107c10; font-weight: bold;");
     rtmpLayout->addWidget(streamKeyLabel, 1, 0, 1, 3);
     
+    // Encodes inside OBS and hands the packets straight to the relay; the
+    // URL above is then only for other encoders. Applies on the next start.
+    nativeOutput = new QCheckBox("Relay OBS's output directly (no stream settings needed)");
+    nativeOutput->setChecked(true);
+    rtmpLayout->addWidget(nativeOutput, 2, 0, 1, 3);
+    
     controlLayout->addWidget(rtmpGroup);
     
     // Control buttons
@@ -390,15 +751,33 @@ void StreamRelayDialog::setupUI()
     
     // Stats
     auto *statsLayout = new QHBoxLayout();
-    viewersLabel = new QLabel("Viewers: 0");
+    latencyLabel = new QLabel("Latency: -");
     bitrateLabel = new QLabel("Bitrate: 0 kbps");
     uptimeLabel = new QLabel("Uptime: 00:00:00");
     
-    statsLayout->addWidget(viewersLabel);
+    statsLayout->addWidget(latencyLabel);
     statsLayout->addWidget(bitrateLabel);
     statsLayout->addWidget(uptimeLabel);
     monitorLayout->addLayout(statsLayout);
     
+    // Per-destination live stats
+    destinationsTable = new QTableWidget(0, 9);
+    destinationsTable->setHorizontalHeaderLabels(
+        {"Destination", "State", "In kbps", "Out kbps", "Est. kbps", "FPS", "Dropped", "Queue", "RTT"});
+    destinationsTable->verticalHeader()->setVisible(false);
+    destinationsTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    destinationsTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    destinationsTable->setSelectionMode(QAbstractItemView::NoSelection);
+    monitorLayout->addWidget(destinationsTable);
+    
+    // Per-packet timings for ui.perfetto.dev or chrome://tracing
+    saveTraceBtn = new QPushButton("Save Trace...");
+    connect(saveTraceBtn, &QPushButton::clicked, this, &StreamRelayDialog::onSaveTrace);
+    auto *traceLayout = new QHBoxLayout();
+    traceLayout->addStretch();
+    traceLayout->addWidget(saveTraceBtn);
+    monitorLayout->addLayout(traceLayout);
+    
     // Log output
     logOutput = new QTextEdit();
     logOutput->setReadOnly(true);
@@ -415,9 +794,11 @@ void StreamRelayDialog::setupUI()
     auto *qualityGroup = new QGroupBox("Quality Settings");
     auto *qualityLayout = new QGridLayout(qualityGroup);
     
+    const QStringList presetLabels = {"Ultra Fast", "Super Fast", "Very Fast", "Faster", "Fast",
+                                      "Medium", "Slow", "Slower", "Very Slow"};
     qualityLayout->addWidget(new QLabel("Quality Preset:"), 0, 0);
     qualityPreset = new QComboBox();
-    qualityPreset->addItems({"Ultra Fast", "Super Fast", "Very Fast", "Faster", "Fast", "Medium", "Slow", "Slower", "Very Slow"});
+    qualityPreset->addItems(presetLabels);
     qualityPreset->setCurrentText("Very Fast");
     qualityLayout->addWidget(qualityPreset, 0, 1);
     
@@ -427,6 +808,45 @@ void StreamRelayDialog::setupUI()
     maxBitrate->setValue(6000);
     qualityLayout->addWidget(maxBitrate, 1, 1);
     
+    // Each rung is encoded once no matter how many platforms pick it;
+    // platforms left on "Source" get OBS's own encode untouched
+    qualityLayout->addWidget(new QLabel("Rendition Ladder:"), 2, 0);
+    renditionLadder = new QLineEdit();
+    renditionLadder->setPlaceholderText("name=WIDTHxHEIGHT@FPS:KBPS, ...");
+    connect(renditionLadder, &QLineEdit::editingFinished, this, &StreamRelayDialog::updateRenditionChoices);
+    qualityLayout->addWidget(renditionLadder, 2, 1);
+    
+    // The ladder starts at the preset above and follows the host's
+    // headroom from there, within these limits
+    autoTune = new QCheckBox("Auto-tune the ladder's preset and threads to the CPU");
+    autoTune->setChecked(true);
+    qualityLayout->addWidget(autoTune, 3, 0, 1, 2);
+    
+    qualityLayout->addWidget(new QLabel("Preset Range:"), 4, 0);
+    auto *presetRangeLayout = new QHBoxLayout();
+    fastestPreset = new QComboBox();
+    fastestPreset->addItems(presetLabels);
+    fastestPreset->setCurrentText("Ultra Fast");
+    slowestPreset = new QComboBox();
+    slowestPreset->addItems(presetLabels);
+    slowestPreset->setCurrentText("Medium");
+    presetRangeLayout->addWidget(fastestPreset);
+    presetRangeLayout->addWidget(new QLabel("to"));
+    presetRangeLayout->addWidget(slowestPreset);
+    qualityLayout->addLayout(presetRangeLayout, 4, 1);
+    
+    qualityLayout->addWidget(new QLabel("Max Encoder Threads:"), 5, 0);
+    maxThreads = new QSpinBox();
+    maxThreads->setRange(0, 64);
+    maxThreads->setSpecialValueText("One per CPU");
+    qualityLayout->addWidget(maxThreads, 5, 1);
+    
+    connect(autoTune, &QCheckBox::toggled, [this](bool checked) {
+        fastestPreset->setEnabled(checked);
+        slowestPreset->setEnabled(checked);
+        maxThreads->setEnabled(checked);
+    });
+    
     settingsLayout->addWidget(qualityGroup);
     
     auto *advancedGroup = new QGroupBox("Advanced Settings");
@@ -436,6 +856,16 @@ void StreamRelayDialog::setupUI()
     autoReconnect->setChecked(true);
     advancedLayout->addWidget(autoReconnect);
     
+    // Platforms that fall behind move to a lower rung, or turn down OBS's
+    // encoder when they are on the source and nothing lower exists
+    adaptiveBitrate = new QCheckBox("Adapt each platform to its bandwidth");
+    adaptiveBitrate->setChecked(true);
+    advancedLayout->addWidget(adaptiveBitrate);
+    
+    tracing = new QCheckBox("Trace packet latency");
+    tracing->setChecked(true);
+    advancedLayout->addWidget(tracing);
+    
     enableLogging = new QCheckBox("Enable detailed logging");
     enableLogging->setChecked(true);
     advancedLayout->addWidget(enableLogging);
@@ -445,17 +875,103 @@ void StreamRelayDialog::setupUI()
     customFFmpegArgs->setPlaceholderText("-tune zerolatency -preset veryfast");
     advancedLayout->addWidget(customFFmpegArgs);
     
+    // How destinations write to the platforms; applies on the next start
+    advancedLayout->addWidget(new QLabel("Network Backend:"));
+    networkBackend = new QComboBox();
+    networkBackend->addItem("Default (non-blocking sockets)", RELAY_SEND_BACKEND_DEFAULT);
+#ifdef __linux__
+    networkBackend->addItem("io_uring (batched sends)", RELAY_SEND_BACKEND_IO_URING);
+#endif
+    advancedLayout->addWidget(networkBackend);
+    
+    // Socket options for every platform connection unless it overrides
+    // them below; they change live
+    advancedLayout->addWidget(new QLabel("Unsent Data Limit per Platform (KB):"));
+    sendLowat = new QSpinBox();
+    sendLowat->setRange(0, 16384);
+    sendLowat->setSingleStep(16);
+    sendLowat->setSpecialValueText("System default");
+    sendLowat->setToolTip("Keeps the backlog in the relay, where it can skip frames, instead of the kernel");
+    advancedLayout->addWidget(sendLowat);
+    
+    advancedLayout->addWidget(new QLabel("Send Pacing (% of platform bitrate):"));
+    sendPacing = new QSpinBox();
+    sendPacing->setRange(0, 1000);
+    sendPacing->setSuffix("%");
+    sendPacing->setSpecialValueText("Off");
+#ifndef __linux__
+    sendPacing->setEnabled(false);
+#endif
+    advancedLayout->addWidget(sendPacing);
+    
+    advancedLayout->addWidget(new QLabel("Congestion Control:"));
+    congestionControl = new QComboBox();
+    congestionControl->addItem("System default", "");
+#ifdef __linux__
+    congestionControl->addItem("BBR", "bbr");
+    congestionControl->addItem("CUBIC", "cubic");
+#endif
+    advancedLayout->addWidget(congestionControl);
+    
+    advancedLayout->addWidget(new QLabel("Metrics Port (OpenMetrics at /metrics):"));
+    metricsPort = new QSpinBox();
+    metricsPort->setRange(0, 65535);
+    metricsPort->setSpecialValueText("Disabled");
+    metricsPort->setValue(DEFAULT_METRICS_PORT);
+    advancedLayout->addWidget(metricsPort);
+    
     settingsLayout->addWidget(advancedGroup);
     
+    // Platforms differ in how far away and how well peered they are, so
+    // each can override the send path; these change live too
+    auto *platformNetworkGroup = new QGroupBox("Per-Platform Network");
+    auto *platformNetworkLayout = new QGridLayout(platformNetworkGroup);
+    platformNetworkLayout->addWidget(new QLabel("Unsent Limit (KB)"), 0, 1);
+    platformNetworkLayout->addWidget(new QLabel("Pacing (%)"), 0, 2);
+    platformNetworkLayout->addWidget(new QLabel("Congestion Control"), 0, 3);
+    int platformRow = 1;
+    for (auto platform : {std::make_pair("Twitch", &twitchTuning), std::make_pair("YouTube", &youtubeTuning),
+                          std::make_pair("Kick", &kickTuning)}) {
+        PlatformTuning &tuning = *platform.second;
+        platformNetworkLayout->addWidget(new QLabel(platform.first), platformRow, 0);
+        
+        tuning.sendLowat = new QSpinBox();
+        tuning.sendLowat->setRange(-1, 16384);
+        tuning.sendLowat->setSingleStep(16);
+        tuning.sendLowat->setSpecialValueText("As above");
+        tuning.sendLowat->setValue(-1);
+        tuning.sendLowat->setToolTip("0 leaves the limit to the system");
+        platformNetworkLayout->addWidget(tuning.sendLowat, platformRow, 1);
+        
+        tuning.sendPacing = new QSpinBox();
+        tuning.sendPacing->setRange(-1, 1000);
+        tuning.sendPacing->setSuffix("%");
+        tuning.sendPacing->setSpecialValueText("As above");
+        tuning.sendPacing->setValue(-1);
+        tuning.sendPacing->setToolTip("0% turns pacing off");
+#ifndef __linux__
+        tuning.sendPacing->setEnabled(false);
+#endif
+        platformNetworkLayout->addWidget(tuning.sendPacing, platformRow, 2);
+        
+        tuning.congestionControl = new QComboBox();
+        tuning.congestionControl->addItem("As above", QVariant());
+        tuning.congestionControl->addItem("System default", "");
+#ifdef __linux__
+        tuning.congestionControl->addItem("BBR", "bbr");
+        tuning.congestionControl->addItem("CUBIC", "cubic");
+#endif
+        platformNetworkLayout->addWidget(tuning.congestionControl, platformRow, 3);
+        platformRow++;
+    }
+    settingsLayout->addWidget(platformNetworkGroup);
+    
     tabWidget->addTab(settingsTab, "Settings");
     
     mainLayout->addWidget(tabWidget);
     
     // Instructions
-    auto *instructionsLabel = new QLabel(
-        "Instructions: 1) Configure your stream keys 2) Click 'Start Multi-Stream Relay' "
-        "3) In OBS, set Server to the RTMP URL above with Stream Key 'live' 4) Start streaming in OBS"
-    );
+    instructionsLabel = new QLabel();
     instructionsLabel->setStyleSheet("color: #ff8c00; font-weight: bold; padding: 10px; background-color: #2d2d30;");
     instructionsLabel->setWordWrap(true);
     mainLayout->addWidget(instructionsLabel);
@@ -467,6 +983,32 @@ void StreamRelayDialog::setupUI()
     connect(localPort, QOverload<int>::of(&QSpinBox::valueChanged), [this](int value) {
         rtmpUrlEdit->setText(QString("rtmp://localhost:%1/live").arg(value));
     });
+    connect(nativeOutput, &QCheckBox::toggled, this, &StreamRelayDialog::updateIngestHints);
+    updateIngestHints();
+    
+    // Anything that feeds buildRelayConfig() can change mid-stream
+    for (QCheckBox *check :
+         {twitchEnabled, youtubeEnabled, kickEnabled, autoReconnect, adaptiveBitrate, tracing, autoTune}) {
+        connect(check, &QCheckBox::toggled, this, &StreamRelayDialog::scheduleLiveConfig);
+    }
+    for (QLineEdit *edit : {twitchKey, youtubeKey, kickKey, renditionLadder, customFFmpegArgs}) {
+        connect(edit, &QLineEdit::editingFinished, this, &StreamRelayDialog::scheduleLiveConfig);
+    }
+    for (QComboBox *combo : {twitchRendition, youtubeRendition, kickRendition, qualityPreset, fastestPreset,
+                             slowestPreset, networkBackend, congestionControl}) {
+        connect(combo, QOverload<int>::of(&QComboBox::currentIndexChanged), this,
+                &StreamRelayDialog::scheduleLiveConfig);
+    }
+    for (QSpinBox *spin : {maxBitrate, maxThreads, sendLowat, sendPacing, metricsPort, localPort}) {
+        connect(spin, QOverload<int>::of(&QSpinBox::valueChanged), this, &StreamRelayDialog::scheduleLiveConfig);
+    }
+    for (const PlatformTuning *tuning : {&twitchTuning, &youtubeTuning, &kickTuning}) {
+        for (QSpinBox *spin : {tuning->sendLowat, tuning->sendPacing}) {
+            connect(spin, QOverload<int>::of(&QSpinBox::valueChanged), this, &StreamRelayDialog::scheduleLiveConfig);
+        }
+        connect(tuning->congestionControl, QOverload<int>::of(&QComboBox::currentIndexChanged), this,
+                &StreamRelayDialog::scheduleLiveConfig);
+    }
 }
 
 void StreamRelayDialog::onStartRelay()
@@ -487,22 +1029,25 @@ void StreamRelayDialog::onStartRelay()
     }
     
     try {
+        restartBackoff.reset();
         startRTMPServer();
         isRelaying = true;
+        uptimeClock.start();
+        lastStats = RelayStatsSnapshot();
         
         startBtn->setEnabled(false);
         stopBtn->setEnabled(true);
         statusLabel->setText("Status: Multi-Stream Relay Active");
         statusLabel->setStyleSheet("font-size: 14px; font-weight: bold; color: #107c10; padding: 10px;");
         
-        statusTimer->start(5000); // Update every 5 seconds
         updateTimer->start(1000);  // Update stats every second
         
         logOutput->append(QString("[%1] Multi-stream relay started successfully")
                          .arg(QDateTime::currentDateTime().toString("hh:mm:ss")));
         
-        QMessageBox::information(this, "Relay Started", 
-            "Multi-stream relay is now active! Configure OBS with the RTMP URL shown above and start streaming.");
+        QMessageBox::information(this, "Relay Started", nativeOutput->isChecked()
+            ? "Multi-stream relay is now active and streaming OBS's output to every enabled platform."
+            : "Multi-stream relay is now active! Configure OBS with the RTMP URL shown above and start streaming.");
     } catch (const std::exception& e) {
         QMessageBox::critical(this, "Error", QString("Failed to start relay: %1").arg(e.what()));
     }
@@ -519,8 +1064,10 @@ void StreamRelayDialog::onStopRelay()
         statusLabel->setText("Status: Stopped");
         statusLabel->setStyleSheet("font-size: 14px; font-weight: bold; color: #d13438; padding: 10px;");
         
-        statusTimer->stop();
         updateTimer->stop();
+        reconfigureTimer->stop();
+        destinationsTable->setRowCount(0);
+        bitrateLabel->setText("Bitrate: 0 kbps");
         
         logOutput->append(QString("[%1] Multi-stream relay stopped")
                          .arg(QDateTime::currentDateTime().toString("hh:mm:ss")));
@@ -557,16 +1104,80 @@ void StreamRelayDialog::onLoadConfig()
 
 void StreamRelayDialog::onTestConnection()
 {
-    // Implement connection testing logic
+    // A second publish with the same key would fight the live one
+    if (isRelaying) {
+        QMessageBox::information(this, "Connection Test",
+            "Stop the relay first; while it runs the Monitor tab shows each platform's estimated bandwidth.");
+        return;
+    }
+    
+    RelayConfig config = buildRelayConfig();
+    if (config.destinations.empty()) {
+        QMessageBox::warning(this, "Connection Test", "Enable at least one platform with a stream key first.");
+        return;
+    }
+    
     statusProgress->setVisible(true);
     statusProgress->setRange(0, 0); // Indeterminate progress
-    
-    QTimer::singleShot(3000, [this]() {
-        statusProgress->setVisible(false);
-        QMessageBox::information(this, "Connection Test", "Connection test completed. Check the monitor tab for details.");
-        logOutput->append(QString("[%1] Connection test completed")
-                         .arg(QDateTime::currentDateTime().toString("hh:mm:ss")));
+    testBtn->setEnabled(false);
+    startBtn->setEnabled(false);
+    logOutput->append(QString("[%1] Testing %2 platform(s), a few seconds each...")
+                     .arg(QDateTime::currentDateTime().toString("hh:mm:ss")).arg(config.destinations.size()));
+    
+    // Platforms are probed one at a time so their bursts do not share the uplink
+    probeThread = QThread::create([this, destinations = config.destinations]() {
+        std::vector<std::string> names;
+        std::vector<RelayProbeResult> results;
+        for (const auto &destination : destinations) {
+            names.push_back(destination.name);
+            results.push_back(relayProbeDestination(destination.url, destination.streamKey));
+        }
+        QMetaObject::invokeMethod(this, [this, names, results]() {
+            showProbeResults(names, results);
+        }, Qt::QueuedConnection);
     });
+    probeThread->start();
+}
+
+void StreamRelayDialog::showProbeResults(const std::vector<std::string> &names,
+                                         const std::vector<RelayProbeResult> &results)
+{
+    probeThread->wait();
+    delete probeThread;
+    probeThread = nullptr;
+    statusProgress->setVisible(false);
+    testBtn->setEnabled(true);
+    onPlatformToggled();
+    tabWidget->setCurrentWidget(monitorTab);
+    
+    QString time = QDateTime::currentDateTime().toString("hh:mm:ss");
+    for (size_t i = 0; i < results.size(); i++) {
+        const RelayProbeResult &result = results[i];
+        QString name = QString::fromStdString(names[i]);
+        if (!result.ok) {
+            logOutput->append(QString("[%1] %2: failed - %3").arg(time, name, QString::fromStdString(result.error)));
+            continue;
+        }
+        logOutput->append(QString("[%1] %2: connect %3 ms, handshake %4 ms, publish %5 ms, RTT %6 ms, upload %7%8 kbps")
+                         .arg(time, name)
+                         .arg(result.connectMs, 0, 'f', 1).arg(result.handshakeMs, 0, 'f', 1)
+                         .arg(result.publishMs, 0, 'f', 1).arg(result.rttMs, 0, 'f', 1)
+                         .arg(result.reachedMax ? ">= " : "").arg(qRound(result.uploadKbps)));
+    }
+    
+    int suggestion = relayProbeSuggestion(results);
+    if (suggestion <= 0) {
+        QMessageBox::warning(this, "Connection Test", "No platform could be reached. See the Monitor tab for details.");
+        return;
+    }
+    suggestion = qBound(maxBitrate->minimum(), suggestion, maxBitrate->maximum());
+    logOutput->append(QString("[%1] Suggested max bitrate: %2 kbps").arg(time).arg(suggestion));
+    if (suggestion != maxBitrate->value() &&
+        QMessageBox::question(this, "Connection Test",
+            QString("Every tested platform sustains about %1 kbps. Set Max Bitrate to %1 kbps?").arg(suggestion))
+            == QMessageBox::Yes) {
+        maxBitrate->setValue(suggestion);
+    }
 }
 
 void StreamRelayDialog::onCopyRTMPUrl()
@@ -575,23 +1186,109 @@ void StreamRelayDialog::onCopyRTMPUrl()
     QMessageBox::information(this, "Copied", "RTMP URL copied to clipboard!");
 }
 
+void StreamRelayDialog::onSaveTrace()
+{
+    if (!tracing->isChecked()) {
+        QMessageBox::information(this, "Save Trace", "Enable \"Trace packet latency\" in Settings first.");
+        return;
+    }
+    QString path = QFileDialog::getSaveFileName(this, "Save Trace",
+                                                QDir::homePath() + "/stream-relay-trace.json", "Trace (*.json)");
+    if (path.isEmpty()) {
+        return;
+    }
+    std::string error;
+    if (!RelayTracer::instance().writeChromeTrace(path.toStdString(), error)) {
+        QMessageBox::warning(this, "Save Trace", QString::fromStdString(error));
+        return;
+    }
+    logOutput->append(QString("[%1] Trace saved to %2; open it in ui.perfetto.dev")
+                     .arg(QDateTime::currentDateTime().toString("hh:mm:ss")).arg(path));
+}
+
 void StreamRelayDialog::updateStatus()
 {
     if (isRelaying) {
-        // Update uptime, bitrate, etc.
-        static int seconds = 0;
-        seconds++;
-        int hours = seconds / 3600;
-        int minutes = (seconds % 3600) / 60;
-        int secs = seconds % 60;
+        qint64 seconds = uptimeClock.elapsed() / 1000;
+        qint64 hours = seconds / 3600;
+        qint64 minutes = (seconds % 3600) / 60;
+        qint64 secs = seconds % 60;
         
         uptimeLabel->setText(QString("Uptime: %1:%2:%3")
                            .arg(hours, 2, 10, QChar('0'))
                            .arg(minutes, 2, 10, QChar('0'))
                            .arg(secs, 2, 10, QChar('0')));
         
-        // Simulate bitrate (in real implementation, get from nginx stats)
-        bitrateLabel->setText(QString("Bitrate: %1 kbps").arg(qrand() % 1000 + 2000));
+        if (!relayEngine) {
+            return;
+        }
+        
+        // Counters are cumulative; rates are taken over the timer interval
+        RelayStatsSnapshot stats = relayEngine->statsSnapshot();
+        uint64_t intervalMs = lastStats.timestampMs ? stats.timestampMs - lastStats.timestampMs : 0;
+        RelayTrafficRate ingest = relayTrafficRate(lastStats.ingest, stats.ingest, intervalMs);
+        bitrateLabel->setText(QString("Bitrate: %1 kbps @ %2 fps")
+                            .arg(qRound(ingest.kbps)).arg(ingest.fps, 0, 'f', 1));
+        
+        // Ingest to socket write in the label, every stage in its tooltip
+        if (tracing->isChecked()) {
+            QStringList stages;
+            for (const auto &stage : RelayTracer::instance().summary()) {
+                stages << QString("%1: p50 %2 ms, p99 %3 ms")
+                              .arg(QString::fromStdString(stage.stage))
+                              .arg(stage.p50Ms, 0, 'f', 2).arg(stage.p99Ms, 0, 'f', 2);
+                if (stage.stage == "total") {
+                    latencyLabel->setText(stage.count ? QString("Latency: %1 ms (p99 %2 ms)")
+                                                            .arg(stage.p50Ms, 0, 'f', 1).arg(stage.p99Ms, 0, 'f', 1)
+                                                      : QString("Latency: -"));
+                }
+            }
+            latencyLabel->setToolTip(stages.join("\n"));
+        } else {
+            latencyLabel->setText("Latency: off");
+            latencyLabel->setToolTip(QString());
+        }
+        
+        destinationsTable->setRowCount((int)stats.destinations.size());
+        for (size_t i = 0; i < stats.destinations.size(); i++) {
+            const RelayDestinationSnapshot &destination = stats.destinations[i];
+            RelayTrafficRate in, out;
+            for (const auto &previous : lastStats.destinations) {
+                if (previous.name == destination.name) {
+                    in = relayTrafficRate(previous.ingress, destination.ingress, intervalMs);
+                    out = relayTrafficRate(previous.egress, destination.egress, intervalMs);
+                }
+            }
+            
+            // Connected but sending nothing while the source flows is a stall
+            QString state = "Connecting";
+            if (destination.connected) {
+                state = (in.kbps > 0 && out.kbps == 0) ? "Stalled" : "Live";
+            } else if (destination.reconnects > 0 || destination.egress.packets > 0) {
+                state = "Reconnecting";
+            }
+            
+            QStringList cells = {
+                QString::fromStdString(destination.name),
+                state,
+                QString::number(qRound(in.kbps)),
+                QString::number(qRound(out.kbps)),
+                destination.estimatedKbps > 0 ? QString::number(destination.estimatedKbps) : QString("-"),
+                QString::number(out.fps, 'f', 1),
+                QString::number(destination.droppedPackets),
+                QString("%1 (%2 KB)").arg(destination.queuedPackets).arg(destination.queuedBytes / 1024),
+                destination.rttUs >= 0 ? QString("%1 ms").arg(destination.rttUs / 1000.0, 0, 'f', 1) : QString("-"),
+            };
+            for (int column = 0; column < cells.size(); column++) {
+                auto *item = destinationsTable->item((int)i, column);
+                if (!item) {
+                    item = new QTableWidgetItem();
+                    destinationsTable->setItem((int)i, column, item);
+                }
+                item->setText(cells[column]);
+            }
+        }
+        lastStats = stats;
     }
 }
 
@@ -602,135 +1299,331 @@ void StreamRelayDialog::onPlatformToggled()
     startBtn->setEnabled(anyEnabled && !isRelaying);
 }
 
+void StreamRelayDialog::scheduleLiveConfig()
+{
+    if (isRelaying) {
+        reconfigureTimer->start();
+    }
+}
+
+void StreamRelayDialog::applyLiveConfig()
+{
+    if (!isRelaying || !relayEngine) {
+        return;
+    }
+    
+    // Only destinations whose settings changed reconnect
+    if (relayEngine->reconfigure(buildRelayConfig())) {
+        logOutput->append(QString("[%1] Configuration applied live")
+                         .arg(QDateTime::currentDateTime().toString("hh:mm:ss")));
+    } else {
+        logOutput->append(QString("[%1] %2")
+                         .arg(QDateTime::currentDateTime().toString("hh:mm:ss"))
+                         .arg(QString::fromStdString(relayEngine->lastError())));
+    }
+}
+
 void StreamRelayDialog::updateRelayStatus()
 {
-    if (nginxProcess && nginxProcess->state() != QProcess::Running) {
-        // Process died, handle restart if auto-reconnect is enabled
-        if (autoReconnect->isChecked()) {
-            logOutput->append(QString("[%1] Relay process died, attempting restart...")
-                             .arg(QDateTime::currentDateTime().toString("hh:mm:ss")));
+    if (!isRelaying || restartPending || (relayEngine && relayEngine->isRunning())) {
+        return;
+    }
+    
+    // The engine gave up (e.g. an encoder kept crashing); platforms
+    // reconnect on their own inside it, so only get here when it cannot
+    if (!autoReconnect->isChecked()) {
+        onStopRelay();
+        QMessageBox::warning(this, "Relay Error", "The relay process has stopped unexpectedly.");
+        return;
+    }
+    
+    int delayMs = restartBackoff.nextDelayMs();
+    if (delayMs < 0) {
+        onStopRelay();
+        QMessageBox::warning(this, "Relay Error",
+            QString("The relay could not be restarted after %1 attempts.").arg(restartBackoff.maxAttemptCount()));
+        return;
+    }
+    
+    logOutput->append(QString("[%1] Relay stopped unexpectedly, restarting in %2 ms...")
+                     .arg(QDateTime::currentDateTime().toString("hh:mm:ss")).arg(delayMs));
+    restartPending = true;
+    QTimer::singleShot(delayMs, this, [this]() {
+        restartPending = false;
+        if (!isRelaying) {
+            return;
+        }
+        try {
             startRTMPServer();
-        } else {
-            onStopRelay();
-            QMessageBox::warning(this, "Relay Error", "The relay process has stopped unexpectedly.");
+            logOutput->append(QString("[%1] Relay restarted")
+                             .arg(QDateTime::currentDateTime().toString("hh:mm:ss")));
+        } catch (const std::exception& e) {
+            logOutput->append(QString("[%1] Relay restart failed: %2")
+                             .arg(QDateTime::currentDateTime().toString("hh:mm:ss")).arg(e.what()));
+            updateRelayStatus();
         }
-    }
+    });
 }
 
 void StreamRelayDialog::startRTMPServer()
 {
-    createNginxConfig();
-    
-    // Start nginx process (implementation depends on nginx availability)
-    nginxProcess = new QProcess(this);
-    
-    QString nginxPath = "nginx"; // Assume nginx is in PATH or bundled
-    QStringList arguments;
-    arguments << "-c" << configPath + "nginx.conf";
+    stopRTMPServer();
+    
+    // OBS publishes once, through the native output or to the local
+    // ingest; the engine fans packets out to every enabled platform directly
+    relayEngine = std::make_unique<RelayEngine>(buildRelayConfig());
+    
+    // Failures are pushed from engine threads as they happen; nothing polls
+    relayEngine->setFailureCallback([this](const std::string &reason) {
+        QString message = QString::fromStdString(reason);
+        QMetaObject::invokeMethod(this, [this, message]() {
+            logOutput->append(QString("[%1] Relay failure: %2")
+                             .arg(QDateTime::currentDateTime().toString("hh:mm:ss")).arg(message));
+            updateRelayStatus();
+        }, Qt::QueuedConnection);
+    });
     
-    nginxProcess->start(nginxPath, arguments);
+    // Only OBS's own publish is ours to turn down
+    relayEngine->setBitrateAdviceCallback([this](const std::string &stream, int kbps) {
+        if (stream != RELAY_DEFAULT_ROUTE) {
+            return;
+        }
+        QMetaObject::invokeMethod(this, [this, kbps]() { applyBitrateAdvice(kbps); }, Qt::QueuedConnection);
+    });
     
-    if (!nginxProcess->waitForStarted(5000)) {
-        throw std::runtime_error("Failed to start nginx process");
+    if (!relayEngine->start()) {
+        std::string message = relayEngine->lastError();
+        relayEngine.reset();
+        throw std::runtime_error(message);
+    }
+    if (nativeOutput->isChecked()) {
+        try {
+            startNativeOutput();
+        } catch (const std::exception &) {
+            stopRTMPServer();
+            throw;
+        }
     }
 }
 
 void StreamRelayDialog::stopRTMPServer()
 {
-    if (nginxProcess) {
-        nginxProcess->kill();
-        nginxProcess->waitForFinished(5000);
-        nginxProcess->deleteLater();
-        nginxProcess = nullptr;
+    // OBS's own encoder must not keep the relay's advice, or the user's
+    // next stream goes out at the lowered bitrate
+    applyBitrateAdvice(0);
+    // Before the engine, which the output's stream belongs to
+    stopNativeOutput();
+    if (relayEngine) {
+        relayEngine->stop();
+        relayEngine.reset();
     }
 }
 
-void StreamRelayDialog::createNginxConfig()
+// Encoders of the relay's own, copied from the ones OBS streams with at
+// the relay's bitrate, which the platforms are set up for. Where OBS's
+// encoder does not make H.264 and AAC, x264 at the quality settings and
+// OBS's AAC stand in.
+void StreamRelayDialog::startNativeOutput()
 {
-    QString configFile = configPath + "nginx.conf";
-    QFile file(configFile);
-    
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&file);
-        
-        out << "worker_processes 1;\n";
-        out << "events { worker_connections 1024; }\n\n";
-        out << "rtmp {\n";
-        out << "    server {\n";
-        out << "        listen " << localPort->value() << ";\n";
-        out << "        chunk_size 4096;\n";
-        out << "        allow publish all;\n";
-        out << "        allow play all;\n\n";
-        
-        out << "        application live {\n";
-        out << "            live on;\n";
-        out << "            record off;\n\n";
-        
-        // Add platform pushes
-        if (twitchEnabled->isChecked()) {
-            out << "            push rtmp://localhost/twitch;\n";
+    RelayEncoderChoice video = streamingEncoder(true);
+    if (!video.id.empty()) {
+        obs_data_set_int(video.settings, "bitrate", maxBitrate->value());
+        // 0 lets the encoder pick, which is longer than platforms accept
+        if (obs_data_get_int(video.settings, "keyint_sec") == 0) {
+            obs_data_set_int(video.settings, "keyint_sec", DEFAULT_KEYFRAME_SECONDS);
         }
-        if (youtubeEnabled->isChecked()) {
-            out << "            push rtmp://localhost/youtube;\n";
+        relayVideoEncoder = obs_video_encoder_create(video.id.c_str(), "StreamRelay Video", video.settings, nullptr);
+        obs_data_release(video.settings);
+    }
+    if (!relayVideoEncoder) {
+        obs_data_t *videoSettings = obs_data_create();
+        obs_data_set_string(videoSettings, "rate_control", "CBR");
+        obs_data_set_int(videoSettings, "bitrate", maxBitrate->value());
+        obs_data_set_int(videoSettings, "keyint_sec", DEFAULT_KEYFRAME_SECONDS);
+        obs_data_set_string(videoSettings, "preset",
+                            relayPresetName(qualityPreset->currentText().toStdString()).c_str());
+        relayVideoEncoder = obs_video_encoder_create("obs_x264", "StreamRelay Video", videoSettings, nullptr);
+        obs_data_release(videoSettings);
+    }
+    
+    RelayEncoderChoice audio = streamingEncoder(false);
+    if (!audio.id.empty()) {
+        if (obs_data_get_int(audio.settings, "bitrate") <= 0) {
+            obs_data_set_int(audio.settings, "bitrate", DEFAULT_AUDIO_BITRATE);
         }
-        if (kickEnabled->isChecked()) {
-            out << "            push rtmp://localhost/kick;\n";
+        relayAudioEncoder =
+            obs_audio_encoder_create(audio.id.c_str(), "StreamRelay Audio", audio.settings, 0, nullptr);
+        obs_data_release(audio.settings);
+    }
+    if (!relayAudioEncoder) {
+        obs_data_t *audioSettings = obs_data_create();
+        obs_data_set_int(audioSettings, "bitrate", DEFAULT_AUDIO_BITRATE);
+        relayAudioEncoder = obs_audio_encoder_create("ffmpeg_aac", "StreamRelay Audio", audioSettings, 0, nullptr);
+        obs_data_release(audioSettings);
+    }
+    
+    if (relayVideoEncoder) {
+        const char *name = obs_encoder_get_display_name(obs_encoder_get_id(relayVideoEncoder));
+        logOutput->append(QString("[%1] Relaying OBS's output encoded with %2%3")
+                         .arg(QDateTime::currentDateTime().toString("hh:mm:ss"))
+                         .arg(name ? name : obs_encoder_get_id(relayVideoEncoder))
+                         .arg(video.id.empty() ? " (OBS's streaming encoder is not H.264)" : ""));
+    }
+    
+    relayOutput = obs_output_create(RELAY_OUTPUT_ID, "StreamRelay", nullptr, nullptr);
+    if (!relayVideoEncoder || !relayAudioEncoder || !relayOutput) {
+        stopNativeOutput();
+        throw std::runtime_error("Cannot create the OBS encoders for the relay");
+    }
+    obs_encoder_set_video(relayVideoEncoder, obs_get_video());
+    obs_encoder_set_audio(relayAudioEncoder, obs_get_audio());
+    obs_output_set_video_encoder(relayOutput, relayVideoEncoder);
+    obs_output_set_audio_encoder(relayOutput, relayAudioEncoder, 0);
+    static_cast<RelayObsOutput *>(obs_obj_get_data(relayOutput))->engine = relayEngine.get();
+    // The dialog restarts the relay and this output with it; OBS retrying
+    // on its own would reach into the engine being replaced
+    obs_output_set_reconnect_settings(relayOutput, 0, 0);
+    
+    if (!obs_output_start(relayOutput)) {
+        const char *error = obs_output_get_last_error(relayOutput);
+        std::string message = error ? error : "The relay's OBS output did not start";
+        stopNativeOutput();
+        throw std::runtime_error(message);
+    }
+}
+
+// The native output publishes to the default route itself, so OBS's own
+// stream would be refused there as a second publisher
+void StreamRelayDialog::updateIngestHints()
+{
+    if (nativeOutput->isChecked()) {
+        streamKeyLabel->setText("Stream Key: live (taken by OBS's output while the relay runs)");
+        instructionsLabel->setText(
+            "Instructions: 1) Configure your stream keys 2) Click 'Start Multi-Stream Relay'. "
+            "OBS's output is relayed directly; leave OBS's own stream settings as they are.");
+    } else {
+        streamKeyLabel->setText("Stream Key: live");
+        instructionsLabel->setText(
+            "Instructions: 1) Configure your stream keys 2) Click 'Start Multi-Stream Relay' "
+            "3) In OBS, set Server to the RTMP URL above with Stream Key 'live' 4) Start streaming in OBS");
+    }
+}
+
+void StreamRelayDialog::stopNativeOutput()
+{
+    if (relayOutput) {
+        obs_output_stop(relayOutput);
+        obs_output_release(relayOutput);
+        relayOutput = nullptr;
+    }
+    for (obs_encoder_t **encoder : {&relayVideoEncoder, &relayAudioEncoder}) {
+        if (*encoder) {
+            obs_encoder_release(*encoder);
+            *encoder = nullptr;
         }
-        
-        out << "        }\n\n";
-        
-        // Platform-specific applications
-        if (twitchEnabled->isChecked()) {
-            out << "        application twitch {\n";
-            out << "            live on;\n";
-            out << "            record off;\n";
-            out << "            allow publish 127.0.0.1;\n";
-            out << "            deny publish all;\n\n";
-            out << "            exec ffmpeg -i rtmp://localhost/twitch/$name\n";
-            out << "                -c:v libx264 -preset " << qualityPreset->currentText().toLower().replace(" ", "") << "\n";
-            out << "                -b:v " << maxBitrate->value() << "k -maxrate " << maxBitrate->value() << "k -bufsize " << maxBitrate->value() << "k\n";
-            out << "                -pix_fmt yuv420p -g 50 -r 30\n";
-            out << "                -c:a aac -b:a 160k -ar 44100 -ac 2\n";
-            out << "                " << customFFmpegArgs->text() << "\n";
-            out << "                -f flv rtmp://live.twitch.tv/app/" << twitchKey->text() << ";\n";
-            out << "        }\n\n";
+    }
+}
+
+// Changes the running encoder in place; OBS keeps streaming, so the relay
+// needs no restart. kbps 0 puts back what the user configured.
+void StreamRelayDialog::applyBitrateAdvice(int kbps)
+{
+    // Advice still queued from an engine that has since stopped, or
+    // nothing to put back
+    if ((kbps > 0 && !relayEngine) || (kbps == 0 && originalEncoderKbps == 0)) {
+        return;
+    }
+    // The relay's own encoder, or the one OBS streams to the ingest with
+    obs_output_t *output = relayVideoEncoder ? nullptr : obs_frontend_get_streaming_output();
+    if (!relayVideoEncoder && !output) {
+        return;
+    }
+    obs_encoder_t *encoder = relayVideoEncoder ? relayVideoEncoder : obs_output_get_video_encoder(output);
+    if (encoder) {
+        obs_data_t *encoderSettings = obs_encoder_get_settings(encoder);
+        int current = (int)obs_data_get_int(encoderSettings, "bitrate");
+        int wanted = kbps;
+        if (kbps > 0 && originalEncoderKbps == 0) {
+            originalEncoderKbps = current;
+        } else if (kbps == 0) {
+            wanted = originalEncoderKbps;
+            originalEncoderKbps = 0;
         }
-        
-        if (youtubeEnabled->isChecked()) {
-            out << "        application youtube {\n";
-            out << "            live on;\n";
-            out << "            record off;\n";
-            out << "            allow publish 127.0.0.1;\n";
-            out << "            deny publish all;\n\n";
-            out << "            exec ffmpeg -i rtmp://localhost/youtube/$name\n";
-            out << "                -c:v libx264 -preset " << qualityPreset->currentText().toLower().replace(" ", "") << "\n";
-            out << "                -b:v " << (maxBitrate->value() * 2) << "k -maxrate " << (maxBitrate->value() * 2) << "k -bufsize " << (maxBitrate->value() * 2) << "k\n";
-            out << "                -pix_fmt yuv420p -g 50 -r 30\n";
-            out << "                -c:a aac -b:a 160k -ar 44100 -ac 2\n";
-            out << "                " << customFFmpegArgs->text() << "\n";
-            out << "                -f flv rtmp://a.rtmp.youtube.com/live2/" << youtubeKey->text() << ";\n";
-            out << "        }\n\n";
+        if (wanted > 0 && wanted != current) {
+            obs_data_set_int(encoderSettings, "bitrate", wanted);
+            obs_encoder_update(encoder, encoderSettings);
+            logOutput->append(QString("[%1] %2 OBS encoder bitrate to %3 kbps")
+                             .arg(QDateTime::currentDateTime().toString("hh:mm:ss"))
+                             .arg(kbps > 0 ? "Lowered" : "Restored").arg(wanted));
         }
-        
-        if (kickEnabled->isChecked()) {
-            out << "        application kick {\n";
-            out << "            live on;\n";
-            out << "            record off;\n";
-            out << "            allow publish 127.0.0.1;\n";
-            out << "            deny publish all;\n\n";
-            out << "            exec ffmpeg -i rtmp://localhost/kick/$name\n";
-            out << "                -c:v libx264 -preset " << qualityPreset->currentText().toLower().replace(" ", "") << "\n";
-            out << "                -b:v " << (maxBitrate->value() + 4000) << "k -maxrate " << (maxBitrate->value() + 4000) << "k -bufsize " << (maxBitrate->value() + 4000) << "k\n";
-            out << "                -pix_fmt yuv420p -g 50 -r 30\n";
-            out << "                -c:a aac -b:a 160k -ar 44100 -ac 2\n";
-            out << "                " << customFFmpegArgs->text() << "\n";
-            out << "                -f flv rtmp://ingest.kick.com/live/" << kickKey->text() << ";\n";
-            out << "        }\n\n";
+        obs_data_release(encoderSettings);
+    }
+    if (output) {
+        obs_output_release(output);
+    }
+}
+
+RelayConfig StreamRelayDialog::buildRelayConfig() const
+{
+    RelayConfig config;
+    config.listenPort = (uint16_t)localPort->value();
+    config.autoReconnect = autoReconnect->isChecked();
+    config.adaptiveBitrate = adaptiveBitrate->isChecked();
+    config.tracing = tracing->isChecked();
+    config.metricsPort = (uint16_t)metricsPort->value();
+    config.sendBackend = relayParseSendBackend(networkBackend->currentData().toString().toStdString());
+    if (enableLogging->isChecked()) {
+        config.logDirectory = (configPath + "logs/").toStdString();
+        QDir().mkpath(configPath + "logs/");
+    }
+    config.runDirectory = (configPath + "run/").toStdString();
+    QDir().mkpath(configPath + "run/");
+    
+    std::vector<RelayEncodeParams> ladder;
+    if (!parseRenditionLadder(renditionLadder->text().toStdString(), ladder)) {
+        PLUGIN_LOG_WARNING("Invalid rendition ladder, using the default");
+        parseRenditionLadder(DEFAULT_RENDITION_LADDER, ladder);
+    }
+    for (auto &rung : ladder) {
+        rung.preset = relayPresetName(qualityPreset->currentText().toStdString());
+        rung.extraArgs = customFFmpegArgs->text().toStdString();
+    }
+    config.ladder = ladder;
+    config.encoderGovernor.enabled = autoTune->isChecked();
+    config.encoderGovernor.fastestPreset = relayPresetName(fastestPreset->currentText().toStdString());
+    config.encoderGovernor.slowestPreset = relayPresetName(slowestPreset->currentText().toStdString());
+    config.encoderGovernor.maxThreads = maxThreads->value();
+    
+    RelayTcpTuning tuning;
+    tuning.notSentLowatKb = sendLowat->value();
+    tuning.pacingPercent = sendPacing->value();
+    tuning.congestionControl = congestionControl->currentData().toString().toStdString();
+    
+    auto addDestination = [&](const char *name, const char *url, QLineEdit *key, QComboBox *rendition,
+                              const PlatformTuning &platform) {
+        // A key being typed in mid-stream is not a destination yet
+        if (key->text().isEmpty()) {
+            return;
         }
-        
-        out << "    }\n";
-        out << "}\n";
+        config.destinations.push_back(relayMakeDestination(name, url, key->text().toStdString(),
+                                                           rendition->currentData().toString().toStdString(),
+                                                           ladder, maxBitrate->value()));
+        config.destinations.back().tcp = platformTuning(platform, tuning);
+    };
+    
+    if (twitchEnabled->isChecked()) {
+        addDestination("twitch", TWITCH_RTMP_URL, twitchKey, twitchRendition, twitchTuning);
+    }
+    
+    if (youtubeEnabled->isChecked()) {
+        addDestination("youtube", YOUTUBE_RTMP_URL, youtubeKey, youtubeRendition, youtubeTuning);
+    }
+    
+    if (kickEnabled->isChecked()) {
+        addDestination("kick", KICK_RTMP_URL, kickKey, kickRendition, kickTuning);
     }
+    
+    return config;
 }
 
 void StreamRelayDialog::loadSettings()
@@ -742,11 +1635,97 @@ void StreamRelayDialog::loadSettings()
     kickEnabled->setChecked(settings->value("kick/enabled", false).toBool());
     kickKey->setText(settings->value("kick/key", "").toString());
     localPort->setValue(settings->value("general/port", 1935).toInt());
+    nativeOutput->setChecked(settings->value("general/native_output", true).toBool());
     qualityPreset->setCurrentText(settings->value("quality/preset", "Very Fast").toString());
     maxBitrate->setValue(settings->value("quality/bitrate", 6000).toInt());
+    renditionLadder->setText(settings->value("quality/ladder", DEFAULT_RENDITION_LADDER).toString());
+    autoTune->setChecked(settings->value("quality/auto_tune", true).toBool());
+    fastestPreset->setCurrentText(settings->value("quality/fastest_preset", "Ultra Fast").toString());
+    slowestPreset->setCurrentText(settings->value("quality/slowest_preset", "Medium").toString());
+    maxThreads->setValue(settings->value("quality/max_threads", 0).toInt());
+    updateRenditionChoices();
+    twitchRendition->setCurrentIndex(qMax(0, twitchRendition->findData(settings->value("twitch/rendition", ""))));
+    youtubeRendition->setCurrentIndex(qMax(0, youtubeRendition->findData(settings->value("youtube/rendition", ""))));
+    kickRendition->setCurrentIndex(qMax(0, kickRendition->findData(settings->value("kick/rendition", ""))));
     autoReconnect->setChecked(settings->value("advanced/auto_reconnect", true).toBool());
+    adaptiveBitrate->setChecked(settings->value("advanced/adaptive_bitrate", true).toBool());
+    tracing->setChecked(settings->value("advanced/tracing", true).toBool());
     enableLogging->setChecked(settings->value("advanced/logging", true).toBool());
     customFFmpegArgs->setText(settings->value("advanced/ffmpeg_args", "-tune zerolatency").toString());
+    networkBackend->setCurrentIndex(
+        qMax(0, networkBackend->findData(settings->value("advanced/send_backend", RELAY_SEND_BACKEND_DEFAULT))));
+    sendLowat->setValue(settings->value("advanced/notsent_lowat_kb", 0).toInt());
+    sendPacing->setValue(settings->value("advanced/pacing_percent", 0).toInt());
+    congestionControl->setCurrentIndex(
+        qMax(0, congestionControl->findData(settings->value("advanced/congestion", ""))));
+    metricsPort->setValue(settings->value("advanced/metrics_port", DEFAULT_METRICS_PORT).toInt());
+    loadPlatformTuning("twitch", twitchTuning);
+    loadPlatformTuning("youtube", youtubeTuning);
+    loadPlatformTuning("kick", kickTuning);
+}
+
+RelayTcpTuning StreamRelayDialog::platformTuning(const PlatformTuning &platform,
+                                                 const RelayTcpTuning &fallback) const
+{
+    RelayTcpTuning tuning = fallback;
+    if (platform.sendLowat->value() >= 0) {
+        tuning.notSentLowatKb = platform.sendLowat->value();
+    }
+    if (platform.sendPacing->value() >= 0) {
+        tuning.pacingPercent = platform.sendPacing->value();
+    }
+    QVariant congestion = platform.congestionControl->currentData();
+    if (congestion.isValid()) {
+        tuning.congestionControl = congestion.toString().toStdString();
+    }
+    return tuning;
+}
+
+// A missing key is what the daemon takes as "use advanced/", see
+// relayConfigFromIni()
+void StreamRelayDialog::loadPlatformTuning(const QString &group, const PlatformTuning &platform)
+{
+    platform.sendLowat->setValue(settings->value(group + "/notsent_lowat_kb", -1).toInt());
+    platform.sendPacing->setValue(settings->value(group + "/pacing_percent", -1).toInt());
+    QVariant congestion = settings->value(group + "/congestion");
+    platform.congestionControl->setCurrentIndex(
+        congestion.isValid() ? qMax(0, platform.congestionControl->findData(congestion)) : 0);
+}
+
+void StreamRelayDialog::savePlatformTuning(const QString &group, const PlatformTuning &platform)
+{
+    auto store = [&](const QString &key, const QVariant &value, bool inherited) {
+        if (inherited) {
+            settings->remove(group + "/" + key);
+        } else {
+            settings->setValue(group + "/" + key, value);
+        }
+    };
+    store("notsent_lowat_kb", platform.sendLowat->value(), platform.sendLowat->value() < 0);
+    store("pacing_percent", platform.sendPacing->value(), platform.sendPacing->value() < 0);
+    QVariant congestion = platform.congestionControl->currentData();
+    store("congestion", congestion, !congestion.isValid());
+}
+
+void StreamRelayDialog::updateRenditionChoices()
+{
+    std::vector<RelayEncodeParams> ladder;
+    if (!parseRenditionLadder(renditionLadder->text().toStdString(), ladder)) {
+        logOutput->append(QString("[%1] Invalid rendition ladder, expected name=WIDTHxHEIGHT@FPS:KBPS entries")
+                         .arg(QDateTime::currentDateTime().toString("hh:mm:ss")));
+        return;
+    }
+    
+    for (QComboBox *combo : {twitchRendition, youtubeRendition, kickRendition}) {
+        QVariant current = combo->currentData();
+        combo->clear();
+        combo->addItem("Source (passthrough)", "");
+        for (const auto &rung : ladder) {
+            combo->addItem(QString("%1 (%2 kbps)").arg(QString::fromStdString(rung.name)).arg(rung.videoBitrateKbps),
+                           QString::fromStdString(rung.name));
+        }
+        combo->setCurrentIndex(qMax(0, combo->findData(current)));
+    }
 }
 
 void StreamRelayDialog::saveSettings()
@@ -758,11 +1737,30 @@ void StreamRelayDialog::saveSettings()
     settings->setValue("kick/enabled", kickEnabled->isChecked());
     settings->setValue("kick/key", kickKey->text());
     settings->setValue("general/port", localPort->value());
+    settings->setValue("general/native_output", nativeOutput->isChecked());
     settings->setValue("quality/preset", qualityPreset->currentText());
     settings->setValue("quality/bitrate", maxBitrate->value());
+    settings->setValue("quality/ladder", renditionLadder->text());
+    settings->setValue("quality/auto_tune", autoTune->isChecked());
+    settings->setValue("quality/fastest_preset", fastestPreset->currentText());
+    settings->setValue("quality/slowest_preset", slowestPreset->currentText());
+    settings->setValue("quality/max_threads", maxThreads->value());
+    settings->setValue("twitch/rendition", twitchRendition->currentData());
+    settings->setValue("youtube/rendition", youtubeRendition->currentData());
+    settings->setValue("kick/rendition", kickRendition->currentData());
     settings->setValue("advanced/auto_reconnect", autoReconnect->isChecked());
+    settings->setValue("advanced/adaptive_bitrate", adaptiveBitrate->isChecked());
+    settings->setValue("advanced/tracing", tracing->isChecked());
     settings->setValue("advanced/logging", enableLogging->isChecked());
     settings->setValue("advanced/ffmpeg_args", customFFmpegArgs->text());
+    settings->setValue("advanced/send_backend", networkBackend->currentData());
+    settings->setValue("advanced/notsent_lowat_kb", sendLowat->value());
+    settings->setValue("advanced/pacing_percent", sendPacing->value());
+    settings->setValue("advanced/congestion", congestionControl->currentData());
+    settings->setValue("advanced/metrics_port", metricsPort->value());
+    savePlatformTuning("twitch", twitchTuning);
+    savePlatformTuning("youtube", youtubeTuning);
+    savePlatformTuning("kick", kickTuning);
     settings->sync();
 }
 
@@ -826,6 +1824,7 @@ bool obs_module_load(void)
 {
     blog(LOG_INFO, "StreamRelay plugin loaded");
     
+    register_relay_output();
     plugin_instance = new StreamRelayPlugin();
     
     // Add menu item